@@ -0,0 +1,365 @@
+#!/usr/bin/env bash
+
+# Copyright © Tavian Barnes <tavianator@tavianator.com>
+# SPDX-License-Identifier: 0BSD
+
+set -euP
+umask 022
+
+export LC_ALL=C
+export TZ=UTC0
+
+if [ -t 2 ]; then
+    BLD=$'\033[01m'
+    RED=$'\033[01;31m'
+    GRN=$'\033[01;32m'
+    BLU=$'\033[01;34m'
+    MAG=$'\033[01;35m'
+    RST=$'\033[0m'
+else
+    BLD=
+    RED=
+    GRN=
+    BLU=
+    MAG=
+    RST=
+fi
+
+ALL_TREES=(wide deep dirs links)
+ALL_QUERIES=(walk name stat print follow startup)
+
+function usage() {
+    local pad=$(printf "%*s" ${#0} "")
+    cat <<EOF
+Usage: ${GRN}$0${RST} [${BLU}--bfs${RST}=${MAG}path/to/bfs${RST}] [${BLU}--dir${RST}=${MAG}path/to/trees${RST}] [${BLU}--scale${RST}=${BLD}N${RST}]
+       $pad [${BLU}--runs${RST}=${BLD}N${RST}] [${BLU}--jobs${RST}=${BLD}"1 2 4"${RST}] [${BLU}--strategies${RST}=${BLD}"bfs dfs"${RST}]
+       $pad [${BLU}--trees${RST}=${BLD}"wide deep"${RST}] [${BLU}--queries${RST}=${BLD}"walk name"${RST}]
+       $pad [${BLU}--format${RST}=${BLD}tsv${RST}|${BLD}json${RST}] [${BLU}--help${RST}]
+
+  ${BLU}--bfs${RST}=${MAG}path/to/bfs${RST}
+      Set the path to the bfs executable to benchmark (default: ${MAG}./bin/bfs${RST})
+
+  ${BLU}--dir${RST}=${MAG}path/to/trees${RST}
+      Generate the synthetic trees here, and keep them for later runs
+      (default: a temporary directory)
+
+  ${BLU}--scale${RST}=${BLD}N${RST}
+      Multiply the size of the synthetic trees by ${BLD}N${RST} (default: ${BLD}1${RST})
+
+  ${BLU}--runs${RST}=${BLD}N${RST}
+      Time each benchmark ${BLD}N${RST} times, after a warm-up run (default: ${BLD}5${RST})
+
+  ${BLU}--jobs${RST}=${BLD}LIST${RST}
+      The ${BLU}-j${RST} settings to benchmark (default: ${BLD}"1 2 4 8"${RST})
+
+  ${BLU}--strategies${RST}=${BLD}LIST${RST}
+      The ${BLU}-S${RST} settings to benchmark (default: ${BLD}"bfs dfs ids eds par"${RST})
+
+  ${BLU}--trees${RST}=${BLD}LIST${RST}
+      The trees to search (default: ${BLD}"${ALL_TREES[*]}"${RST})
+
+      ${BLD}wide${RST}:  one huge directory
+      ${BLD}deep${RST}:  a long chain of nested directories
+      ${BLD}dirs${RST}:  many small directories
+      ${BLD}links${RST}: lots of symbolic links, including loops
+
+  ${BLU}--queries${RST}=${BLD}LIST${RST}
+      The queries to run (default: ${BLD}"${ALL_QUERIES[*]}"${RST})
+
+      ${BLD}walk${RST}:   ${BLU}-false${RST} (just the traversal)
+      ${BLD}name${RST}:   ${BLU}-name${RST} ${BLD}'*7*'${RST} (no stat() needed)
+      ${BLD}stat${RST}:   ${BLU}-size${RST} ${BLD}+0${RST} (stat() every file)
+      ${BLD}print${RST}:  ${BLU}-print${RST} (output to /dev/null)
+      ${BLD}follow${RST}: ${BLU}-L -false${RST} (follow symbolic links)
+      ${BLD}startup${RST}: ${BLU}-maxdepth${RST} ${BLD}0${RST} ${BLU}-name${RST} ${BLD}x${RST} (just startup and teardown)
+
+  ${BLU}--format${RST}=${BLD}tsv${RST}|${BLD}json${RST}
+      Write the results to standard output as tab-separated values, or as one
+      JSON object per line (default: ${BLD}tsv${RST})
+
+  ${BLU}--help${RST}
+      This message
+EOF
+}
+
+BFS=
+DIR=
+SCALE=1
+RUNS=5
+JOBS=(1 2 4 8)
+STRATEGIES=(bfs dfs ids eds par)
+TREES=("${ALL_TREES[@]}")
+QUERIES=("${ALL_QUERIES[@]}")
+FORMAT=tsv
+
+for arg; do
+    case "$arg" in
+        --bfs=*)
+            BFS="${arg#*=}"
+            ;;
+        --dir=*)
+            DIR="${arg#*=}"
+            ;;
+        --scale=*)
+            SCALE="${arg#*=}"
+            ;;
+        --runs=*)
+            RUNS="${arg#*=}"
+            ;;
+        --jobs=*)
+            read -a JOBS <<<"${arg#*=}"
+            ;;
+        --strategies=*)
+            read -a STRATEGIES <<<"${arg#*=}"
+            ;;
+        --trees=*)
+            read -a TREES <<<"${arg#*=}"
+            ;;
+        --queries=*)
+            read -a QUERIES <<<"${arg#*=}"
+            ;;
+        --format=tsv|--format=json)
+            FORMAT="${arg#*=}"
+            ;;
+        --help)
+            usage
+            exit 0
+            ;;
+        *)
+            printf "${RED}error:${RST} Unrecognized option '%s'.\n\n" "$arg" >&2
+            usage >&2
+            exit 1
+            ;;
+    esac
+done
+
+for n in "$SCALE" "$RUNS"; do
+    if ! [[ $n =~ ^[1-9][0-9]*$ ]]; then
+        printf "${RED}error:${RST} '%s' is not a positive integer.\n" "$n" >&2
+        exit 1
+    fi
+done
+
+function _realpath() {
+    (
+        cd "$(dirname -- "$1")"
+        echo "$PWD/$(basename -- "$1")"
+    )
+}
+
+BENCH=$(_realpath "$(dirname -- "${BASH_SOURCE[0]}")")
+
+if [ "${BUILDDIR-}" ]; then
+    BIN=$(_realpath "$BUILDDIR/bin")
+else
+    BIN=$(_realpath "$BENCH/../bin")
+fi
+
+BFS=$(_realpath "$(command -v "${BFS:-$BIN/bfs}")")
+VERSION=$("$BFS" --version | head -n1)
+
+if [ "$DIR" ]; then
+    mkdir -p "$DIR"
+    DIR=$(_realpath "$DIR")
+else
+    DIR=$(mktemp -d "${TMPDIR:-/tmp}"/bfs-bench.XXXXXXXXXX)
+    trap 'rm -rf "$DIR"' EXIT
+fi
+
+function log() {
+    printf "$@" >&2
+}
+
+# Create files named $2/0 through $2/$(($1 - 1))
+function make_files() {
+    local n="$1" dir="$2"
+    mkdir -p "$dir"
+    (cd "$dir" && seq 0 $((n - 1)) | xargs touch)
+}
+
+# Create a single directory with lots of entries
+function make_wide() {
+    make_files $((20000 * SCALE)) "$1"
+}
+
+# Create a deep chain of directories, with a few files at each level
+function make_deep() {
+    local depth=$((500 * SCALE))
+    local dir="$1"
+    mkdir -p "$dir"
+    (
+        cd "$dir"
+        for ((i = 0; i < depth; ++i)); do
+            touch 0 1 2 3
+            mkdir d
+            cd d
+        done
+    )
+}
+
+# Create many small directories
+function make_dirs() {
+    local dir="$1"
+    mkdir -p "$dir"
+    (
+        cd "$dir"
+        for ((i = 0; i < SCALE; ++i)); do
+            mkdir -p "$i"/{0..9}/{0..9}/{0..9}
+            for leaf in "$i"/*/*/*; do
+                touch "$leaf"/{0..7}
+            done
+        done
+    )
+}
+
+# Create a tree with lots of symbolic links (to files, to directories,
+# dangling, and looping)
+function make_links() {
+    local dir="$1"
+    local ndirs=$((100 * SCALE))
+    mkdir -p "$dir"
+    (
+        cd "$dir"
+        for ((i = 0; i < ndirs; ++i)); do
+            make_files 10 "$i"
+            mkdir "$i/sub"
+            touch "$i/sub/"{0..9}
+            for j in {0..9}; do
+                ln -s "$j" "$i/l$j"
+            done
+            ln -s ../"$(( (i + 1) % ndirs ))"/sub "$i/next"
+            ln -s .. "$i/sub/loop"
+            ln -s nowhere "$i/dangling"
+        done
+    )
+}
+
+# Generate a synthetic tree, unless it already exists
+function make_tree() {
+    local tree="$1"
+    local path="$DIR/$tree.$SCALE"
+    if [ -e "$path/.done" ]; then
+        return
+    fi
+
+    log "Generating ${BLD}%s${RST} (scale %s)...\n" "$tree" "$SCALE"
+    rm -rf "$path"
+    "make_$tree" "$path/tree"
+    touch "$path/.done"
+}
+
+# The arguments to pass for each query
+function query_args() {
+    case "$1" in
+        walk)
+            echo "-false"
+            ;;
+        name)
+            echo "-name *7*"
+            ;;
+        stat)
+            echo "-size +0"
+            ;;
+        print)
+            echo "-print"
+            ;;
+        follow)
+            echo "-L -false"
+            ;;
+        startup)
+            echo "-maxdepth 0 -name x"
+            ;;
+        *)
+            printf "${RED}error:${RST} Unknown query '%s'.\n" "$1" >&2
+            exit 1
+            ;;
+    esac
+}
+
+# Get the current time in nanoseconds
+if [ "${EPOCHREALTIME-}" ]; then
+    function now() {
+        local t="${EPOCHREALTIME/[^0-9]/}"
+        echo "${t}000"
+    }
+else
+    function now() {
+        date +%s%N
+    }
+fi
+
+# Run a command $RUNS times after warming up, and print the elapsed times in ns
+function time_cmd() {
+    "$@" >/dev/null 2>&1 || true
+
+    local start end
+    for ((run = 0; run < RUNS; ++run)); do
+        start=$(now)
+        "$@" >/dev/null 2>&1 || true
+        end=$(now)
+        echo $((end - start))
+    done
+}
+
+# Summarize a list of times as min, median, mean, and max seconds
+function summarize() {
+    sort -n | awk '
+        { t[NR] = $1; sum += $1 }
+        END {
+            if (NR % 2) {
+                median = t[(NR + 1) / 2]
+            } else {
+                median = (t[NR / 2] + t[NR / 2 + 1]) / 2
+            }
+            printf "%.6f\t%.6f\t%.6f\t%.6f\n", t[1] / 1e9, median / 1e9, sum / NR / 1e9, t[NR] / 1e9
+        }'
+}
+
+function json_string() {
+    local str="${1//\\/\\\\}"
+    str="${str//\"/\\\"}"
+    printf '"%s"' "$str"
+}
+
+function report() {
+    local tree="$1" query="$2" strategy="$3" jobs="$4" times="$5"
+    local min median mean max
+    IFS=$'\t' read -r min median mean max <<<"$times"
+
+    if [ "$FORMAT" = json ]; then
+        printf '{"version":%s,"tree":"%s","scale":%s,"query":"%s","strategy":"%s","jobs":%s,"runs":%s,"min":%s,"median":%s,"mean":%s,"max":%s}\n' \
+            "$(json_string "$VERSION")" "$tree" "$SCALE" "$query" "$strategy" "$jobs" "$RUNS" "$min" "$median" "$mean" "$max"
+    else
+        printf '%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\n' \
+            "$VERSION" "$tree" "$SCALE" "$query" "$strategy" "$jobs" "$RUNS" "$min" "$median" "$mean" "$max"
+    fi
+
+    log "  ${BLD}%-5s %-7s${RST} -S %-3s -j%-2s %ss\n" "$tree" "$query" "$strategy" "$jobs" "$median"
+}
+
+for tree in "${TREES[@]}"; do
+    if ! declare -F "make_$tree" >/dev/null; then
+        printf "${RED}error:${RST} Unknown tree '%s'.\n" "$tree" >&2
+        exit 1
+    fi
+    make_tree "$tree"
+done
+
+if [ "$FORMAT" = tsv ]; then
+    printf 'version\ttree\tscale\tquery\tstrategy\tjobs\truns\tmin\tmedian\tmean\tmax\n'
+fi
+
+log "Benchmarking ${MAG}%s${RST} (%s)\n" "$BFS" "$VERSION"
+
+for tree in "${TREES[@]}"; do
+    for query in "${QUERIES[@]}"; do
+        read -a args <<<"$(query_args "$query")"
+
+        for strategy in "${STRATEGIES[@]}"; do
+            for jobs in "${JOBS[@]}"; do
+                times=$(time_cmd "$BFS" -S "$strategy" -j"$jobs" "$DIR/$tree.$SCALE/tree" "${args[@]}" | summarize)
+                report "$tree" "$query" "$strategy" "$jobs" "$times"
+            done
+        done
+    done
+done
@@ -0,0 +1,301 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * Microbenchmarks for the hot data structures: the trie, the arena allocators,
+ * and the I/O queue.
+ */
+
+#include "../src/alloc.h"
+#include "../src/config.h"
+#include "../src/diag.h"
+#include "../src/dstring.h"
+#include "../src/ioq.h"
+#include "../src/trie.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/** Output formats. */
+enum format {
+	FORMAT_TSV,
+	FORMAT_JSON,
+};
+
+/** Global benchmark settings. */
+static struct {
+	/** The output format. */
+	enum format format;
+	/** Multiplier for the number of operations. */
+	size_t scale;
+	/** The benchmark groups to run (empty for all). */
+	const char **patterns;
+	/** The number of patterns. */
+	size_t npatterns;
+} settings = {
+	.format = FORMAT_TSV,
+	.scale = 1,
+};
+
+/** Read a monotonic clock, in seconds. */
+static double now(void) {
+	struct timespec ts;
+	bfs_verify(clock_gettime(CLOCK_MONOTONIC, &ts) == 0, "clock_gettime(): %s", strerror(errno));
+	return ts.tv_sec + ts.tv_nsec / 1.0e9;
+}
+
+/** Check if a benchmark was selected on the command line. */
+static bool should_run(const char *name) {
+	if (settings.npatterns == 0) {
+		return true;
+	}
+
+	for (size_t i = 0; i < settings.npatterns; ++i) {
+		if (strcmp(name, settings.patterns[i]) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/** Print one result. */
+static void report(const char *name, size_t threads, size_t ops, double start) {
+	double secs = now() - start;
+	double ns = secs * 1.0e9 / ops;
+	double rate = ops / secs;
+
+	if (settings.format == FORMAT_JSON) {
+		printf("{\"name\":\"%s\",\"threads\":%zu,\"ops\":%zu,\"seconds\":%.6f,\"ns_per_op\":%.2f,\"ops_per_sec\":%.0f}\n",
+			name, threads, ops, secs, ns, rate);
+	} else {
+		printf("%s\t%zu\t%zu\t%.6f\t%.2f\t%.0f\n", name, threads, ops, secs, ns, rate);
+	}
+	fflush(stdout);
+}
+
+/** Generate some path-like keys. */
+static char **make_keys(size_t n, const char *suffix) {
+	char **keys = ALLOC_ARRAY(char *, n);
+	bfs_verify(keys);
+
+	for (size_t i = 0; i < n; ++i) {
+		keys[i] = dstrprintf("/usr/share/%zu/%zu/file%zu%s", i % 97, i % 1009, i, suffix);
+		bfs_verify(keys[i]);
+	}
+
+	return keys;
+}
+
+/** Free the generated keys. */
+static void free_keys(char **keys, size_t n) {
+	for (size_t i = 0; i < n; ++i) {
+		dstrfree(keys[i]);
+	}
+	free(keys);
+}
+
+/** Benchmark trie insertions and lookups. */
+static void bench_trie(void) {
+	if (!should_run("trie")) {
+		return;
+	}
+
+	size_t n = 100000 * settings.scale;
+	char **keys = make_keys(n, "");
+	char **children = make_keys(n, "/child");
+
+	struct trie trie;
+	trie_init(&trie);
+
+	double start = now();
+	for (size_t i = 0; i < n; ++i) {
+		bfs_verify(trie_insert_mem(&trie, keys[i], dstrlen(keys[i])));
+	}
+	report("trie_insert_mem", 1, n, start);
+
+	start = now();
+	for (size_t i = 0; i < n; ++i) {
+		bfs_verify(trie_find_mem(&trie, keys[i], dstrlen(keys[i])));
+	}
+	report("trie_find_mem", 1, n, start);
+
+	start = now();
+	for (size_t i = 0; i < n; ++i) {
+		bfs_verify(trie_find_prefix(&trie, children[i]));
+	}
+	report("trie_find_prefix", 1, n, start);
+
+	start = now();
+	for (size_t i = 0; i < n; ++i) {
+		bfs_verify(!trie_find_str(&trie, children[i]));
+	}
+	report("trie_find_str_miss", 1, n, start);
+
+	trie_destroy(&trie);
+	free_keys(children, n);
+	free_keys(keys, n);
+}
+
+/** A type with a flexible array member. */
+struct flexible {
+	size_t size;
+	char data[];
+};
+
+/** Benchmark the arena allocators. */
+static void bench_alloc(void) {
+	size_t n = 1000000 * settings.scale;
+
+	void **ptrs = ALLOC_ARRAY(void *, n);
+	bfs_verify(ptrs);
+
+	if (should_run("arena")) {
+		struct arena arena;
+		ARENA_INIT(&arena, struct flexible);
+
+		double start = now();
+		for (size_t i = 0; i < n; ++i) {
+			ptrs[i] = arena_alloc(&arena);
+			bfs_verify(ptrs[i]);
+		}
+		report("arena_alloc", 1, n, start);
+
+		start = now();
+		for (size_t i = 0; i < n; ++i) {
+			arena_free(&arena, ptrs[i]);
+		}
+		report("arena_free", 1, n, start);
+
+		arena_destroy(&arena);
+	}
+
+	if (should_run("varena")) {
+		struct varena varena;
+		VARENA_INIT(&varena, struct flexible, data);
+
+		double start = now();
+		for (size_t i = 0; i < n; ++i) {
+			ptrs[i] = varena_alloc(&varena, i % 256);
+			bfs_verify(ptrs[i]);
+		}
+		report("varena_alloc", 1, n, start);
+
+		start = now();
+		for (size_t i = 0; i < n; ++i) {
+			varena_free(&varena, ptrs[i], i % 256);
+		}
+		report("varena_free", 1, n, start);
+
+		// Grow each allocation one element at a time, like a dstring
+		size_t m = n / 256;
+		start = now();
+		for (size_t i = 0; i < m; ++i) {
+			void *ptr = varena_alloc(&varena, 0);
+			for (size_t j = 1; j < 256; ++j) {
+				ptr = varena_realloc(&varena, ptr, j - 1, j);
+				bfs_verify(ptr);
+			}
+			varena_free(&varena, ptr, 255);
+		}
+		report("varena_realloc", 1, m * 255, start);
+
+		varena_destroy(&varena);
+	}
+
+	free(ptrs);
+}
+
+/** A no-op for ioq_call(). */
+static int nop(void *arg) {
+	return 0;
+}
+
+/** Push no-op requests through an ioq with the given number of threads. */
+static void bench_ioq_threads(size_t nthreads) {
+	size_t n = 100000 * settings.scale;
+
+	struct ioq *ioq = ioq_create(4096, nthreads, 0);
+	bfs_verify(ioq, "ioq_create(): %s", strerror(errno));
+
+	struct ioq_ent *batch[64];
+	size_t submitted = 0, completed = 0;
+
+	double start = now();
+	while (completed < n) {
+		while (submitted < n && ioq_capacity(ioq) > 0) {
+			bfs_verify(ioq_call(ioq, nop, NULL, NULL) == 0);
+			++submitted;
+		}
+		ioq_submit_batch(ioq);
+
+		size_t count = ioq_pop_batch(ioq, batch, countof(batch), true);
+		for (size_t i = 0; i < count; ++i) {
+			ioq_free(ioq, batch[i]);
+		}
+		completed += count;
+	}
+	report("ioq_call", nthreads, n, start);
+
+	ioq_destroy(ioq);
+}
+
+/** Benchmark the I/O queue with different thread counts. */
+static void bench_ioq(void) {
+	if (!should_run("ioq")) {
+		return;
+	}
+
+	for (size_t nthreads = 1; nthreads <= 16; nthreads *= 2) {
+		bench_ioq_threads(nthreads);
+	}
+}
+
+static void usage(FILE *file, const char *argv0) {
+	fprintf(file, "Usage: %s [--format=tsv|json] [--scale=N] [GROUP...]\n\n", argv0);
+	fprintf(file, "Runs the given groups of benchmarks (default: all).\n");
+	fprintf(file, "Groups: trie, arena, varena, ioq\n");
+}
+
+int main(int argc, char *argv[]) {
+	settings.patterns = ALLOC_ARRAY(const char *, argc);
+	bfs_verify(settings.patterns);
+
+	for (int i = 1; i < argc; ++i) {
+		const char *arg = argv[i];
+		if (strcmp(arg, "--format=tsv") == 0) {
+			settings.format = FORMAT_TSV;
+		} else if (strcmp(arg, "--format=json") == 0) {
+			settings.format = FORMAT_JSON;
+		} else if (strncmp(arg, "--scale=", 8) == 0) {
+			char *end;
+			long scale = strtol(arg + 8, &end, 10);
+			if (*end || scale < 1) {
+				fprintf(stderr, "%s: Invalid scale '%s'\n", argv[0], arg + 8);
+				return EXIT_FAILURE;
+			}
+			settings.scale = scale;
+		} else if (strcmp(arg, "--help") == 0) {
+			usage(stdout, argv[0]);
+			return EXIT_SUCCESS;
+		} else if (arg[0] == '-') {
+			usage(stderr, argv[0]);
+			return EXIT_FAILURE;
+		} else {
+			settings.patterns[settings.npatterns++] = arg;
+		}
+	}
+
+	if (settings.format == FORMAT_TSV) {
+		printf("name\tthreads\tops\tseconds\tns_per_op\tops_per_sec\n");
+	}
+
+	bench_trie();
+	bench_alloc();
+	bench_ioq();
+
+	free(settings.patterns);
+	return EXIT_SUCCESS;
+}
@@ -12,6 +12,7 @@ _bfs() {
     local special=(
         -D
         -S
+        -chown
         -exec
         -execdir
         -fprintf
@@ -31,12 +32,17 @@ _bfs() {
     # (e.g. because they are numeric, glob, regexp, time, etc.)
     local nocomp=(
         -{a,B,c,m}{min,since,time}
+        -chmod
+        -cpus
+        -exec-jobs
         -ilname
         -iname
         -inum
+        -iolimit
         -ipath
         -iregex
         -iwholename
+        -limit
         -links
         -lname
         -maxdepth
@@ -47,8 +53,11 @@ _bfs() {
         -perm
         -printf
         -regex
+        -root-threads
         -since
+        -shard
         -size
+        -spill
         -used
         -wholename
         -xattrname
@@ -61,8 +70,12 @@ _bfs() {
         -fls
         -fprint
         -fprint0
+        -fprintb
+        -incremental
+        -index
         -newer
         -newer{a,B,c,m}{a,B,c,m}
+        -profile
         -samefile
     )
 
@@ -90,10 +103,15 @@ _bfs() {
     # Options that take no arguments
     local nullary_options=(
         -color
+        -cpus
         -daystart
         -depth
+        -exec-jobs
         -follow
         -ignore_readdir_race
+        -inode_order
+        -iolimit
+        -limit
         -maxdepth
         -mindepth
         -mount
@@ -101,9 +119,14 @@ _bfs() {
         -noignore_readdir_race
         -noleaf
         -nowarn
+        -preload_users
+        -root-threads
+        -shard
+        -spill
         -status
         -unique
         -warn
+        -watch
         -xdev
     )
 
@@ -130,15 +153,18 @@ _bfs() {
         --help
         --version
         -delete
+        -du
         -exit
         -help
         -ls
         -print
         -print0
+        -printb
         -printx
         -prune
         -quit
         -rm
+        -touch
         -version
     )
 
@@ -211,10 +237,10 @@ _bfs() {
             return
             ;;
         -S)
-            # -S bfs|dfs|ids|eds
+            # -S bfs|dfs|ids|eds|par
             #     Use breadth-first/depth-first/iterative/exponential deepening search
             #     (default: -S bfs)
-            COMPREPLY=($(compgen -W 'bfs dfs ids eds' -- "$cur"))
+            COMPREPLY=($(compgen -W 'bfs dfs ids eds par' -- "$cur"))
             return
             ;;
         -fstype)
@@ -247,6 +273,12 @@ _bfs() {
             COMPREPLY=($(compgen -u -- "$cur"))
             return
             ;;
+        -chown)
+            # -chown [USER][:GROUP]
+            #     Change the owner and/or group of the found file
+            COMPREPLY=($(compgen -u -- "$cur"))
+            return
+            ;;
         -regextype)
             # -regextype TYPE
             #     Use TYPE-flavored regexes (default: posix-basic; see -regextype help)
@@ -2,7 +2,7 @@
 
 set -l debug_flag_comp 'help\t"Print help message" cost\t"Show cost estimates" exec\t"Print executed command details" opt\t"Print optimization details" rates\t"Print predicate success rates" search\t"Trace the filesystem traversal" stat\t"Trace all stat() calls" tree\t"Print the parse tree" all\t"All debug flags at once"'
 set -l optimization_comp '0\t"Disable all optimizations" 1\t"Basic logical simplifications" 2\t"-O1, plus dead code elimination and data flow analysis" 3\t"-02, plus re-order expressions to reduce expected cost" 4\t"All optimizations, including aggressive optimizations" fast\t"Same as -O4"'
-set -l strategy_comp 'bfs\t"Breadth-first search" dfs\t"Depth-first search" ids\t"Iterative deepening search" eds\t"Exponential deepening search"'
+set -l strategy_comp 'bfs\t"Breadth-first search" dfs\t"Depth-first search" ids\t"Iterative deepening search" eds\t"Exponential deepening search" par\t"Parallel search"'
 set -l regex_type_comp 'help\t"Print help message" posix-basic\t"POSIX basic regular expressions" posix-extended\t"POSIX extended regular expressions" ed\t"Like ed" emacs\t"Like emacs" grep\t"Like grep" sed\t"Like sed"'
 set -l type_comp 'b\t"Block device" c\t"Character device" d\t"Directory" l\t"Symbolic link" p\t"Pipe" f\t"Regular file" s\t"Socket" w\t"Whiteout" D\t"Door"'
 
@@ -35,20 +35,33 @@ complete -c bfs -o exclude -d "Exclude all paths matching the expression from th
 
 complete -c bfs -o color -d "Turn colors on"
 complete -c bfs -o nocolor -d "Turn colors off"
+complete -c bfs -o cpus -d "Run on the CPUs in the specified list (e.g. 0-7,16-23)" -x
 complete -c bfs -o daystart -d "Measure time relative to the start of today"
+complete -c bfs -o exec-jobs -d "Run up to the specified number of -exec ... {} + commands at once" -x
 complete -c bfs -o files0-from -d "Treat the NUL-separated paths in specified file as starting points for the search" -F
+complete -c bfs -o incremental -d "Skip files in directories unchanged since the specified snapshot file" -F
+complete -c bfs -o index -d "Skip reading unchanged directories using the specified index file" -F
+complete -c bfs -o inode_order -d "Open and stat() each directory's entries in inode number order"
+complete -c bfs -o iolimit -d "Limit the background I/O requests outstanding to each file system of the given type (TYPE=N)" -x
 complete -c bfs -o ignore_readdir_race -d "Don't report an error if the file tree is modified during the search"
 complete -c bfs -o noignore_readdir_race -d "Report an error if the file tree is modified during the search"
+complete -c bfs -o limit -d "Quit after the specified number of actions succeed" -x
 complete -c bfs -o maxdepth -d "Ignore files deeper than specified number" -x
 complete -c bfs -o mindepth -d "Ignore files shallower than specified number" -x
 complete -c bfs -o mount -d "Don't descend into other mount points"
 complete -c bfs -o nohidden -d "Exclude hidden files and directories"
 complete -c bfs -o noleaf -d "Ignored; for compatibility with GNU find"
+complete -c bfs -o preload_users -d "Load the whole user and group databases up front"
+complete -c bfs -o profile -d "Save test costs to the specified profile, and use them at -O4" -F
 complete -c bfs -o regextype -d "Use specified flavored regex" -a $regex_type_comp -x
+complete -c bfs -o root-threads -d "Search up to the specified number of root paths at once" -x
+complete -c bfs -o shard -d "Only search the specified shard (I/N[:DEPTH]) of the tree" -x
+complete -c bfs -o spill -d "Spill the breadth-first queue to a temporary file past the specified memory size" -x
 complete -c bfs -o status -d "Display a status bar while searching"
 complete -c bfs -o unique -d "Skip any files that have already been seen"
 complete -c bfs -o warn -d "Turn on warnings about the command line"
 complete -c bfs -o nowarn -d "Turn off warnings about the command line"
+complete -c bfs -o watch -d "Keep running and re-evaluate files as they change"
 
 # Tests
 
@@ -123,7 +136,10 @@ complete -c bfs -o xtype -d "Find files of the given type, following links when
 
 # Actions
 
+complete -c bfs -o chmod -d "Change the permissions of the found file" -x
+complete -c bfs -o chown -d "Change the owner and/or group of the found file" -x
 complete -c bfs -o rm -o delete -d "Delete any found files"
+complete -c bfs -o du -d "Print the disk usage of the found file and everything under it"
 complete -c bfs -o exec -d "Execute a command" -r
 complete -c bfs -o ok -d "Prompt the user whether to execute a command" -r
 complete -c bfs -o execdir -d "Like -exec, but run the command in the same directory as the found file(s)" -r
@@ -132,13 +148,16 @@ complete -c bfs -o exit -d "Exit immediately with the given status" -x
 complete -c bfs -o fls -d "Like -ls, but write to specified file" -F
 complete -c bfs -o fprint -d "Like -print, but write to specified file" -F
 complete -c bfs -o fprint0 -d "Like -print0, but write to specified file" -F
+complete -c bfs -o fprintb -d "Like -printb, but write to specified file" -F
 complete -c bfs -o fprintf -d "Like -printf, but write to specified file" -F
 complete -c bfs -o ls -d "List files like ls -dils"
 complete -c bfs -o print -d "Print the path to the found file"
 complete -c bfs -o print0 -d "Like -print, but use the null character as a separator rather than newlines"
+complete -c bfs -o printb -d "Write a binary record with the path and metadata of the found file"
 complete -c bfs -o printf -d "Print according to a format string" -x
 complete -c bfs -o printx -d "Like -print, but escape whitespace and quotation characters"
 complete -c bfs -o prune -d "Don't descend into this directory"
 complete -c bfs -o quit -d "Quit immediately"
+complete -c bfs -o touch -d "Set the access and modification times of the found file to now"
 complete -c bfs -o version -l version -d "Print version information"
 complete -c bfs -o help -l help -d "Print usage information"
@@ -5,6 +5,7 @@
 #include "bit.h"
 #include "diag.h"
 #include "sanity.h"
+#include "thread.h"
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
@@ -287,3 +288,256 @@ void varena_destroy(struct varena *varena) {
 	free(varena->arenas);
 	sanitize_uninit(varena);
 }
+
+/** The number of chunks in a full magazine. */
+#define TVARENA_MAG_SIZE 64
+
+/**
+ * A magazine of free chunks from one size class.
+ */
+struct tvarena_mag {
+	/** The number of chunks in the magazine. */
+	size_t count;
+	/** The chunks themselves. */
+	void *chunks[TVARENA_MAG_SIZE];
+};
+
+int tvarena_init(struct tvarena *tvarena, size_t align, size_t min, size_t offset, size_t size) {
+	if (mutex_init(&tvarena->mutex, NULL) != 0) {
+		return -1;
+	}
+
+	varena_init(&tvarena->varena, align, min, offset, size);
+	return 0;
+}
+
+void tvarena_cache_init(struct tvarena_cache *cache) {
+	cache->nmags = 0;
+	cache->mags = NULL;
+}
+
+/** Get the full chunk size of a size class, without touching the shared arenas. */
+static size_t tvarena_class_size(const struct tvarena *tvarena, size_t i) {
+	const struct varena *varena = &tvarena->varena;
+	return varena_exact_size(varena, (size_t)1 << (i + varena->shift));
+}
+
+/** Get the magazine for a size class. */
+static struct tvarena_mag *tvarena_get_mag(struct tvarena_cache *cache, size_t i) {
+	if (i >= cache->nmags) {
+		size_t nmags = i + 1;
+		struct tvarena_mag *mags = realloc(cache->mags, sizeof_array(struct tvarena_mag, nmags));
+		if (!mags) {
+			return NULL;
+		}
+
+		for (size_t j = cache->nmags; j < nmags; ++j) {
+			mags[j].count = 0;
+		}
+
+		cache->nmags = nmags;
+		cache->mags = mags;
+	}
+
+	return &cache->mags[i];
+}
+
+/** Move chunks from the shared arena into a magazine (with the lock held). */
+static void tvarena_refill(struct tvarena *tvarena, struct tvarena_mag *mag, size_t count) {
+	struct arena *arena = varena_get(&tvarena->varena, count);
+	if (!arena) {
+		return;
+	}
+
+	while (mag->count < TVARENA_MAG_SIZE / 2) {
+		void *chunk = arena_alloc(arena);
+		if (!chunk) {
+			break;
+		}
+		sanitize_free(chunk, arena->size);
+		mag->chunks[mag->count++] = chunk;
+	}
+}
+
+/** Move chunks from a magazine back to the shared arena (with the lock held). */
+static void tvarena_drain(struct tvarena *tvarena, struct tvarena_mag *mag, size_t i, size_t keep) {
+	struct arena *arena = &tvarena->varena.arenas[i];
+
+	while (mag->count > keep) {
+		void *chunk = mag->chunks[--mag->count];
+		sanitize_alloc(chunk, arena->size);
+		arena_free(arena, chunk);
+	}
+}
+
+void *tvarena_alloc(struct tvarena *tvarena, struct tvarena_cache *cache, size_t count) {
+	struct varena *varena = &tvarena->varena;
+	size_t i = varena_size_class(varena, count);
+
+	struct tvarena_mag *mag = tvarena_get_mag(cache, i);
+	if (!mag) {
+		mutex_lock(&tvarena->mutex);
+		void *ret = varena_alloc(varena, count);
+		mutex_unlock(&tvarena->mutex);
+		return ret;
+	}
+
+	if (mag->count == 0) {
+		mutex_lock(&tvarena->mutex);
+		tvarena_refill(tvarena, mag, count);
+		mutex_unlock(&tvarena->mutex);
+
+		if (mag->count == 0) {
+			errno = ENOMEM;
+			return NULL;
+		}
+	}
+
+	void *ret = mag->chunks[--mag->count];
+	sanitize_alloc(ret, varena_exact_size(varena, count));
+	return ret;
+}
+
+void tvarena_free(struct tvarena *tvarena, struct tvarena_cache *cache, void *ptr, size_t count) {
+	struct varena *varena = &tvarena->varena;
+	size_t i = varena_size_class(varena, count);
+
+	struct tvarena_mag *mag = tvarena_get_mag(cache, i);
+	if (!mag) {
+		mutex_lock(&tvarena->mutex);
+		varena_free(varena, ptr, count);
+		mutex_unlock(&tvarena->mutex);
+		return;
+	}
+
+	if (mag->count == TVARENA_MAG_SIZE) {
+		mutex_lock(&tvarena->mutex);
+		tvarena_drain(tvarena, mag, i, TVARENA_MAG_SIZE / 2);
+		mutex_unlock(&tvarena->mutex);
+	}
+
+	sanitize_free(ptr, tvarena_class_size(tvarena, i));
+	mag->chunks[mag->count++] = ptr;
+}
+
+void tvarena_cache_destroy(struct tvarena *tvarena, struct tvarena_cache *cache) {
+	mutex_lock(&tvarena->mutex);
+	for (size_t i = 0; i < cache->nmags; ++i) {
+		tvarena_drain(tvarena, &cache->mags[i], i, 0);
+	}
+	mutex_unlock(&tvarena->mutex);
+
+	free(cache->mags);
+	tvarena_cache_init(cache);
+}
+
+void tvarena_destroy(struct tvarena *tvarena) {
+	varena_destroy(&tvarena->varena);
+	mutex_destroy(&tvarena->mutex);
+}
+
+/** A block of scratch memory. */
+struct scratch_block {
+	/** The previous (smaller) block, if any. */
+	struct scratch_block *prev;
+	/** The usable size of this block. */
+	size_t size;
+	/** The memory itself. */
+	alignas(max_align_t) char data[];
+};
+
+/** The smallest block a scratch arena allocates. */
+#define SCRATCH_MIN 4096
+
+void scratch_init(struct scratch *scratch) {
+	scratch->block = NULL;
+	scratch->used = 0;
+}
+
+/** Allocate a new block big enough for a request. */
+static int scratch_grow(struct scratch *scratch, size_t size) {
+	size_t new_size = SCRATCH_MIN;
+	if (scratch->block) {
+		new_size = 2 * scratch->block->size;
+	}
+	while (new_size < size) {
+		new_size *= 2;
+	}
+
+	struct scratch_block *block = ALLOC_FLEX(struct scratch_block, data, new_size);
+	if (!block) {
+		return -1;
+	}
+
+	block->prev = scratch->block;
+	block->size = new_size;
+	sanitize_free(block->data, new_size);
+
+	scratch->block = block;
+	scratch->used = 0;
+	return 0;
+}
+
+void *scratch_alloc(struct scratch *scratch, size_t size) {
+	// Leave room for scratch_grow() to double the block size
+	if (size >> (SIZE_WIDTH - 2)) {
+		errno = EOVERFLOW;
+		return NULL;
+	}
+	size = align_ceil(alignof(max_align_t), size);
+
+	struct scratch_block *block = scratch->block;
+	if (!block || block->size - scratch->used < size) {
+		if (scratch_grow(scratch, size) != 0) {
+			return NULL;
+		}
+		block = scratch->block;
+	}
+
+	char *ptr = block->data + scratch->used;
+	scratch->used += size;
+	sanitize_alloc(ptr, size);
+	return ptr;
+}
+
+char *scratch_strndup(struct scratch *scratch, const char *str, size_t n) {
+	size_t len = strnlen(str, n);
+	char *copy = scratch_alloc(scratch, len + 1);
+	if (copy) {
+		memcpy(copy, str, len);
+		copy[len] = '\0';
+	}
+	return copy;
+}
+
+/** Free all but the newest block. */
+static void scratch_free_old(struct scratch_block *block) {
+	struct scratch_block *prev = block->prev;
+	block->prev = NULL;
+
+	while (prev) {
+		block = prev;
+		prev = block->prev;
+		free(block);
+	}
+}
+
+void scratch_reset(struct scratch *scratch) {
+	struct scratch_block *block = scratch->block;
+	if (!block) {
+		return;
+	}
+
+	scratch_free_old(block);
+	sanitize_free(block->data, scratch->used);
+	scratch->used = 0;
+}
+
+void scratch_destroy(struct scratch *scratch) {
+	struct scratch_block *block = scratch->block;
+	if (block) {
+		scratch_free_old(block);
+		free(block);
+	}
+	sanitize_uninit(scratch);
+}
@@ -9,6 +9,7 @@
 #define BFS_ALLOC_H
 
 #include "config.h"
+#include <pthread.h>
 #include <stddef.h>
 
 /** Round down to a multiple of an alignment. */
@@ -282,4 +283,144 @@ void varena_free(struct varena *varena, void *ptr, size_t count);
  */
 void varena_destroy(struct varena *varena);
 
+/**
+ * A thread-safe arena allocator for flexibly-sized types.
+ *
+ * Each thread allocates from and frees to its own magazines of chunks (one per
+ * size class), and only locks the shared varena to exchange half a magazine at
+ * a time.
+ */
+struct tvarena {
+	/** Protects the shared varena. */
+	pthread_mutex_t mutex;
+	/** The shared varena. */
+	struct varena varena;
+};
+
+/**
+ * A thread's private cache of free chunks from a tvarena.
+ */
+struct tvarena_cache {
+	/** The number of magazines. */
+	size_t nmags;
+	/** One magazine per size class. */
+	struct tvarena_mag *mags;
+};
+
+/**
+ * Initialize a tvarena for a struct with the given layout (see varena_init()).
+ *
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int tvarena_init(struct tvarena *tvarena, size_t align, size_t min, size_t offset, size_t size);
+
+/**
+ * Initialize a tvarena for the given type and flexible array.
+ */
+#define TVARENA_INIT(tvarena, type, member) \
+	tvarena_init(tvarena, alignof(type), sizeof(type), offsetof(type, member), sizeof_member(type, member[0]))
+
+/**
+ * Initialize a thread's cache for a tvarena.
+ */
+void tvarena_cache_init(struct tvarena_cache *cache);
+
+/**
+ * Arena-allocate a flexible struct.
+ *
+ * @param tvarena
+ *         The tvarena to allocate from.
+ * @param cache
+ *         The calling thread's cache.
+ * @param count
+ *         The length of the flexible array.
+ * @return
+ *         The allocated struct, or NULL on failure.
+ */
+void *tvarena_alloc(struct tvarena *tvarena, struct tvarena_cache *cache, size_t count);
+
+/**
+ * Free an arena-allocated flexible struct.  It may have been allocated by a
+ * different thread.
+ *
+ * @param tvarena
+ *         The tvarena that allocated the object.
+ * @param cache
+ *         The calling thread's cache.
+ * @param ptr
+ *         The object to free.
+ * @param count
+ *         The length of the flexible array.
+ */
+void tvarena_free(struct tvarena *tvarena, struct tvarena_cache *cache, void *ptr, size_t count);
+
+/**
+ * Return all of a thread's cached chunks to the shared varena, and destroy the
+ * cache.
+ */
+void tvarena_cache_destroy(struct tvarena *tvarena, struct tvarena_cache *cache);
+
+/**
+ * Destroy a tvarena, freeing all allocations.  Every cache should be destroyed
+ * first.
+ */
+void tvarena_destroy(struct tvarena *tvarena);
+
+/**
+ * A bump-pointer arena for short-lived allocations, which are all freed at
+ * once by scratch_reset().  After a reset, the arena keeps its largest block,
+ * so steady-state use doesn't call malloc() at all.
+ *
+ * Scratch arenas are intentionally not thread safe.
+ */
+struct scratch {
+	/** The newest (and largest) block. */
+	struct scratch_block *block;
+	/** The number of bytes used in the newest block. */
+	size_t used;
+};
+
+/**
+ * Initialize a scratch arena.
+ */
+void scratch_init(struct scratch *scratch);
+
+/**
+ * Allocate memory from a scratch arena, aligned for any type.
+ *
+ * @param scratch
+ *         The scratch arena.
+ * @param size
+ *         The number of bytes to allocate.
+ * @return
+ *         The allocated memory, valid until the next scratch_reset(), or NULL
+ *         on failure.
+ */
+void *scratch_alloc(struct scratch *scratch, size_t size);
+
+/**
+ * Copy (a prefix of) a string into a scratch arena.
+ *
+ * @param scratch
+ *         The scratch arena.
+ * @param str
+ *         The string to copy.
+ * @param n
+ *         The maximum number of bytes to copy.
+ * @return
+ *         The NUL-terminated copy, or NULL on failure.
+ */
+char *scratch_strndup(struct scratch *scratch, const char *str, size_t n);
+
+/**
+ * Free every allocation from a scratch arena at once.
+ */
+void scratch_reset(struct scratch *scratch);
+
+/**
+ * Destroy a scratch arena.
+ */
+void scratch_destroy(struct scratch *scratch);
+
 #endif // BFS_ALLOC_H
@@ -0,0 +1,231 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "ascii.h"
+#include "bit.h"
+#include "config.h"
+#include <stdint.h>
+#include <string.h>
+
+#if __SSE2__
+#  include <emmintrin.h>
+#  define ASCII_SSE2 true
+#elif __ARM_NEON && __aarch64__
+#  include <arm_neon.h>
+#  define ASCII_NEON true
+#endif
+
+#if ASCII_SSE2 || ASCII_NEON
+
+/** The number of bytes processed at once. */
+#define ASCII_BLOCK 16
+
+#if ASCII_SSE2
+
+typedef __m128i ascii_vec;
+
+/** Load an unaligned block. */
+static ascii_vec ascii_load(const char *src) {
+	return _mm_loadu_si128((const __m128i *)src);
+}
+
+/** Store an unaligned block. */
+static void ascii_store(char *dest, ascii_vec v) {
+	_mm_storeu_si128((__m128i *)dest, v);
+}
+
+/** Fold the case of a block. */
+static ascii_vec ascii_fold(ascii_vec v) {
+	// Bytes >= 0x80 are negative, so they're never in range
+	__m128i ge = _mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1));
+	__m128i le = _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1));
+	__m128i bit = _mm_and_si128(_mm_and_si128(ge, le), _mm_set1_epi8(0x20));
+	return _mm_or_si128(v, bit);
+}
+
+/** Check if a block is all ASCII. */
+static bool ascii_isascii(ascii_vec v) {
+	return _mm_movemask_epi8(v) == 0;
+}
+
+/** Check if two blocks are equal. */
+static bool ascii_eq(ascii_vec lhs, ascii_vec rhs) {
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(lhs, rhs)) == 0xFFFF;
+}
+
+/** Reverse the bytes of a block. */
+static ascii_vec ascii_rev(ascii_vec v) {
+	// SSE2 has no byte shuffle, so reverse dwords, then words, then bytes
+	v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+	v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+	v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+	return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+#else // ASCII_NEON
+
+typedef uint8x16_t ascii_vec;
+
+static ascii_vec ascii_load(const char *src) {
+	return vld1q_u8((const uint8_t *)src);
+}
+
+static void ascii_store(char *dest, ascii_vec v) {
+	vst1q_u8((uint8_t *)dest, v);
+}
+
+static ascii_vec ascii_fold(ascii_vec v) {
+	uint8x16_t ge = vcgeq_u8(v, vdupq_n_u8('A'));
+	uint8x16_t le = vcleq_u8(v, vdupq_n_u8('Z'));
+	uint8x16_t bit = vandq_u8(vandq_u8(ge, le), vdupq_n_u8(0x20));
+	return vorrq_u8(v, bit);
+}
+
+static bool ascii_isascii(ascii_vec v) {
+	return vmaxvq_u8(v) < 0x80;
+}
+
+static bool ascii_eq(ascii_vec lhs, ascii_vec rhs) {
+	return vminvq_u8(vceqq_u8(lhs, rhs)) == 0xFF;
+}
+
+static ascii_vec ascii_rev(ascii_vec v) {
+	v = vrev64q_u8(v);
+	return vextq_u8(v, v, 8);
+}
+
+#endif // ASCII_NEON
+
+#else // !(ASCII_SSE2 || ASCII_NEON)
+
+/** The number of bytes processed at once. */
+#define ASCII_BLOCK 8
+
+/** Without SIMD, operate on the bytes of a 64-bit word in parallel. */
+typedef uint64_t ascii_vec;
+
+/** Broadcast a byte to every byte of a word. */
+#define ASCII_SPLAT(c) ((uint64_t)(c) * 0x0101010101010101)
+
+static ascii_vec ascii_load(const char *src) {
+	uint64_t v;
+	memcpy(&v, src, sizeof(v));
+	return v;
+}
+
+static void ascii_store(char *dest, ascii_vec v) {
+	memcpy(dest, &v, sizeof(v));
+}
+
+static ascii_vec ascii_fold(ascii_vec v) {
+	// The high bit of each byte of ge/gt is set if the low 7 bits are
+	// >= 'A'/> 'Z', without carries between bytes
+	uint64_t low = v & ASCII_SPLAT(0x7F);
+	uint64_t ge = low + ASCII_SPLAT(0x80 - 'A');
+	uint64_t gt = low + ASCII_SPLAT(0x80 - 'Z' - 1);
+	uint64_t upper = ge & ~gt & ~v & ASCII_SPLAT(0x80);
+	return v | (upper >> 2);
+}
+
+static bool ascii_isascii(ascii_vec v) {
+	return !(v & ASCII_SPLAT(0x80));
+}
+
+static bool ascii_eq(ascii_vec lhs, ascii_vec rhs) {
+	return lhs == rhs;
+}
+
+static ascii_vec ascii_rev(ascii_vec v) {
+	return bswap64(v);
+}
+
+#endif // !(ASCII_SSE2 || ASCII_NEON)
+
+/** Fold the case of a single byte. */
+static char ascii_fold_char(char c) {
+	if (c >= 'A' && c <= 'Z') {
+		c += 'a' - 'A';
+	}
+	return c;
+}
+
+/**
+ * Get the offset of the next block.  The last block overlaps the previous one
+ * instead of being padded, which would need a slow partial copy.
+ */
+static size_t ascii_next(size_t i, size_t len) {
+	i += ASCII_BLOCK;
+	if (i + ASCII_BLOCK > len) {
+		i = len - ASCII_BLOCK;
+	}
+	return i;
+}
+
+bool ascii_tolower(char *dest, const char *src, size_t len) {
+	bool ret = true;
+
+	if (len < ASCII_BLOCK) {
+		for (size_t i = 0; i < len; ++i) {
+			ret &= (unsigned char)src[i] < 0x80;
+			dest[i] = ascii_fold_char(src[i]);
+		}
+		return ret;
+	}
+
+	// Folding is idempotent, so it's fine for the last block to re-read
+	// bytes that were already folded in place
+	for (size_t i = 0; ; i = ascii_next(i, len)) {
+		ascii_vec v = ascii_load(src + i);
+		ret &= ascii_isascii(v);
+		ascii_store(dest + i, ascii_fold(v));
+		if (i + ASCII_BLOCK == len) {
+			return ret;
+		}
+	}
+}
+
+bool ascii_caseeq(const char *lhs, const char *rhs, size_t len) {
+	if (len < ASCII_BLOCK) {
+		for (size_t i = 0; i < len; ++i) {
+			if (ascii_fold_char(lhs[i]) != ascii_fold_char(rhs[i])) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	for (size_t i = 0; ; i = ascii_next(i, len)) {
+		ascii_vec l = ascii_fold(ascii_load(lhs + i));
+		ascii_vec r = ascii_fold(ascii_load(rhs + i));
+		if (!ascii_eq(l, r)) {
+			return false;
+		}
+		if (i + ASCII_BLOCK == len) {
+			return true;
+		}
+	}
+}
+
+void ascii_reverse(char *dest, const char *src, size_t len) {
+	// Swap whole blocks from both ends inwards
+	size_t i = 0;
+	for (; 2 * (i + ASCII_BLOCK) <= len; i += ASCII_BLOCK) {
+		ascii_vec front = ascii_load(src + i);
+		ascii_vec back = ascii_load(src + len - i - ASCII_BLOCK);
+		ascii_store(dest + i, ascii_rev(back));
+		ascii_store(dest + len - i - ASCII_BLOCK, ascii_rev(front));
+	}
+
+	// Then reverse what's left in the middle (less than two blocks) by
+	// right-aligning it in a padded buffer, so it ends up left-aligned
+	size_t rest = len - 2 * i;
+	if (rest > 0) {
+		char buf[2 * ASCII_BLOCK] = {0};
+		memcpy(buf + sizeof(buf) - rest, src + i, rest);
+		ascii_vec lo = ascii_load(buf);
+		ascii_vec hi = ascii_load(buf + ASCII_BLOCK);
+		ascii_store(buf, ascii_rev(hi));
+		ascii_store(buf + ASCII_BLOCK, ascii_rev(lo));
+		memcpy(dest + i, buf, rest);
+	}
+}
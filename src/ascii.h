@@ -0,0 +1,60 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * Locale-independent ASCII string operations.
+ *
+ * These run for (nearly) every file name, so they process 16 bytes at a time
+ * with SSE2 or NEON where available, and 8 bytes at a time otherwise.
+ */
+
+#ifndef BFS_ASCII_H
+#define BFS_ASCII_H
+
+#include "config.h"
+#include <stddef.h>
+
+/**
+ * Convert a string to lowercase, only folding the ASCII letters A-Z.
+ *
+ * @param dest
+ *         The destination buffer, of at least len bytes.  May be the same as
+ *         src, but must not otherwise overlap it.
+ * @param src
+ *         The string to convert.
+ * @param len
+ *         The length of the string.
+ * @return
+ *         Whether the string was entirely ASCII.  If not, dest is still filled
+ *         in, with any non-ASCII bytes unchanged.
+ */
+bool ascii_tolower(char *dest, const char *src, size_t len);
+
+/**
+ * Compare two strings of the same length, ignoring the case of ASCII letters.
+ *
+ * @param lhs
+ *         The first string.
+ * @param rhs
+ *         The second string.
+ * @param len
+ *         The length of both strings.
+ * @return
+ *         Whether the strings are equal after ASCII case folding.
+ */
+bool ascii_caseeq(const char *lhs, const char *rhs, size_t len);
+
+/**
+ * Reverse a string, e.g. to turn suffix matches into prefix matches.
+ *
+ * @param dest
+ *         The destination buffer, of at least len bytes.  May be the same as
+ *         src, but must not otherwise overlap it.
+ * @param src
+ *         The string to reverse.
+ * @param len
+ *         The length of the string.
+ */
+void ascii_reverse(char *dest, const char *src, size_t len);
+
+#endif // BFS_ASCII_H
@@ -82,4 +82,15 @@
 #define fetch_and(obj, arg, order) \
 	atomic_fetch_and_explicit(obj, arg, memory_order_##order)
 
+/**
+ * Hint to the CPU that we're in a spin loop.
+ */
+#if __i386__ || __x86_64__
+#  define spin_loop() __builtin_ia32_pause()
+#elif __aarch64__ || __arm__
+#  define spin_loop() __asm__ volatile("yield" ::: "memory")
+#else
+#  define spin_loop() ((void)0)
+#endif
+
 #endif // BFS_ATOMIC_H
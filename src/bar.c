@@ -2,27 +2,48 @@
 // SPDX-License-Identifier: 0BSD
 
 #include "bar.h"
+#include "atomic.h"
 #include "bfstd.h"
 #include "bit.h"
 #include "config.h"
 #include "dstring.h"
+#include "thread.h"
+#include "xtime.h"
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/ioctl.h>
+#include <time.h>
+
+/** How often the bar should be redrawn, in nanoseconds. */
+#define BFS_BAR_INTERVAL 100000000L
 
 struct bfs_bar {
 	int fd;
 	volatile sig_atomic_t width;
 	volatile sig_atomic_t height;
+
+	/** Set by the ticker thread whenever it's time to redraw. */
+	atomic bool due;
+	/** Wakes up the ticker thread every BFS_BAR_INTERVAL. */
+	pthread_t ticker;
+	/** Protects stop. */
+	pthread_mutex_t mutex;
+	/** Signalled to stop the ticker early. */
+	pthread_cond_t cond;
+	/** Whether the ticker thread should exit. */
+	bool stop;
 };
 
 /** The global status bar instance. */
 static struct bfs_bar the_bar = {
 	.fd = -1,
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
 };
 
 /** Get the terminal size, if possible. */
@@ -124,6 +145,32 @@ static void reset_before_death_by(int sig) {
 	sigaction(sig, &sa, NULL);
 }
 
+/** The ticker thread, which keeps the clock off the hot path. */
+static void *bfs_bar_tick(void *ptr) {
+	struct bfs_bar *bar = ptr;
+
+	mutex_lock(&bar->mutex);
+	while (!bar->stop) {
+		struct timespec deadline;
+		if (xgettime(&deadline) != 0) {
+			break;
+		}
+
+		deadline.tv_nsec += BFS_BAR_INTERVAL;
+		if (deadline.tv_nsec >= 1000000000L) {
+			deadline.tv_nsec -= 1000000000L;
+			++deadline.tv_sec;
+		}
+
+		// Spurious wakeups and timeouts are both fine here
+		pthread_cond_timedwait(&bar->cond, &bar->mutex, &deadline);
+		store(&bar->due, true, relaxed);
+	}
+	mutex_unlock(&bar->mutex);
+
+	return NULL;
+}
+
 /** printf() to the status bar with a single write(). */
 BFS_FORMATTER(2, 3)
 static int bfs_bar_printf(struct bfs_bar *bar, const char *format, ...) {
@@ -163,6 +210,13 @@ struct bfs_bar *bfs_bar_show(void) {
 		goto fail_close;
 	}
 
+	// Draw the first update right away
+	store(&the_bar.due, true, relaxed);
+	the_bar.stop = false;
+	if (thread_create(&the_bar.ticker, NULL, bfs_bar_tick, &the_bar) != 0) {
+		goto fail_close;
+	}
+
 	reset_before_death_by(SIGABRT);
 	reset_before_death_by(SIGINT);
 	reset_before_death_by(SIGPIPE);
@@ -200,6 +254,11 @@ unsigned int bfs_bar_width(const struct bfs_bar *bar) {
 	return bar->width;
 }
 
+bool bfs_bar_due(struct bfs_bar *bar) {
+	// Skip the atomic read-modify-write when nothing has changed
+	return load(&bar->due, relaxed) && exchange(&bar->due, false, relaxed);
+}
+
 int bfs_bar_update(struct bfs_bar *bar, const char *str) {
 	return bfs_bar_printf(bar,
 		"\0337"      // DECSC: Save cursor
@@ -219,6 +278,12 @@ void bfs_bar_hide(struct bfs_bar *bar) {
 		return;
 	}
 
+	mutex_lock(&bar->mutex);
+	bar->stop = true;
+	cond_signal(&bar->cond);
+	mutex_unlock(&bar->mutex);
+	thread_join(bar->ticker, NULL);
+
 	signal(SIGABRT, SIG_DFL);
 	signal(SIGINT, SIG_DFL);
 	signal(SIGPIPE, SIG_DFL);
@@ -8,6 +8,8 @@
 #ifndef BFS_BAR_H
 #define BFS_BAR_H
 
+#include "config.h"
+
 /** A terminal status bar. */
 struct bfs_bar;
 
@@ -24,6 +26,15 @@ struct bfs_bar *bfs_bar_show(void);
  */
 unsigned int bfs_bar_width(const struct bfs_bar *bar);
 
+/**
+ * Check whether the status bar is due to be redrawn.  A background thread
+ * sets this periodically, so it is cheap enough to check for every file.
+ *
+ * @return
+ *         Whether the caller should call bfs_bar_update() now.
+ */
+bool bfs_bar_due(struct bfs_bar *bar);
+
 /**
  * Update the status bar message.
  *
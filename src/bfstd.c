@@ -5,12 +5,14 @@
 #include "bit.h"
 #include "config.h"
 #include "diag.h"
+#include "sanity.h"
 #include "xregex.h"
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <langinfo.h>
 #include <nl_types.h>
+#include <sched.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -21,6 +23,10 @@
 #include <wchar.h>
 #include <wctype.h>
 
+#if BFS_USE_STDIO_EXT_H
+#  include <stdio_ext.h>
+#endif
+
 #if BFS_USE_SYS_SYSMACROS_H
 #  include <sys/sysmacros.h>
 #elif BFS_USE_SYS_MKDEV_H
@@ -32,7 +38,7 @@
 #endif
 
 bool is_nonexistence_error(int error) {
-	return error == ENOENT || errno == ENOTDIR;
+	return error == ENOENT || error == ENOTDIR;
 }
 
 char *xdirname(const char *path) {
@@ -128,6 +134,20 @@ FILE *xfopen(const char *path, int flags) {
 	return ret;
 }
 
+/** The buffer size for non-interactive output (the Linux pipe capacity). */
+#define OUTPUT_BUFSIZE (64 * 1024)
+
+void xoutput_stream(FILE *file) {
+	if (!isatty(fileno(file))) {
+		// Errors just leave the default buffering in place
+		setvbuf(file, NULL, _IOFBF, OUTPUT_BUFSIZE);
+	}
+
+#if BFS_USE_STDIO_EXT_H
+	__fsetlocking(file, FSETLOCKING_BYCALLER);
+#endif
+}
+
 char *xgetdelim(FILE *file, char delim) {
 	char *chunk = NULL;
 	size_t n = 0;
@@ -322,6 +342,257 @@ void xstrmode(mode_t mode, char str[11]) {
 	}
 }
 
+/**
+ * Shared implementation of xstrtomode() and xstrtochmod().
+ *
+ * @param chmod
+ *         Whether to follow chmod(1) exactly, rather than the traditional
+ *         -perm semantics.
+ * @param cmask
+ *         The umask to apply to clauses with no user class, for chmod(1).
+ */
+static int strtomode(const char *str, mode_t *file_mode, mode_t *dir_mode, bool chmod, mode_t cmask) {
+	// Parse the same grammar as chmod(1), which looks like this:
+	//
+	// MODE : CLAUSE ["," CLAUSE]*
+	//
+	// CLAUSE : WHO* ACTION+
+	//
+	// WHO : "u" | "g" | "o" | "a"
+	//
+	// ACTION : OP PERM*
+	//        | OP PERMCOPY
+	//
+	// OP : "+" | "-" | "="
+	//
+	// PERM : "r" | "w" | "x" | "X" | "s" | "t"
+	//
+	// PERMCOPY : "u" | "g" | "o"
+
+	// State machine state
+	enum {
+		MODE_CLAUSE,
+		MODE_WHO,
+		MODE_ACTION,
+		MODE_ACTION_APPLY,
+		MODE_OP,
+		MODE_PERM,
+	} mstate = MODE_CLAUSE;
+
+	enum {
+		MODE_PLUS,
+		MODE_MINUS,
+		MODE_EQUALS,
+	} op = uninit(op, MODE_EQUALS);
+
+	mode_t who = uninit(who, 0);
+	mode_t mask = uninit(mask, 0);
+	mode_t special = uninit(special, 0);
+	mode_t file_change = uninit(file_change, 0);
+	mode_t dir_change = uninit(dir_change, 0);
+
+	const char *i = str;
+	while (true) {
+		switch (mstate) {
+		case MODE_CLAUSE:
+			who = 0;
+			mask = 0;
+			mstate = MODE_WHO;
+			fallthru;
+
+		case MODE_WHO:
+			switch (*i) {
+			case 'u':
+				who |= 0700;
+				break;
+			case 'g':
+				who |= 0070;
+				break;
+			case 'o':
+				who |= 0007;
+				break;
+			case 'a':
+				who |= 0777;
+				break;
+			default:
+				mstate = MODE_ACTION;
+				continue;
+			}
+			break;
+
+		case MODE_ACTION_APPLY:
+			file_change &= ~mask;
+			dir_change &= ~mask;
+
+			switch (op) {
+			case MODE_EQUALS:
+				if (chmod) {
+					// chmod(1) also clears the special bits,
+					// except set[ug]id on directories
+					*file_mode &= ~(who | special);
+					*dir_mode &= ~(who | (special & S_ISVTX));
+				} else {
+					*file_mode &= ~who;
+					*dir_mode &= ~who;
+				}
+				fallthru;
+			case MODE_PLUS:
+				*file_mode |= file_change;
+				*dir_mode |= dir_change;
+				break;
+			case MODE_MINUS:
+				*file_mode &= ~file_change;
+				*dir_mode &= ~dir_change;
+				break;
+			}
+			fallthru;
+
+		case MODE_ACTION:
+			if (who == 0) {
+				who = 0777;
+				if (chmod) {
+					// chmod(1) leaves the umask bits alone
+					mask = cmask & 0777;
+				}
+			}
+
+			special = 0;
+			if (who & 0700) {
+				special |= S_ISUID;
+			}
+			if (who & 0070) {
+				special |= S_ISGID;
+			}
+			if (who & 0007) {
+				special |= S_ISVTX;
+			}
+
+			switch (*i) {
+			case '+':
+				op = MODE_PLUS;
+				mstate = MODE_OP;
+				break;
+			case '-':
+				op = MODE_MINUS;
+				mstate = MODE_OP;
+				break;
+			case '=':
+				op = MODE_EQUALS;
+				mstate = MODE_OP;
+				break;
+
+			case ',':
+				if (mstate == MODE_ACTION_APPLY) {
+					mstate = MODE_CLAUSE;
+				} else {
+					goto fail;
+				}
+				break;
+
+			case '\0':
+				if (mstate == MODE_ACTION_APPLY) {
+					goto done;
+				} else {
+					goto fail;
+				}
+
+			default:
+				goto fail;
+			}
+			break;
+
+		case MODE_OP:
+			switch (*i) {
+			case 'u':
+				file_change = (*file_mode >> 6) & 07;
+				dir_change = (*dir_mode >> 6) & 07;
+				break;
+			case 'g':
+				file_change = (*file_mode >> 3) & 07;
+				dir_change = (*dir_mode >> 3) & 07;
+				break;
+			case 'o':
+				file_change = *file_mode & 07;
+				dir_change = *dir_mode & 07;
+				break;
+
+			default:
+				file_change = 0;
+				dir_change = 0;
+				mstate = MODE_PERM;
+				continue;
+			}
+
+			file_change |= (file_change << 6) | (file_change << 3);
+			file_change &= who;
+			dir_change |= (dir_change << 6) | (dir_change << 3);
+			dir_change &= who;
+			mstate = MODE_ACTION_APPLY;
+			break;
+
+		case MODE_PERM:
+			switch (*i) {
+			case 'r':
+				file_change |= who & 0444;
+				dir_change |= who & 0444;
+				break;
+			case 'w':
+				file_change |= who & 0222;
+				dir_change |= who & 0222;
+				break;
+			case 'x':
+				file_change |= who & 0111;
+				fallthru;
+			case 'X':
+				dir_change |= who & 0111;
+				// chmod(1) also grants X to files that are already
+				// executable by someone
+				if (chmod && (*file_mode & 0111)) {
+					file_change |= who & 0111;
+				}
+				break;
+			case 's':
+				if (who & 0700) {
+					file_change |= S_ISUID;
+					dir_change |= S_ISUID;
+				}
+				if (who & 0070) {
+					file_change |= S_ISGID;
+					dir_change |= S_ISGID;
+				}
+				break;
+			case 't':
+				if (who & 0007) {
+					file_change |= S_ISVTX;
+					dir_change |= S_ISVTX;
+				}
+				break;
+			default:
+				mstate = MODE_ACTION_APPLY;
+				continue;
+			}
+			break;
+		}
+
+		++i;
+	}
+
+done:
+	return 0;
+
+fail:
+	errno = EINVAL;
+	return -1;
+}
+
+int xstrtomode(const char *str, mode_t *file_mode, mode_t *dir_mode) {
+	return strtomode(str, file_mode, dir_mode, false, 0);
+}
+
+int xstrtochmod(const char *str, mode_t cmask, mode_t *file_mode, mode_t *dir_mode) {
+	return strtomode(str, file_mode, dir_mode, true, cmask);
+}
+
 dev_t xmakedev(int ma, int mi) {
 #ifdef makedev
 	return makedev(ma, mi);
@@ -515,6 +786,38 @@ error:
 	return NULL;
 }
 
+int xsetaffinity(const unsigned int cpus[], size_t ncpus) {
+#if __linux__
+	unsigned int max = 0;
+	for (size_t i = 0; i < ncpus; ++i) {
+		if (cpus[i] > max) {
+			max = cpus[i];
+		}
+	}
+
+	// Use a dynamically sized set, in case there are more than CPU_SETSIZE
+	cpu_set_t *set = CPU_ALLOC(max + 1);
+	if (!set) {
+		return -1;
+	}
+
+	size_t size = CPU_ALLOC_SIZE(max + 1);
+	CPU_ZERO_S(size, set);
+	for (size_t i = 0; i < ncpus; ++i) {
+		CPU_SET_S(cpus[i], size, set);
+	}
+
+	int ret = sched_setaffinity(0, size, set);
+	int error = errno;
+	CPU_FREE(set);
+	errno = error;
+	return ret;
+#else
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
 int xstrtofflags(const char **str, unsigned long long *set, unsigned long long *clear) {
 #if BSD && !__GNU__
 	char *str_arg = (char *)*str;
@@ -90,6 +90,16 @@ size_t xbaseoff(const char *path);
  */
 FILE *xfopen(const char *path, int flags);
 
+/**
+ * Set up an output stream for bulk writes.  Non-interactive streams get a large
+ * buffer, and stdio's internal locking is disabled where possible, so the
+ * caller must not write to the stream from multiple threads at once.
+ *
+ * @param file
+ *         The stream to set up, before any I/O has been done on it.
+ */
+void xoutput_stream(FILE *file);
+
 /**
  * Convenience wrapper for getdelim().
  *
@@ -176,6 +186,38 @@ char *xstpencpy(char *dest, char *end, const char *src, size_t n);
  */
 void xstrmode(mode_t mode, char str[11]);
 
+/**
+ * Apply a symbolic mode like chmod(1) (e.g. u+w,go-x).
+ *
+ * @param str
+ *         The symbolic mode.
+ * @param file_mode
+ *         The mode of a non-directory to update.
+ * @param dir_mode
+ *         The mode of a directory to update (different due to X).
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int xstrtomode(const char *str, mode_t *file_mode, mode_t *dir_mode);
+
+/**
+ * Apply a symbolic mode exactly like chmod(1) would.  Unlike xstrtomode(), =
+ * also clears the special bits, X also applies to already-executable files,
+ * and clauses with no user class leave the umask bits alone.
+ *
+ * @param str
+ *         The symbolic mode.
+ * @param cmask
+ *         The file mode creation mask (see umask(2)) to respect.
+ * @param file_mode
+ *         The current mode of a non-directory to update.
+ * @param dir_mode
+ *         The current mode of a directory to update.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int xstrtochmod(const char *str, mode_t cmask, mode_t *file_mode, mode_t *dir_mode);
+
 #include <sys/types.h>
 
 /**
@@ -290,6 +332,20 @@ char *xreadlinkat(int fd, const char *path, size_t size);
  */
 char *xconfstr(int name);
 
+/**
+ * Restrict the calling thread, and any threads it creates later, to a set of
+ * CPUs.
+ *
+ * @param cpus
+ *         The CPU numbers to allow.
+ * @param ncpus
+ *         The number of CPUs.
+ * @return
+ *         0 on success, -1 on failure (with errno set to ENOTSUP if this
+ *         platform doesn't support CPU affinity).
+ */
+int xsetaffinity(const unsigned int cpus[], size_t ncpus);
+
 /**
  * Portability wrapper for strtofflags().
  *
@@ -12,34 +12,66 @@
  * - struct bftw_cache: An LRU list of bftw_file's with open file descriptors,
  *   used for openat() to minimize the amount of path re-traversals.
  *
+ * - struct bftw_spill: A queue of directories spilled to a temporary file, to
+ *   bound the memory used by breadth-first search.
+ *
+ * - struct bftw_listings: Directory listings kept in memory between the passes
+ *   of iterative deepening, so shallow directories aren't read over and over.
+ *
  * - struct bftw_state: Represents the current state of the traversal, allowing
  *   various helper functions to take fewer parameters.
  */
 
 #include "bftw.h"
 #include "alloc.h"
+#include "atomic.h"
 #include "bfstd.h"
 #include "config.h"
+#include "darray.h"
 #include "diag.h"
 #include "dir.h"
 #include "dstring.h"
+#include "index.h"
 #include "ioq.h"
 #include "list.h"
 #include "mtab.h"
+#include "perf.h"
 #include "stat.h"
+#include "thread.h"
+#include "trace.h"
 #include "trie.h"
+#include "xtime.h"
 #include <errno.h>
 #include <fcntl.h>
+#include <locale.h>
+#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
+#include <unistd.h>
+
+#if __linux__
+#  include <sys/vfs.h>
+#endif
+
+/** The bfs_stat() fields that bftw() needs for itself (cycle detection etc.). */
+#define BFTW_STAT_FIELDS (BFS_STAT_DEV | BFS_STAT_INO | BFS_STAT_TYPE)
+
+/** Get the bfs_stat() fields to request. */
+static enum bfs_stat_field bftw_stat_fields(const struct bftw_args *args) {
+	return args->stat_fields | BFTW_STAT_FIELDS;
+}
 
 /** Caching bfs_stat(). */
 static const struct bfs_stat *bftw_stat_impl(struct BFTW *ftwbuf, struct bftw_stat *cache, enum bfs_stat_flags flags) {
-	if (!cache->buf) {
-		if (cache->error) {
-			errno = cache->error;
-		} else if (bfs_stat(ftwbuf->at_fd, ftwbuf->at_path, flags, &cache->storage) == 0) {
+	if (!cache->buf && cache->error) {
+		errno = cache->error;
+	} else if (!cache->buf) {
+		uint64_t start = trace_stat_start(flags);
+		int ret = bfs_stat_fields(ftwbuf->at_fd, ftwbuf->at_path, flags, ftwbuf->stat_fields, &cache->storage);
+		trace_stat_stop(start, flags);
+
+		if (ret == 0) {
 			cache->buf = &cache->storage;
 		} else {
 			cache->error = errno;
@@ -81,6 +113,16 @@ const struct bfs_stat *bftw_cached_stat(const struct BFTW *ftwbuf, enum bfs_stat
 	}
 }
 
+char *bftw_readlink(const struct BFTW *ftwbuf) {
+	if (ftwbuf->link_target) {
+		return strdup(ftwbuf->link_target);
+	}
+
+	const struct bfs_stat *statbuf = bftw_cached_stat(ftwbuf, BFS_STAT_NOFOLLOW);
+	size_t len = statbuf && (statbuf->mask & BFS_STAT_SIZE) ? statbuf->size : 0;
+	return xreadlinkat(ftwbuf->at_fd, ftwbuf->at_path, len);
+}
+
 enum bfs_type bftw_type(const struct BFTW *ftwbuf, enum bfs_stat_flags flags) {
 	if (flags & BFS_STAT_NOFOLLOW) {
 		if (ftwbuf->type == BFS_LNK || (ftwbuf->stat_flags & BFS_STAT_NOFOLLOW)) {
@@ -106,6 +148,23 @@ enum bfs_type bftw_type(const struct BFTW *ftwbuf, enum bfs_stat_flags flags) {
 	}
 }
 
+/**
+ * The state of an open file.  Only files that get opened (usually just
+ * directories) need one, so it lives apart from the bftw_file itself.
+ */
+struct bftw_fdinfo {
+	/** LRU list node. */
+	struct {
+		struct bftw_file *prev;
+		struct bftw_file *next;
+	} lru;
+
+	/** Pin count (for ->fd). */
+	size_t pincount;
+	/** An open directory for this file, if any. */
+	struct bfs_dir *dir;
+};
+
 /**
  * A file.
  */
@@ -120,33 +179,43 @@ struct bftw_file {
 	/** The next directory to read. */
 	struct { struct bftw_file *next; } to_read;
 
-	/** LRU list node. */
-	struct {
-		struct bftw_file *prev;
-		struct bftw_file *next;
-	} lru;
+	/** The open file state, allocated the first time this file is opened. */
+	struct bftw_fdinfo *info;
 
 	/** This file's depth in the walk. */
 	size_t depth;
 	/** Reference count (for ->parent). */
 	size_t refcount;
 
-	/** Pin count (for ->fd). */
-	size_t pincount;
-	/** An open descriptor to this file, or -1. */
-	int fd;
-	/** Whether this file has a pending ioq request. */
-	bool ioqueued;
-	/** An open directory for this file, if any. */
-	struct bfs_dir *dir;
+	/** Prefetched stat() info, if any. */
+	struct bfs_stat *statbuf;
+	/** Prefetched extended attribute names, if any. */
+	struct bfs_xattrs *xattrs;
+	/** Prefetched symbolic link target, if any. */
+	char *target;
 
-	/** This file's type, if known. */
-	enum bfs_type type;
 	/** The device number, for cycle detection. */
 	dev_t dev;
 	/** The inode number, for cycle detection. */
 	ino_t ino;
 
+	/** An open descriptor to this file, or -1. */
+	int fd;
+	/** This file's type, if known. */
+	enum bfs_type type;
+	/** The flags used for the stat() prefetch, if any. */
+	enum bfs_stat_flags statflags;
+	/** The error from a failed stat() prefetch or deletion, if any. */
+	int staterror;
+	/** The result of the filter, if it was evaluated in advance. */
+	signed char filtered;
+	/** The number of pending ioq requests for this file. */
+	unsigned char ioqueued;
+	/** Whether reading this directory found no entries. */
+	bool empty;
+	/** A saved listing to read instead of this directory, if any. */
+	const struct bftw_listing *listing;
+
 	/** The offset of this file in the full path. */
 	size_t nameoff;
 	/** The length of the file's name. */
@@ -155,6 +224,28 @@ struct bftw_file {
 	char name[];
 };
 
+/**
+ * A pending bftw_args::filter evaluation.
+ */
+struct bftw_job {
+	/** The file being filtered. */
+	struct bftw_file *file;
+	/** The filter to evaluate. */
+	bftw_filter *filter;
+	/** The filter's argument. */
+	void *ptr;
+	/** Whether the file must be stat()ed first. */
+	bool stat;
+	/** The error from that stat(), if any. */
+	int staterror;
+	/** The result of the filter. */
+	int result;
+	/** The full path to the file. */
+	char *path;
+	/** The data passed to the filter. */
+	struct BFTW ftwbuf;
+};
+
 /**
  * A linked list of bftw_file's.
  */
@@ -175,11 +266,21 @@ struct bftw_cache {
 	struct bftw_file *target;
 	/** The remaining capacity of the LRU list. */
 	size_t capacity;
+	/** The number of evictions of directories that were still in use. */
+	size_t churn;
 
 	/** bftw_file arena. */
 	struct varena files;
+	/** bftw_fdinfo arena. */
+	struct arena fdinfos;
 	/** bfs_dir arena. */
 	struct arena dirs;
+	/** bfs_stat arena. */
+	struct arena stat_bufs;
+	/** bfs_xattrs arena. */
+	struct arena xattr_bufs;
+	/** bftw_job arena. */
+	struct arena jobs;
 };
 
 /** Initialize a cache. */
@@ -187,8 +288,13 @@ static void bftw_cache_init(struct bftw_cache *cache, size_t capacity) {
 	LIST_INIT(cache);
 	cache->target = NULL;
 	cache->capacity = capacity;
+	cache->churn = 0;
 	VARENA_INIT(&cache->files, struct bftw_file, name);
+	ARENA_INIT(&cache->fdinfos, struct bftw_fdinfo);
 	bfs_dir_arena(&cache->dirs);
+	ARENA_INIT(&cache->stat_bufs, struct bfs_stat);
+	ARENA_INIT(&cache->xattr_bufs, struct bfs_xattrs);
+	ARENA_INIT(&cache->jobs, struct bftw_job);
 }
 
 /** Allocate a directory. */
@@ -204,10 +310,10 @@ static void bftw_freedir(struct bftw_cache *cache, struct bfs_dir *dir) {
 /** Remove a bftw_file from the LRU list. */
 static void bftw_lru_remove(struct bftw_cache *cache, struct bftw_file *file) {
 	if (cache->target == file) {
-		cache->target = file->lru.prev;
+		cache->target = file->info->lru.prev;
 	}
 
-	LIST_REMOVE(cache, file, lru);
+	LIST_REMOVE(cache, file, info->lru);
 }
 
 /** Remove a bftw_file from the cache. */
@@ -219,12 +325,13 @@ static void bftw_cache_remove(struct bftw_cache *cache, struct bftw_file *file)
 /** Close a bftw_file. */
 static void bftw_file_close(struct bftw_cache *cache, struct bftw_file *file) {
 	bfs_assert(file->fd >= 0);
-	bfs_assert(file->pincount == 0);
+	bfs_assert(file->info->pincount == 0);
 
-	if (file->dir) {
-		bfs_closedir(file->dir);
-		bftw_freedir(cache, file->dir);
-		file->dir = NULL;
+	struct bfs_dir *dir = file->info->dir;
+	if (dir) {
+		bfs_closedir(dir);
+		bftw_freedir(cache, dir);
+		file->info->dir = NULL;
 	} else {
 		xclose(file->fd);
 	}
@@ -233,13 +340,32 @@ static void bftw_file_close(struct bftw_cache *cache, struct bftw_file *file) {
 	bftw_cache_remove(cache, file);
 }
 
-/** Pop the least recently used directory from the cache. */
+/** How far from the tail of the LRU list to look for an eviction candidate. */
+#define BFTW_EVICT_SCAN 8
+
+/** Pop a directory from the cache, preferring ones we're done with. */
 static int bftw_cache_pop(struct bftw_cache *cache) {
 	struct bftw_file *file = cache->tail;
 	if (!file) {
 		return -1;
 	}
 
+	// A file with no children left to open is cheaper to evict than one
+	// that we'll have to reopen later
+	struct bftw_file *victim = file;
+	for (int i = 0; victim && i < BFTW_EVICT_SCAN; ++i) {
+		if (victim->refcount <= 1) {
+			file = victim;
+			break;
+		}
+		victim = victim->info->lru.prev;
+	}
+
+	if (file->refcount > 1) {
+		++cache->churn;
+	}
+
+	perf_count(PERF_FD_EVICT, 1);
 	bftw_file_close(cache, file);
 	return 0;
 }
@@ -248,7 +374,7 @@ static int bftw_cache_pop(struct bftw_cache *cache) {
 static void bftw_lru_add(struct bftw_cache *cache, struct bftw_file *file) {
 	bfs_assert(file->fd >= 0);
 
-	LIST_INSERT(cache, cache->target, file, lru);
+	LIST_INSERT(cache, cache->target, file, info->lru);
 
 	// Prefer to keep the root paths open by keeping them at the head of the list
 	if (file->depth == 0) {
@@ -277,7 +403,7 @@ static int bftw_cache_add(struct bftw_cache *cache, struct bftw_file *file) {
 static void bftw_cache_pin(struct bftw_cache *cache, struct bftw_file *file) {
 	bfs_assert(file->fd >= 0);
 
-	if (file->pincount++ == 0) {
+	if (file->info->pincount++ == 0) {
 		bftw_lru_remove(cache, file);
 	}
 }
@@ -285,9 +411,9 @@ static void bftw_cache_pin(struct bftw_cache *cache, struct bftw_file *file) {
 /** Unpin a cache entry. */
 static void bftw_cache_unpin(struct bftw_cache *cache, struct bftw_file *file) {
 	bfs_assert(file->fd >= 0);
-	bfs_assert(file->pincount > 0);
+	bfs_assert(file->info->pincount > 0);
 
-	if (--file->pincount == 0) {
+	if (--file->info->pincount == 0) {
 		bftw_lru_add(cache, file);
 	}
 }
@@ -308,7 +434,11 @@ static void bftw_cache_destroy(struct bftw_cache *cache) {
 	bfs_assert(!cache->target);
 
 	varena_destroy(&cache->files);
+	arena_destroy(&cache->fdinfos);
 	arena_destroy(&cache->dirs);
+	arena_destroy(&cache->stat_bufs);
+	arena_destroy(&cache->xattr_bufs);
+	arena_destroy(&cache->jobs);
 }
 
 /** Create a new bftw_file. */
@@ -334,28 +464,59 @@ static struct bftw_file *bftw_file_new(struct bftw_cache *cache, struct bftw_fil
 
 	file->next = NULL;
 	file->to_read.next = NULL;
-	file->lru.prev = file->lru.next = NULL;
+	file->info = NULL;
 
 	file->refcount = 1;
-	file->pincount = 0;
-	file->fd = -1;
-	file->ioqueued = false;
-	file->dir = NULL;
+	file->statbuf = NULL;
+	file->xattrs = NULL;
+	file->target = NULL;
 
-	file->type = BFS_UNKNOWN;
 	file->dev = -1;
 	file->ino = -1;
 
+	file->fd = -1;
+	file->type = BFS_UNKNOWN;
+	file->statflags = 0;
+	file->staterror = 0;
+	file->filtered = -1;
+	file->ioqueued = 0;
+	file->empty = false;
+	file->listing = NULL;
+
 	file->namelen = namelen;
 	memcpy(file->name, name, namelen + 1);
 
 	return file;
 }
 
+/** Get the open directory for a bftw_file, if any. */
+static struct bfs_dir *bftw_file_dir(const struct bftw_file *file) {
+	return file->info ? file->info->dir : NULL;
+}
+
+/** Make sure a bftw_file has room for its open file state. */
+static int bftw_file_reserve(struct bftw_cache *cache, struct bftw_file *file) {
+	if (file->info) {
+		return 0;
+	}
+
+	struct bftw_fdinfo *info = arena_alloc(&cache->fdinfos);
+	if (!info) {
+		return -1;
+	}
+
+	info->lru.prev = info->lru.next = NULL;
+	info->pincount = 0;
+	info->dir = NULL;
+	file->info = info;
+	return 0;
+}
+
 /** Associate an open directory with a bftw_file. */
 static void bftw_file_set_dir(struct bftw_cache *cache, struct bftw_file *file, struct bfs_dir *dir) {
-	bfs_assert(!file->dir);
-	file->dir = dir;
+	bfs_assert(file->info);
+	bfs_assert(!file->info->dir);
+	file->info->dir = dir;
 
 	if (file->fd >= 0) {
 		bfs_assert(file->fd == bfs_dirfd(dir));
@@ -375,1300 +536,4728 @@ static void bftw_file_free(struct bftw_cache *cache, struct bftw_file *file) {
 		bftw_file_close(cache, file);
 	}
 
-	varena_free(&cache->files, file, file->namelen + 1);
-}
-
-/**
- * Holds the current state of the bftw() traversal.
- */
-struct bftw_state {
-	/** bftw() callback. */
-	bftw_callback *callback;
-	/** bftw() callback data. */
-	void *ptr;
-	/** bftw() flags. */
-	enum bftw_flags flags;
-	/** Search strategy. */
-	enum bftw_strategy strategy;
-	/** The mount table. */
-	const struct bfs_mtab *mtab;
-
-	/** The appropriate errno value, if any. */
-	int error;
-
-	/** The cache of open directories. */
-	struct bftw_cache cache;
+	if (file->info) {
+		arena_free(&cache->fdinfos, file->info);
+	}
 
-	/** The async I/O queue. */
-	struct ioq *ioq;
-	/** The number of I/O threads. */
-	size_t nthreads;
+	if (file->statbuf) {
+		arena_free(&cache->stat_bufs, file->statbuf);
+	}
 
-	/** The queue of directories to open. */
-	struct bftw_list to_open;
-	/** The queue of directories to read. */
-	struct bftw_list to_read;
-	/** The queue of unpinned directories to unwrap. */
-	struct bftw_list to_close;
-	/** Available capacity in to_read. */
-	size_t dirlimit;
+	if (file->xattrs) {
+		arena_free(&cache->xattr_bufs, file->xattrs);
+	}
 
-	/** The queue of files to visit. */
-	struct bftw_list to_visit;
-	/** A batch of files to enqueue. */
-	struct bftw_list batch;
+	free(file->target);
+	varena_free(&cache->files, file, file->namelen + 1);
+}
 
-	/** The current path. */
-	char *path;
-	/** The current file. */
-	struct bftw_file *file;
-	/** The previous file. */
-	struct bftw_file *previous;
+/** How many bytes of spilled records to buffer before writing them out. */
+#define BFTW_SPILL_BUFSIZE (64 << 10)
 
-	/** The currently open directory. */
-	struct bfs_dir *dir;
-	/** The current directory entry. */
-	struct bfs_dirent *de;
-	/** Storage for the directory entry. */
-	struct bfs_dirent de_storage;
-	/** Any error encountered while reading the directory. */
-	int direrror;
+/**
+ * A spilled bftw_file record, followed by its NUL-terminated name.
+ */
+struct bftw_spill_ent {
+	/** The parent directory, which is kept referenced for this record. */
+	struct bftw_file *parent;
+	/** The device number. */
+	dev_t dev;
+	/** The inode number. */
+	ino_t ino;
+	/** The length of the name. */
+	size_t namelen;
+};
 
-	/** Extra data about the current file. */
-	struct BFTW ftwbuf;
+/**
+ * A FIFO of directories spilled to a temporary file.
+ */
+struct bftw_spill {
+	/** The temporary file, or -1 if it hasn't been created. */
+	int fd;
+	/** Whether creating the temporary file failed. */
+	bool failed;
+	/** The number of records not yet read back. */
+	size_t count;
+
+	/** Records not yet written to the file. */
+	char *wbuf;
+	/** The number of bytes written to the file. */
+	off_t wpos;
+
+	/** Records read from the file. */
+	char *rbuf;
+	/** The offset of the next record in rbuf. */
+	size_t rhead;
+	/** The number of bytes read from the file. */
+	off_t rpos;
 };
 
-/** Initialize the bftw() state. */
-static int bftw_state_init(struct bftw_state *state, const struct bftw_args *args) {
-	state->callback = args->callback;
-	state->ptr = args->ptr;
-	state->flags = args->flags;
-	state->strategy = args->strategy;
-	state->mtab = args->mtab;
+/** Initialize a spill queue. */
+static void bftw_spill_init(struct bftw_spill *spill) {
+	spill->fd = -1;
+	spill->failed = false;
+	spill->count = 0;
+	spill->wbuf = NULL;
+	spill->wpos = 0;
+	spill->rbuf = NULL;
+	spill->rhead = 0;
+	spill->rpos = 0;
+}
 
-	if ((state->flags & BFTW_SORT) || state->strategy == BFTW_DFS) {
-		state->flags |= BFTW_BUFFER;
+/** Create the temporary file for a spill queue. */
+static int bftw_spill_open(struct bftw_spill *spill) {
+	const char *tmpdir = getenv("TMPDIR");
+	if (!tmpdir || !tmpdir[0]) {
+		tmpdir = "/tmp";
 	}
 
-	state->error = 0;
-
-	if (args->nopenfd < 1) {
-		errno = EMFILE;
+	char *path = dstrprintf("%s/bfs-spill.XXXXXX", tmpdir);
+	if (!path) {
 		return -1;
 	}
-	bftw_cache_init(&state->cache, args->nopenfd);
 
-	state->nthreads = args->nthreads;
-	if (state->nthreads > 0) {
-		state->ioq = ioq_create(4096, state->nthreads);
-		if (!state->ioq) {
-			return -1;
-		}
-	} else {
-		state->ioq = NULL;
+	// Nobody else needs to see the file, so unlink it right away
+	int fd = mkstemp(path);
+	if (fd >= 0) {
+		unlink(path);
+	}
+	dstrfree(path);
+	if (fd < 0) {
+		return -1;
 	}
 
-	SLIST_INIT(&state->to_open);
-	SLIST_INIT(&state->to_read);
-	SLIST_INIT(&state->to_close);
+	if (fcntl(fd, F_SETFD, FD_CLOEXEC) != 0) {
+		goto fail;
+	}
 
-	size_t dirlimit = args->nopenfd - 1;
-	if (dirlimit > 1024) {
-		dirlimit = 1024;
+	spill->wbuf = dstralloc(BFTW_SPILL_BUFSIZE);
+	spill->rbuf = dstralloc(BFTW_SPILL_BUFSIZE);
+	if (!spill->wbuf || !spill->rbuf) {
+		goto fail;
 	}
-	state->dirlimit = dirlimit;
 
-	SLIST_INIT(&state->to_visit);
-	SLIST_INIT(&state->batch);
+	spill->fd = fd;
+	return 0;
 
-	state->path = NULL;
-	state->file = NULL;
-	state->previous = NULL;
+fail:
+	close_quietly(fd);
+	dstrfree(spill->rbuf);
+	spill->rbuf = NULL;
+	dstrfree(spill->wbuf);
+	spill->wbuf = NULL;
+	return -1;
+}
 
-	state->dir = NULL;
-	state->de = NULL;
-	state->direrror = 0;
+/** Write out the buffered records. */
+static int bftw_spill_flush(struct bftw_spill *spill) {
+	size_t len = dstrlen(spill->wbuf);
+	size_t ret = xwrite(spill->fd, spill->wbuf, len);
+	spill->wpos += ret;
 
-	return 0;
+	// Keep anything that didn't make it, even part of a record, to try again later
+	memmove(spill->wbuf, spill->wbuf + ret, len - ret);
+	dstresize(&spill->wbuf, len - ret);
+	return ret == len ? 0 : -1;
 }
 
-/** Pop a response from the I/O queue. */
-static int bftw_ioq_pop(struct bftw_state *state, bool block) {
-	struct ioq *ioq = state->ioq;
-	if (!ioq) {
+/** Append a file to a spill queue. */
+static int bftw_spill_push(struct bftw_spill *spill, const struct bftw_file *file) {
+	struct bftw_spill_ent ent = {
+		.parent = file->parent,
+		.dev = file->dev,
+		.ino = file->ino,
+		.namelen = file->namelen,
+	};
+
+	size_t len = dstrlen(spill->wbuf);
+	if (dstresize(&spill->wbuf, len + sizeof(ent) + ent.namelen + 1) != 0) {
 		return -1;
 	}
+	memcpy(spill->wbuf + len, &ent, sizeof(ent));
+	memcpy(spill->wbuf + len + sizeof(ent), file->name, ent.namelen + 1);
+	++spill->count;
 
-	struct ioq_ent *ent = block ? ioq_pop(ioq) : ioq_trypop(ioq);
-	if (!ent) {
-		return -1;
+	if (dstrlen(spill->wbuf) >= BFTW_SPILL_BUFSIZE) {
+		// Failure is okay, the records just stay buffered
+		bftw_spill_flush(spill);
 	}
 
-	struct bftw_cache *cache = &state->cache;
-	struct bftw_file *file;
-	struct bftw_file *parent;
-	struct bfs_dir *dir;
-
-	enum ioq_op op = ent->op;
-	switch (op) {
-	case IOQ_CLOSE:
-		++cache->capacity;
-		break;
-
-	case IOQ_CLOSEDIR:
-		++cache->capacity;
-		dir = ent->closedir.dir;
-		bftw_freedir(cache, dir);
-		break;
-
-	case IOQ_OPENDIR:
-		file = ent->ptr;
-		file->ioqueued = false;
+	return 0;
+}
 
-		++cache->capacity;
-		parent = file->parent;
-		if (parent) {
-			bftw_cache_unpin(cache, parent);
-			if (parent->pincount == 0 && parent->dir) {
-				SLIST_APPEND(&state->to_close, parent);
-			}
+/** Read more records into the read buffer. */
+static int bftw_spill_read(struct bftw_spill *spill) {
+	// Discard the records that were already consumed
+	size_t len = dstrlen(spill->rbuf) - spill->rhead;
+	memmove(spill->rbuf, spill->rbuf + spill->rhead, len);
+	dstresize(&spill->rbuf, len);
+	spill->rhead = 0;
+
+	if (spill->rpos == spill->wpos) {
+		// The rest of the records haven't been written out yet
+		if (dstrlen(spill->wbuf) == 0) {
+			errno = EIO;
+			return -1;
 		}
-
-		dir = ent->opendir.dir;
-		if (ent->ret == 0) {
-			bftw_file_set_dir(cache, file, dir);
-		} else {
-			bftw_freedir(cache, dir);
-			++state->dirlimit;
+		if (dstrdcat(&spill->rbuf, spill->wbuf) != 0) {
+			return -1;
 		}
+		dstresize(&spill->wbuf, 0);
 
-		if (!(state->flags & BFTW_SORT)) {
-			SLIST_APPEND(&state->to_read, file, to_read);
+		// The file is empty now, so start over to reclaim the space
+		if (ftruncate(spill->fd, 0) == 0 && lseek(spill->fd, 0, SEEK_SET) == 0) {
+			spill->rpos = spill->wpos = 0;
 		}
-		break;
+		return 0;
 	}
 
-	ioq_free(ioq, ent);
-	return op;
-}
-
-/** Try to reserve space in the I/O queue. */
-static int bftw_ioq_reserve(struct bftw_state *state) {
-	struct ioq *ioq = state->ioq;
-	if (!ioq) {
+	size_t size = BFTW_SPILL_BUFSIZE;
+	if ((off_t)size > spill->wpos - spill->rpos) {
+		size = spill->wpos - spill->rpos;
+	}
+	if (dstresize(&spill->rbuf, len + size) != 0) {
 		return -1;
 	}
 
-	if (ioq_capacity(ioq) > 0) {
-		return 0;
-	}
+	ssize_t ret;
+	do {
+		ret = pread(spill->fd, spill->rbuf + len, size, spill->rpos);
+	} while (ret < 0 && errno == EINTR);
 
-	// With more than two threads, it is faster to wait for an I/O operation
-	// to complete than it is to do it ourselves
-	bool block = state->nthreads > 2;
-	if (bftw_ioq_pop(state, block) < 0) {
+	if (ret <= 0) {
+		dstresize(&spill->rbuf, len);
+		if (ret == 0) {
+			errno = EIO;
+		}
 		return -1;
 	}
 
+	dstresize(&spill->rbuf, len + ret);
+	spill->rpos += ret;
 	return 0;
 }
 
-/** Try to reserve space in the cache. */
-static int bftw_cache_reserve(struct bftw_state *state) {
-	struct bftw_cache *cache = &state->cache;
-	if (cache->capacity > 0) {
-		return 0;
-	}
+/**
+ * Get the next record from a spill queue, without removing it.
+ *
+ * @return
+ *         The name of the spilled file, or NULL on error.
+ */
+static const char *bftw_spill_peek(struct bftw_spill *spill, struct bftw_spill_ent *ent) {
+	bfs_assert(spill->count > 0);
 
-	while (bftw_ioq_pop(state, true) >= 0) {
-		if (cache->capacity > 0) {
-			return 0;
+	while (true) {
+		const char *rec = spill->rbuf + spill->rhead;
+		size_t avail = dstrlen(spill->rbuf) - spill->rhead;
+		if (avail >= sizeof(*ent)) {
+			memcpy(ent, rec, sizeof(*ent));
+			if (avail > sizeof(*ent) + ent->namelen) {
+				return rec + sizeof(*ent);
+			}
 		}
-	}
-
-	if (bftw_cache_pop(cache) != 0) {
-		errno = EMFILE;
-		return -1;
-	}
-
-	bfs_assert(cache->capacity > 0);
-	return 0;
-}
-
-/** Open a bftw_file relative to another one. */
-static int bftw_file_openat(struct bftw_state *state, struct bftw_file *file, struct bftw_file *base, const char *at_path) {
-	bfs_assert(file->fd < 0);
-
-	struct bftw_cache *cache = &state->cache;
-
-	int at_fd = AT_FDCWD;
-	if (base) {
-		bftw_cache_pin(cache, base);
-		at_fd = base->fd;
-	}
-
-	int fd = -1;
-	if (bftw_cache_reserve(state) != 0) {
-		goto unpin;
-	}
-
-	int flags = O_RDONLY | O_CLOEXEC | O_DIRECTORY;
-	fd = openat(at_fd, at_path, flags);
 
-	if (fd < 0 && errno == EMFILE) {
-		if (bftw_cache_pop(cache) == 0) {
-			fd = openat(at_fd, at_path, flags);
+		if (bftw_spill_read(spill) != 0) {
+			return NULL;
 		}
-		cache->capacity = 1;
 	}
+}
 
-unpin:
-	if (base) {
-		bftw_cache_unpin(cache, base);
-	}
+/** Remove the record returned by bftw_spill_peek(). */
+static void bftw_spill_pop(struct bftw_spill *spill, const struct bftw_spill_ent *ent) {
+	spill->rhead += sizeof(*ent) + ent->namelen + 1;
+	--spill->count;
+}
 
-	if (fd >= 0) {
-		file->fd = fd;
-		bftw_cache_add(cache, file);
+/** Destroy a spill queue. */
+static void bftw_spill_destroy(struct bftw_spill *spill) {
+	if (spill->fd >= 0) {
+		xclose(spill->fd);
 	}
-
-	return fd;
+	dstrfree(spill->rbuf);
+	dstrfree(spill->wbuf);
 }
 
-/** Open a bftw_file. */
-static int bftw_file_open(struct bftw_state *state, struct bftw_file *file, const char *path) {
-	// Find the nearest open ancestor
-	struct bftw_file *base = file;
-	do {
-		base = base->parent;
-	} while (base && base->fd < 0);
+/** A saved directory entry. */
+struct bftw_listing_ent {
+	/** The inode number. */
+	ino_t ino;
+	/** The offset of the name in bftw_listing::names. */
+	size_t name;
+	/** The file type. */
+	enum bfs_type type;
+};
 
-	const char *at_path = path;
-	if (base) {
-		at_path += bftw_child_nameoff(base);
-	}
+/**
+ * A directory listing saved by one iterative deepening pass for the next.
+ */
+struct bftw_listing {
+	/** The modification time of the directory when it was read. */
+	struct timespec mtime;
+	/** The status change time of the directory when it was read. */
+	struct timespec ctime;
+	/** The entries (a darray). */
+	struct bftw_listing_ent *ents;
+	/** The names of the entries, each NUL-terminated (a dstring). */
+	char *names;
+};
 
-	int fd = bftw_file_openat(state, file, base, at_path);
-	if (fd >= 0 || errno != ENAMETOOLONG) {
-		return fd;
-	}
+/** The identity of a directory with a saved listing. */
+struct bftw_listing_key {
+	dev_t dev;
+	ino_t ino;
+};
 
-	// Handle ENAMETOOLONG by manually traversing the path component-by-component
-	struct bftw_list parents;
-	SLIST_INIT(&parents);
+/** The most memory to use for saved listings. */
+#define BFTW_LISTINGS_MAX (32 << 20)
 
-	struct bftw_file *cur;
-	for (cur = file; cur != base; cur = cur->parent) {
-		SLIST_PREPEND(&parents, cur);
-	}
+/**
+ * Directory listings saved across iterative deepening passes.  Every pass
+ * re-reads all the shallower directories, so answering them from memory saves
+ * most of the I/O when the top few levels are large.  Listings are kept until
+ * the memory limit is reached, which naturally favours the shallowest (most
+ * often repeated) levels, and each one is only trusted as long as the
+ * directory's timestamps are unchanged.
+ */
+struct bftw_listings {
+	/** Maps bftw_listing_keys to bftw_listings. */
+	struct trie dirs;
+	/** The memory still available for listings. */
+	size_t budget;
+	/** When the search started. */
+	struct timespec start;
+	/** The listing being recorded, if any. */
+	struct bftw_listing *current;
+	/** The key for the current listing. */
+	struct bftw_listing_key key;
+};
 
-	while ((cur = SLIST_POP(&parents))) {
-		if (!cur->parent || cur->parent->fd >= 0) {
-			bftw_file_openat(state, cur, cur->parent, cur->name);
-		}
-	}
+/** Initialize a set of saved listings. */
+static void bftw_listings_init(struct bftw_listings *listings) {
+	trie_init(&listings->dirs);
+	listings->budget = BFTW_LISTINGS_MAX;
+	listings->current = NULL;
 
-	return file->fd;
+	if (xgettime(&listings->start) != 0) {
+		// Without a start time, nothing can be trusted
+		listings->budget = 0;
+	}
 }
 
-/** Close a directory, asynchronously if possible. */
-static int bftw_ioq_closedir(struct bftw_state *state, struct bfs_dir *dir) {
-	if (bftw_ioq_reserve(state) == 0) {
-		if (ioq_closedir(state->ioq, dir, NULL) == 0) {
-			return 0;
-		}
+/** Free a saved listing. */
+static void bftw_listing_free(struct bftw_listing *listing) {
+	if (listing) {
+		dstrfree(listing->names);
+		darray_free(listing->ents);
+		free(listing);
 	}
-
-	struct bftw_cache *cache = &state->cache;
-	int ret = bfs_closedir(dir);
-	bftw_freedir(cache, dir);
-	++cache->capacity;
-	return ret;
 }
 
-/** Close a file descriptor, asynchronously if possible. */
-static int bftw_ioq_close(struct bftw_state *state, int fd) {
-	if (bftw_ioq_reserve(state) == 0) {
-		if (ioq_close(state->ioq, fd, NULL) == 0) {
-			return 0;
-		}
-	}
+/** The memory used by a saved listing. */
+static size_t bftw_listing_size(const struct bftw_listing *listing) {
+	return sizeof(*listing)
+		+ darray_length(listing->ents) * sizeof(*listing->ents)
+		+ dstrlen(listing->names);
+}
 
-	struct bftw_cache *cache = &state->cache;
-	int ret = xclose(fd);
-	++cache->capacity;
-	return ret;
+/** Fill in the key for a directory. */
+static void bftw_listing_key(struct bftw_listing_key *key, const struct bfs_stat *statbuf) {
+	// Make sure any padding is zeroed, since the whole key is compared
+	memset(key, 0, sizeof(*key));
+	key->dev = statbuf->dev;
+	key->ino = statbuf->ino;
 }
 
-/** Close a file, asynchronously if possible. */
-static int bftw_close(struct bftw_state *state, struct bftw_file *file) {
-	bfs_assert(file->fd >= 0);
-	bfs_assert(file->pincount == 0);
+/** The bfs_stat() fields needed to save and check listings. */
+#define BFTW_LISTING_FIELDS (BFS_STAT_DEV | BFS_STAT_INO | BFS_STAT_MTIME | BFS_STAT_CTIME)
 
-	struct bfs_dir *dir = file->dir;
-	int fd = file->fd;
+/** Check if two timestamps are equal. */
+static bool bftw_timespec_eq(const struct timespec *lhs, const struct timespec *rhs) {
+	return lhs->tv_sec == rhs->tv_sec && lhs->tv_nsec == rhs->tv_nsec;
+}
 
-	bftw_lru_remove(&state->cache, file);
-	file->dir = NULL;
-	file->fd = -1;
+/** Find an up-to-date saved listing for a directory. */
+static const struct bftw_listing *bftw_listings_find(const struct bftw_listings *listings, const struct bfs_stat *statbuf) {
+	if ((statbuf->mask & BFTW_LISTING_FIELDS) != BFTW_LISTING_FIELDS) {
+		return NULL;
+	}
 
-	if (dir) {
-		return bftw_ioq_closedir(state, dir);
-	} else {
-		return bftw_ioq_close(state, fd);
+	struct bftw_listing_key key;
+	bftw_listing_key(&key, statbuf);
+	const struct trie_leaf *leaf = trie_find_mem(&listings->dirs, &key, sizeof(key));
+	if (!leaf) {
+		return NULL;
 	}
-}
 
-/** Free an open directory. */
-static int bftw_unwrapdir(struct bftw_state *state, struct bftw_file *file) {
-	struct bfs_dir *dir = file->dir;
-	if (!dir) {
-		return 0;
+	const struct bftw_listing *listing = leaf->value;
+	if (!bftw_timespec_eq(&listing->mtime, &statbuf->mtime) || !bftw_timespec_eq(&listing->ctime, &statbuf->ctime)) {
+		return NULL;
 	}
 
-	struct bftw_cache *cache = &state->cache;
+	return listing;
+}
 
-	// Try to keep an open fd if any children exist
-	bool reffed = file->refcount > 1;
-	// Keep the fd the same if it's pinned
-	bool pinned = file->pincount > 0;
+/** Start recording the listing of a directory. */
+static void bftw_listings_begin(struct bftw_listings *listings, const struct bfs_stat *statbuf) {
+	bfs_assert(!listings->current);
 
-#if BFS_USE_UNWRAPDIR
-	if (reffed || pinned) {
-		bfs_unwrapdir(dir);
-		bftw_freedir(cache, dir);
-		file->dir = NULL;
-		return 0;
-	}
-#else
-	if (pinned) {
-		return -1;
+	if ((statbuf->mask & BFTW_LISTING_FIELDS) != BFTW_LISTING_FIELDS) {
+		return;
 	}
-#endif
 
-	if (!reffed) {
-		return bftw_close(state, file);
+	// A directory modified in the same second as our search began could
+	// change again without its timestamps changing, so don't trust it
+	time_t start = listings->start.tv_sec;
+	if (statbuf->mtime.tv_sec >= start || statbuf->ctime.tv_sec >= start) {
+		return;
 	}
 
-	if (bftw_cache_reserve(state) != 0) {
-		return -1;
+	struct bftw_listing *listing = ALLOC(struct bftw_listing);
+	if (!listing) {
+		return;
 	}
 
-	int fd = dup_cloexec(file->fd);
-	if (fd < 0) {
-		return -1;
+	listing->names = dstralloc(0);
+	if (!listing->names) {
+		free(listing);
+		return;
 	}
-	--cache->capacity;
 
-	file->dir = NULL;
-	file->fd = fd;
-	return bftw_ioq_closedir(state, dir);
+	listing->mtime = statbuf->mtime;
+	listing->ctime = statbuf->ctime;
+	listing->ents = NULL;
+
+	listings->current = listing;
+	bftw_listing_key(&listings->key, statbuf);
 }
 
-/** Open a directory asynchronously. */
-static int bftw_ioq_opendir(struct bftw_state *state, struct bftw_file *file) {
-	if (state->dirlimit == 0) {
-		goto fail;
+/** Finish recording the current listing. */
+static void bftw_listings_end(struct bftw_listings *listings, bool complete) {
+	struct bftw_listing *listing = listings->current;
+	if (!listing) {
+		return;
 	}
+	listings->current = NULL;
 
-	if (bftw_ioq_reserve(state) != 0) {
+	size_t size = bftw_listing_size(listing);
+	if (!complete || size > listings->budget) {
 		goto fail;
 	}
 
-	int dfd = AT_FDCWD;
-	struct bftw_cache *cache = &state->cache;
-	struct bftw_file *parent = file->parent;
-	if (parent) {
-		dfd = parent->fd;
-		if (dfd < 0) {
-			goto fail;
-		}
-		bftw_cache_pin(cache, parent);
-	}
-
-	if (bftw_cache_reserve(state) != 0) {
-		goto unpin;
-	}
-
-	struct bfs_dir *dir = bftw_allocdir(cache);
-	if (!dir) {
-		goto unpin;
+	struct trie_leaf *leaf = trie_insert_mem(&listings->dirs, &listings->key, sizeof(listings->key));
+	if (!leaf) {
+		goto fail;
 	}
 
-	if (ioq_opendir(state->ioq, dir, dfd, file->name, file) != 0) {
-		goto free;
+	// Replace any stale listing for the same directory
+	struct bftw_listing *old = leaf->value;
+	if (old) {
+		listings->budget += bftw_listing_size(old);
+		bftw_listing_free(old);
 	}
 
-	file->ioqueued = true;
-	--cache->capacity;
-	--state->dirlimit;
-	return 0;
+	leaf->value = listing;
+	listings->budget -= size;
+	return;
 
-free:
-	bftw_freedir(cache, dir);
-unpin:
-	if (parent) {
-		bftw_cache_unpin(cache, parent);
-	}
 fail:
-	return -1;
+	bftw_listing_free(listing);
 }
 
-/** Push a directory onto the queue. */
-static void bftw_push_dir(struct bftw_state *state, struct bftw_file *file) {
-	bfs_assert(file->type == BFS_DIR);
+/** Record an entry of the current listing. */
+static void bftw_listings_add(struct bftw_listings *listings, const struct bfs_dirent *de) {
+	struct bftw_listing *listing = listings->current;
+	if (!listing) {
+		return;
+	}
 
-	SLIST_APPEND(&state->to_open, file);
+	struct bftw_listing_ent ent = {
+		.ino = de->ino,
+		.name = dstrlen(listing->names),
+		.type = de->type,
+	};
 
-	if (state->flags & BFTW_SORT) {
-		// When sorting, directories are kept in order on the to_read
-		// list; otherwise, they are only added once they are open
-		SLIST_APPEND(&state->to_read, file, to_read);
+	if (dstrxcat(&listing->names, de->name, strlen(de->name) + 1) != 0) {
+		goto fail;
 	}
-
-	while (state->to_open.head) {
-		if (bftw_ioq_opendir(state, state->to_open.head) == 0) {
-			SLIST_POP(&state->to_open);
-		} else {
-			break;
-		}
+	if (DARRAY_PUSH(&listing->ents, &ent) != 0) {
+		goto fail;
 	}
-}
 
-/** Pop a directory to read from the queue. */
-static bool bftw_pop_dir(struct bftw_state *state) {
-	bfs_assert(!state->file);
+	// Give up early on directories too big to keep
+	if (bftw_listing_size(listing) > listings->budget) {
+		goto fail;
+	}
 
-	bool have_files = state->to_visit.head;
+	return;
 
-	if (state->flags & BFTW_SORT) {
-		// Keep strict breadth-first order when sorting
-		if (state->strategy != BFTW_DFS && have_files) {
-			return false;
-		}
-	} else {
-		while (!state->to_read.head) {
-			// Block if we have no other files/dirs to visit, or no room in the cache
-			bool have_dirs = state->to_open.head;
-			bool have_room = state->cache.capacity > 0;
-			bool block = !(have_dirs || have_files) || !have_room;
+fail:
+	bftw_listings_end(listings, false);
+}
 
-			if (bftw_ioq_pop(state, block) < 0) {
-				break;
-			}
-		}
+/** Read the next entry from a saved listing. */
+static int bftw_listing_read(const struct bftw_listing *listing, size_t *pos, struct bfs_dirent *de) {
+	if (*pos >= darray_length(listing->ents)) {
+		return 0;
 	}
 
-	struct bftw_file *file = SLIST_POP(&state->to_read, to_read);
-	if (!file || file == state->to_open.head) {
-		file = SLIST_POP(&state->to_open);
-	}
-	if (!file) {
-		return false;
-	}
+	const struct bftw_listing_ent *ent = &listing->ents[(*pos)++];
+	de->type = ent->type;
+	de->ino = ent->ino;
+	de->name = listing->names + ent->name;
+	return 1;
+}
 
-	if (file->dir) {
-		++state->dirlimit;
-	}
+/** Destroy a set of saved listings. */
+static void bftw_listings_destroy(struct bftw_listings *listings) {
+	bftw_listing_free(listings->current);
 
-	while (file->ioqueued) {
-		bftw_ioq_pop(state, true);
+	TRIE_FOR_EACH(&listings->dirs, leaf) {
+		bftw_listing_free(leaf->value);
 	}
-
-	state->file = file;
-	return true;
+	trie_destroy(&listings->dirs);
 }
 
-/** Pop a file to visit from the queue. */
-static bool bftw_pop_file(struct bftw_state *state) {
-	bfs_assert(!state->file);
-	state->file = SLIST_POP(&state->to_visit);
-	return state->file;
+/**
+ * An entry in the array used by bftw_batch_sort().
+ */
+struct bftw_sort_ent {
+	/** The key to compare. */
+	const char *key;
+	/** The offset of the key in sort_keys (which may move while filling). */
+	size_t offset;
+	/** The original position, to keep the sort stable. */
+	size_t index;
+	/** The file itself. */
+	struct bftw_file *file;
+};
+
+/**
+ * Whether a device reports the same inode numbers from readdir() as stat().
+ */
+struct bftw_devino {
+	/** The device number. */
+	dev_t dev;
+	/** Whether d_ino can stand in for st_ino. */
+	bool trusted;
+};
+
+/**
+ * The outstanding background I/O to one device.
+ */
+struct bftw_devq {
+	/** The device number. */
+	dev_t dev;
+	/** The maximum number of outstanding requests. */
+	size_t limit;
+	/** The number of outstanding requests. */
+	size_t queued;
+};
+
+/**
+ * Holds the current state of the bftw() traversal.
+ */
+struct bftw_state {
+	/** bftw() callback. */
+	bftw_callback *callback;
+	/** bftw() callback data. */
+	void *ptr;
+	/** bftw() filter, if enabled. */
+	bftw_filter *filter;
+	/** bftw() batch filter, if any. */
+	bftw_batch_fn *batch_fn;
+	/** Reads more root paths, if any. */
+	bftw_paths_fn *more_paths;
+	/** bftw() flags. */
+	enum bftw_flags flags;
+	/** Search strategy. */
+	enum bftw_strategy strategy;
+	/** The bfs_stat() fields to request. */
+	enum bfs_stat_field stat_fields;
+	/** The mount table. */
+	const struct bfs_mtab *mtab;
+	/** The directory index, if any. */
+	struct bfs_index *index;
+	/** Devices whose readdir() inode numbers match stat() (a darray). */
+	struct bftw_devino *devinos;
+	/** Per-filesystem I/O limits. */
+	const struct bftw_iolimit *iolimits;
+	/** The number of iolimits. */
+	size_t niolimits;
+	/** Outstanding I/O per device, if there are any iolimits (a darray). */
+	struct bftw_devq *devqs;
+	/** Where to publish progress, if anywhere. */
+	struct bftw_progress *progress;
+
+	/** The appropriate errno value, if any. */
+	int error;
+
+	/** The cache of open directories. */
+	struct bftw_cache cache;
+
+	/** The async I/O queue. */
+	struct ioq *ioq;
+	/** The number of I/O threads. */
+	size_t nthreads;
+
+	/** The queue of directories to open. */
+	struct bftw_list to_open;
+	/** The memory used by the files in to_open. */
+	size_t to_open_size;
+	/** The spill_limit for to_open, or 0 for none. */
+	size_t spill_limit;
+	/** The directories spilled from the end of to_open. */
+	struct bftw_spill spill;
+	/** The queue of directories to read. */
+	struct bftw_list to_read;
+	/** The queue of unpinned directories to unwrap. */
+	struct bftw_list to_close;
+	/** The number of directories being opened ahead of time. */
+	size_t dirqueued;
+	/** The current limit on dirqueued, adjusted by bftw_adapt(). */
+	size_t dirlimit;
+	/** The largest allowed dirlimit. */
+	size_t dirmax;
+	/** Directories popped since the last adjustment. */
+	size_t dirpops;
+	/** Times we waited for a directory to open since the last adjustment. */
+	size_t dirstalls;
+	/** Times we hit dirlimit since the last adjustment. */
+	size_t dirfull;
+	/** The cache churn at the last adjustment. */
+	size_t lastchurn;
+
+	/** The queue of files to visit. */
+	struct bftw_list to_visit;
+	/** A batch of files to enqueue. */
+	struct bftw_list batch;
+	/** Files whose background deletions have completed. */
+	struct bftw_list deleted;
+	/** The number of background deletions still in the I/O queue. */
+	size_t unlinking;
+
+	/** Whether names can be sorted with strcmp() rather than strcoll(). */
+	bool sort_bytewise;
+	/** Scratch space for sorting batches. */
+	struct bftw_sort_ent *sort_ents;
+	/** The capacity of sort_ents. */
+	size_t sort_cap;
+	/** Storage for strxfrm() keys. */
+	char *sort_keys;
+	/** The capacity of sort_keys. */
+	size_t sort_keys_cap;
+
+	/** Scratch arrays for the batch filter, all in one allocation. */
+	ino_t *batch_inos;
+	/** The names of the batch entries. */
+	const char **batch_names;
+	/** The lengths of the batch entry names. */
+	size_t *batch_lengths;
+	/** The types of the batch entries. */
+	enum bfs_type *batch_types;
+	/** Whether to visit each batch entry. */
+	bool *batch_visit;
+	/** The capacity of the batch arrays. */
+	size_t batch_cap;
+
+	/** The current path. */
+	char *path;
+	/** The current file. */
+	struct bftw_file *file;
+	/** The previous file. */
+	struct bftw_file *previous;
+
+	/** The currently open directory. */
+	struct bfs_dir *dir;
+	/** The current directory entry. */
+	struct bfs_dirent *de;
+	/** Storage for the directory entry. */
+	struct bfs_dirent de_storage;
+	/** Any error encountered while reading the directory. */
+	int direrror;
+	/** Whether any entries have been read from the current directory. */
+	bool dirents;
+	/** A spare buffer for reading ahead in the current directory. */
+	struct bfs_dir *ahead;
+	/** Whether we are reading ahead in the current directory. */
+	bool reading_ahead;
+	/** Whether the read-ahead is still in the I/O queue. */
+	bool ahead_queued;
+	/** Whether the current directory is being read from the index. */
+	bool indexed;
+	/** The indexed listing of the current directory. */
+	struct bfs_index_cursor cursor;
+	/** Listings saved across iterative deepening passes, if any. */
+	struct bftw_listings *listings;
+	/** The saved listing being read instead of the current directory. */
+	const struct bftw_listing *listing;
+	/** The position in the saved listing. */
+	size_t listpos;
+
+	/** Extra data about the current file. */
+	struct BFTW ftwbuf;
+	/** The device number of the current file, for cycle detection. */
+	dev_t dev;
+	/** The inode number of the current file, for cycle detection. */
+	ino_t ino;
+	/** The prefetched link target of the current file, if any. */
+	char *target;
+};
+
+/**
+ * A specialization of the traversal loop.  Helpers that take one read the flags
+ * through bftw_spec_flags(), so once they're inlined into a loop with a
+ * constant spec, the tests of any known flags fold away.
+ */
+struct bftw_spec {
+	/** The flags whose values are known. */
+	enum bftw_flags known;
+	/** The known flags that are set. */
+	enum bftw_flags set;
+};
+
+/** The unspecialized loop, which reads every flag from the state. */
+#define BFTW_SPEC_GENERIC ((struct bftw_spec){0})
+
+/** Get the flags for a specialized loop. */
+static inline enum bftw_flags bftw_spec_flags(const struct bftw_state *state, struct bftw_spec spec) {
+	bfs_assert((state->flags & spec.known) == spec.set);
+	return (state->flags & ~spec.known) | spec.set;
+}
+
+/** The initial read-ahead window. */
+#define BFTW_DIRLIMIT_INIT 1024
+/** The smallest read-ahead window that bftw_adapt() will shrink to. */
+#define BFTW_DIRLIMIT_MIN 16
+
+/** Initialize the bftw() state. */
+static int bftw_state_init(struct bftw_state *state, const struct bftw_args *args) {
+	state->callback = args->callback;
+	state->ptr = args->ptr;
+	state->more_paths = args->more_paths;
+	state->flags = args->flags;
+	state->strategy = args->strategy;
+	state->stat_fields = bftw_stat_fields(args);
+	state->mtab = args->mtab;
+	state->index = args->index;
+	state->devinos = NULL;
+	state->target = NULL;
+	state->iolimits = args->iolimits;
+	state->niolimits = args->mtab ? args->niolimits : 0;
+	state->devqs = NULL;
+	state->progress = args->progress;
+
+	if ((state->flags & (BFTW_SORT | BFTW_INO_ORDER)) || state->strategy == BFTW_DFS) {
+		state->flags |= BFTW_BUFFER;
+	}
+
+	enum bftw_flags prefetch = BFTW_STAT | BFTW_XATTRS | BFTW_READLINK | BFTW_STAT_LINKS;
+	if (((state->flags & prefetch) || state->more_paths) && args->nthreads > 0) {
+		// Buffer files so they can be stat()ed in the I/O queue
+		state->flags |= BFTW_BUFFER;
+	}
+
+	state->filter = NULL;
+	if (args->filter && args->nthreads > 0) {
+		// Buffer files so they can be filtered in the I/O queue
+		state->filter = args->filter;
+		state->flags |= BFTW_BUFFER;
+	}
+
+	state->batch_fn = args->batch;
+	if (state->batch_fn) {
+		// Each directory's entries are filtered together before visiting
+		state->flags |= BFTW_BUFFER;
+	}
+
+	state->error = 0;
+
+	size_t nopenfd = args->nopenfd;
+	if (nopenfd < 1) {
+		errno = EMFILE;
+		return -1;
+	}
+
+	state->nthreads = args->nthreads;
+	if (state->nthreads > 0) {
+		// Let the I/O queue use a fraction of our fds for itself
+		state->ioq = ioq_create(4096, state->nthreads, nopenfd / 4);
+		if (!state->ioq) {
+			return -1;
+		}
+		if (args->min_threads > 0) {
+			ioq_autotune(state->ioq, args->min_threads);
+		}
+		nopenfd -= ioq_nfds(state->ioq);
+	} else {
+		state->ioq = NULL;
+	}
+
+	state->spill_limit = args->spill_limit;
+	if (state->strategy != BFTW_BFS || (state->flags & BFTW_SORT)) {
+		// Only a plain FIFO queue can be spilled
+		state->spill_limit = 0;
+	}
+	if (state->spill_limit) {
+		// Set aside an fd for the spill file, if we can spare one
+		if (nopenfd > 2) {
+			--nopenfd;
+		} else {
+			state->spill_limit = 0;
+		}
+	}
+	bftw_spill_init(&state->spill);
+
+	bftw_cache_init(&state->cache, nopenfd);
+
+	SLIST_INIT(&state->to_open);
+	state->to_open_size = 0;
+
+	SLIST_INIT(&state->to_read);
+	SLIST_INIT(&state->to_close);
+
+	// Start with a moderate read-ahead window and let bftw_adapt() grow
+	// or shrink it based on how the search is going
+	state->dirqueued = 0;
+	state->dirmax = nopenfd - 1;
+	state->dirlimit = state->dirmax;
+	if (state->dirlimit > BFTW_DIRLIMIT_INIT) {
+		state->dirlimit = BFTW_DIRLIMIT_INIT;
+	}
+	state->dirpops = 0;
+	state->dirstalls = 0;
+	state->dirfull = 0;
+	state->lastchurn = 0;
+
+	SLIST_INIT(&state->to_visit);
+	SLIST_INIT(&state->batch);
+	SLIST_INIT(&state->deleted);
+	state->unlinking = 0;
+
+	// strcoll() is strcmp() in the C locale, so skip strxfrm()
+	const char *collate = setlocale(LC_COLLATE, NULL);
+	state->sort_bytewise = collate && (strcmp(collate, "C") == 0 || strcmp(collate, "POSIX") == 0);
+	state->sort_ents = NULL;
+	state->sort_cap = 0;
+	state->sort_keys = NULL;
+	state->sort_keys_cap = 0;
+
+	state->batch_inos = NULL;
+	state->batch_names = NULL;
+	state->batch_lengths = NULL;
+	state->batch_types = NULL;
+	state->batch_visit = NULL;
+	state->batch_cap = 0;
+
+	state->path = NULL;
+	state->file = NULL;
+	state->previous = NULL;
+
+	state->dir = NULL;
+	state->de = NULL;
+	state->direrror = 0;
+	state->ahead = NULL;
+	state->reading_ahead = false;
+	state->ahead_queued = false;
+	state->indexed = false;
+	state->listings = NULL;
+	state->listing = NULL;
+	state->listpos = 0;
+
+	return 0;
+}
+
+/** Handle a finished filter job. */
+static void bftw_job_finish(struct bftw_state *state, struct bftw_job *job) {
+	struct bftw_cache *cache = &state->cache;
+	struct bftw_file *file = job->file;
+	--file->ioqueued;
+
+	struct bftw_file *parent = file->parent;
+	if (parent) {
+		bftw_cache_unpin(cache, parent);
+		if (parent->info->pincount == 0 && parent->info->dir) {
+			SLIST_APPEND(&state->to_close, parent);
+		}
+	}
+
+	file->filtered = job->result;
+
+	// Keep any stat() info so we don't have to repeat it
+	const struct BFTW *ftwbuf = &job->ftwbuf;
+	const struct bfs_stat *statbuf = bftw_cached_stat(ftwbuf, ftwbuf->stat_flags);
+	if (statbuf) {
+		file->statbuf = arena_alloc(&cache->stat_bufs);
+		if (file->statbuf) {
+			*file->statbuf = *statbuf;
+			file->statflags = ftwbuf->stat_flags;
+		}
+	} else if (job->staterror) {
+		file->staterror = job->staterror;
+		file->statflags = ftwbuf->stat_flags;
+	}
+
+	// Likewise for the extended attribute names
+	const struct bfs_xattrs *xattrs = ftwbuf->xattr_cache.buf;
+	if (xattrs && ftwbuf->type != BFS_LNK) {
+		file->xattrs = arena_alloc(&cache->xattr_bufs);
+		if (file->xattrs) {
+			*file->xattrs = *xattrs;
+		}
+	}
+
+	dstrfree(job->path);
+	arena_free(&cache->jobs, job);
+}
+
+/** Get the device that I/O for a file will go to, or -1 if unknown. */
+static dev_t bftw_io_dev(const struct bftw_file *file) {
+	if (file->dev != (dev_t)-1) {
+		return file->dev;
+	} else if (file->parent) {
+		return file->parent->dev;
+	} else {
+		return -1;
+	}
+}
+
+/** Get the outstanding I/O for a file's device, if it has a limit. */
+static struct bftw_devq *bftw_devq(struct bftw_state *state, const struct bftw_file *file) {
+	if (state->niolimits == 0) {
+		return NULL;
+	}
+
+	dev_t dev = bftw_io_dev(file);
+	if (dev == (dev_t)-1) {
+		return NULL;
+	}
+
+	size_t ndevs = darray_length(state->devqs);
+	for (size_t i = 0; i < ndevs; ++i) {
+		if (state->devqs[i].dev == dev) {
+			return &state->devqs[i];
+		}
+	}
+
+	struct bftw_devq devq = {
+		.dev = dev,
+		.limit = SIZE_MAX,
+		.queued = 0,
+	};
+
+	// Later limits override earlier ones
+	const char *type = bfs_dev_fstype(state->mtab, dev);
+	for (size_t i = 0; type && i < state->niolimits; ++i) {
+		if (strcmp(state->iolimits[i].fstype, type) == 0) {
+			devq.limit = state->iolimits[i].limit;
+		}
+	}
+
+	// Failure is okay, we just won't throttle this device
+	if (DARRAY_PUSH(&state->devqs, &devq) != 0) {
+		return NULL;
+	}
+	return &state->devqs[ndevs];
+}
+
+/** Check if background I/O for a file must wait for its device. */
+static bool bftw_throttled(struct bftw_state *state, const struct bftw_file *file) {
+	const struct bftw_devq *devq = bftw_devq(state, file);
+	return devq && devq->queued >= devq->limit;
+}
+
+/** Record a new background I/O request for a file. */
+static void bftw_devq_push(struct bftw_state *state, const struct bftw_file *file) {
+	struct bftw_devq *devq = bftw_devq(state, file);
+	if (devq) {
+		bfs_assert(devq->queued < devq->limit);
+		++devq->queued;
+	}
+}
+
+/** Record a completed background I/O request for a file. */
+static void bftw_devq_pop(struct bftw_state *state, const struct bftw_file *file) {
+	struct bftw_devq *devq = bftw_devq(state, file);
+	if (devq && devq->queued > 0) {
+		--devq->queued;
+	}
+}
+
+/** Handle a response from the I/O queue. */
+static void bftw_ioq_complete(struct bftw_state *state, struct ioq_ent *ent) {
+	struct bftw_cache *cache = &state->cache;
+	struct bftw_file *file;
+	struct bftw_file *parent;
+	struct bfs_dir *dir;
+
+	switch (ent->op) {
+	case IOQ_CLOSE:
+		++cache->capacity;
+		break;
+
+	case IOQ_CLOSEDIR:
+		++cache->capacity;
+		dir = ent->closedir.dir;
+		bftw_freedir(cache, dir);
+		break;
+
+	case IOQ_OPENDIR:
+		file = ent->ptr;
+		--file->ioqueued;
+		bftw_devq_pop(state, file);
+
+		++cache->capacity;
+		parent = file->parent;
+		if (parent) {
+			bftw_cache_unpin(cache, parent);
+			if (parent->info->pincount == 0 && parent->info->dir) {
+				SLIST_APPEND(&state->to_close, parent);
+			}
+		}
+
+		dir = ent->opendir.dir;
+		if (ent->ret == 0) {
+			bftw_file_set_dir(cache, file, dir);
+		} else {
+			bftw_freedir(cache, dir);
+			--state->dirqueued;
+		}
+
+		if (!(state->flags & BFTW_SORT)) {
+			SLIST_APPEND(&state->to_read, file, to_read);
+		}
+		break;
+
+	case IOQ_READDIR:
+		state->ahead_queued = false;
+		break;
+
+	case IOQ_CALL:
+		bftw_job_finish(state, ent->ptr);
+		break;
+
+	case IOQ_STAT:
+		file = ent->ptr;
+		--file->ioqueued;
+		bftw_devq_pop(state, file);
+
+		parent = file->parent;
+		if (parent) {
+			bftw_cache_unpin(cache, parent);
+			if (parent->info->pincount == 0 && parent->info->dir) {
+				SLIST_APPEND(&state->to_close, parent);
+			}
+		}
+
+		if (ent->ret != 0) {
+			arena_free(&cache->stat_bufs, file->statbuf);
+			file->statbuf = NULL;
+			file->staterror = ent->error;
+		}
+		break;
+
+	case IOQ_READLINK:
+		file = ent->ptr;
+		--file->ioqueued;
+		bftw_devq_pop(state, file);
+
+		parent = file->parent;
+		if (parent) {
+			bftw_cache_unpin(cache, parent);
+			if (parent->info->pincount == 0 && parent->info->dir) {
+				SLIST_APPEND(&state->to_close, parent);
+			}
+		}
+
+		// On failure, let the callback read it again and report the error
+		file->target = ent->readlink.target;
+		break;
+
+	case IOQ_UNLINK:
+		file = ent->ptr;
+		--file->ioqueued;
+		bftw_devq_pop(state, file);
+		--state->unlinking;
+
+		parent = file->parent;
+		bftw_cache_unpin(cache, parent);
+		if (parent->info->pincount == 0 && parent->info->dir) {
+			SLIST_APPEND(&state->to_close, parent);
+		}
+
+		// bftw_reap() will report any error and release the file
+		file->staterror = ent->ret == 0 ? 0 : ent->error;
+		SLIST_APPEND(&state->deleted, file);
+		break;
+
+	case IOQ_XATTRS:
+		file = ent->ptr;
+		--file->ioqueued;
+		bftw_devq_pop(state, file);
+
+		parent = file->parent;
+		if (parent) {
+			bftw_cache_unpin(cache, parent);
+			if (parent->info->pincount == 0 && parent->info->dir) {
+				SLIST_APPEND(&state->to_close, parent);
+			}
+		}
+
+		if (ent->ret != 0) {
+			// Let the callback read them again and report any error
+			arena_free(&cache->xattr_bufs, file->xattrs);
+			file->xattrs = NULL;
+		}
+		break;
+	}
+
+	ioq_free(state->ioq, ent);
+}
+
+/** Pop a batch of responses from the I/O queue. */
+static int bftw_ioq_pop(struct bftw_state *state, bool block) {
+	struct ioq *ioq = state->ioq;
+	if (!ioq) {
+		return -1;
+	}
+
+	struct ioq_ent *batch[64];
+	uint64_t start = trace_ioq_pop_start(block);
+	size_t count = ioq_pop_batch(ioq, batch, countof(batch), block);
+	trace_ioq_pop_stop(start, block);
+	if (count == 0) {
+		return -1;
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		bftw_ioq_complete(state, batch[i]);
+	}
+
+	return count;
+}
+
+/** Submit any buffered I/O requests. */
+static void bftw_ioq_submit(struct bftw_state *state) {
+	if (state->ioq) {
+		ioq_submit_batch(state->ioq);
+	}
+}
+
+/** Try to reserve space in the I/O queue. */
+static int bftw_ioq_reserve(struct bftw_state *state) {
+	struct ioq *ioq = state->ioq;
+	if (!ioq) {
+		return -1;
+	}
+
+	if (ioq_capacity(ioq) > 0) {
+		return 0;
+	}
+
+	// With more than two threads, it is faster to wait for an I/O operation
+	// to complete than it is to do it ourselves
+	bool block = state->nthreads > 2;
+	if (bftw_ioq_pop(state, block) < 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Try to reserve space in the cache. */
+static int bftw_cache_reserve(struct bftw_state *state) {
+	struct bftw_cache *cache = &state->cache;
+	if (cache->capacity > 0) {
+		return 0;
+	}
+
+	while (bftw_ioq_pop(state, true) >= 0) {
+		if (cache->capacity > 0) {
+			return 0;
+		}
+	}
+
+	if (bftw_cache_pop(cache) != 0) {
+		errno = EMFILE;
+		return -1;
+	}
+
+	bfs_assert(cache->capacity > 0);
+	return 0;
+}
+
+/** Open a bftw_file relative to another one. */
+static int bftw_file_openat(struct bftw_state *state, struct bftw_file *file, struct bftw_file *base, const char *at_path) {
+	bfs_assert(file->fd < 0);
+
+	struct bftw_cache *cache = &state->cache;
+
+	int at_fd = AT_FDCWD;
+	if (base) {
+		bftw_cache_pin(cache, base);
+		at_fd = base->fd;
+	}
+
+	int fd = -1;
+	if (bftw_file_reserve(cache, file) != 0) {
+		goto unpin;
+	}
+
+	if (bftw_cache_reserve(state) != 0) {
+		goto unpin;
+	}
+
+	int flags = O_RDONLY | O_CLOEXEC | O_DIRECTORY;
+	uint64_t start = perf_start();
+	fd = openat(at_fd, at_path, flags);
+	perf_stop(PERF_OPEN, start);
+
+	if (fd < 0 && errno == EMFILE) {
+		if (bftw_cache_pop(cache) == 0) {
+			start = perf_start();
+			fd = openat(at_fd, at_path, flags);
+			perf_stop(PERF_OPEN, start);
+		}
+		cache->capacity = 1;
+	}
+
+unpin:
+	if (base) {
+		bftw_cache_unpin(cache, base);
+	}
+
+	if (fd >= 0) {
+		file->fd = fd;
+		bftw_cache_add(cache, file);
+	}
+
+	return fd;
+}
+
+/** Open a bftw_file. */
+static int bftw_file_open(struct bftw_state *state, struct bftw_file *file, const char *path) {
+	// Find the nearest open ancestor
+	struct bftw_file *base = file;
+	do {
+		base = base->parent;
+	} while (base && base->fd < 0);
+
+	// It's a hit if we can open the file relative to its parent
+	if (file->parent) {
+		perf_count(base == file->parent ? PERF_FD_HIT : PERF_FD_MISS, 1);
+	}
+
+	const char *at_path = path;
+	if (base) {
+		at_path += bftw_child_nameoff(base);
+	}
+
+	int fd = bftw_file_openat(state, file, base, at_path);
+	if (fd >= 0 || errno != ENAMETOOLONG) {
+		return fd;
+	}
+
+	// Handle ENAMETOOLONG by manually traversing the path component-by-component
+	struct bftw_list parents;
+	SLIST_INIT(&parents);
+
+	struct bftw_file *cur;
+	for (cur = file; cur != base; cur = cur->parent) {
+		SLIST_PREPEND(&parents, cur);
+	}
+
+	while ((cur = SLIST_POP(&parents))) {
+		if (!cur->parent || cur->parent->fd >= 0) {
+			bftw_file_openat(state, cur, cur->parent, cur->name);
+		}
+	}
+
+	return file->fd;
+}
+
+/** Close a directory, asynchronously if possible. */
+static int bftw_ioq_closedir(struct bftw_state *state, struct bfs_dir *dir) {
+	if (bftw_ioq_reserve(state) == 0) {
+		if (ioq_closedir(state->ioq, dir, NULL) == 0) {
+			return 0;
+		}
+	}
+
+	struct bftw_cache *cache = &state->cache;
+	int ret = bfs_closedir(dir);
+	bftw_freedir(cache, dir);
+	++cache->capacity;
+	return ret;
+}
+
+/** Close a file descriptor, asynchronously if possible. */
+static int bftw_ioq_close(struct bftw_state *state, int fd) {
+	if (bftw_ioq_reserve(state) == 0) {
+		if (ioq_close(state->ioq, fd, NULL) == 0) {
+			return 0;
+		}
+	}
+
+	struct bftw_cache *cache = &state->cache;
+	int ret = xclose(fd);
+	++cache->capacity;
+	return ret;
+}
+
+/** Close a file, asynchronously if possible. */
+static int bftw_close(struct bftw_state *state, struct bftw_file *file) {
+	bfs_assert(file->fd >= 0);
+	bfs_assert(file->info->pincount == 0);
+
+	struct bfs_dir *dir = file->info->dir;
+	int fd = file->fd;
+
+	bftw_lru_remove(&state->cache, file);
+	file->info->dir = NULL;
+	file->fd = -1;
+
+	if (dir) {
+		return bftw_ioq_closedir(state, dir);
+	} else {
+		return bftw_ioq_close(state, fd);
+	}
+}
+
+/** Free an open directory. */
+static int bftw_unwrapdir(struct bftw_state *state, struct bftw_file *file) {
+	struct bfs_dir *dir = bftw_file_dir(file);
+	if (!dir) {
+		return 0;
+	}
+
+	struct bftw_cache *cache = &state->cache;
+
+	// Try to keep an open fd if any children exist
+	bool reffed = file->refcount > 1;
+	// Keep the fd the same if it's pinned
+	bool pinned = file->info->pincount > 0;
+
+#if BFS_USE_UNWRAPDIR
+	if (reffed || pinned) {
+		bfs_unwrapdir(dir);
+		bftw_freedir(cache, dir);
+		file->info->dir = NULL;
+		return 0;
+	}
+#else
+	if (pinned) {
+		return -1;
+	}
+#endif
+
+	if (!reffed) {
+		return bftw_close(state, file);
+	}
+
+	if (bftw_cache_reserve(state) != 0) {
+		return -1;
+	}
+
+	int fd = dup_cloexec(file->fd);
+	if (fd < 0) {
+		return -1;
+	}
+	--cache->capacity;
+
+	file->info->dir = NULL;
+	file->fd = fd;
+	return bftw_ioq_closedir(state, dir);
+}
+
+/** Open a directory asynchronously. */
+static int bftw_ioq_opendir(struct bftw_state *state, struct bftw_file *file) {
+	uint64_t start = trace_ioq_opendir_start(file->depth);
+
+	if (state->dirqueued >= state->dirlimit) {
+		++state->dirfull;
+		goto fail;
+	}
+
+	if (bftw_ioq_reserve(state) != 0) {
+		goto fail;
+	}
+
+	struct bftw_cache *cache = &state->cache;
+	if (bftw_file_reserve(cache, file) != 0) {
+		goto fail;
+	}
+
+	int dfd = AT_FDCWD;
+	struct bftw_file *parent = file->parent;
+	if (parent) {
+		dfd = parent->fd;
+		if (dfd < 0) {
+			goto fail;
+		}
+		bftw_cache_pin(cache, parent);
+	}
+
+	if (bftw_cache_reserve(state) != 0) {
+		goto unpin;
+	}
+
+	struct bfs_dir *dir = bftw_allocdir(cache);
+	if (!dir) {
+		goto unpin;
+	}
+
+	// With an index, the directory may not need to be read at all
+	bool poll = !state->index;
+	if (ioq_opendir(state->ioq, dir, dfd, file->name, poll, file) != 0) {
+		goto free;
+	}
+
+	++file->ioqueued;
+	--cache->capacity;
+	++state->dirqueued;
+	bftw_devq_push(state, file);
+	trace_ioq_opendir_stop(start, file->depth);
+	return 0;
+
+free:
+	bftw_freedir(cache, dir);
+unpin:
+	if (parent) {
+		bftw_cache_unpin(cache, parent);
+	}
+fail:
+	trace_ioq_opendir_stop(start, file->depth);
+	return -1;
+}
+
+/** The memory used by a queued bftw_file. */
+static size_t bftw_queued_size(const struct bftw_file *file) {
+	return sizeof(*file) + file->namelen + 1;
+}
+
+/** Add a directory to the end of to_open. */
+static void bftw_append_open(struct bftw_state *state, struct bftw_file *file) {
+	SLIST_APPEND(&state->to_open, file);
+	state->to_open_size += bftw_queued_size(file);
+}
+
+/** Remove a directory from to_open. */
+static struct bftw_file *bftw_remove_open(struct bftw_state *state, struct bftw_file **cursor) {
+	struct bftw_file *file = SLIST_REMOVE(&state->to_open, cursor);
+	state->to_open_size -= bftw_queued_size(file);
+	return file;
+}
+
+/** Pop a directory from the front of to_open. */
+static struct bftw_file *bftw_pop_open(struct bftw_state *state) {
+	if (state->to_open.head) {
+		return bftw_remove_open(state, &state->to_open.head);
+	} else {
+		return NULL;
+	}
+}
+
+/**
+ * The most directories on throttled filesystems (or with saved listings) to
+ * skip when opening ahead.
+ */
+#define BFTW_THROTTLE_SKIP 64
+
+/** Open the directories at the front of to_open ahead of time. */
+static void bftw_open_ahead(struct bftw_state *state) {
+	// Without a strict order to keep, skip past directories on throttled
+	// filesystems so that other filesystems stay busy
+	bool reorder = state->strategy == BFTW_BFS && !(state->flags & BFTW_SORT);
+	size_t skipped = 0;
+
+	struct bftw_file **cursor = &state->to_open.head;
+	while (*cursor) {
+		struct bftw_file *file = *cursor;
+		if (file->listing) {
+			// Nothing to open, but don't walk the whole queue
+			if (++skipped > BFTW_THROTTLE_SKIP) {
+				break;
+			}
+			cursor = &file->next;
+			continue;
+		}
+
+		if (bftw_throttled(state, file)) {
+			if (!reorder || ++skipped > BFTW_THROTTLE_SKIP) {
+				break;
+			}
+			cursor = &file->next;
+			continue;
+		}
+
+		if (bftw_ioq_opendir(state, file) != 0) {
+			break;
+		}
+		bftw_remove_open(state, cursor);
+	}
+
+	bftw_ioq_submit(state);
+}
+
+/** Check whether a directory should be spilled rather than queued in memory. */
+static bool bftw_should_spill(const struct bftw_state *state, const struct bftw_file *file) {
+	if (!state->spill_limit || state->spill.failed) {
+		return false;
+	}
+
+	if (file->fd >= 0 || file->ioqueued) {
+		return false;
+	}
+
+	// Once anything is spilled, everything after it must be to stay in order
+	if (state->spill.count > 0) {
+		return true;
+	}
+
+	return state->to_open_size + bftw_queued_size(file) > state->spill_limit;
+}
+
+/** Spill a directory to the temporary file. */
+static int bftw_spill_dir(struct bftw_state *state, struct bftw_file *file) {
+	struct bftw_cache *cache = &state->cache;
+	struct bftw_spill *spill = &state->spill;
+
+	if (spill->fd < 0 && bftw_spill_open(spill) != 0) {
+		spill->failed = true;
+		return -1;
+	}
+
+	if (bftw_spill_push(spill, file) != 0) {
+		return -1;
+	}
+
+	perf_count(PERF_SPILL, 1);
+
+	if (state->previous == file) {
+		state->previous = file->parent;
+	}
+
+	// The spilled record keeps this file's reference to its parent
+	file->refcount = 0;
+	bftw_file_free(cache, file);
+	return 0;
+}
+
+/** Read spilled directories back into to_open. */
+static void bftw_unspill(struct bftw_state *state) {
+	struct bftw_spill *spill = &state->spill;
+
+	while (spill->count > 0 && state->to_open_size < state->spill_limit) {
+		struct bftw_spill_ent ent;
+		const char *name = bftw_spill_peek(spill, &ent);
+		if (!name) {
+			state->error = errno;
+			break;
+		}
+
+		struct bftw_file *file = bftw_file_new(&state->cache, ent.parent, name);
+		if (!file) {
+			state->error = errno;
+			break;
+		}
+		bftw_spill_pop(spill, &ent);
+
+		if (ent.parent) {
+			// The record already held a reference
+			--ent.parent->refcount;
+		}
+
+		file->type = BFS_DIR;
+		file->dev = ent.dev;
+		file->ino = ent.ino;
+		bftw_append_open(state, file);
+	}
+
+	bftw_open_ahead(state);
+}
+
+/** Update the published count of queued directories. */
+static void bftw_progress_queued(struct bftw_progress *progress, bool push) {
+	if (!progress) {
+		return;
+	}
+
+	if (push) {
+		fetch_add(&progress->queued, 1, relaxed);
+	} else {
+		fetch_sub(&progress->queued, 1, relaxed);
+	}
+}
+
+/** Push a directory onto the queue. */
+static inline BFS_ALWAYS_INLINE void bftw_push_dir(struct bftw_state *state, struct bftw_file *file, struct bftw_spec spec) {
+	bfs_assert(file->type == BFS_DIR);
+
+	bftw_progress_queued(state->progress, true);
+
+	// Failure is okay, we'll just keep it in memory
+	if (bftw_should_spill(state, file) && bftw_spill_dir(state, file) == 0) {
+		return;
+	}
+
+	bftw_append_open(state, file);
+
+	if (bftw_spec_flags(state, spec) & BFTW_SORT) {
+		// When sorting, directories are kept in order on the to_read
+		// list; otherwise, they are only added once they are open
+		SLIST_APPEND(&state->to_read, file, to_read);
+	}
+
+	bftw_open_ahead(state);
+}
+
+/**
+ * Adjust the read-ahead window.  If we keep waiting for directories to open
+ * while the window is full, the I/O latency is high enough that opening more
+ * of them ahead of time will help.  But if that starts evicting directories
+ * we still need, the window is too big for the fd limit, so shrink it.
+ */
+static void bftw_adapt(struct bftw_state *state) {
+	size_t pops = ++state->dirpops;
+	if (pops < BFTW_DIRLIMIT_MIN || pops < state->dirlimit / 4) {
+		return;
+	}
+
+	size_t churn = state->cache.churn - state->lastchurn;
+	size_t limit = state->dirlimit;
+	if (churn > pops / 8) {
+		limit /= 2;
+		if (limit < BFTW_DIRLIMIT_MIN) {
+			limit = BFTW_DIRLIMIT_MIN;
+		}
+	} else if (churn == 0 && state->dirstalls > pops / 8 && state->dirfull > 0) {
+		limit *= 2;
+	}
+
+	if (limit > state->dirmax) {
+		limit = state->dirmax;
+	}
+	state->dirlimit = limit;
+
+	state->dirpops = 0;
+	state->dirstalls = 0;
+	state->dirfull = 0;
+	state->lastchurn = state->cache.churn;
+}
+
+/** Pop a directory to read from the queue. */
+static bool bftw_pop_dir(struct bftw_state *state) {
+	bfs_assert(!state->file);
+
+	// Refill the queue once it has drained halfway
+	if (state->spill.count > 0 && state->to_open_size <= state->spill_limit / 2) {
+		bftw_unspill(state);
+	}
+
+	bool have_files = state->to_visit.head;
+
+	if (state->flags & BFTW_SORT) {
+		// Keep strict breadth-first order when sorting
+		if (state->strategy != BFTW_DFS && have_files) {
+			return false;
+		}
+	} else {
+		while (!state->to_read.head) {
+			// Block if we have no other files/dirs to visit, or no room in the cache
+			bool have_dirs = state->to_open.head;
+			bool have_room = state->cache.capacity > 0;
+			bool block = !(have_dirs || have_files) || !have_room;
+			if (block) {
+				++state->dirstalls;
+			}
+
+			if (bftw_ioq_pop(state, block) < 0) {
+				break;
+			}
+		}
+	}
+
+	struct bftw_file *file = SLIST_POP(&state->to_read, to_read);
+	if (!file || file == state->to_open.head) {
+		file = bftw_pop_open(state);
+	}
+	if (!file) {
+		return false;
+	}
+
+	bftw_progress_queued(state->progress, false);
+
+	if (bftw_file_dir(file)) {
+		--state->dirqueued;
+	}
+
+	if (file->ioqueued) {
+		++state->dirstalls;
+	}
+	while (file->ioqueued) {
+		bftw_ioq_pop(state, true);
+	}
+
+	bftw_adapt(state);
+
+	state->file = file;
+	return true;
+}
+
+/** Pop a file to visit from the queue. */
+static bool bftw_pop_file(struct bftw_state *state) {
+	bfs_assert(!state->file);
+	state->file = SLIST_POP(&state->to_visit);
+	return state->file;
+}
+
+/** Build the path to the current file. */
+static int bftw_build_path(struct bftw_state *state, const char *name) {
+	const struct bftw_file *file = state->file;
+
+	size_t pathlen = file ? file->nameoff + file->namelen : 0;
+	size_t namelen = name ? strlen(name) : 0;
+
+	// Reserve space for the whole path upfront, including a possible '/'
+	if (dstresize(&state->path, pathlen + (name ? 1 : 0) + namelen) != 0) {
+		state->error = errno;
+		return -1;
+	}
+
+	// Try to find a common ancestor with the existing path
+	const struct bftw_file *ancestor = state->previous;
+	while (ancestor && ancestor->depth > file->depth) {
+		ancestor = ancestor->parent;
+	}
+
+	// Build the path backwards
+	while (file && file != ancestor) {
+		if (file->nameoff > 0) {
+			state->path[file->nameoff - 1] = '/';
+		}
+		memcpy(state->path + file->nameoff, file->name, file->namelen);
+
+		if (ancestor && ancestor->depth == file->depth) {
+			ancestor = ancestor->parent;
+		}
+		file = file->parent;
+	}
+
+	state->previous = state->file;
+
+	// Siblings only need to rewrite the name at the end
+	if (name) {
+		if (pathlen > 0 && state->path[pathlen - 1] != '/') {
+			state->path[pathlen++] = '/';
+		}
+		memcpy(state->path + pathlen, name, namelen);
+		pathlen += namelen;
+	}
+
+	// Never grows, so this just sets the length and terminator
+	dstresize(&state->path, pathlen);
+	return 0;
+}
+
+/** Open a bftw_file as a directory. */
+static struct bfs_dir *bftw_file_opendir(struct bftw_state *state, struct bftw_file *file, const char *path) {
+	int fd = bftw_file_open(state, file, path);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	struct bftw_cache *cache = &state->cache;
+	struct bfs_dir *dir = bftw_allocdir(cache);
+	if (!dir) {
+		return NULL;
+	}
+
+	if (bfs_opendir(dir, fd, NULL) != 0) {
+		bftw_freedir(cache, dir);
+		return NULL;
+	}
+
+	bftw_file_set_dir(cache, file, dir);
+	return dir;
+}
+
+/** Check the index for the current directory, and start recording it. */
+static void bftw_index_opendir(struct bftw_state *state) {
+	struct bfs_stat buf;
+	if (bfs_stat(bfs_dirfd(state->dir), NULL, 0, &buf) != 0) {
+		return;
+	}
+
+	// If the directory hasn't changed, we can skip reading it
+	state->indexed = bfs_index_lookup(state->index, state->path, &buf, &state->cursor);
+
+	if (bfs_index_begin(state->index, state->path, &buf) != 0) {
+		state->error = errno;
+	}
+}
+
+/** Start saving the listing of the current directory for the next pass. */
+static void bftw_listing_opendir(struct bftw_state *state) {
+	if (!state->listings) {
+		return;
+	}
+
+	struct bfs_stat buf;
+	if (bfs_stat(bfs_dirfd(state->dir), NULL, 0, &buf) == 0) {
+		bftw_listings_begin(state->listings, &buf);
+	}
+}
+
+/** Open the current directory. */
+static int bftw_opendir(struct bftw_state *state) {
+	bfs_assert(!state->dir);
+	bfs_assert(!state->de);
+
+	state->direrror = 0;
+	state->dirents = false;
+
+	struct bftw_file *file = state->file;
+	if (file->listing) {
+		state->listing = file->listing;
+		state->listpos = 0;
+		perf_count(PERF_LISTING_HIT, 1);
+		return 0;
+	}
+
+	state->dir = bftw_file_dir(file);
+	if (state->dir && !state->index) {
+		bftw_listing_opendir(state);
+		return 0;
+	}
+
+	if (bftw_build_path(state, NULL) != 0) {
+		return -1;
+	}
+
+	if (!state->dir) {
+		state->dir = bftw_file_opendir(state, file, state->path);
+	}
+	if (!state->dir) {
+		state->direrror = errno;
+	} else if (state->index) {
+		bftw_index_opendir(state);
+	} else {
+		bftw_listing_opendir(state);
+	}
+
+	return 0;
+}
+
+/** Start reading the next chunk of the current directory in the background. */
+static void bftw_readahead(struct bftw_state *state) {
+#if BFS_USE_READAHEAD
+	if (!state->ioq || state->reading_ahead) {
+		return;
+	}
+
+	if (!state->ahead) {
+		state->ahead = bftw_allocdir(&state->cache);
+		if (!state->ahead) {
+			return;
+		}
+	}
+
+	if (bfs_readahead(state->dir, state->ahead) != 0) {
+		// Nothing left to read
+		return;
+	}
+	state->reading_ahead = true;
+
+	if (bftw_ioq_reserve(state) == 0 && ioq_readdir(state->ioq, state->ahead, NULL) == 0) {
+		state->ahead_queued = true;
+		bftw_ioq_submit(state);
+	} else {
+		// Read it ourselves; the error (if any) will be reported later
+		bfs_polldir(state->ahead);
+	}
+#endif
+}
+
+/** Wait for any read-ahead in the current directory to finish. */
+static void bftw_readahead_wait(struct bftw_state *state) {
+	while (state->ahead_queued && bftw_ioq_pop(state, true) >= 0);
+	bfs_assert(!state->ahead_queued);
+}
+
+/** Stop reading ahead, releasing the read-ahead buffer. */
+static void bftw_readahead_stop(struct bftw_state *state) {
+	bftw_readahead_wait(state);
+
+#if BFS_USE_READAHEAD
+	if (state->reading_ahead) {
+		// Frees any grown buffer, but leaves the shared fd alone
+		bfs_unwrapdir(state->ahead);
+		state->reading_ahead = false;
+	}
+#endif
+}
+
+/** Switch to the read-ahead buffer once the current one is exhausted. */
+static void bftw_readahead_swap(struct bftw_state *state) {
+	bftw_readahead_wait(state);
+
+	struct bfs_dir *dir = state->ahead;
+	state->ahead = state->dir;
+	state->dir = dir;
+	state->file->info->dir = dir;
+
+	// The old buffer is now the read-ahead one, sharing the new one's fd
+	bftw_readahead_stop(state);
+}
+
+/** Read an entry from the current directory. */
+static int bftw_readdir(struct bftw_state *state) {
+	uint64_t start = trace_readdir_start(state->file->depth);
+
+	int ret;
+	if (state->listing) {
+		ret = bftw_listing_read(state->listing, &state->listpos, &state->de_storage);
+	} else if (!state->dir) {
+		trace_readdir_stop(start, state->file->depth);
+		return -1;
+	} else if (state->indexed) {
+		ret = bfs_index_read(&state->cursor, &state->de_storage);
+	} else {
+		ret = bfs_readdir(state->dir, &state->de_storage);
+		if (ret < 0 && errno == EAGAIN && state->reading_ahead) {
+			bftw_readahead_swap(state);
+			ret = bfs_readdir(state->dir, &state->de_storage);
+		}
+	}
+
+	trace_readdir_stop(start, state->file->depth);
+
+	if (ret > 0) {
+		state->de = &state->de_storage;
+		state->dirents = true;
+		if (state->index && bfs_index_add(state->index, state->de) != 0) {
+			state->error = errno;
+		}
+		if (state->listings) {
+			bftw_listings_add(state->listings, state->de);
+		}
+		// Overlap the next getdents() with processing these entries
+		if (!state->indexed && !state->listing) {
+			bftw_readahead(state);
+		}
+	} else if (ret == 0) {
+		state->de = NULL;
+		state->file->empty = !state->dirents;
+		if (state->index) {
+			bfs_index_end(state->index, true);
+		}
+		if (state->listings) {
+			bftw_listings_end(state->listings, true);
+		}
+	} else {
+		state->de = NULL;
+		state->direrror = errno;
+	}
+
+	return ret;
+}
+
+/** Get the bfs_stat() flags for a file at the given depth. */
+static enum bfs_stat_flags bftw_stat_flags(enum bftw_flags flags, size_t depth) {
+	enum bftw_flags mask = BFTW_FOLLOW_ALL;
+	if (depth == 0) {
+		mask |= BFTW_FOLLOW_ROOTS;
+	}
+
+	if (flags & mask) {
+		return BFS_STAT_TRYFOLLOW;
+	} else {
+		return BFS_STAT_NOFOLLOW;
+	}
+}
+
+/** Check if a stat() call is needed for a file. */
+static inline bool bftw_must_stat(enum bftw_flags flags, const struct bfs_mtab *mtab, size_t depth, enum bfs_type type, const char *name) {
+	if (flags & BFTW_STAT) {
+		return true;
+	}
+
+	if (type == BFS_UNKNOWN) {
+		return true;
+	}
+
+	if (type == BFS_LNK && !(bftw_stat_flags(flags, depth) & BFS_STAT_NOFOLLOW)) {
+		return true;
+	}
+
+	if (type == BFS_DIR) {
+		if (flags & (BFTW_DETECT_CYCLES | BFTW_SKIP_MOUNTS | BFTW_PRUNE_MOUNTS)) {
+			return true;
+		}
+#if __linux__
+	} else if (mtab) {
+		// Linux fills in d_type from the underlying inode, even when
+		// the directory entry is a bind mount point.  In that case, we
+		// need to stat() to get the correct type.  We don't need to
+		// check for directories because they can only be mounted over
+		// by other directories.
+		if (bfs_might_be_mount(mtab, name)) {
+			return true;
+		}
+#endif
+	}
+
+	return false;
+}
+
+/** Check if a stat() call is needed for this visit. */
+static inline bool bftw_need_stat(const struct bftw_state *state, struct bftw_spec spec) {
+	const struct BFTW *ftwbuf = &state->ftwbuf;
+	return bftw_must_stat(bftw_spec_flags(state, spec), state->mtab, ftwbuf->depth, ftwbuf->type, ftwbuf->path);
+}
+
+/** Check if a filesystem's readdir() inode numbers always match stat(). */
+static bool bftw_fs_stable_ino(int fd) {
+#if __linux__
+	struct statfs buf;
+	if (fstatfs(fd, &buf) != 0) {
+		return false;
+	}
+
+	// Not overlayfs, btrfs, or network filesystems, where subvolume and
+	// layer boundaries change st_dev or st_ino without a mount point
+	switch (buf.f_type) {
+	case 0xEF53: // ext2/3/4
+	case 0x58465342: // XFS
+	case 0x01021994: // tmpfs
+		return true;
+	default:
+		return false;
+	}
+#else
+	return false;
+#endif
+}
+
+/** Check if d_ino can stand in for st_ino on a device. */
+static bool bftw_trust_ino(struct bftw_state *state, dev_t dev, int fd) {
+	size_t ndevs = darray_length(state->devinos);
+	for (size_t i = 0; i < ndevs; ++i) {
+		if (state->devinos[i].dev == dev) {
+			return state->devinos[i].trusted;
+		}
+	}
+
+	if (fd < 0) {
+		return false;
+	}
+
+	struct bftw_devino devino = {
+		.dev = dev,
+		.trusted = bftw_fs_stable_ino(fd),
+	};
+	// Failure is okay, we'll just check again next time
+	DARRAY_PUSH(&state->devinos, &devino);
+	return devino.trusted;
+}
+
+/**
+ * Check if cycle detection can use the inode number from readdir() and the
+ * parent's device number, rather than stat()ing a directory.
+ */
+static inline bool bftw_can_skip_stat(struct bftw_state *state, struct bftw_spec spec, const struct bftw_file *parent, enum bfs_type type, ino_t ino, const char *name) {
+	enum bftw_flags mask = BFTW_STAT | BFTW_DETECT_CYCLES | BFTW_SKIP_MOUNTS | BFTW_PRUNE_MOUNTS;
+	if ((bftw_spec_flags(state, spec) & mask) != BFTW_DETECT_CYCLES) {
+		return false;
+	}
+
+	if (type != BFS_DIR || ino == 0 || ino == (ino_t)-1) {
+		return false;
+	}
+
+	if (!parent || parent->dev == (dev_t)-1) {
+		return false;
+	}
+
+	// Mount points report the inode number of the directory underneath
+	if (!state->mtab || bfs_might_be_mount(state->mtab, name)) {
+		return false;
+	}
+
+	return bftw_trust_ino(state, parent->dev, parent->fd);
+}
+
+/**
+ * Check if a directory must be stat()ed to learn its device for the I/O
+ * limits, rather than assuming it's on the same one as its parent.
+ */
+static bool bftw_need_dev(const struct bftw_state *state, const struct bftw_file *parent) {
+	const struct BFTW *ftwbuf = &state->ftwbuf;
+	if (state->niolimits == 0 || ftwbuf->type != BFS_DIR) {
+		return false;
+	}
+
+	if (!parent || parent->dev == (dev_t)-1) {
+		return true;
+	}
+
+	return bfs_might_be_mount(state->mtab, ftwbuf->path);
+}
+
+/** Fill the stat() caches from a prefetched result, if any. */
+static void bftw_stat_prefetched(struct bftw_state *state, struct bftw_file *file) {
+	while (file->ioqueued) {
+		bftw_ioq_pop(state, true);
+	}
+
+	struct bfs_stat *buf = file->statbuf;
+	int error = file->staterror;
+	file->statbuf = NULL;
+	file->staterror = 0;
+
+	struct BFTW *ftwbuf = &state->ftwbuf;
+	struct bftw_stat *cache = &ftwbuf->stat_cache;
+	if (file->statflags & BFS_STAT_NOFOLLOW) {
+		cache = &ftwbuf->lstat_cache;
+	}
+
+	if (buf) {
+		if (S_ISLNK(buf->mode) && cache == &ftwbuf->stat_cache) {
+			// BFS_STAT_TRYFOLLOW fell back to lstat() for a broken link
+			ftwbuf->stat_cache.error = ENOENT;
+			cache = &ftwbuf->lstat_cache;
+		}
+		cache->storage = *buf;
+		cache->buf = &cache->storage;
+		arena_free(&state->cache.stat_bufs, buf);
+	} else if (error) {
+		cache->error = error;
+	}
+}
+
+/** Initialize bftw_stat cache. */
+static void bftw_stat_init(struct bftw_stat *cache) {
+	cache->buf = NULL;
+	cache->error = 0;
+}
+
+/** Initialize bftw_xattrs cache. */
+static void bftw_xattrs_init(struct bftw_xattrs *cache, enum bftw_flags flags) {
+	cache->buf = NULL;
+	cache->error = 0;
+	cache->fd = -1;
+	cache->fd_error = (flags & BFTW_ATTR_FDS) ? 0 : ENOTSUP;
+}
+
+/** Close any file descriptor opened for attribute calls. */
+static void bftw_xattrs_close(struct bftw_xattrs *cache) {
+	if (cache->fd >= 0) {
+		xclose(cache->fd);
+		cache->fd = -1;
+	}
+}
+
+/** Fill the xattr cache from a prefetched result, if any. */
+static void bftw_xattrs_prefetched(struct bftw_state *state, struct bftw_file *file) {
+	struct bfs_xattrs *buf = file->xattrs;
+	if (!buf) {
+		return;
+	}
+	file->xattrs = NULL;
+
+	// The prefetch followed links, so it only applies to other types
+	struct BFTW *ftwbuf = &state->ftwbuf;
+	if (ftwbuf->type != BFS_LNK) {
+		struct bftw_xattrs *cache = &ftwbuf->xattr_cache;
+		cache->storage = *buf;
+		cache->buf = &cache->storage;
+	}
+	arena_free(&state->cache.xattr_bufs, buf);
+}
+
+/** Open an ancestor of the current file if necessary. */
+static int bftw_ensure_open(struct bftw_state *state, struct bftw_file *file) {
+	int ret = file->fd;
+
+	if (ret >= 0) {
+		perf_count(PERF_FD_HIT, 1);
+	} else {
+		// Temporarily truncate the current path, rather than copying it
+		char *path = state->path;
+		size_t len = file->nameoff + file->namelen;
+		char c = path[len];
+		path[len] = '\0';
+		ret = bftw_file_open(state, file, path);
+		path[len] = c;
+	}
+
+	return ret;
+}
+
+/** Initialize the buffers with data about the current path. */
+static inline BFS_ALWAYS_INLINE void bftw_init_ftwbuf(struct bftw_state *state, enum bftw_visit visit, struct bftw_spec spec) {
+	enum bftw_flags flags = bftw_spec_flags(state, spec);
+	struct bftw_file *file = state->file;
+	const struct bfs_dirent *de = state->de;
+
+	free(state->target);
+	state->target = NULL;
+
+	struct BFTW *ftwbuf = &state->ftwbuf;
+	ftwbuf->path = state->path;
+	ftwbuf->root = file ? file->root->name : ftwbuf->path;
+	ftwbuf->depth = 0;
+	ftwbuf->visit = visit;
+	ftwbuf->type = BFS_UNKNOWN;
+	ftwbuf->error = state->direrror;
+	ftwbuf->at_fd = AT_FDCWD;
+	ftwbuf->at_path = ftwbuf->path;
+	ftwbuf->stat_flags = BFS_STAT_NOFOLLOW;
+	ftwbuf->stat_fields = state->stat_fields;
+	bftw_stat_init(&ftwbuf->lstat_cache);
+	bftw_stat_init(&ftwbuf->stat_cache);
+	bftw_xattrs_init(&ftwbuf->xattr_cache, flags);
+	ftwbuf->link_target = NULL;
+	ftwbuf->filtered = -1;
+	ftwbuf->was_empty = false;
+
+	struct bftw_file *parent = NULL;
+	if (de) {
+		parent = file;
+		ftwbuf->depth = file->depth + 1;
+		ftwbuf->type = de->type;
+		ftwbuf->nameoff = bftw_child_nameoff(file);
+	} else if (file) {
+		parent = file->parent;
+		ftwbuf->depth = file->depth;
+		ftwbuf->type = file->type;
+		ftwbuf->nameoff = file->nameoff;
+	}
+
+	if (parent) {
+		// Try to ensure the immediate parent is open, to avoid ENAMETOOLONG
+		if (bftw_ensure_open(state, parent) >= 0) {
+			ftwbuf->at_fd = parent->fd;
+			ftwbuf->at_path += ftwbuf->nameoff;
+		} else {
+			ftwbuf->error = errno;
+		}
+	}
+
+	if (ftwbuf->depth == 0) {
+		// Compute the name offset for root paths like "foo/bar"
+		ftwbuf->nameoff = xbaseoff(ftwbuf->path);
+	}
+
+	if (ftwbuf->error != 0) {
+		ftwbuf->type = BFS_ERROR;
+		return;
+	}
+
+	ftwbuf->stat_flags = bftw_stat_flags(flags, ftwbuf->depth);
+
+	if (file && !de) {
+		bftw_stat_prefetched(state, file);
+
+		state->target = file->target;
+		file->target = NULL;
+		ftwbuf->link_target = state->target;
+
+		// The filter only saw the file as it was before any pre-order visit
+		if (visit == BFTW_PRE) {
+			ftwbuf->filtered = file->filtered;
+		} else {
+			ftwbuf->was_empty = file->empty;
+		}
+		file->filtered = -1;
+	}
+
+	state->dev = -1;
+	state->ino = -1;
+
+	ino_t ino = de ? de->ino : (file ? file->ino : 0);
+	if (!ftwbuf->stat_cache.buf && bftw_can_skip_stat(state, spec, parent, ftwbuf->type, ino, ftwbuf->path)) {
+		state->dev = parent->dev;
+		state->ino = ino;
+	} else if (bftw_need_stat(state, spec)) {
+		const struct bfs_stat *statbuf = bftw_stat(ftwbuf, ftwbuf->stat_flags);
+		if (statbuf) {
+			ftwbuf->type = bfs_mode_to_type(statbuf->mode);
+			state->dev = statbuf->dev;
+			state->ino = statbuf->ino;
+		} else {
+			ftwbuf->type = BFS_ERROR;
+			ftwbuf->error = errno;
+			return;
+		}
+	} else if (bftw_need_dev(state, parent)) {
+		// Failure is okay, we just won't throttle I/O to this directory
+		const struct bfs_stat *statbuf = bftw_stat(ftwbuf, ftwbuf->stat_flags);
+		if (statbuf) {
+			state->dev = statbuf->dev;
+		}
+	} else if (state->niolimits > 0 && ftwbuf->type == BFS_DIR) {
+		state->dev = parent->dev;
+	}
+
+	if (file && !de) {
+		bftw_xattrs_prefetched(state, file);
+	}
+
+	if (ftwbuf->type == BFS_DIR && (flags & BFTW_DETECT_CYCLES)) {
+		for (const struct bftw_file *ancestor = parent; ancestor; ancestor = ancestor->parent) {
+			if (ancestor->dev == state->dev && ancestor->ino == state->ino) {
+				ftwbuf->type = BFS_ERROR;
+				ftwbuf->error = ELOOP;
+				return;
+			}
+		}
+	}
+}
+
+/** Check if the current file is a mount point. */
+static bool bftw_is_mount(struct bftw_state *state, const char *name) {
+	const struct bftw_file *file = state->file;
+	if (!file) {
+		return false;
+	}
+
+	const struct bftw_file *parent = name ? file : file->parent;
+	if (!parent) {
+		return false;
+	}
+
+	const struct BFTW *ftwbuf = &state->ftwbuf;
+	const struct bfs_stat *statbuf = bftw_stat(ftwbuf, ftwbuf->stat_flags);
+	return statbuf && statbuf->dev != parent->dev;
+}
+
+/** Invoke the callback. */
+/** Delete the current file in the background. */
+static int bftw_ioq_unlink(struct bftw_state *state, const char *name, int flags) {
+	if (!state->ioq) {
+		return -1;
+	}
+
+	struct bftw_file *file = name ? NULL : state->file;
+	struct bftw_file *parent = name ? state->file : file->parent;
+
+	// Root paths have no parent to keep open
+	if (!parent || parent->fd < 0 || parent->fd != state->ftwbuf.at_fd) {
+		return -1;
+	}
+
+	if (bftw_throttled(state, file ? file : parent)) {
+		return -1;
+	}
+
+	if (bftw_ioq_reserve(state) != 0) {
+		return -1;
+	}
+
+	// The new file holds a reference to its parent, which delays the
+	// parent's post-order visit until the deletion is done
+	struct bftw_cache *cache = &state->cache;
+	if (!file) {
+		file = bftw_file_new(cache, parent, name);
+		if (!file) {
+			return -1;
+		}
+		file->type = state->ftwbuf.type;
+	}
+
+	if (ioq_unlink(state->ioq, parent->fd, file->name, flags, file) != 0) {
+		if (name) {
+			--file->refcount;
+			--parent->refcount;
+			bftw_file_free(cache, file);
+		}
+		return -1;
+	}
+
+	bftw_cache_pin(cache, parent);
+	++file->ioqueued;
+	bftw_devq_push(state, file);
+	++state->unlinking;
+	return 0;
+}
+
+/** Report a failed deletion by visiting the file again. */
+static enum bftw_action bftw_delete_error(struct bftw_state *state, int error) {
+	if (!(state->flags & BFTW_RECOVER)) {
+		state->error = error;
+		return BFTW_STOP;
+	}
+
+	struct BFTW *ftwbuf = &state->ftwbuf;
+	ftwbuf->type = BFS_ERROR;
+	ftwbuf->error = error;
+	enum bftw_action ret = state->callback(ftwbuf, state->ptr);
+	bftw_xattrs_close(&ftwbuf->xattr_cache);
+	if (ret == BFTW_STOP) {
+		return BFTW_STOP;
+	} else {
+		return BFTW_PRUNE;
+	}
+}
+
+/** Handle BFTW_DELETE from the callback. */
+static enum bftw_action bftw_delete(struct bftw_state *state, const char *name) {
+	const struct BFTW *ftwbuf = &state->ftwbuf;
+
+	// Delete symbolic links themselves, not what they point to
+	enum bfs_type type = bftw_type(ftwbuf, BFS_STAT_NOFOLLOW);
+	if (type == BFS_ERROR) {
+		return bftw_delete_error(state, errno);
+	}
+
+	int flags = type == BFS_DIR ? AT_REMOVEDIR : 0;
+
+	// Failure is okay, we'll just do it synchronously
+	if (bftw_ioq_unlink(state, name, flags) == 0) {
+		return BFTW_PRUNE;
+	}
+
+	if (unlinkat(ftwbuf->at_fd, ftwbuf->at_path, flags) != 0) {
+		return bftw_delete_error(state, errno);
+	}
+
+	return BFTW_PRUNE;
+}
+
+/** Visit the current file, for a specialized loop. */
+static inline BFS_ALWAYS_INLINE enum bftw_action bftw_call_back_spec(struct bftw_state *state, const char *name, enum bftw_visit visit, struct bftw_spec spec) {
+	enum bftw_flags flags = bftw_spec_flags(state, spec);
+	if (visit == BFTW_POST && !(flags & BFTW_POST_ORDER)) {
+		return BFTW_PRUNE;
+	}
+
+	if (bftw_build_path(state, name) != 0) {
+		return BFTW_STOP;
+	}
+
+	const struct BFTW *ftwbuf = &state->ftwbuf;
+	bftw_init_ftwbuf(state, visit, spec);
+
+	// Never give the callback BFS_ERROR unless BFTW_RECOVER is specified
+	if (ftwbuf->type == BFS_ERROR && !(flags & BFTW_RECOVER)) {
+		state->error = ftwbuf->error;
+		return BFTW_STOP;
+	}
+
+	if ((flags & BFTW_SKIP_MOUNTS) && bftw_is_mount(state, name)) {
+		return BFTW_PRUNE;
+	}
+
+	enum bftw_action ret = state->callback(ftwbuf, state->ptr);
+	bftw_xattrs_close(&state->ftwbuf.xattr_cache);
+	switch (ret) {
+	case BFTW_CONTINUE:
+		if (visit != BFTW_PRE) {
+			return BFTW_PRUNE;
+		}
+		if (ftwbuf->type != BFS_DIR) {
+			return BFTW_PRUNE;
+		}
+		if ((flags & BFTW_PRUNE_MOUNTS) && bftw_is_mount(state, name)) {
+			return BFTW_PRUNE;
+		}
+		fallthru;
+	case BFTW_PRUNE:
+	case BFTW_STOP:
+		return ret;
+
+	case BFTW_DELETE:
+		return bftw_delete(state, name);
+
+	default:
+		state->error = EINVAL;
+		return BFTW_STOP;
+	}
+}
+
+/** Visit the current file. */
+static enum bftw_action bftw_call_back(struct bftw_state *state, const char *name, enum bftw_visit visit) {
+	return bftw_call_back_spec(state, name, visit, BFTW_SPEC_GENERIC);
+}
+
+/**
+ * Flags controlling which files get visited when done with a directory.
+ */
+enum bftw_gc_flags {
+	/** Don't visit anything. */
+	BFTW_VISIT_NONE = 0,
+	/** Report directory errors. */
+	BFTW_VISIT_ERROR = 1 << 0,
+	/** Visit the file itself. */
+	BFTW_VISIT_FILE = 1 << 1,
+	/** Visit the file's ancestors. */
+	BFTW_VISIT_PARENTS = 1 << 2,
+	/** Visit both the file and its ancestors. */
+	BFTW_VISIT_ALL = BFTW_VISIT_ERROR | BFTW_VISIT_FILE | BFTW_VISIT_PARENTS,
+};
+
+/**
+ * Drop a reference to the current file.  Once nothing else refers to it, visit
+ * and free it, and then do the same for its parents.
+ *
+ * @param flags
+ *         Which files to visit.
+ * @param visit
+ *         BFTW_VISIT_FILE if the file itself may be visited, otherwise
+ *         BFTW_VISIT_NONE.
+ */
+static int bftw_release(struct bftw_state *state, enum bftw_gc_flags flags, enum bftw_gc_flags visit) {
+	int ret = 0;
+
+	struct bftw_file *file;
+	while ((file = state->file)) {
+		if (--file->refcount > 0) {
+			state->file = NULL;
+			break;
+		}
+
+		if (flags & visit) {
+			if (bftw_call_back(state, NULL, BFTW_POST) == BFTW_STOP) {
+				ret = -1;
+				flags = 0;
+			}
+		}
+		visit = BFTW_VISIT_PARENTS;
+
+		// Only a deletion can still be pending after the last visit.
+		// Keep the file (and its parents) until bftw_reap().
+		if (file->ioqueued > 0) {
+			++file->refcount;
+			state->file = NULL;
+			break;
+		}
+
+		struct bftw_file *parent = file->parent;
+		if (state->previous == file) {
+			state->previous = parent;
+		}
+		state->file = parent;
+
+		if (file->fd >= 0) {
+			bftw_close(state, file);
+		}
+		bftw_file_free(&state->cache, file);
+	}
+
+	return ret;
+}
+
+/** Garbage collect the current file and its parents. */
+static int bftw_gc(struct bftw_state *state, enum bftw_gc_flags flags) {
+	int ret = 0;
+
+	// Don't close the directory out from under a pending read-ahead
+	bftw_readahead_stop(state);
+
+	struct bftw_file *file = state->file;
+	if (file && bftw_file_dir(file)) {
+		bftw_cache_unpin(&state->cache, file);
+		SLIST_APPEND(&state->to_close, file);
+	}
+	state->dir = NULL;
+	state->de = NULL;
+
+	// Discard the listing if we didn't finish reading it
+	if (state->index) {
+		bfs_index_end(state->index, false);
+	}
+	state->indexed = false;
+	if (state->listings) {
+		bftw_listings_end(state->listings, false);
+	}
+	state->listing = NULL;
+
+	if (state->direrror != 0) {
+		if (flags & BFTW_VISIT_ERROR) {
+			if (bftw_call_back(state, NULL, BFTW_PRE) == BFTW_STOP) {
+				ret = -1;
+				flags = 0;
+			}
+		} else {
+			state->error = state->direrror;
+		}
+	}
+	state->direrror = 0;
+
+	while ((file = SLIST_POP(&state->to_close))) {
+		bftw_unwrapdir(state, file);
+	}
+
+	if (bftw_release(state, flags, BFTW_VISIT_FILE) != 0) {
+		ret = -1;
+	}
+
+	return ret;
+}
+
+/** Report and release any files whose background deletions have completed. */
+static int bftw_reap(struct bftw_state *state) {
+	bfs_assert(!state->file);
+
+	struct bftw_file *file;
+	while ((file = SLIST_POP(&state->deleted))) {
+		state->file = file;
+
+		// Report errors the same way as directory errors
+		if (file->staterror != 0) {
+			state->direrror = file->staterror;
+			enum bftw_action ret = bftw_call_back(state, NULL, BFTW_PRE);
+			state->direrror = 0;
+			if (ret == BFTW_STOP) {
+				return -1;
+			}
+		}
+
+		if (bftw_release(state, BFTW_VISIT_ALL, BFTW_VISIT_NONE) != 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/** Sort a bftw_list by filename. */
+static void bftw_list_sort(struct bftw_list *list) {
+	if (!list->head || !list->head->next) {
+		return;
+	}
+
+	struct bftw_list left, right;
+	SLIST_INIT(&left);
+	SLIST_INIT(&right);
+
+	// Split
+	for (struct bftw_file *hare = list->head; hare && (hare = hare->next); hare = hare->next) {
+		struct bftw_file *tortoise = SLIST_POP(list);
+		SLIST_APPEND(&left, tortoise);
+	}
+	SLIST_EXTEND(&right, list);
+
+	// Recurse
+	bftw_list_sort(&left);
+	bftw_list_sort(&right);
+
+	// Merge
+	while (left.head && right.head) {
+		struct bftw_file *lf = left.head;
+		struct bftw_file *rf = right.head;
+
+		if (strcoll(lf->name, rf->name) <= 0) {
+			SLIST_POP(&left);
+			SLIST_APPEND(list, lf);
+		} else {
+			SLIST_POP(&right);
+			SLIST_APPEND(list, rf);
+		}
+	}
+	SLIST_EXTEND(list, &left);
+	SLIST_EXTEND(list, &right);
+}
+
+/** Compare two bftw_sort_ents. */
+static int bftw_sort_cmp(const void *a, const void *b) {
+	const struct bftw_sort_ent *x = a;
+	const struct bftw_sort_ent *y = b;
+
+	int ret = strcmp(x->key, y->key);
+	if (ret == 0) {
+		ret = (x->index > y->index) - (x->index < y->index);
+	}
+	return ret;
+}
+
+/** Compute the strxfrm() key for a sort entry. */
+static int bftw_sort_key(struct bftw_state *state, size_t *used, struct bftw_sort_ent *ent) {
+	const char *name = ent->file->name;
+
+	while (true) {
+		size_t avail = state->sort_keys_cap - *used;
+		size_t len = strxfrm(state->sort_keys + *used, name, avail);
+		if (len < avail) {
+			ent->offset = *used;
+			*used += len + 1;
+			return 0;
+		}
+
+		size_t cap = 2 * state->sort_keys_cap;
+		if (cap < *used + len + 1) {
+			cap = *used + len + 1;
+		}
+		char *keys = realloc(state->sort_keys, cap);
+		if (!keys) {
+			return -1;
+		}
+		state->sort_keys = keys;
+		state->sort_keys_cap = cap;
+	}
+}
+
+/**
+ * Make room for a batch in the sort_ents array.
+ *
+ * @return
+ *         The size of the batch, or (size_t)-1 on failure.
+ */
+static size_t bftw_batch_reserve(struct bftw_state *state) {
+	size_t count = 0;
+	for (struct bftw_file *file = state->batch.head; file; file = file->next) {
+		++count;
+	}
+
+	if (count > state->sort_cap) {
+		struct bftw_sort_ent *ents = realloc(state->sort_ents, sizeof_array(struct bftw_sort_ent, count));
+		if (!ents) {
+			return -1;
+		}
+		state->sort_ents = ents;
+		state->sort_cap = count;
+	}
+
+	return count;
+}
+
+/** Replace the batch with the sorted sort_ents. */
+static void bftw_batch_sorted(struct bftw_state *state, size_t count) {
+	struct bftw_list *batch = &state->batch;
+	SLIST_INIT(batch);
+	for (size_t i = 0; i < count; ++i) {
+		SLIST_APPEND(batch, state->sort_ents[i].file);
+	}
+}
+
+/**
+ * Sort a batch of files by name.  The batch is copied into an array with
+ * precomputed strxfrm() keys, so each comparison is a cheap strcmp().
+ */
+static int bftw_batch_sort(struct bftw_state *state) {
+	struct bftw_list *batch = &state->batch;
+
+	size_t count = bftw_batch_reserve(state);
+	if (count == (size_t)-1) {
+		return -1;
+	} else if (count < 2) {
+		return 0;
+	}
+
+	if (!state->sort_bytewise && !state->sort_keys) {
+		size_t cap = 4096;
+		state->sort_keys = malloc(cap);
+		if (!state->sort_keys) {
+			return -1;
+		}
+		state->sort_keys_cap = cap;
+	}
+
+	size_t used = 0;
+	size_t i = 0;
+	for (struct bftw_file *file = batch->head; file; file = file->next, ++i) {
+		struct bftw_sort_ent *ent = &state->sort_ents[i];
+		ent->key = file->name;
+		ent->index = i;
+		ent->file = file;
+
+		if (!state->sort_bytewise && bftw_sort_key(state, &used, ent) != 0) {
+			return -1;
+		}
+	}
+
+	if (!state->sort_bytewise) {
+		for (i = 0; i < count; ++i) {
+			struct bftw_sort_ent *ent = &state->sort_ents[i];
+			ent->key = state->sort_keys + ent->offset;
+		}
+	}
+
+	qsort(state->sort_ents, count, sizeof(*state->sort_ents), bftw_sort_cmp);
+	bftw_batch_sorted(state, count);
+	return 0;
+}
+
+/** Compare two bftw_sort_ents by inode number. */
+static int bftw_sort_ino_cmp(const void *a, const void *b) {
+	const struct bftw_sort_ent *x = a;
+	const struct bftw_sort_ent *y = b;
+
+	ino_t xino = x->file->ino;
+	ino_t yino = y->file->ino;
+	int ret = (xino > yino) - (xino < yino);
+	if (ret == 0) {
+		ret = (x->index > y->index) - (x->index < y->index);
+	}
+	return ret;
+}
+
+/**
+ * Sort a batch of files by the inode numbers from readdir(), which usually
+ * follow the on-disk layout, to cut down on seeking.
+ */
+static int bftw_batch_sort_ino(struct bftw_state *state) {
+	size_t count = bftw_batch_reserve(state);
+	if (count == (size_t)-1) {
+		return -1;
+	} else if (count < 2) {
+		return 0;
+	}
+
+	size_t i = 0;
+	for (struct bftw_file *file = state->batch.head; file; file = file->next, ++i) {
+		struct bftw_sort_ent *ent = &state->sort_ents[i];
+		ent->key = NULL;
+		ent->index = i;
+		ent->file = file;
+	}
+
+	qsort(state->sort_ents, count, sizeof(*state->sort_ents), bftw_sort_ino_cmp);
+	bftw_batch_sorted(state, count);
+	return 0;
+}
+
+/** Fill file identity information from the current visit. */
+static void bftw_save_ftwbuf(struct bftw_state *state, struct bftw_file *file) {
+	const struct BFTW *ftwbuf = &state->ftwbuf;
+	file->type = ftwbuf->type;
+
+	const struct bfs_stat *statbuf = ftwbuf->stat_cache.buf;
+	if (!statbuf || (ftwbuf->stat_flags & BFS_STAT_NOFOLLOW)) {
+		statbuf = ftwbuf->lstat_cache.buf;
+	}
+	if (statbuf) {
+		file->dev = statbuf->dev;
+		file->ino = statbuf->ino;
+	} else {
+		file->dev = state->dev;
+		file->ino = state->ino;
+	}
+}
+
+/** Stat a file asynchronously. */
+static int bftw_ioq_stat(struct bftw_state *state, struct bftw_file *file, enum bfs_stat_flags flags) {
+	if (bftw_throttled(state, file)) {
+		return -1;
+	}
+
+	if (bftw_ioq_reserve(state) != 0) {
+		return -1;
+	}
+
+	int dfd = AT_FDCWD;
+	struct bftw_file *parent = file->parent;
+	if (parent) {
+		dfd = parent->fd;
+		if (dfd < 0) {
+			return -1;
+		}
+	}
+
+	struct bftw_cache *cache = &state->cache;
+	struct bfs_stat *buf = arena_alloc(&cache->stat_bufs);
+	if (!buf) {
+		return -1;
+	}
+
+	if (ioq_stat(state->ioq, dfd, file->name, flags, state->stat_fields, buf, file) != 0) {
+		arena_free(&cache->stat_bufs, buf);
+		return -1;
+	}
+
+	if (parent) {
+		bftw_cache_pin(cache, parent);
+	}
+
+	file->statbuf = buf;
+	file->statflags = flags;
+	++file->ioqueued;
+	bftw_devq_push(state, file);
+	return 0;
+}
+
+/** Read a file's extended attribute names asynchronously. */
+static int bftw_ioq_xattrs(struct bftw_state *state, struct bftw_file *file) {
+	// The callback reads a link's own attributes only if it isn't followed
+	if (file->type == BFS_UNKNOWN || file->type == BFS_LNK) {
+		return -1;
+	}
+
+	if (bftw_throttled(state, file)) {
+		return -1;
+	}
+
+	if (bftw_ioq_reserve(state) != 0) {
+		return -1;
+	}
+
+	int dfd = AT_FDCWD;
+	struct bftw_file *parent = file->parent;
+	if (parent) {
+		dfd = parent->fd;
+		if (dfd < 0) {
+			return -1;
+		}
+	}
+
+	struct bftw_cache *cache = &state->cache;
+	struct bfs_xattrs *buf = arena_alloc(&cache->xattr_bufs);
+	if (!buf) {
+		return -1;
+	}
+
+	if (ioq_xattrs(state->ioq, dfd, file->name, BFS_STAT_FOLLOW, buf, file) != 0) {
+		arena_free(&cache->xattr_bufs, buf);
+		return -1;
+	}
+
+	if (parent) {
+		bftw_cache_pin(cache, parent);
+	}
+
+	file->xattrs = buf;
+	++file->ioqueued;
+	bftw_devq_push(state, file);
+	return 0;
+}
+
+/** Read a symbolic link asynchronously. */
+static int bftw_ioq_readlink(struct bftw_state *state, struct bftw_file *file) {
+	if (bftw_throttled(state, file)) {
+		return -1;
+	}
+
+	if (bftw_ioq_reserve(state) != 0) {
+		return -1;
+	}
+
+	int dfd = AT_FDCWD;
+	struct bftw_file *parent = file->parent;
+	if (parent) {
+		dfd = parent->fd;
+		if (dfd < 0) {
+			return -1;
+		}
+	}
+
+	if (ioq_readlink(state->ioq, dfd, file->name, 0, file) != 0) {
+		return -1;
+	}
+
+	if (parent) {
+		bftw_cache_pin(&state->cache, parent);
+	}
+
+	++file->ioqueued;
+	bftw_devq_push(state, file);
+	return 0;
+}
+
+/** Build the full path to a file. */
+static int bftw_file_path(const struct bftw_file *file, char **path) {
+	if (dstresize(path, file->nameoff + file->namelen) != 0) {
+		return -1;
+	}
+
+	for (; file; file = file->parent) {
+		if (file->nameoff > 0) {
+			(*path)[file->nameoff - 1] = '/';
+		}
+		memcpy(*path + file->nameoff, file->name, file->namelen);
+	}
+
+	return 0;
+}
+
+/** Background thread entry point for filter jobs. */
+static int bftw_job_run(void *ptr) {
+	struct bftw_job *job = ptr;
+	struct BFTW *ftwbuf = &job->ftwbuf;
+
+	if (job->stat) {
+		const struct bfs_stat *statbuf = bftw_stat(ftwbuf, ftwbuf->stat_flags);
+		if (!statbuf) {
+			// Let the main thread report the error
+			job->staterror = errno;
+			return 0;
+		}
+		ftwbuf->type = bfs_mode_to_type(statbuf->mode);
+	}
+
+	job->result = job->filter(ftwbuf, job->ptr);
+	bftw_xattrs_close(&ftwbuf->xattr_cache);
+	return 0;
+}
+
+/** Evaluate the filter for a file asynchronously. */
+static int bftw_ioq_filter(struct bftw_state *state, struct bftw_file *file) {
+	if (bftw_ioq_reserve(state) != 0) {
+		return -1;
+	}
+
+	int dfd = AT_FDCWD;
+	struct bftw_file *parent = file->parent;
+	if (parent) {
+		dfd = parent->fd;
+		if (dfd < 0) {
+			return -1;
+		}
+	}
+
+	struct bftw_cache *cache = &state->cache;
+	struct bftw_job *job = arena_alloc(&cache->jobs);
+	if (!job) {
+		return -1;
+	}
+
+	job->path = NULL;
+	if (bftw_file_path(file, &job->path) != 0) {
+		goto fail;
+	}
+
+	job->file = file;
+	job->filter = state->filter;
+	job->ptr = state->ptr;
+	job->stat = bftw_must_stat(state->flags, state->mtab, file->depth, file->type, file->name);
+	job->staterror = 0;
+	job->result = -1;
+
+	struct BFTW *ftwbuf = &job->ftwbuf;
+	ftwbuf->path = job->path;
+	ftwbuf->root = file->root->name;
+	ftwbuf->depth = file->depth;
+	ftwbuf->visit = BFTW_PRE;
+	ftwbuf->type = file->type;
+	ftwbuf->error = 0;
+	ftwbuf->at_fd = dfd;
+	ftwbuf->at_path = parent ? file->name : job->path;
+	ftwbuf->stat_flags = bftw_stat_flags(state->flags, file->depth);
+	ftwbuf->stat_fields = state->stat_fields;
+	bftw_stat_init(&ftwbuf->lstat_cache);
+	bftw_stat_init(&ftwbuf->stat_cache);
+	bftw_xattrs_init(&ftwbuf->xattr_cache, state->flags);
+	ftwbuf->link_target = NULL;
+	ftwbuf->filtered = -1;
+	ftwbuf->was_empty = false;
+
+	if (file->depth == 0) {
+		ftwbuf->nameoff = xbaseoff(job->path);
+	} else {
+		ftwbuf->nameoff = file->nameoff;
+	}
+
+	if (ioq_call(state->ioq, bftw_job_run, job, job) != 0) {
+		goto fail;
+	}
+
+	if (parent) {
+		bftw_cache_pin(cache, parent);
+	}
+
+	++file->ioqueued;
+	return 0;
+
+fail:
+	dstrfree(job->path);
+	arena_free(&cache->jobs, job);
+	return -1;
+}
+
+/** Start any background I/O for a buffered file. */
+static inline BFS_ALWAYS_INLINE void bftw_prefetch(struct bftw_state *state, struct bftw_file *file, struct bftw_spec spec) {
+	// Failure is okay, we'll just do it synchronously
+	if (state->filter && bftw_ioq_filter(state, file) == 0) {
+		return;
+	}
+	enum bftw_flags bftw_flags = bftw_spec_flags(state, spec);
+	enum bfs_stat_flags flags = bftw_stat_flags(bftw_flags, file->depth);
+	if (bftw_must_stat(bftw_flags, state->mtab, file->depth, file->type, file->name)
+	    && !bftw_can_skip_stat(state, spec, file->parent, file->type, file->ino, file->name)) {
+		bftw_ioq_stat(state, file, flags);
+	} else if (file->type == BFS_LNK && (flags & BFS_STAT_NOFOLLOW) && (bftw_flags & BFTW_STAT_LINKS)) {
+		// Stat the link target instead, the way -xtype would
+		bftw_ioq_stat(state, file, BFS_STAT_TRYFOLLOW);
+	}
+	if (file->type == BFS_LNK && (bftw_flags & BFTW_READLINK)) {
+		bftw_ioq_readlink(state, file);
+	}
+	if (bftw_flags & BFTW_XATTRS) {
+		bftw_ioq_xattrs(state, file);
+	}
+}
+
+/**
+ * Check whether prefetches should wait for bftw_batch_finish(), either so they
+ * go out in inode order, or so that the batch filter can drop files first.
+ */
+static inline bool bftw_defer_prefetch(const struct bftw_state *state, struct bftw_spec spec) {
+	return (bftw_spec_flags(state, spec) & BFTW_INO_ORDER) || state->batch_fn;
+}
+
+/** Make room for a batch in the batch filter arrays. */
+static int bftw_batch_reserve_entries(struct bftw_state *state, size_t count) {
+	if (count <= state->batch_cap) {
+		return 0;
+	}
+
+	// Ordered by decreasing alignment, so every array stays aligned
+	size_t size = sizeof(ino_t) + sizeof(const char *) + sizeof(size_t) + sizeof(enum bfs_type) + sizeof(bool);
+	char *block = malloc(array_size(1, size, count));
+	if (!block) {
+		return -1;
+	}
+
+	free(state->batch_inos);
+	state->batch_inos = (ino_t *)block;
+	block += count * sizeof(ino_t);
+	state->batch_names = (const char **)block;
+	block += count * sizeof(const char *);
+	state->batch_lengths = (size_t *)block;
+	block += count * sizeof(size_t);
+	state->batch_types = (enum bfs_type *)block;
+	block += count * sizeof(enum bfs_type);
+	state->batch_visit = (bool *)block;
+	state->batch_cap = count;
+	return 0;
+}
+
+/** Check whether the batch filter can drop a file without visiting it. */
+static bool bftw_can_drop(enum bfs_type type, enum bfs_stat_flags flags) {
+	switch (type) {
+	case BFS_UNKNOWN:
+	case BFS_DIR:
+		// We might need to descend into it
+		return false;
+	case BFS_LNK:
+		// It could be a followed link to a directory
+		return flags & BFS_STAT_NOFOLLOW;
+	default:
+		return true;
+	}
+}
+
+/** Run the batch filter on the entries of the current directory. */
+static int bftw_batch_filter(struct bftw_state *state) {
+	size_t count = 0;
+	for (struct bftw_file *file = state->batch.head; file; file = file->next) {
+		++count;
+	}
+	if (count == 0) {
+		return 0;
+	}
+
+	if (bftw_batch_reserve_entries(state, count) != 0) {
+		return -1;
+	}
+	if (bftw_build_path(state, NULL) != 0) {
+		return -1;
+	}
+
+	size_t i = 0;
+	for (struct bftw_file *file = state->batch.head; file; file = file->next, ++i) {
+		state->batch_inos[i] = file->ino;
+		state->batch_names[i] = file->name;
+		state->batch_lengths[i] = file->namelen;
+		state->batch_types[i] = file->type;
+		state->batch_visit[i] = true;
+	}
+
+	struct bftw_file *dir = state->file;
+	struct bftw_entries entries = {
+		.path = state->path,
+		.depth = dir->depth + 1,
+		.count = count,
+		.names = state->batch_names,
+		.lengths = state->batch_lengths,
+		.types = state->batch_types,
+		.inos = state->batch_inos,
+		.visit = state->batch_visit,
+	};
+	state->batch_fn(&entries, state->ptr);
+
+	enum bfs_stat_flags flags = bftw_stat_flags(state->flags, entries.depth);
+	struct bftw_list kept;
+	SLIST_INIT(&kept);
+
+	struct bftw_file *file;
+	i = 0;
+	while ((file = SLIST_POP(&state->batch))) {
+		if (state->batch_visit[i++] || !bftw_can_drop(file->type, flags)) {
+			SLIST_APPEND(&kept, file);
+			continue;
+		}
+
+		// Nothing else refers to the file yet, not even a prefetch
+		bfs_assert(file->refcount == 1 && file->ioqueued == 0);
+		file->refcount = 0;
+		--dir->refcount;
+		bftw_file_free(&state->cache, file);
+	}
+
+	SLIST_EXTEND(&state->batch, &kept);
+	return 0;
+}
+
+/** Finish adding a batch of files. */
+static inline BFS_ALWAYS_INLINE void bftw_batch_finish(struct bftw_state *state, struct bftw_spec spec) {
+	enum bftw_flags flags = bftw_spec_flags(state, spec);
+	if (flags & BFTW_INO_ORDER) {
+		// Failure is okay, the order is just an optimization
+		bftw_batch_sort_ino(state);
+	}
+
+	// Prefetches were held back until now, so they go out in order
+	if (state->ioq && bftw_defer_prefetch(state, spec)) {
+		for (struct bftw_file *file = state->batch.head; file; file = file->next) {
+			bftw_prefetch(state, file, spec);
+		}
+	}
+
+	// Start any stat() prefetches for the batch
+	bftw_ioq_submit(state);
+
+	if (flags & BFTW_SORT) {
+		if (bftw_batch_sort(state) != 0) {
+			// Out of memory, so fall back to sorting the list in place
+			bftw_list_sort(&state->batch);
+		}
+	}
+
+	if (state->strategy != BFTW_BFS) {
+		SLIST_EXTEND(&state->batch, &state->to_visit);
+	}
+	SLIST_EXTEND(&state->to_visit, &state->batch);
+}
+
+/** Close the current directory. */
+static inline BFS_ALWAYS_INLINE int bftw_closedir(struct bftw_state *state, struct bftw_spec spec) {
+	if (state->batch_fn) {
+		// Failure is okay, every file will just be visited
+		bftw_batch_filter(state);
+	}
+
+	if (bftw_gc(state, BFTW_VISIT_ALL) != 0) {
+		return -1;
+	}
+
+	bftw_batch_finish(state, spec);
+	return 0;
+}
+
+/** Look for a saved listing of the current directory. */
+static void bftw_find_listing(struct bftw_state *state, struct bftw_file *file) {
+	const struct bftw_listings *listings = state->listings;
+	if (!listings || !listings->dirs.head) {
+		return;
+	}
+
+	const struct BFTW *ftwbuf = &state->ftwbuf;
+	const struct bfs_stat *statbuf = bftw_stat(ftwbuf, ftwbuf->stat_flags);
+	if (statbuf) {
+		file->listing = bftw_listings_find(listings, statbuf);
+	}
+}
+
+/** Visit and/or enqueue the current file, for a specialized loop. */
+static inline BFS_ALWAYS_INLINE int bftw_visit_spec(struct bftw_state *state, const char *name, struct bftw_spec spec) {
+	struct bftw_file *file = state->file;
+
+	if (name && (bftw_spec_flags(state, spec) & BFTW_BUFFER)) {
+		file = bftw_file_new(&state->cache, file, name);
+		if (!file) {
+			state->error = errno;
+			return -1;
+		}
+
+		if (state->de) {
+			file->type = state->de->type;
+			file->ino = state->de->ino;
+		}
+
+		SLIST_APPEND(&state->batch, file);
+
+		if (state->ioq && !bftw_defer_prefetch(state, spec)) {
+			bftw_prefetch(state, file, spec);
+		}
+		return 0;
+	}
+
+	switch (bftw_call_back_spec(state, name, BFTW_PRE, spec)) {
+	case BFTW_CONTINUE:
+		if (name) {
+			file = bftw_file_new(&state->cache, state->file, name);
+		} else {
+			state->file = NULL;
+		}
+		if (!file) {
+			state->error = errno;
+			return -1;
+		}
+
+		bftw_save_ftwbuf(state, file);
+		bftw_find_listing(state, file);
+		bftw_push_dir(state, file, spec);
+		return 0;
+
+	case BFTW_PRUNE:
+		if (file && !name) {
+			return bftw_gc(state, BFTW_VISIT_PARENTS);
+		} else {
+			return 0;
+		}
+
+	default:
+		return -1;
+	}
 }
 
-/** Build the path to the current file. */
-static int bftw_build_path(struct bftw_state *state, const char *name) {
-	const struct bftw_file *file = state->file;
+/** Visit and/or enqueue the current file. */
+static int bftw_visit(struct bftw_state *state, const char *name) {
+	return bftw_visit_spec(state, name, BFTW_SPEC_GENERIC);
+}
+
+/**
+ * Dispose of the bftw() state.
+ *
+ * @return
+ *         The bftw() return value.
+ */
+static int bftw_state_destroy(struct bftw_state *state) {
+	dstrfree(state->path);
+
+	struct ioq *ioq = state->ioq;
+	if (ioq) {
+		// The callback was already told these files are gone, so
+		// finish deleting them rather than cancelling
+		while (state->unlinking > 0 && bftw_ioq_pop(state, true) >= 0);
+
+		ioq_cancel(ioq);
+		while (bftw_ioq_pop(state, true) >= 0);
+		state->ioq = NULL;
+	}
+
+	SLIST_EXTEND(&state->to_visit, &state->batch);
+	SLIST_EXTEND(&state->to_visit, &state->deleted);
+	do {
+		bftw_gc(state, BFTW_VISIT_NONE);
+	} while (bftw_pop_dir(state) || bftw_pop_file(state));
+
+	ioq_destroy(ioq);
+
+	if (state->ahead) {
+		bftw_freedir(&state->cache, state->ahead);
+	}
+	bftw_spill_destroy(&state->spill);
+	bftw_cache_destroy(&state->cache);
+
+	free(state->target);
+	free(state->batch_inos);
+	free(state->sort_keys);
+	free(state->sort_ents);
+	darray_free(state->devqs);
+	darray_free(state->devinos);
+
+	errno = state->error;
+	return state->error ? -1 : 0;
+}
+
+/** The number of streamed root paths to read at a time. */
+#define BFTW_ROOT_BATCH 1024
+
+/**
+ * Visit the next batch of streamed root paths, once everything before them is
+ * done.  That keeps the queues bounded no matter how many roots there are,
+ * while the stat() and opendir() calls for each batch still go through the
+ * I/O queue together.
+ *
+ * @return
+ *         The number of roots visited, or -1 on error.
+ */
+static int bftw_more_roots(struct bftw_state *state) {
+	if (!state->more_paths) {
+		return 0;
+	}
+
+	int count = 0;
+	while (count < BFTW_ROOT_BATCH) {
+		const char *path = state->more_paths(state->ptr);
+		if (!path) {
+			// Don't ask again once the input is exhausted
+			state->more_paths = NULL;
+			break;
+		}
+
+		if (bftw_visit(state, path) != 0) {
+			return -1;
+		}
+		++count;
+	}
+
+	bftw_batch_finish(state, BFTW_SPEC_GENERIC);
+	return count;
+}
+
+/**
+ * The main loop of bftw_impl(), specialized for the given flags.
+ *
+ * @return
+ *         0 once the search is done, or -1 to stop early.
+ */
+static inline BFS_ALWAYS_INLINE int bftw_walk(struct bftw_state *state, struct bftw_spec spec) {
+	while (true) {
+		while (true) {
+			if (bftw_reap(state) != 0) {
+				return -1;
+			}
+			if (!bftw_pop_dir(state)) {
+				break;
+			}
+
+			if (bftw_opendir(state) != 0) {
+				return -1;
+			}
+			while (bftw_readdir(state) > 0) {
+				if (bftw_visit_spec(state, state->de->name, spec) != 0) {
+					return -1;
+				}
+			}
+			if (bftw_closedir(state, spec) != 0) {
+				return -1;
+			}
+		}
+
+		if (!bftw_pop_file(state)) {
+			// Finished deletions may lead to more post-order visits
+			if (state->deleted.head) {
+				continue;
+			} else if (state->unlinking > 0) {
+				bftw_ioq_pop(state, true);
+				continue;
+			}
+
+			int ret = bftw_more_roots(state);
+			if (ret < 0) {
+				return -1;
+			} else if (ret == 0) {
+				return 0;
+			}
+			continue;
+		}
+		if (bftw_visit_spec(state, NULL, spec) != 0) {
+			return -1;
+		}
+	}
+}
+
+/** Flags that make every file need extra work. */
+#define BFTW_SPEC_SLOW (BFTW_STAT | BFTW_FOLLOW_ALL | BFTW_DETECT_CYCLES \
+	| BFTW_SKIP_MOUNTS | BFTW_PRUNE_MOUNTS | BFTW_SORT | BFTW_INO_ORDER)
+
+/** Files are visited as they're read, and nothing needs a stat(). */
+static const struct bftw_spec bftw_spec_direct = {
+	.known = BFTW_SPEC_SLOW | BFTW_BUFFER,
+	.set = 0,
+};
+
+/** Files are buffered (e.g. for prefetching), but nothing else is unusual. */
+static const struct bftw_spec bftw_spec_buffered = {
+	.known = BFTW_SPEC_SLOW | BFTW_BUFFER,
+	.set = BFTW_BUFFER,
+};
+
+/** Check if the flags match a specialization. */
+static bool bftw_spec_match(const struct bftw_state *state, struct bftw_spec spec) {
+	return (state->flags & spec.known) == spec.set;
+}
+
+/**
+ * bftw() implementation for simple breadth-/depth-first search.
+ *
+ * @param listings
+ *         Saved directory listings to use and add to, if any.
+ */
+static int bftw_impl(const struct bftw_args *args, struct bftw_listings *listings) {
+	struct bftw_state state;
+	if (bftw_state_init(&state, args) != 0) {
+		return -1;
+	}
+
+	// The index needs to see every directory it records
+	if (!state.index) {
+		state.listings = listings;
+	}
+
+	for (size_t i = 0; i < args->npaths; ++i) {
+		if (bftw_visit(&state, args->paths[i]) != 0) {
+			goto done;
+		}
+	}
+	bftw_batch_finish(&state, BFTW_SPEC_GENERIC);
+
+	// Pick the most specialized loop once, rather than testing the flags
+	// for every file
+	if (bftw_spec_match(&state, bftw_spec_direct)) {
+		bftw_walk(&state, bftw_spec_direct);
+	} else if (bftw_spec_match(&state, bftw_spec_buffered)) {
+		bftw_walk(&state, bftw_spec_buffered);
+	} else {
+		bftw_walk(&state, BFTW_SPEC_GENERIC);
+	}
+
+done:
+	return bftw_state_destroy(&state);
+}
+
+/**
+ * Iterative deepening search state.
+ */
+struct bftw_ids_state {
+	/** The wrapped callback. */
+	bftw_callback *delegate;
+	/** The wrapped callback arguments. */
+	void *ptr;
+	/** Which visit this search corresponds to. */
+	enum bftw_visit visit;
+	/** Whether to override the bftw_visit. */
+	bool force_visit;
+	/** The current minimum depth (inclusive). */
+	size_t min_depth;
+	/** The current maximum depth (exclusive). */
+	size_t max_depth;
+	/** The set of pruned paths. */
+	struct trie pruned;
+	/** Directory listings saved from previous passes. */
+	struct bftw_listings listings;
+	/** An error code to report. */
+	int error;
+	/** Whether the bottom has been found. */
+	bool bottom;
+	/** Whether to quit the search. */
+	bool quit;
+};
+
+/** Iterative deepening callback function. */
+static enum bftw_action bftw_ids_callback(const struct BFTW *ftwbuf, void *ptr) {
+	struct bftw_ids_state *state = ptr;
+
+	if (state->force_visit) {
+		struct BFTW *mutbuf = (struct BFTW *)ftwbuf;
+		mutbuf->visit = state->visit;
+	}
+
+	if (ftwbuf->type == BFS_ERROR) {
+		if (ftwbuf->depth + 1 >= state->min_depth) {
+			return state->delegate(ftwbuf, state->ptr);
+		} else {
+			return BFTW_PRUNE;
+		}
+	}
+
+	if (ftwbuf->depth < state->min_depth) {
+		if (trie_find_str(&state->pruned, ftwbuf->path)) {
+			return BFTW_PRUNE;
+		} else {
+			return BFTW_CONTINUE;
+		}
+	} else if (state->visit == BFTW_POST) {
+		if (trie_find_str(&state->pruned, ftwbuf->path)) {
+			return BFTW_PRUNE;
+		}
+	}
+
+	enum bftw_action ret = BFTW_CONTINUE;
+	if (ftwbuf->visit == state->visit) {
+		ret = state->delegate(ftwbuf, state->ptr);
+	}
+
+	switch (ret) {
+	case BFTW_CONTINUE:
+		if (ftwbuf->type == BFS_DIR && ftwbuf->depth + 1 >= state->max_depth) {
+			state->bottom = false;
+			ret = BFTW_PRUNE;
+		}
+		break;
+	case BFTW_PRUNE:
+		if (ftwbuf->type == BFS_DIR) {
+			if (!trie_insert_str(&state->pruned, ftwbuf->path)) {
+				state->error = errno;
+				state->quit = true;
+				ret = BFTW_STOP;
+			}
+		}
+		break;
+	case BFTW_STOP:
+		state->quit = true;
+		break;
+	case BFTW_DELETE:
+		break;
+	}
+
+	return ret;
+}
+
+/** Initialize iterative deepening state. */
+static void bftw_ids_init(const struct bftw_args *args, struct bftw_ids_state *state, struct bftw_args *ids_args) {
+	state->delegate = args->callback;
+	state->ptr = args->ptr;
+	state->visit = BFTW_PRE;
+	state->force_visit = false;
+	state->min_depth = 0;
+	state->max_depth = 1;
+	trie_init(&state->pruned);
+	bftw_listings_init(&state->listings);
+	state->error = 0;
+	state->bottom = false;
+	state->quit = false;
+
+	*ids_args = *args;
+	ids_args->callback = bftw_ids_callback;
+	ids_args->ptr = state;
+	// Files are visited repeatedly, and the filters would see the wrong ptr
+	ids_args->filter = NULL;
+	ids_args->batch = NULL;
+	ids_args->flags &= ~BFTW_POST_ORDER;
+	// Saved listings are checked against the directory timestamps
+	ids_args->stat_fields |= BFTW_LISTING_FIELDS;
+}
 
-	size_t pathlen = file ? file->nameoff + file->namelen : 0;
-	if (dstresize(&state->path, pathlen) != 0) {
+/** Finish an iterative deepening search. */
+static int bftw_ids_finish(struct bftw_ids_state *state) {
+	int ret = 0;
+
+	if (state->error) {
+		ret = -1;
+	} else {
 		state->error = errno;
-		return -1;
 	}
 
-	// Try to find a common ancestor with the existing path
-	const struct bftw_file *ancestor = state->previous;
-	while (ancestor && ancestor->depth > file->depth) {
-		ancestor = ancestor->parent;
-	}
+	trie_destroy(&state->pruned);
+	bftw_listings_destroy(&state->listings);
 
-	// Build the path backwards
-	while (file && file != ancestor) {
-		if (file->nameoff > 0) {
-			state->path[file->nameoff - 1] = '/';
-		}
-		memcpy(state->path + file->nameoff, file->name, file->namelen);
+	errno = state->error;
+	return ret;
+}
 
-		if (ancestor && ancestor->depth == file->depth) {
-			ancestor = ancestor->parent;
-		}
-		file = file->parent;
-	}
+/**
+ * Iterative deepening bftw() wrapper.
+ */
+static int bftw_ids(const struct bftw_args *args) {
+	struct bftw_ids_state state;
+	struct bftw_args ids_args;
+	bftw_ids_init(args, &state, &ids_args);
 
-	state->previous = state->file;
+	while (!state.quit && !state.bottom) {
+		state.bottom = true;
 
-	if (name) {
-		if (pathlen > 0 && state->path[pathlen - 1] != '/') {
-			if (dstrapp(&state->path, '/') != 0) {
-				state->error = errno;
-				return -1;
-			}
-		}
-		if (dstrcat(&state->path, name) != 0) {
-			state->error = errno;
-			return -1;
+		if (bftw_impl(&ids_args, &state.listings) != 0) {
+			state.error = errno;
+			state.quit = true;
 		}
-	}
-
-	return 0;
-}
 
-/** Open a bftw_file as a directory. */
-static struct bfs_dir *bftw_file_opendir(struct bftw_state *state, struct bftw_file *file, const char *path) {
-	int fd = bftw_file_open(state, file, path);
-	if (fd < 0) {
-		return NULL;
+		++state.min_depth;
+		++state.max_depth;
 	}
 
-	struct bftw_cache *cache = &state->cache;
-	struct bfs_dir *dir = bftw_allocdir(cache);
-	if (!dir) {
-		return NULL;
-	}
+	if (args->flags & BFTW_POST_ORDER) {
+		state.visit = BFTW_POST;
+		state.force_visit = true;
 
-	if (bfs_opendir(dir, fd, NULL) != 0) {
-		bftw_freedir(cache, dir);
-		return NULL;
+		while (!state.quit && state.min_depth > 0) {
+			--state.max_depth;
+			--state.min_depth;
+
+			if (bftw_impl(&ids_args, &state.listings) != 0) {
+				state.error = errno;
+				state.quit = true;
+			}
+		}
 	}
 
-	bftw_file_set_dir(cache, file, dir);
-	return dir;
+	return bftw_ids_finish(&state);
 }
 
-/** Open the current directory. */
-static int bftw_opendir(struct bftw_state *state) {
-	bfs_assert(!state->dir);
-	bfs_assert(!state->de);
+/**
+ * Exponential deepening bftw() wrapper.
+ */
+static int bftw_eds(const struct bftw_args *args) {
+	struct bftw_ids_state state;
+	struct bftw_args ids_args;
+	bftw_ids_init(args, &state, &ids_args);
 
-	state->direrror = 0;
+	while (!state.quit && !state.bottom) {
+		state.bottom = true;
 
-	struct bftw_file *file = state->file;
-	state->dir = file->dir;
-	if (state->dir) {
-		return 0;
-	}
+		if (bftw_impl(&ids_args, &state.listings) != 0) {
+			state.error = errno;
+			state.quit = true;
+		}
 
-	if (bftw_build_path(state, NULL) != 0) {
-		return -1;
+		state.min_depth = state.max_depth;
+		state.max_depth *= 2;
 	}
 
-	state->dir = bftw_file_opendir(state, file, state->path);
-	if (!state->dir) {
-		state->direrror = errno;
+	if (!state.quit && (args->flags & BFTW_POST_ORDER)) {
+		state.visit = BFTW_POST;
+		state.min_depth = 0;
+		ids_args.flags |= BFTW_POST_ORDER;
+
+		if (bftw_impl(&ids_args, &state.listings) != 0) {
+			state.error = errno;
+		}
 	}
 
-	return 0;
+	return bftw_ids_finish(&state);
 }
 
-/** Read an entry from the current directory. */
-static int bftw_readdir(struct bftw_state *state) {
-	if (!state->dir) {
-		return -1;
-	}
+/**
+ * A directory to be read by a parallel search.
+ */
+struct bftw_task {
+	/** The parent directory, if any. */
+	struct bftw_task *parent;
+	/** Reference count (this task, plus its live children). */
+	atomic size_t refcount;
 
-	int ret = bfs_readdir(state->dir, &state->de_storage);
-	if (ret > 0) {
-		state->de = &state->de_storage;
-	} else if (ret == 0) {
-		state->de = NULL;
-	} else {
-		state->de = NULL;
-		state->direrror = errno;
-	}
+	/** Deque links. */
+	struct bftw_task *prev;
+	struct bftw_task *next;
 
-	return ret;
-}
+	/** The root path this directory was found under. */
+	const char *root;
+	/** The depth of this directory. */
+	size_t depth;
+	/** The device number, for cycle and mount detection. */
+	dev_t dev;
+	/** The inode number, for cycle detection. */
+	ino_t ino;
+	/** Whether reading this directory found no entries. */
+	bool empty;
 
-/** Check if a stat() call is needed for this visit. */
-static bool bftw_need_stat(const struct bftw_state *state) {
-	if (state->flags & BFTW_STAT) {
-		return true;
-	}
+	/** The offset of the directory name in the path. */
+	size_t nameoff;
+	/** The length of the path. */
+	size_t pathlen;
+	/** The full path to this directory. */
+	char path[];
+};
 
-	const struct BFTW *ftwbuf = &state->ftwbuf;
-	if (ftwbuf->type == BFS_UNKNOWN) {
-		return true;
-	}
+/**
+ * A work-stealing deque of tasks.  The owning worker pushes and pops from the
+ * tail, while other workers steal from the head.
+ */
+struct bftw_deque {
+	/** Protects the list. */
+	cache_align pthread_mutex_t mutex;
+	/** The oldest task. */
+	struct bftw_task *head;
+	/** The newest task. */
+	struct bftw_task *tail;
+};
 
-	if (ftwbuf->type == BFS_LNK && !(ftwbuf->stat_flags & BFS_STAT_NOFOLLOW)) {
-		return true;
-	}
+/**
+ * A parallel search worker.
+ */
+struct bftw_worker {
+	/** The shared search state. */
+	struct bftw_par *par;
+	/** This worker's index. */
+	size_t index;
+	/** The thread handle. */
+	pthread_t id;
+	/** Whether the thread was started. */
+	bool started;
+
+	/** This worker's task queue. */
+	struct bftw_deque deque;
+	/** This worker's cache of free tasks. */
+	struct tvarena_cache tasks;
+	/** A directory buffer. */
+	struct bfs_dir *dir;
+	/** The path buffer. */
+	char *path;
+};
 
-	if (ftwbuf->type == BFS_DIR) {
-		if (state->flags & (BFTW_DETECT_CYCLES | BFTW_SKIP_MOUNTS | BFTW_PRUNE_MOUNTS)) {
-			return true;
-		}
-#if __linux__
-	} else if (state->mtab) {
-		// Linux fills in d_type from the underlying inode, even when
-		// the directory entry is a bind mount point.  In that case, we
-		// need to stat() to get the correct type.  We don't need to
-		// check for directories because they can only be mounted over
-		// by other directories.
-		if (bfs_might_be_mount(state->mtab, ftwbuf->path)) {
-			return true;
-		}
-#endif
-	}
+/**
+ * Shared state for a parallel search.
+ */
+struct bftw_par {
+	/** The bftw() arguments. */
+	const struct bftw_args *args;
 
-	return false;
-}
+	/** Serializes callbacks. */
+	pthread_mutex_t mutex;
+	/** The first error encountered (protected by mutex). */
+	int error;
+	/** Whether the search should stop. */
+	atomic bool quit;
+
+	/** The number of tasks that are queued or being read. */
+	atomic size_t pending;
+	/** The number of queued tasks. */
+	atomic size_t nqueued;
+	/** The number of idle workers. */
+	atomic size_t nidle;
+	/** Protects idle workers from missing wakeups. */
+	pthread_mutex_t idle_mutex;
+	/** Signalled when tasks are queued or the search ends. */
+	pthread_cond_t idle_cond;
+
+	/** Allocates tasks. */
+	struct tvarena tasks;
+
+	/** The number of workers. */
+	size_t nworkers;
+	/** The workers themselves. */
+	struct bftw_worker workers[];
+};
 
-/** Initialize bftw_stat cache. */
-static void bftw_stat_init(struct bftw_stat *cache) {
-	cache->buf = NULL;
-	cache->error = 0;
+/** Wake up all idle workers. */
+static void bftw_par_wake_all(struct bftw_par *par) {
+	mutex_lock(&par->idle_mutex);
+	cond_broadcast(&par->idle_cond);
+	mutex_unlock(&par->idle_mutex);
 }
 
-/** Open a file if necessary. */
-static int bftw_ensure_open(struct bftw_state *state, struct bftw_file *file, const char *path) {
-	int ret = file->fd;
-
-	if (ret < 0) {
-		char *copy = strndup(path, file->nameoff + file->namelen);
-		if (!copy) {
-			return -1;
-		}
-
-		ret = bftw_file_open(state, file, copy);
-		free(copy);
+/** Record an error and stop the search. */
+static void bftw_par_fail(struct bftw_par *par, int error) {
+	mutex_lock(&par->mutex);
+	if (!par->error) {
+		par->error = error;
 	}
+	mutex_unlock(&par->mutex);
 
-	return ret;
+	store(&par->quit, true, relaxed);
+	bftw_par_wake_all(par);
 }
 
-/** Initialize the buffers with data about the current path. */
-static void bftw_init_ftwbuf(struct bftw_state *state, enum bftw_visit visit) {
-	struct bftw_file *file = state->file;
-	const struct bfs_dirent *de = state->de;
-
-	struct BFTW *ftwbuf = &state->ftwbuf;
-	ftwbuf->path = state->path;
-	ftwbuf->root = file ? file->root->name : ftwbuf->path;
-	ftwbuf->depth = 0;
-	ftwbuf->visit = visit;
-	ftwbuf->type = BFS_UNKNOWN;
-	ftwbuf->error = state->direrror;
-	ftwbuf->at_fd = AT_FDCWD;
-	ftwbuf->at_path = ftwbuf->path;
-	ftwbuf->stat_flags = BFS_STAT_NOFOLLOW;
-	bftw_stat_init(&ftwbuf->lstat_cache);
-	bftw_stat_init(&ftwbuf->stat_cache);
+/** Check if the search should stop. */
+static bool bftw_par_quit(struct bftw_par *par) {
+	return load(&par->quit, relaxed);
+}
 
-	struct bftw_file *parent = NULL;
-	if (de) {
-		parent = file;
-		ftwbuf->depth = file->depth + 1;
-		ftwbuf->type = de->type;
-		ftwbuf->nameoff = bftw_child_nameoff(file);
-	} else if (file) {
-		parent = file->parent;
-		ftwbuf->depth = file->depth;
-		ftwbuf->type = file->type;
-		ftwbuf->nameoff = file->nameoff;
+/** Create a task for a directory. */
+static struct bftw_task *bftw_task_new(struct bftw_worker *worker, struct bftw_task *parent, const struct BFTW *ftwbuf) {
+	size_t pathlen = strlen(ftwbuf->path);
+	struct bftw_task *task = tvarena_alloc(&worker->par->tasks, &worker->tasks, pathlen + 1);
+	if (!task) {
+		return NULL;
 	}
 
+	task->parent = parent;
 	if (parent) {
-		// Try to ensure the immediate parent is open, to avoid ENAMETOOLONG
-		if (bftw_ensure_open(state, parent, state->path) >= 0) {
-			ftwbuf->at_fd = parent->fd;
-			ftwbuf->at_path += ftwbuf->nameoff;
-		} else {
-			ftwbuf->error = errno;
-		}
+		fetch_add(&parent->refcount, 1, relaxed);
 	}
+	atomic_init(&task->refcount, 1);
 
-	if (ftwbuf->depth == 0) {
-		// Compute the name offset for root paths like "foo/bar"
-		ftwbuf->nameoff = xbaseoff(ftwbuf->path);
-	}
+	task->prev = task->next = NULL;
+	task->root = ftwbuf->root;
+	task->depth = ftwbuf->depth;
 
-	if (ftwbuf->error != 0) {
-		ftwbuf->type = BFS_ERROR;
-		return;
+	const struct bfs_stat *statbuf = bftw_cached_stat(ftwbuf, ftwbuf->stat_flags);
+	if (statbuf) {
+		task->dev = statbuf->dev;
+		task->ino = statbuf->ino;
+	} else {
+		task->dev = -1;
+		task->ino = -1;
 	}
+	task->empty = false;
 
-	int follow_flags = BFTW_FOLLOW_ALL;
-	if (ftwbuf->depth == 0) {
-		follow_flags |= BFTW_FOLLOW_ROOTS;
+	task->nameoff = ftwbuf->nameoff;
+	task->pathlen = pathlen;
+	memcpy(task->path, ftwbuf->path, pathlen + 1);
+	return task;
+}
+
+/** Queue a task on a worker's deque. */
+static void bftw_par_push(struct bftw_worker *worker, struct bftw_task *task) {
+	struct bftw_par *par = worker->par;
+	struct bftw_deque *deque = &worker->deque;
+
+	fetch_add(&par->pending, 1, relaxed);
+	// Count the task before it becomes visible, so nqueued can't underflow
+	fetch_add(&par->nqueued, 1, seq_cst);
+	bftw_progress_queued(par->args->progress, true);
+
+	mutex_lock(&deque->mutex);
+	LIST_APPEND(deque, task);
+	mutex_unlock(&deque->mutex);
+
+	if (load(&par->nidle, seq_cst) > 0) {
+		mutex_lock(&par->idle_mutex);
+		cond_signal(&par->idle_cond);
+		mutex_unlock(&par->idle_mutex);
 	}
-	bool follow = state->flags & follow_flags;
-	if (follow) {
-		ftwbuf->stat_flags = BFS_STAT_TRYFOLLOW;
+}
+
+/** Pop a task from a deque, from the head (steal) or the tail (own). */
+static struct bftw_task *bftw_deque_pop(struct bftw_deque *deque, bool steal) {
+	mutex_lock(&deque->mutex);
+	struct bftw_task *task = steal ? deque->head : deque->tail;
+	if (task) {
+		LIST_REMOVE(deque, task);
 	}
+	mutex_unlock(&deque->mutex);
+	return task;
+}
 
-	const struct bfs_stat *statbuf = NULL;
-	if (bftw_need_stat(state)) {
-		statbuf = bftw_stat(ftwbuf, ftwbuf->stat_flags);
-		if (statbuf) {
-			ftwbuf->type = bfs_mode_to_type(statbuf->mode);
-		} else {
-			ftwbuf->type = BFS_ERROR;
-			ftwbuf->error = errno;
-			return;
-		}
+/** Get the next task for a worker, stealing one if necessary. */
+static struct bftw_task *bftw_par_pop(struct bftw_worker *worker) {
+	struct bftw_par *par = worker->par;
+	if (load(&par->nqueued, seq_cst) == 0) {
+		return NULL;
 	}
 
-	if (ftwbuf->type == BFS_DIR && (state->flags & BFTW_DETECT_CYCLES)) {
-		for (const struct bftw_file *ancestor = parent; ancestor; ancestor = ancestor->parent) {
-			if (ancestor->dev == statbuf->dev && ancestor->ino == statbuf->ino) {
-				ftwbuf->type = BFS_ERROR;
-				ftwbuf->error = ELOOP;
-				return;
-			}
-		}
+	struct bftw_task *task = bftw_deque_pop(&worker->deque, false);
+	for (size_t i = 1; !task && i < par->nworkers; ++i) {
+		struct bftw_worker *victim = &par->workers[(worker->index + i) % par->nworkers];
+		task = bftw_deque_pop(&victim->deque, true);
 	}
-}
 
-/** Check if the current file is a mount point. */
-static bool bftw_is_mount(struct bftw_state *state, const char *name) {
-	const struct bftw_file *file = state->file;
-	if (!file) {
-		return false;
+	if (task) {
+		fetch_sub(&par->nqueued, 1, seq_cst);
+		bftw_progress_queued(par->args->progress, false);
 	}
+	return task;
+}
 
-	const struct bftw_file *parent = name ? file : file->parent;
+/** Check if a file is a mount point. */
+static bool bftw_par_is_mount(const struct BFTW *ftwbuf, const struct bftw_task *parent) {
 	if (!parent) {
 		return false;
 	}
 
-	const struct BFTW *ftwbuf = &state->ftwbuf;
 	const struct bfs_stat *statbuf = bftw_stat(ftwbuf, ftwbuf->stat_flags);
 	return statbuf && statbuf->dev != parent->dev;
 }
 
-/** Invoke the callback. */
-static enum bftw_action bftw_call_back(struct bftw_state *state, const char *name, enum bftw_visit visit) {
-	if (visit == BFTW_POST && !(state->flags & BFTW_POST_ORDER)) {
-		return BFTW_PRUNE;
+/**
+ * Handle BFTW_DELETE.  This runs outside the callback lock, so deletions
+ * proceed in parallel.  Each worker finishes a directory's children before
+ * releasing it, so they're always gone before its post-order visit.
+ */
+static int bftw_par_delete(const struct BFTW *ftwbuf) {
+	// Delete symbolic links themselves, not what they point to
+	enum bfs_type type = bftw_type(ftwbuf, BFS_STAT_NOFOLLOW);
+	if (type == BFS_ERROR) {
+		return -1;
 	}
 
-	if (bftw_build_path(state, name) != 0) {
-		return BFTW_STOP;
+	int flags = type == BFS_DIR ? AT_REMOVEDIR : 0;
+	return unlinkat(ftwbuf->at_fd, ftwbuf->at_path, flags);
+}
+
+/** Invoke the callback for a file, queueing it if it should be descended into. */
+static void bftw_par_visit(struct bftw_worker *worker, struct BFTW *ftwbuf, struct bftw_task *parent) {
+	struct bftw_par *par = worker->par;
+	const struct bftw_args *args = par->args;
+	enum bftw_flags flags = args->flags;
+
+	if (ftwbuf->type == BFS_ERROR && !(flags & BFTW_RECOVER)) {
+		bftw_par_fail(par, ftwbuf->error);
+		return;
 	}
 
-	const struct BFTW *ftwbuf = &state->ftwbuf;
-	bftw_init_ftwbuf(state, visit);
+	if ((flags & BFTW_SKIP_MOUNTS) && bftw_par_is_mount(ftwbuf, parent)) {
+		return;
+	}
 
-	// Never give the callback BFS_ERROR unless BFTW_RECOVER is specified
-	if (ftwbuf->type == BFS_ERROR && !(state->flags & BFTW_RECOVER)) {
-		state->error = ftwbuf->error;
-		return BFTW_STOP;
+	// Run the filter on this thread, outside the callback lock
+	if (args->filter && ftwbuf->visit == BFTW_PRE && ftwbuf->type != BFS_ERROR) {
+		ftwbuf->filtered = args->filter(ftwbuf, args->ptr);
 	}
 
-	if ((state->flags & BFTW_SKIP_MOUNTS) && bftw_is_mount(state, name)) {
-		return BFTW_PRUNE;
+	mutex_lock(&par->mutex);
+	enum bftw_action ret = BFTW_STOP;
+	if (!bftw_par_quit(par)) {
+		ret = args->callback(ftwbuf, args->ptr);
 	}
+	mutex_unlock(&par->mutex);
+	bftw_xattrs_close(&ftwbuf->xattr_cache);
 
-	enum bftw_action ret = state->callback(ftwbuf, state->ptr);
 	switch (ret) {
 	case BFTW_CONTINUE:
-		if (visit != BFTW_PRE) {
-			return BFTW_PRUNE;
-		}
-		if (ftwbuf->type != BFS_DIR) {
-			return BFTW_PRUNE;
-		}
-		if ((state->flags & BFTW_PRUNE_MOUNTS) && bftw_is_mount(state, name)) {
-			return BFTW_PRUNE;
-		}
-		fallthru;
+		break;
 	case BFTW_PRUNE:
+		return;
 	case BFTW_STOP:
-		return ret;
-
+		store(&par->quit, true, relaxed);
+		bftw_par_wake_all(par);
+		return;
+	case BFTW_DELETE:
+		if (bftw_par_delete(ftwbuf) != 0) {
+			// Report the failure by visiting the file again
+			ftwbuf->type = BFS_ERROR;
+			ftwbuf->error = errno;
+			bftw_par_visit(worker, ftwbuf, parent);
+		}
+		return;
 	default:
-		state->error = EINVAL;
-		return BFTW_STOP;
+		bftw_par_fail(par, EINVAL);
+		return;
 	}
-}
-
-/**
- * Flags controlling which files get visited when done with a directory.
- */
-enum bftw_gc_flags {
-	/** Don't visit anything. */
-	BFTW_VISIT_NONE = 0,
-	/** Report directory errors. */
-	BFTW_VISIT_ERROR = 1 << 0,
-	/** Visit the file itself. */
-	BFTW_VISIT_FILE = 1 << 1,
-	/** Visit the file's ancestors. */
-	BFTW_VISIT_PARENTS = 1 << 2,
-	/** Visit both the file and its ancestors. */
-	BFTW_VISIT_ALL = BFTW_VISIT_ERROR | BFTW_VISIT_FILE | BFTW_VISIT_PARENTS,
-};
-
-/** Garbage collect the current file and its parents. */
-static int bftw_gc(struct bftw_state *state, enum bftw_gc_flags flags) {
-	int ret = 0;
 
-	struct bftw_file *file = state->file;
-	if (file && file->dir) {
-		bftw_cache_unpin(&state->cache, file);
-		SLIST_APPEND(&state->to_close, file);
+	if (ftwbuf->visit != BFTW_PRE || ftwbuf->type != BFS_DIR) {
+		return;
 	}
-	state->dir = NULL;
-	state->de = NULL;
 
-	if (state->direrror != 0) {
-		if (flags & BFTW_VISIT_ERROR) {
-			if (bftw_call_back(state, NULL, BFTW_PRE) == BFTW_STOP) {
-				ret = -1;
-				flags = 0;
-			}
-		} else {
-			state->error = state->direrror;
-		}
+	if ((flags & BFTW_PRUNE_MOUNTS) && bftw_par_is_mount(ftwbuf, parent)) {
+		return;
 	}
-	state->direrror = 0;
 
-	while ((file = SLIST_POP(&state->to_close))) {
-		bftw_unwrapdir(state, file);
+	struct bftw_task *task = bftw_task_new(worker, parent, ftwbuf);
+	if (!task) {
+		bftw_par_fail(par, errno);
+		return;
 	}
 
-	enum bftw_gc_flags visit = BFTW_VISIT_FILE;
-	while ((file = state->file)) {
-		if (--file->refcount > 0) {
-			state->file = NULL;
-			break;
-		}
+	bftw_par_push(worker, task);
+}
 
-		if (flags & visit) {
-			if (bftw_call_back(state, NULL, BFTW_POST) == BFTW_STOP) {
-				ret = -1;
-				flags = 0;
-			}
-		}
-		visit = BFTW_VISIT_PARENTS;
+/** Initialize the bftw() buffer for a task's own directory. */
+static void bftw_par_init_dir(struct BFTW *ftwbuf, const struct bftw_task *task, const struct bftw_args *args, enum bftw_visit visit) {
+	ftwbuf->path = task->path;
+	ftwbuf->nameoff = task->nameoff;
+	ftwbuf->root = task->root;
+	ftwbuf->depth = task->depth;
+	ftwbuf->visit = visit;
+	ftwbuf->type = BFS_DIR;
+	ftwbuf->error = 0;
+	ftwbuf->at_fd = AT_FDCWD;
+	ftwbuf->at_path = task->path;
+	ftwbuf->stat_flags = bftw_stat_flags(args->flags, task->depth);
+	ftwbuf->stat_fields = bftw_stat_fields(args);
+	bftw_stat_init(&ftwbuf->lstat_cache);
+	bftw_stat_init(&ftwbuf->stat_cache);
+	bftw_xattrs_init(&ftwbuf->xattr_cache, args->flags);
+	ftwbuf->link_target = NULL;
+	ftwbuf->filtered = -1;
+	ftwbuf->was_empty = visit == BFTW_POST && task->empty;
+}
 
-		struct bftw_file *parent = file->parent;
-		if (state->previous == file) {
-			state->previous = parent;
-		}
-		state->file = parent;
+/** Report an error reading a task's directory. */
+static void bftw_par_dir_error(struct bftw_worker *worker, struct bftw_task *task, int error) {
+	struct BFTW ftwbuf;
+	bftw_par_init_dir(&ftwbuf, task, worker->par->args, BFTW_PRE);
+	ftwbuf.type = BFS_ERROR;
+	ftwbuf.error = error;
+	bftw_par_visit(worker, &ftwbuf, task->parent);
+}
 
-		if (file->fd >= 0) {
-			bftw_close(state, file);
+/** Drop a reference to a task, doing any post-order visits. */
+static void bftw_task_release(struct bftw_worker *worker, struct bftw_task *task) {
+	struct bftw_par *par = worker->par;
+	enum bftw_flags flags = par->args->flags;
+
+	while (task && fetch_sub(&task->refcount, 1, acq_rel) == 1) {
+		struct bftw_task *parent = task->parent;
+
+		if ((flags & BFTW_POST_ORDER) && !bftw_par_quit(par)) {
+			struct BFTW ftwbuf;
+			bftw_par_init_dir(&ftwbuf, task, par->args, BFTW_POST);
+			bftw_par_visit(worker, &ftwbuf, parent);
 		}
-		bftw_file_free(&state->cache, file);
+
+		tvarena_free(&par->tasks, &worker->tasks, task, task->pathlen + 1);
+		task = parent;
 	}
+}
 
-	return ret;
+/** Open a task's directory, one component at a time if the path is too long. */
+static int bftw_task_open(const struct bftw_task *task) {
+	int flags = O_RDONLY | O_CLOEXEC | O_DIRECTORY;
+	uint64_t start = perf_start();
+	int fd = openat(AT_FDCWD, task->path, flags);
+	perf_stop(PERF_OPEN, start);
+	if (fd >= 0 || errno != ENAMETOOLONG || !task->parent) {
+		return fd;
+	}
+
+	int dfd = bftw_task_open(task->parent);
+	if (dfd < 0) {
+		return -1;
+	}
+
+	fd = openat(dfd, task->path + task->nameoff, flags);
+	close_quietly(dfd);
+	return fd;
 }
 
-/** Sort a bftw_list by filename. */
-static void bftw_list_sort(struct bftw_list *list) {
-	if (!list->head || !list->head->next) {
+/** Read a task's directory, visiting all its entries. */
+static void bftw_par_read(struct bftw_worker *worker, struct bftw_task *task) {
+	struct bftw_par *par = worker->par;
+	const struct bftw_args *args = par->args;
+	enum bftw_flags flags = args->flags;
+
+	int fd = bftw_task_open(task);
+	if (fd < 0) {
+		bftw_par_dir_error(worker, task, errno);
 		return;
 	}
 
-	struct bftw_list left, right;
-	SLIST_INIT(&left);
-	SLIST_INIT(&right);
+	struct bfs_dir *dir = worker->dir;
+	if (bfs_opendir(dir, fd, NULL) != 0) {
+		int error = errno;
+		close_quietly(fd);
+		bftw_par_dir_error(worker, task, error);
+		return;
+	}
 
-	// Split
-	for (struct bftw_file *hare = list->head; hare && (hare = hare->next); hare = hare->next) {
-		struct bftw_file *tortoise = SLIST_POP(list);
-		SLIST_APPEND(&left, tortoise);
+	size_t nameoff = task->pathlen;
+	if (dstrxcpy(&worker->path, task->path, task->pathlen) != 0) {
+		goto fail;
+	}
+	if (nameoff > 0 && task->path[nameoff - 1] != '/') {
+		if (dstrapp(&worker->path, '/') != 0) {
+			goto fail;
+		}
+		++nameoff;
 	}
-	SLIST_EXTEND(&right, list);
 
-	// Recurse
-	bftw_list_sort(&left);
-	bftw_list_sort(&right);
+	int error = 0;
+	bool empty = true;
+	while (!bftw_par_quit(par)) {
+		struct bfs_dirent de;
+		int ret = bfs_readdir(dir, &de);
+		if (ret < 0) {
+			error = errno;
+			break;
+		} else if (ret == 0) {
+			task->empty = empty;
+			break;
+		}
+		empty = false;
 
-	// Merge
-	while (left.head && right.head) {
-		struct bftw_file *lf = left.head;
-		struct bftw_file *rf = right.head;
+		if (dstresize(&worker->path, nameoff) != 0 || dstrcat(&worker->path, de.name) != 0) {
+			goto fail;
+		}
 
-		if (strcoll(lf->name, rf->name) <= 0) {
-			SLIST_POP(&left);
-			SLIST_APPEND(list, lf);
-		} else {
-			SLIST_POP(&right);
-			SLIST_APPEND(list, rf);
+		struct BFTW ftwbuf;
+		ftwbuf.path = worker->path;
+		ftwbuf.nameoff = nameoff;
+		ftwbuf.root = task->root;
+		ftwbuf.depth = task->depth + 1;
+		ftwbuf.visit = BFTW_PRE;
+		ftwbuf.type = de.type;
+		ftwbuf.error = 0;
+		ftwbuf.at_fd = bfs_dirfd(dir);
+		ftwbuf.at_path = worker->path + nameoff;
+		ftwbuf.stat_flags = bftw_stat_flags(flags, ftwbuf.depth);
+		ftwbuf.stat_fields = bftw_stat_fields(args);
+		bftw_stat_init(&ftwbuf.lstat_cache);
+		bftw_stat_init(&ftwbuf.stat_cache);
+		bftw_xattrs_init(&ftwbuf.xattr_cache, flags);
+		ftwbuf.link_target = NULL;
+		ftwbuf.filtered = -1;
+		ftwbuf.was_empty = false;
+
+		const struct bfs_stat *statbuf = NULL;
+		if (bftw_must_stat(flags, args->mtab, ftwbuf.depth, ftwbuf.type, ftwbuf.path)) {
+			statbuf = bftw_stat(&ftwbuf, ftwbuf.stat_flags);
+			if (statbuf) {
+				ftwbuf.type = bfs_mode_to_type(statbuf->mode);
+			} else {
+				ftwbuf.type = BFS_ERROR;
+				ftwbuf.error = errno;
+			}
 		}
-	}
-	SLIST_EXTEND(list, &left);
-	SLIST_EXTEND(list, &right);
-}
 
-/** Finish adding a batch of files. */
-static void bftw_batch_finish(struct bftw_state *state) {
-	if (state->flags & BFTW_SORT) {
-		bftw_list_sort(&state->batch);
-	}
+		if (ftwbuf.type == BFS_DIR && (flags & BFTW_DETECT_CYCLES)) {
+			for (const struct bftw_task *ancestor = task; ancestor; ancestor = ancestor->parent) {
+				if (ancestor->dev == statbuf->dev && ancestor->ino == statbuf->ino) {
+					ftwbuf.type = BFS_ERROR;
+					ftwbuf.error = ELOOP;
+					break;
+				}
+			}
+		}
 
-	if (state->strategy != BFTW_BFS) {
-		SLIST_EXTEND(&state->batch, &state->to_visit);
+		bftw_par_visit(worker, &ftwbuf, task);
 	}
-	SLIST_EXTEND(&state->to_visit, &state->batch);
-}
 
-/** Close the current directory. */
-static int bftw_closedir(struct bftw_state *state) {
-	if (bftw_gc(state, BFTW_VISIT_ALL) != 0) {
-		return -1;
+	bfs_closedir(dir);
+	if (error) {
+		bftw_par_dir_error(worker, task, error);
 	}
+	return;
 
-	bftw_batch_finish(state);
-	return 0;
+fail:
+	bftw_par_fail(par, errno);
+	bfs_closedir(dir);
 }
 
-/** Fill file identity information from an ftwbuf. */
-static void bftw_save_ftwbuf(struct bftw_file *file, const struct BFTW *ftwbuf) {
-	file->type = ftwbuf->type;
-
-	const struct bfs_stat *statbuf = ftwbuf->stat_cache.buf;
-	if (!statbuf || (ftwbuf->stat_flags & BFS_STAT_NOFOLLOW)) {
-		statbuf = ftwbuf->lstat_cache.buf;
+/** Mark one pending unit of work as done. */
+static void bftw_par_done(struct bftw_par *par) {
+	if (fetch_sub(&par->pending, 1, acq_rel) == 1) {
+		bftw_par_wake_all(par);
 	}
-	if (statbuf) {
-		file->dev = statbuf->dev;
-		file->ino = statbuf->ino;
+}
+
+/** Read a directory popped off a queue. */
+static void bftw_par_run(struct bftw_worker *worker, struct bftw_task *task) {
+	struct bftw_par *par = worker->par;
+	if (!bftw_par_quit(par)) {
+		bftw_par_read(worker, task);
 	}
+	bftw_task_release(worker, task);
+	bftw_par_done(par);
 }
 
-/** Visit and/or enqueue the current file. */
-static int bftw_visit(struct bftw_state *state, const char *name) {
-	struct bftw_file *file = state->file;
+/** The main loop for a parallel search worker. */
+static void bftw_par_work(struct bftw_worker *worker) {
+	struct bftw_par *par = worker->par;
 
-	if (name && (state->flags & BFTW_BUFFER)) {
-		file = bftw_file_new(&state->cache, file, name);
-		if (!file) {
-			state->error = errno;
-			return -1;
+	while (true) {
+		struct bftw_task *task = bftw_par_pop(worker);
+		if (task) {
+			bftw_par_run(worker, task);
+			continue;
 		}
 
-		if (state->de) {
-			file->type = state->de->type;
+		if (load(&par->pending, acquire) == 0) {
+			break;
 		}
 
-		SLIST_APPEND(&state->batch, file);
-		return 0;
+		mutex_lock(&par->idle_mutex);
+		fetch_add(&par->nidle, 1, seq_cst);
+		while (load(&par->nqueued, seq_cst) == 0 && load(&par->pending, seq_cst) > 0) {
+			cond_wait(&par->idle_cond, &par->idle_mutex);
+		}
+		fetch_sub(&par->nidle, 1, seq_cst);
+		mutex_unlock(&par->idle_mutex);
 	}
+}
 
-	switch (bftw_call_back(state, name, BFTW_PRE)) {
-	case BFTW_CONTINUE:
-		if (name) {
-			file = bftw_file_new(&state->cache, state->file, name);
-		} else {
-			state->file = NULL;
-		}
-		if (!file) {
-			state->error = errno;
-			return -1;
-		}
+/** Background thread entry point for the parallel search. */
+static void *bftw_par_thread(void *ptr) {
+	bftw_par_work(ptr);
+	return NULL;
+}
 
-		bftw_save_ftwbuf(file, &state->ftwbuf);
-		bftw_push_dir(state, file);
-		return 0;
+/** Destroy a parallel search. */
+static void bftw_par_destroy(struct bftw_par *par) {
+	for (size_t i = 0; i < par->nworkers; ++i) {
+		struct bftw_worker *worker = &par->workers[i];
+		dstrfree(worker->path);
+		free(worker->dir);
+		tvarena_cache_destroy(&par->tasks, &worker->tasks);
+		mutex_destroy(&worker->deque.mutex);
+	}
 
-	case BFTW_PRUNE:
-		if (file && !name) {
-			return bftw_gc(state, BFTW_VISIT_PARENTS);
-		} else {
-			return 0;
-		}
+	tvarena_destroy(&par->tasks);
 
-	default:
-		return -1;
-	}
+	cond_destroy(&par->idle_cond);
+	mutex_destroy(&par->idle_mutex);
+	mutex_destroy(&par->mutex);
+	free(par);
 }
 
-/**
- * Dispose of the bftw() state.
- *
- * @return
- *         The bftw() return value.
- */
-static int bftw_state_destroy(struct bftw_state *state) {
-	dstrfree(state->path);
+/** Create the state for a parallel search. */
+static struct bftw_par *bftw_par_create(const struct bftw_args *args) {
+	size_t nworkers = args->nthreads + 1;
+	size_t maxworkers = args->nopenfd / 2;
+	if (nworkers > maxworkers) {
+		nworkers = maxworkers;
+	}
+	if (nworkers < 1) {
+		nworkers = 1;
+	}
 
-	struct ioq *ioq = state->ioq;
-	if (ioq) {
-		ioq_cancel(ioq);
-		while (bftw_ioq_pop(state, true) >= 0);
-		state->ioq = NULL;
+	struct bftw_par *par = ZALLOC_FLEX(struct bftw_par, workers, nworkers);
+	if (!par) {
+		return NULL;
+	}
+
+	par->args = args;
+	atomic_init(&par->quit, false);
+	atomic_init(&par->pending, 0);
+	atomic_init(&par->nqueued, 0);
+	atomic_init(&par->nidle, 0);
+
+	if (mutex_init(&par->mutex, NULL) != 0) {
+		goto fail_par;
+	}
+	if (mutex_init(&par->idle_mutex, NULL) != 0) {
+		goto fail_mutex;
+	}
+	if (cond_init(&par->idle_cond, NULL) != 0) {
+		goto fail_idle_mutex;
+	}
+	if (TVARENA_INIT(&par->tasks, struct bftw_task, path) != 0) {
+		goto fail_idle_cond;
 	}
 
-	SLIST_EXTEND(&state->to_visit, &state->batch);
-	do {
-		bftw_gc(state, BFTW_VISIT_NONE);
-	} while (bftw_pop_dir(state) || bftw_pop_file(state));
+	for (size_t i = 0; i < nworkers; ++i) {
+		struct bftw_worker *worker = &par->workers[i];
+		worker->par = par;
+		worker->index = i;
+		LIST_INIT(&worker->deque);
+		tvarena_cache_init(&worker->tasks);
 
-	ioq_destroy(ioq);
+		worker->dir = bfs_allocdir();
+		if (!worker->dir) {
+			goto fail;
+		}
 
-	bftw_cache_destroy(&state->cache);
+		if (mutex_init(&worker->deque.mutex, NULL) != 0) {
+			free(worker->dir);
+			goto fail;
+		}
 
-	errno = state->error;
-	return state->error ? -1 : 0;
+		++par->nworkers;
+	}
+
+	return par;
+
+	int err;
+fail:
+	err = errno;
+	bftw_par_destroy(par);
+	errno = err;
+	return NULL;
+
+fail_idle_cond:
+	err = errno;
+	cond_destroy(&par->idle_cond);
+	errno = err;
+fail_idle_mutex:
+	err = errno;
+	mutex_destroy(&par->idle_mutex);
+	errno = err;
+fail_mutex:
+	err = errno;
+	mutex_destroy(&par->mutex);
+	errno = err;
+fail_par:
+	free(par);
+	return NULL;
 }
 
-/**
- * bftw() implementation for simple breadth-/depth-first search.
- */
-static int bftw_impl(const struct bftw_args *args) {
-	struct bftw_state state;
-	if (bftw_state_init(&state, args) != 0) {
-		return -1;
+/** Visit a root path, queueing it if it's a directory. */
+static void bftw_par_root(struct bftw_worker *worker, const char *path) {
+	struct BFTW ftwbuf;
+	ftwbuf.path = path;
+	ftwbuf.nameoff = xbaseoff(path);
+	ftwbuf.root = path;
+	ftwbuf.depth = 0;
+	ftwbuf.visit = BFTW_PRE;
+	ftwbuf.type = BFS_UNKNOWN;
+	ftwbuf.error = 0;
+	ftwbuf.at_fd = AT_FDCWD;
+	ftwbuf.at_path = path;
+	ftwbuf.stat_flags = bftw_stat_flags(worker->par->args->flags, 0);
+	ftwbuf.stat_fields = bftw_stat_fields(worker->par->args);
+	bftw_stat_init(&ftwbuf.lstat_cache);
+	bftw_stat_init(&ftwbuf.stat_cache);
+	bftw_xattrs_init(&ftwbuf.xattr_cache, worker->par->args->flags);
+	ftwbuf.link_target = NULL;
+	ftwbuf.filtered = -1;
+	ftwbuf.was_empty = false;
+
+	const struct bfs_stat *statbuf = bftw_stat(&ftwbuf, ftwbuf.stat_flags);
+	if (statbuf) {
+		ftwbuf.type = bfs_mode_to_type(statbuf->mode);
+	} else {
+		ftwbuf.type = BFS_ERROR;
+		ftwbuf.error = errno;
 	}
 
-	for (size_t i = 0; i < args->npaths; ++i) {
-		if (bftw_visit(&state, args->paths[i]) != 0) {
-			goto done;
-		}
-	}
-	bftw_batch_finish(&state);
+	bftw_par_visit(worker, &ftwbuf, NULL);
+}
 
-	while (true) {
-		while (bftw_pop_dir(&state)) {
-			if (bftw_opendir(&state) != 0) {
-				goto done;
-			}
-			while (bftw_readdir(&state) > 0) {
-				if (bftw_visit(&state, state.de->name) != 0) {
-					goto done;
-				}
-			}
-			if (bftw_closedir(&state) != 0) {
-				goto done;
+/** The number of queued tasks past which bftw_par_more_roots() helps out. */
+#define BFTW_PAR_BACKLOG 1024
+
+/** Visit streamed roots on the first worker, keeping the queues bounded. */
+static void bftw_par_more_roots(struct bftw_worker *worker) {
+	struct bftw_par *par = worker->par;
+	const struct bftw_args *args = par->args;
+
+	while (!bftw_par_quit(par)) {
+		// Work on the backlog rather than letting the queues grow
+		if (load(&par->nqueued, relaxed) >= BFTW_PAR_BACKLOG) {
+			struct bftw_task *task = bftw_par_pop(worker);
+			if (task) {
+				bftw_par_run(worker, task);
+				continue;
 			}
 		}
 
-		if (!bftw_pop_file(&state)) {
-			break;
-		}
-		if (bftw_visit(&state, NULL) != 0) {
+		const char *path = args->more_paths(args->ptr);
+		if (!path) {
 			break;
 		}
+		bftw_par_root(worker, path);
 	}
-
-done:
-	return bftw_state_destroy(&state);
 }
 
 /**
- * Iterative deepening search state.
+ * Parallel bftw() implementation.  Each worker reads directories from its own
+ * deque, stealing from the others when it runs dry.  Callbacks are serialized,
+ * but readdir(), stat(), and the filter run concurrently, so the visit order
+ * is unspecified.
  */
-struct bftw_ids_state {
-	/** The wrapped callback. */
-	bftw_callback *delegate;
-	/** The wrapped callback arguments. */
-	void *ptr;
-	/** Which visit this search corresponds to. */
-	enum bftw_visit visit;
-	/** Whether to override the bftw_visit. */
-	bool force_visit;
-	/** The current minimum depth (inclusive). */
-	size_t min_depth;
-	/** The current maximum depth (exclusive). */
-	size_t max_depth;
-	/** The set of pruned paths. */
-	struct trie pruned;
-	/** An error code to report. */
-	int error;
-	/** Whether the bottom has been found. */
-	bool bottom;
-	/** Whether to quit the search. */
-	bool quit;
-};
-
-/** Iterative deepening callback function. */
-static enum bftw_action bftw_ids_callback(const struct BFTW *ftwbuf, void *ptr) {
-	struct bftw_ids_state *state = ptr;
+static int bftw_par(const struct bftw_args *args) {
+	struct bftw_par *par = bftw_par_create(args);
+	if (!par) {
+		return -1;
+	}
 
-	if (state->force_visit) {
-		struct BFTW *mutbuf = (struct BFTW *)ftwbuf;
-		mutbuf->visit = state->visit;
+	// Visit the roots on the main thread, which then becomes the first worker
+	struct bftw_worker *first = &par->workers[0];
+	for (size_t i = 0; i < args->npaths && !bftw_par_quit(par); ++i) {
+		bftw_par_root(first, args->paths[i]);
 	}
 
-	if (ftwbuf->type == BFS_ERROR) {
-		if (ftwbuf->depth + 1 >= state->min_depth) {
-			return state->delegate(ftwbuf, state->ptr);
-		} else {
-			return BFTW_PRUNE;
-		}
+	// The rest of the roots count as pending work, so the workers stay up
+	if (args->more_paths) {
+		fetch_add(&par->pending, 1, relaxed);
 	}
 
-	if (ftwbuf->depth < state->min_depth) {
-		if (trie_find_str(&state->pruned, ftwbuf->path)) {
-			return BFTW_PRUNE;
-		} else {
-			return BFTW_CONTINUE;
-		}
-	} else if (state->visit == BFTW_POST) {
-		if (trie_find_str(&state->pruned, ftwbuf->path)) {
-			return BFTW_PRUNE;
-		}
+	// If a thread can't be started, the other workers pick up the slack
+	for (size_t i = 1; i < par->nworkers; ++i) {
+		struct bftw_worker *worker = &par->workers[i];
+		worker->started = thread_create(&worker->id, NULL, bftw_par_thread, worker) == 0;
 	}
 
-	enum bftw_action ret = BFTW_CONTINUE;
-	if (ftwbuf->visit == state->visit) {
-		ret = state->delegate(ftwbuf, state->ptr);
+	if (args->more_paths) {
+		bftw_par_more_roots(first);
+		bftw_par_done(par);
 	}
 
-	switch (ret) {
-	case BFTW_CONTINUE:
-		if (ftwbuf->type == BFS_DIR && ftwbuf->depth + 1 >= state->max_depth) {
-			state->bottom = false;
-			ret = BFTW_PRUNE;
-		}
-		break;
-	case BFTW_PRUNE:
-		if (ftwbuf->type == BFS_DIR) {
-			if (!trie_insert_str(&state->pruned, ftwbuf->path)) {
-				state->error = errno;
-				state->quit = true;
-				ret = BFTW_STOP;
-			}
+	bftw_par_work(first);
+
+	for (size_t i = 1; i < par->nworkers; ++i) {
+		struct bftw_worker *worker = &par->workers[i];
+		if (worker->started) {
+			thread_join(worker->id, NULL);
 		}
-		break;
-	case BFTW_STOP:
-		state->quit = true;
-		break;
 	}
 
-	return ret;
-}
+	bfs_assert(load(&par->pending, relaxed) == 0);
 
-/** Initialize iterative deepening state. */
-static void bftw_ids_init(const struct bftw_args *args, struct bftw_ids_state *state, struct bftw_args *ids_args) {
-	state->delegate = args->callback;
-	state->ptr = args->ptr;
-	state->visit = BFTW_PRE;
-	state->force_visit = false;
-	state->min_depth = 0;
-	state->max_depth = 1;
-	trie_init(&state->pruned);
-	state->error = 0;
-	state->bottom = false;
-	state->quit = false;
+	int error = par->error;
+	bftw_par_destroy(par);
 
-	*ids_args = *args;
-	ids_args->callback = bftw_ids_callback;
-	ids_args->ptr = state;
-	ids_args->flags &= ~BFTW_POST_ORDER;
+	if (error) {
+		errno = error;
+		return -1;
+	}
+	return 0;
 }
 
-/** Finish an iterative deepening search. */
-static int bftw_ids_finish(struct bftw_ids_state *state) {
-	int ret = 0;
+/**
+ * A thread walking roots for bftw_roots().
+ */
+struct bftw_roots_worker {
+	/** The thread handle. */
+	pthread_t id;
+	/** Whether the thread was started. */
+	bool started;
+};
 
-	if (state->error) {
-		ret = -1;
-	} else {
-		state->error = errno;
-	}
+/**
+ * Shared state for walking several roots at once.
+ */
+struct bftw_roots {
+	/** The bftw() arguments. */
+	const struct bftw_args *args;
+	/** The arguments for each root's walk. */
+	struct bftw_args walk;
+
+	/** Serializes callbacks, and handing out roots. */
+	pthread_mutex_t mutex;
+	/** The index of the next root in args->paths. */
+	size_t next;
+	/** Whether args->more_paths may have more roots. */
+	bool more;
+	/** Whether the search should stop. */
+	bool quit;
+	/** The first error encountered. */
+	int error;
 
-	trie_destroy(&state->pruned);
+	/** The number of workers. */
+	size_t nworkers;
+	/** The workers themselves. */
+	struct bftw_roots_worker workers[];
+};
+
+/** bftw_callback() that serializes the real callback. */
+static enum bftw_action bftw_roots_callback(const struct BFTW *ftwbuf, void *ptr) {
+	struct bftw_roots *roots = ptr;
+	const struct bftw_args *args = roots->args;
+
+	mutex_lock(&roots->mutex);
+	enum bftw_action ret = BFTW_STOP;
+	if (!roots->quit) {
+		ret = args->callback(ftwbuf, args->ptr);
+		if (ret == BFTW_STOP) {
+			roots->quit = true;
+		}
+	}
+	mutex_unlock(&roots->mutex);
 
-	errno = state->error;
 	return ret;
 }
 
+/** bftw_filter() that forwards to the real filter. */
+static int bftw_roots_filter(const struct BFTW *ftwbuf, void *ptr) {
+	const struct bftw_roots *roots = ptr;
+	const struct bftw_args *args = roots->args;
+	return args->filter(ftwbuf, args->ptr);
+}
+
+/** bftw_batch_fn() that forwards to the real batch filter. */
+static void bftw_roots_batch(struct bftw_entries *entries, void *ptr) {
+	struct bftw_roots *roots = ptr;
+	const struct bftw_args *args = roots->args;
+
+	// Like the callback, this isn't necessarily thread-safe
+	mutex_lock(&roots->mutex);
+	args->batch(entries, args->ptr);
+	mutex_unlock(&roots->mutex);
+}
+
 /**
- * Iterative deepening bftw() wrapper.
+ * Get the next root to walk.
+ *
+ * @param copy
+ *         Set to a copy of the root that the caller must free(), if it came
+ *         from args->more_paths.
+ * @return
+ *         The next root, or NULL if there are no more.
  */
-static int bftw_ids(const struct bftw_args *args) {
-	struct bftw_ids_state state;
-	struct bftw_args ids_args;
-	bftw_ids_init(args, &state, &ids_args);
+static const char *bftw_roots_next(struct bftw_roots *roots, char **copy) {
+	const struct bftw_args *args = roots->args;
+	const char *path = NULL;
+	*copy = NULL;
 
-	while (!state.quit && !state.bottom) {
-		state.bottom = true;
+	mutex_lock(&roots->mutex);
 
-		if (bftw_impl(&ids_args) != 0) {
-			state.error = errno;
-			state.quit = true;
-		}
+	if (roots->quit) {
+		goto done;
+	}
 
-		++state.min_depth;
-		++state.max_depth;
+	if (roots->next < args->npaths) {
+		path = args->paths[roots->next++];
+		goto done;
 	}
 
-	if (args->flags & BFTW_POST_ORDER) {
-		state.visit = BFTW_POST;
-		state.force_visit = true;
+	if (roots->more) {
+		// The path is only valid until the next call, which could come from
+		// another worker while this one is still walking it
+		path = args->more_paths(args->ptr);
+		if (!path) {
+			roots->more = false;
+		} else if (!(path = *copy = strdup(path))) {
+			roots->error = errno;
+			roots->quit = true;
+		}
+	}
 
-		while (!state.quit && state.min_depth > 0) {
-			--state.max_depth;
-			--state.min_depth;
+done:
+	mutex_unlock(&roots->mutex);
+	return path;
+}
 
-			if (bftw_impl(&ids_args) != 0) {
-				state.error = errno;
-				state.quit = true;
+/** Walk roots until there are none left. */
+static void bftw_roots_work(struct bftw_roots *roots) {
+	while (true) {
+		char *copy;
+		const char *path = bftw_roots_next(roots, &copy);
+		if (!path) {
+			break;
+		}
+
+		struct bftw_args walk = roots->walk;
+		walk.paths = &path;
+		walk.npaths = 1;
+		int ret = bftw_impl(&walk, NULL);
+		int error = errno;
+		free(copy);
+
+		if (ret != 0) {
+			mutex_lock(&roots->mutex);
+			if (!roots->error) {
+				roots->error = error;
 			}
+			roots->quit = true;
+			mutex_unlock(&roots->mutex);
 		}
 	}
+}
 
-	return bftw_ids_finish(&state);
+/** Background thread entry point for bftw_roots(). */
+static void *bftw_roots_thread(void *ptr) {
+	bftw_roots_work(ptr);
+	return NULL;
 }
 
 /**
- * Exponential deepening bftw() wrapper.
+ * bftw() implementation that walks several roots at once.  Each root gets its
+ * own bftw_impl() state on its own thread, with a share of the open file
+ * descriptors and I/O threads.  Callbacks are serialized, so each root is still
+ * visited in order, but the visits to different roots are interleaved.
  */
-static int bftw_eds(const struct bftw_args *args) {
-	struct bftw_ids_state state;
-	struct bftw_args ids_args;
-	bftw_ids_init(args, &state, &ids_args);
+static int bftw_roots(const struct bftw_args *args) {
+	size_t nworkers = args->root_threads;
+	if (!args->more_paths && nworkers > args->npaths) {
+		nworkers = args->npaths;
+	}
+	// Each walk needs a couple of fds to make progress
+	size_t maxworkers = args->nopenfd / 2;
+	if (nworkers > maxworkers) {
+		nworkers = maxworkers;
+	}
+	if (nworkers < 2) {
+		return bftw_impl(args, NULL);
+	}
 
-	while (!state.quit && !state.bottom) {
-		state.bottom = true;
+	struct bftw_roots *roots = ZALLOC_FLEX(struct bftw_roots, workers, nworkers);
+	if (!roots) {
+		return -1;
+	}
 
-		if (bftw_impl(&ids_args) != 0) {
-			state.error = errno;
-			state.quit = true;
+	if (mutex_init(&roots->mutex, NULL) != 0) {
+		free(roots);
+		return -1;
+	}
+
+	roots->args = args;
+	roots->more = args->more_paths;
+	roots->nworkers = nworkers;
+
+	struct bftw_args *walk = &roots->walk;
+	*walk = *args;
+	walk->more_paths = NULL;
+	walk->callback = bftw_roots_callback;
+	walk->ptr = roots;
+	if (args->filter) {
+		walk->filter = bftw_roots_filter;
+	}
+	if (args->batch) {
+		walk->batch = bftw_roots_batch;
+	}
+	walk->nopenfd = args->nopenfd / nworkers;
+	walk->nthreads = args->nthreads / nworkers;
+	if (walk->min_threads > walk->nthreads) {
+		walk->min_threads = walk->nthreads;
+	}
+	walk->root_threads = 0;
+	if (walk->mtab && walk->niolimits > 0 && bfs_mtab_load_types(walk->mtab) != 0) {
+		// bftw_devq() would fill in the types lazily, racing with the
+		// other walkers, so just skip the I/O limits
+		walk->niolimits = 0;
+	}
+
+	// If a thread can't be started, the other workers pick up the slack
+	for (size_t i = 1; i < nworkers; ++i) {
+		struct bftw_roots_worker *worker = &roots->workers[i];
+		worker->started = thread_create(&worker->id, NULL, bftw_roots_thread, roots) == 0;
+	}
+
+	bftw_roots_work(roots);
+
+	for (size_t i = 1; i < nworkers; ++i) {
+		struct bftw_roots_worker *worker = &roots->workers[i];
+		if (worker->started) {
+			thread_join(worker->id, NULL);
 		}
+	}
 
-		state.min_depth = state.max_depth;
-		state.max_depth *= 2;
+	int error = roots->error;
+	mutex_destroy(&roots->mutex);
+	free(roots);
+
+	if (error) {
+		errno = error;
+		return -1;
 	}
+	return 0;
+}
 
-	if (!state.quit && (args->flags & BFTW_POST_ORDER)) {
-		state.visit = BFTW_POST;
-		state.min_depth = 0;
-		ids_args.flags |= BFTW_POST_ORDER;
+/** Check whether a search needs all its root paths up front. */
+static bool bftw_needs_all_paths(const struct bftw_args *args) {
+	if (args->flags & BFTW_SORT) {
+		// The roots are sorted along with everything else
+		return true;
+	}
 
-		if (bftw_impl(&ids_args) != 0) {
-			state.error = errno;
+	// Iterative deepening starts over from the roots every time
+	return args->strategy == BFTW_IDS || args->strategy == BFTW_EDS;
+}
+
+/** bftw() with every root path read ahead of time. */
+static int bftw_all_paths(const struct bftw_args *args) {
+	const char **paths = NULL;
+	int ret = -1;
+
+	for (size_t i = 0; i < args->npaths; ++i) {
+		if (DARRAY_PUSH(&paths, &args->paths[i]) != 0) {
+			goto done;
 		}
 	}
 
-	return bftw_ids_finish(&state);
+	// The callback only keeps the latest path alive, so copy them
+	size_t ncopies = 0;
+	while (true) {
+		const char *path = args->more_paths(args->ptr);
+		if (!path) {
+			break;
+		}
+
+		char *copy = strdup(path);
+		if (!copy) {
+			goto free_copies;
+		}
+		if (DARRAY_PUSH(&paths, &copy) != 0) {
+			free(copy);
+			goto free_copies;
+		}
+		++ncopies;
+	}
+
+	struct bftw_args copy = *args;
+	copy.paths = paths;
+	copy.npaths = darray_length(paths);
+	copy.more_paths = NULL;
+	ret = bftw(&copy);
+
+free_copies:
+	for (size_t i = 0; i < ncopies; ++i) {
+		free((char *)paths[args->npaths + i]);
+	}
+done:
+	darray_free(paths);
+	return ret;
 }
 
 int bftw(const struct bftw_args *args) {
+	if (args->more_paths && bftw_needs_all_paths(args)) {
+		return bftw_all_paths(args);
+	}
+
 	switch (args->strategy) {
 	case BFTW_BFS:
 	case BFTW_DFS:
-		return bftw_impl(args);
+		if (args->root_threads > 1 && !(args->flags & BFTW_SORT) && !args->index) {
+			return bftw_roots(args);
+		}
+		return bftw_impl(args, NULL);
 	case BFTW_IDS:
 		return bftw_ids(args);
 	case BFTW_EDS:
 		return bftw_eds(args);
+	case BFTW_PARALLEL:
+		if (args->flags & (BFTW_SORT | BFTW_INO_ORDER)) {
+			// Sorting needs a deterministic order
+			return bftw_impl(args, NULL);
+		} else if (args->index) {
+			// The index records one directory at a time
+			return bftw_impl(args, NULL);
+		}
+		return bftw_par(args);
 	}
 
 	errno = EINVAL;
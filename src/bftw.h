@@ -8,7 +8,9 @@
 #ifndef BFS_BFTW_H
 #define BFS_BFTW_H
 
+#include "atomic.h"
 #include "dir.h"
+#include "fsade.h"
 #include "stat.h"
 #include <stddef.h>
 
@@ -34,6 +36,22 @@ struct bftw_stat {
 	int error;
 };
 
+/**
+ * Cached extended attribute names for a file.
+ */
+struct bftw_xattrs {
+	/** A pointer to the name list, if available. */
+	const struct bfs_xattrs *buf;
+	/** Storage for the name list, if needed. */
+	struct bfs_xattrs storage;
+	/** The cached error code, if any. */
+	int error;
+	/** A file descriptor for attribute calls, or -1 if none is open. */
+	int fd;
+	/** The error from opening it, or ENOTSUP without BFTW_ATTR_FDS. */
+	int fd_error;
+};
+
 /**
  * Data about the current file for the bftw() callback.
  */
@@ -62,10 +80,21 @@ struct BFTW {
 
 	/** Flags for bfs_stat(). */
 	enum bfs_stat_flags stat_flags;
+	/** The fields to request from bfs_stat(). */
+	enum bfs_stat_field stat_fields;
 	/** Cached bfs_stat() info for BFS_STAT_NOFOLLOW. */
 	struct bftw_stat lstat_cache;
 	/** Cached bfs_stat() info for BFS_STAT_FOLLOW. */
 	struct bftw_stat stat_cache;
+	/** Cached extended attribute names. */
+	struct bftw_xattrs xattr_cache;
+	/** The target of a symbolic link, if it was read ahead of time. */
+	const char *link_target;
+
+	/** The result of bftw_args::filter for this file, or -1 if unknown. */
+	int filtered;
+	/** For post-order visits, whether the directory had no entries when it was read. */
+	bool was_empty;
 };
 
 /**
@@ -108,6 +137,17 @@ const struct bfs_stat *bftw_cached_stat(const struct BFTW *ftwbuf, enum bfs_stat
  */
 enum bfs_type bftw_type(const struct BFTW *ftwbuf, enum bfs_stat_flags flags);
 
+/**
+ * Read the target of a symbolic link encountered during bftw(), using the
+ * result of any earlier read.
+ *
+ * @param ftwbuf
+ *         bftw() data for the link to read.
+ * @return
+ *         The link target, which should be free()d, or NULL on failure.
+ */
+char *bftw_readlink(const struct BFTW *ftwbuf);
+
 /**
  * Walk actions returned by the bftw() callback.
  */
@@ -118,6 +158,13 @@ enum bftw_action {
 	BFTW_PRUNE,
 	/** Stop walking. */
 	BFTW_STOP,
+	/**
+	 * Delete this file, possibly in the background, and skip its children.
+	 * Directories are only deleted once any background deletions of their
+	 * children have finished.  Failures are reported by visiting the file
+	 * again with BFS_ERROR.
+	 */
+	BFTW_DELETE,
 };
 
 /**
@@ -132,6 +179,67 @@ enum bftw_action {
  */
 typedef enum bftw_action bftw_callback(const struct BFTW *ftwbuf, void *ptr);
 
+/**
+ * Filter function type for bftw().  Filters are evaluated ahead of time on
+ * background threads, possibly concurrently, so they must be thread-safe and
+ * free of side effects.
+ *
+ * @param ftwbuf
+ *         Data about a file that will be visited later.
+ * @param ptr
+ *         The pointer passed to bftw().
+ * @return
+ *         1 if the file matches, 0 if it doesn't, or -1 if it should be
+ *         decided by the callback instead.
+ */
+typedef int bftw_filter(const struct BFTW *ftwbuf, void *ptr);
+
+/**
+ * A directory's entries, as parallel arrays, for a bftw_batch_fn.
+ */
+struct bftw_entries {
+	/** The path to the directory. */
+	const char *path;
+	/** The depth of the entries in the traversal. */
+	size_t depth;
+	/** The number of entries. */
+	size_t count;
+	/** The name of each entry. */
+	const char *const *names;
+	/** The length of each name. */
+	const size_t *lengths;
+	/** The type of each entry from readdir(), or BFS_UNKNOWN. */
+	const enum bfs_type *types;
+	/** The inode number of each entry from readdir(). */
+	const ino_t *inos;
+	/** Whether to visit each entry, initially all true. */
+	bool *visit;
+};
+
+/**
+ * Batch filter function type for bftw().  This is called on the main thread
+ * with each directory's entries, before any of them are visited.  Entries that
+ * it marks as not visited are dropped without being passed to the callback,
+ * unless they may be directories that bftw() would descend into.
+ *
+ * @param entries
+ *         The entries of a directory.
+ * @param ptr
+ *         The pointer passed to bftw().
+ */
+typedef void bftw_batch_fn(struct bftw_entries *entries, void *ptr);
+
+/**
+ * Function type for reading more root paths as the walk goes.
+ *
+ * @param ptr
+ *         The pointer passed to bftw().
+ * @return
+ *         The next root path, which must stay valid until the next call, or
+ *         NULL if there are no more.
+ */
+typedef const char *bftw_paths_fn(void *ptr);
+
 /**
  * Flags that control bftw() behavior.
  */
@@ -156,6 +264,16 @@ enum bftw_flags {
 	BFTW_SORT          = 1 << 8,
 	/** Read each directory into memory before processing its children. */
 	BFTW_BUFFER        = 1 << 9,
+	/** Prefetch the names of each file's extended attributes. */
+	BFTW_XATTRS        = 1 << 10,
+	/** Prefetch the targets of symbolic links. */
+	BFTW_READLINK      = 1 << 11,
+	/** Prefetch stat() info through symbolic links that aren't followed. */
+	BFTW_STAT_LINKS    = 1 << 12,
+	/** Process each directory's entries in inode number order. */
+	BFTW_INO_ORDER     = 1 << 13,
+	/** Share an open fd between the attribute checks for each file. */
+	BFTW_ATTR_FDS      = 1 << 14,
 };
 
 /**
@@ -170,6 +288,26 @@ enum bftw_strategy {
 	BFTW_IDS,
 	/** Exponential deepening search. */
 	BFTW_EDS,
+	/** Parallel search, in no particular order. */
+	BFTW_PARALLEL,
+};
+
+/**
+ * A limit on the outstanding I/O requests to one type of filesystem.
+ */
+struct bftw_iolimit {
+	/** The filesystem type, as reported by bfs_fstype(). */
+	const char *fstype;
+	/** The maximum number of concurrent requests to each such filesystem. */
+	size_t limit;
+};
+
+/**
+ * Progress counters published by bftw(), which can be read from any thread.
+ */
+struct bftw_progress {
+	/** The number of directories waiting to be read. */
+	atomic size_t queued;
 };
 
 /**
@@ -180,20 +318,59 @@ struct bftw_args {
 	const char **paths;
 	/** The number of starting paths. */
 	size_t npaths;
+	/**
+	 * Reads more starting paths after the first npaths, if non-NULL.  They
+	 * are read in batches as the walk progresses, rather than all at once.
+	 */
+	bftw_paths_fn *more_paths;
 	/** The callback to invoke. */
 	bftw_callback *callback;
 	/** A pointer which is passed to the callback. */
 	void *ptr;
+	/** An optional filter to evaluate in parallel, passed the same ptr. */
+	bftw_filter *filter;
+	/**
+	 * An optional filter for whole directories of entries, passed the same
+	 * ptr.  Only breadth- and depth-first searches use it.
+	 */
+	bftw_batch_fn *batch;
 	/** The maximum number of file descriptors to keep open. */
 	int nopenfd;
 	/** The maximum number of threads to use. */
 	int nthreads;
+	/**
+	 * If nonzero, the I/O threads are tuned at runtime (see ioq_autotune()),
+	 * keeping at least this many of the nthreads active.
+	 */
+	int min_threads;
+	/**
+	 * The number of roots to walk at once, each with its own share of
+	 * nopenfd and nthreads, or 0 to walk them all together.  Only breadth-
+	 * and depth-first searches without BFTW_SORT or an index do this.
+	 */
+	int root_threads;
 	/** Flags that control bftw() behaviour. */
 	enum bftw_flags flags;
 	/** The search strategy to use. */
 	enum bftw_strategy strategy;
+	/** The bfs_stat() fields that the callback and filter need. */
+	enum bfs_stat_field stat_fields;
 	/** The parsed mount table, if available. */
 	const struct bfs_mtab *mtab;
+	/** A directory index to read listings from and record them into. */
+	struct bfs_index *index;
+	/**
+	 * The memory limit (in bytes) for the breadth-first queue, beyond
+	 * which queued directories are spilled to a temporary file, or 0 for
+	 * no limit.
+	 */
+	size_t spill_limit;
+	/** Per-filesystem limits on background I/O (requires mtab). */
+	const struct bftw_iolimit *iolimits;
+	/** The number of iolimits. */
+	size_t niolimits;
+	/** Where to publish progress counters, if anywhere. */
+	struct bftw_progress *progress;
 };
 
 /**
@@ -3,8 +3,10 @@
 
 #include "color.h"
 #include "alloc.h"
+#include "ascii.h"
 #include "bfstd.h"
 #include "bftw.h"
+#include "bit.h"
 #include "config.h"
 #include "diag.h"
 #include "dir.h"
@@ -49,6 +51,24 @@ struct ext_color {
 	char ext[];
 };
 
+/**
+ * A slot in the extension hash table.  Every suffix of every extension gets a
+ * case-insensitive slot, even if nothing matches it exactly, so that lookups
+ * can stop as soon as a suffix of the file name is missing.
+ */
+struct ext_slot {
+	/** The hash of the case-folded suffix. */
+	uint64_t hash;
+	/** The suffix itself, or NULL if this slot is empty. */
+	const char *str;
+	/** The length of the suffix. */
+	size_t len;
+	/** The extension that matches this suffix, if any. */
+	const struct ext_color *ext;
+	/** Whether this slot matches case-insensitively. */
+	bool icase;
+};
+
 struct colors {
 	/** esc_seq allocator. */
 	struct varena esc_arena;
@@ -112,6 +132,10 @@ struct colors {
 	struct trie ext_trie;
 	/** Case-insensitive extension trie. */
 	struct trie iext_trie;
+	/** Hash table of the extensions in both tries, for get_ext(). */
+	struct ext_slot *ext_table;
+	/** The size of ext_table, minus one. */
+	size_t ext_mask;
 };
 
 /** Allocate an escape sequence. */
@@ -183,32 +207,6 @@ static int set_esc(struct colors *colors, const char *name, char *value) {
 	return 0;
 }
 
-/** Reverse a string, to turn suffix matches into prefix matches. */
-static void ext_reverse(char *ext, size_t len) {
-	for (size_t i = 0, j = len - 1; len && i < j; ++i, --j) {
-		char c = ext[i];
-		ext[i] = ext[j];
-		ext[j] = c;
-	}
-}
-
-/** Convert a string to lowercase for case-insensitive matching. */
-static void ext_tolower(char *ext, size_t len) {
-	for (size_t i = 0; i < len; ++i) {
-		char c = ext[i];
-
-		// What's internationalization?  Doesn't matter, this is what
-		// GNU ls does.  Luckily, since there's no standard C way to
-		// casefold.  Not using tolower() here since it respects the
-		// current locale, which GNU ls doesn't do.
-		if (c >= 'A' && c <= 'Z') {
-			c += 'a' - 'A';
-		}
-
-		ext[i] = c;
-	}
-}
-
 /**
  * The "smart case" algorithm.
  *
@@ -274,10 +272,10 @@ static int set_ext(struct colors *colors, char *key, char *value) {
 		goto fail;
 	}
 
-	key = memcpy(ext->ext, key, len + 1);
+	memcpy(ext->ext, key, len + 1);
 
 	// Reverse the extension (`*.y.x` -> `x.y.*`) so we can use trie_find_prefix()
-	ext_reverse(key, len);
+	ascii_reverse(key, key, len);
 
 	// Find any pre-existing exact match
 	struct ext_color *prev = NULL;
@@ -300,8 +298,9 @@ static int set_ext(struct colors *colors, char *key, char *value) {
 	leaf->value = ext;
 
 	// "Smart case": if the same extension is given with two different
-	// capitalizations (e.g. `*.y.x=31:*.Y.Z=32:`), make it case-sensitive
-	ext_tolower(key, len);
+	// capitalizations (e.g. `*.y.x=31:*.Y.Z=32:`), make it case-sensitive.
+	// This is ASCII-only like GNU ls, rather than respecting the locale.
+	ascii_tolower(key, key, len);
 	leaf = trie_insert_str(&colors->iext_trie, key);
 	if (!leaf) {
 		goto fail;
@@ -326,6 +325,9 @@ fail:
 
 /** Rebuild the case-insensitive trie after all extensions have been parsed. */
 static int build_iext_trie(struct colors *colors) {
+	int ret = -1;
+	char *key = NULL;
+
 	trie_destroy(&colors->iext_trie);
 	trie_init(&colors->iext_trie);
 
@@ -340,19 +342,106 @@ static int build_iext_trie(struct colors *colors) {
 			continue;
 		}
 
-		// set_ext() already reversed and lowercased the extension
+		// The key is already reversed, so just lowercase it
+		if (dstrxcpy(&key, leaf->key, len) != 0) {
+			goto fail;
+		}
+		ascii_tolower(key, key, len);
+
 		struct trie_leaf *ileaf;
-		while ((ileaf = trie_find_postfix(&colors->iext_trie, ext->ext))) {
+		while ((ileaf = trie_find_postfix(&colors->iext_trie, key))) {
 			trie_remove(&colors->iext_trie, ileaf);
 		}
 
-		ileaf = trie_insert_str(&colors->iext_trie, ext->ext);
+		ileaf = trie_insert_str(&colors->iext_trie, key);
 		if (!ileaf) {
-			return -1;
+			goto fail;
 		}
 		ileaf->value = ext;
 	}
 
+	ret = 0;
+fail:
+	dstrfree(key);
+	return ret;
+}
+
+/** Initial value for ext_hash_step(). */
+#define EXT_HASH_INIT UINT64_C(0xCBF29CE484222325)
+
+/**
+ * Hash one more byte of an extension.  Extensions are hashed backwards from the
+ * end, with ASCII case folded so both tries can share a table.
+ */
+static uint64_t ext_hash_step(uint64_t hash, char c) {
+	if (c >= 'A' && c <= 'Z') {
+		c += 'a' - 'A';
+	}
+	return (hash ^ (unsigned char)c) * UINT64_C(0x100000001B3);
+}
+
+/** Find or insert a slot in the extension hash table. */
+static struct ext_slot *ext_table_slot(struct colors *colors, uint64_t hash, const char *str, size_t len, bool icase) {
+	size_t i = hash & colors->ext_mask;
+	for (; colors->ext_table[i].str; i = (i + 1) & colors->ext_mask) {
+		struct ext_slot *slot = &colors->ext_table[i];
+		if (slot->hash != hash || slot->len != len || slot->icase != icase) {
+			continue;
+		}
+
+		if (icase ? ascii_caseeq(slot->str, str, len) : memcmp(slot->str, str, len) == 0) {
+			return slot;
+		}
+	}
+
+	struct ext_slot *slot = &colors->ext_table[i];
+	slot->hash = hash;
+	slot->str = str;
+	slot->len = len;
+	slot->icase = icase;
+	return slot;
+}
+
+/** Insert an extension and all its suffixes into the hash table. */
+static void ext_table_insert(struct colors *colors, const struct ext_color *ext, bool icase) {
+	const char *str = ext->ext;
+	size_t len = ext->len;
+
+	uint64_t hash = EXT_HASH_INIT;
+	ext_table_slot(colors, hash, str + len, 0, true);
+	for (size_t i = 1; i <= len; ++i) {
+		hash = ext_hash_step(hash, str[len - i]);
+		ext_table_slot(colors, hash, str + len - i, i, true);
+	}
+
+	struct ext_slot *slot = ext_table_slot(colors, hash, str, len, icase);
+	slot->ext = ext;
+}
+
+/** Build the extension hash table, once both tries are complete. */
+static int build_ext_table(struct colors *colors) {
+	// Each extension needs at most one slot per suffix, plus one for an
+	// exact case-sensitive match, plus one for the empty suffix
+	size_t count = 1;
+	TRIE_FOR_EACH(&colors->ext_trie, leaf) {
+		count += leaf->length + 1;
+	}
+
+	// Keep the load factor at most 1/2 so probes end quickly
+	size_t size = bit_ceil(2 * count);
+	colors->ext_table = ZALLOC_ARRAY(struct ext_slot, size);
+	if (!colors->ext_table) {
+		return -1;
+	}
+	colors->ext_mask = size - 1;
+
+	TRIE_FOR_EACH(&colors->ext_trie, leaf) {
+		ext_table_insert(colors, leaf->value, false);
+	}
+	TRIE_FOR_EACH(&colors->iext_trie, leaf) {
+		ext_table_insert(colors, leaf->value, true);
+	}
+
 	return 0;
 }
 
@@ -360,38 +449,54 @@ static int build_iext_trie(struct colors *colors) {
  * Find a color by an extension.
  */
 static const struct esc_seq *get_ext(const struct colors *colors, const char *filename) {
-	size_t ext_len = colors->ext_len;
-	size_t name_len = strlen(filename);
-	if (name_len < ext_len) {
-		ext_len = name_len;
+	if (!colors->ext_table) {
+		return NULL;
 	}
-	const char *suffix = filename + name_len - ext_len;
 
-	char buf[256];
-	char *copy;
-	if (ext_len < sizeof(buf)) {
-		copy = memcpy(buf, suffix, ext_len + 1);
-	} else {
-		copy = strndup(suffix, ext_len);
-		if (!copy) {
-			return NULL;
+	size_t name_len = strlen(filename);
+	size_t max_len = colors->ext_len;
+	if (max_len > name_len) {
+		max_len = name_len;
+	}
+
+	// Walk the name backwards, looking up each suffix as we go, until no
+	// extension could match.  Later (longer) matches override earlier ones,
+	// like trie_find_prefix().
+	const struct ext_color *ext = NULL;
+	const struct ext_color *iext = NULL;
+	uint64_t hash = EXT_HASH_INIT;
+	for (size_t len = 0; len <= max_len; ++len) {
+		const char *suffix = filename + name_len - len;
+		if (len > 0) {
+			hash = ext_hash_step(hash, *suffix);
 		}
-	}
 
-	ext_reverse(copy, ext_len);
-	const struct trie_leaf *leaf = trie_find_prefix(&colors->ext_trie, copy);
-	const struct ext_color *ext = leaf ? leaf->value : NULL;
+		bool found = false;
+		for (size_t i = hash & colors->ext_mask; colors->ext_table[i].str; i = (i + 1) & colors->ext_mask) {
+			const struct ext_slot *slot = &colors->ext_table[i];
+			if (slot->hash != hash || slot->len != len) {
+				continue;
+			}
 
-	ext_tolower(copy, ext_len);
-	const struct trie_leaf *ileaf = trie_find_prefix(&colors->iext_trie, copy);
-	const struct ext_color *iext = ileaf ? ileaf->value : NULL;
+			if (slot->icase) {
+				if (ascii_caseeq(slot->str, suffix, len)) {
+					found = true;
+					if (slot->ext) {
+						iext = slot->ext;
+					}
+				}
+			} else if (memcmp(slot->str, suffix, len) == 0) {
+				ext = slot->ext;
+			}
+		}
 
-	if (iext && (!ext || ext->priority < iext->priority)) {
-		ext = iext;
+		if (!found) {
+			break;
+		}
 	}
 
-	if (copy != buf) {
-		free(copy);
+	if (iext && (!ext || ext->priority < iext->priority)) {
+		ext = iext;
 	}
 
 	return ext ? ext->esc : NULL;
@@ -623,6 +728,8 @@ struct colors *parse_colors(void) {
 	colors->ext_len = 0;
 	trie_init(&colors->ext_trie);
 	trie_init(&colors->iext_trie);
+	colors->ext_table = NULL;
+	colors->ext_mask = 0;
 
 	int ret = 0;
 
@@ -688,6 +795,14 @@ struct colors *parse_colors(void) {
 	if (build_iext_trie(colors) != 0) {
 		goto fail;
 	}
+	if (build_ext_table(colors) != 0) {
+		goto fail;
+	}
+
+	// The names are read-only from here on, so compact them (failure is
+	// harmless, as it leaves them unchanged).  The extension tries aren't
+	// searched any more, since get_ext() uses ext_table.
+	trie_freeze(&colors->names);
 
 	if (colors->link && esc_eq(colors->link, "target", strlen("target"))) {
 		colors->link_as_target = true;
@@ -706,6 +821,7 @@ void free_colors(struct colors *colors) {
 		return;
 	}
 
+	free(colors->ext_table);
 	trie_destroy(&colors->iext_trie);
 	trie_destroy(&colors->ext_trie);
 	trie_destroy(&colors->names);
@@ -1086,10 +1202,7 @@ static int print_path(CFILE *cfile, const struct BFTW *ftwbuf) {
 
 /** Print a link target with the appropriate colors. */
 static int print_link_target(CFILE *cfile, const struct BFTW *ftwbuf) {
-	const struct bfs_stat *statbuf = bftw_cached_stat(ftwbuf, BFS_STAT_NOFOLLOW);
-	size_t len = statbuf ? statbuf->size : 0;
-
-	char *target = xreadlinkat(ftwbuf->at_fd, ftwbuf->at_path, len);
+	char *target = bftw_readlink(ftwbuf);
 	if (!target) {
 		return -1;
 	}
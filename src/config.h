@@ -32,12 +32,18 @@
 
 #ifdef __has_include
 
+#if __has_include(<liburing.h>)
+#  define BFS_HAS_LIBURING true
+#endif
 #if __has_include(<mntent.h>)
 #  define BFS_HAS_MNTENT_H true
 #endif
 #if __has_include(<paths.h>)
 #  define BFS_HAS_PATHS_H true
 #endif
+#if __has_include(<stdio_ext.h>)
+#  define BFS_HAS_STDIO_EXT_H true
+#endif
 #if __has_include(<sys/acl.h>)
 #  define BFS_HAS_SYS_ACL_H true
 #endif
@@ -47,12 +53,18 @@
 #if __has_include(<sys/extattr.h>)
 #  define BFS_HAS_SYS_EXTATTR_H true
 #endif
+#if __has_include(<sys/inotify.h>)
+#  define BFS_HAS_SYS_INOTIFY_H true
+#endif
 #if __has_include(<sys/mkdev.h>)
 #  define BFS_HAS_SYS_MKDEV_H true
 #endif
 #if __has_include(<sys/param.h>)
 #  define BFS_HAS_SYS_PARAM_H true
 #endif
+#if __has_include(<sys/sdt.h>)
+#  define BFS_HAS_SYS_SDT_H true
+#endif
 #if __has_include(<sys/sysmacros.h>)
 #  define BFS_HAS_SYS_SYSMACROS_H true
 #endif
@@ -65,25 +77,35 @@
 
 #else // !__has_include
 
+#define BFS_HAS_LIBURING false
 #define BFS_HAS_MNTENT_H __GLIBC__
 #define BFS_HAS_PATHS_H true
+#define BFS_HAS_STDIO_EXT_H __GLIBC__
 #define BFS_HAS_SYS_ACL_H true
 #define BFS_HAS_SYS_CAPABILITY_H __linux__
 #define BFS_HAS_SYS_EXTATTR_H __FreeBSD__
+#define BFS_HAS_SYS_INOTIFY_H __linux__
 #define BFS_HAS_SYS_MKDEV_H false
 #define BFS_HAS_SYS_PARAM_H true
+#define BFS_HAS_SYS_SDT_H false
 #define BFS_HAS_SYS_SYSMACROS_H __GLIBC__
 #define BFS_HAS_SYS_XATTR_H __linux__
 #define BFS_HAS_UTIL_H __NetBSD__
 
 #endif // !__has_include
 
+#ifndef BFS_USE_LIBURING
+#  define BFS_USE_LIBURING BFS_HAS_LIBURING
+#endif
 #ifndef BFS_USE_MNTENT_H
 #  define BFS_USE_MNTENT_H BFS_HAS_MNTENT_H
 #endif
 #ifndef BFS_USE_PATHS_H
 #  define BFS_USE_PATHS_H BFS_HAS_PATHS_H
 #endif
+#ifndef BFS_USE_STDIO_EXT_H
+#  define BFS_USE_STDIO_EXT_H BFS_HAS_STDIO_EXT_H
+#endif
 #ifndef BFS_USE_SYS_ACL_H
 #  define BFS_USE_SYS_ACL_H BFS_HAS_SYS_ACL_H
 #endif
@@ -93,12 +115,18 @@
 #ifndef BFS_USE_SYS_EXTATTR_H
 #  define BFS_USE_SYS_EXTATTR_H BFS_HAS_SYS_EXTATTR_H
 #endif
+#ifndef BFS_USE_SYS_INOTIFY_H
+#  define BFS_USE_SYS_INOTIFY_H BFS_HAS_SYS_INOTIFY_H
+#endif
 #ifndef BFS_USE_SYS_MKDEV_H
 #  define BFS_USE_SYS_MKDEV_H BFS_HAS_SYS_MKDEV_H
 #endif
 #ifndef BFS_USE_SYS_PARAM_H
 #  define BFS_USE_SYS_PARAM_H BFS_HAS_SYS_PARAM_H
 #endif
+#ifndef BFS_USE_SYS_SDT_H
+#  define BFS_USE_SYS_SDT_H BFS_HAS_SYS_SDT_H
+#endif
 #ifndef BFS_USE_SYS_SYSMACROS_H
 #  define BFS_USE_SYS_SYSMACROS_H BFS_HAS_SYS_SYSMACROS_H
 #endif
@@ -186,6 +214,16 @@
 #  define BFS_FORMATTER(fmt, args)
 #endif
 
+/**
+ * Force a function to be inlined, so it can be specialized for constant
+ * arguments.  Use like `static inline BFS_ALWAYS_INLINE`.
+ */
+#if __has_attribute(always_inline)
+#  define BFS_ALWAYS_INLINE __attribute__((always_inline))
+#else
+#  define BFS_ALWAYS_INLINE
+#endif
+
 /**
  * Check if function multiversioning via GNU indirect functions (ifunc) is supported.
  */
@@ -25,6 +25,8 @@ const char *debug_flag_name(enum debug_flags flag) {
 		return "exec";
 	case DEBUG_OPT:
 		return "opt";
+	case DEBUG_PERF:
+		return "perf";
 	case DEBUG_RATES:
 		return "rates";
 	case DEBUG_SEARCH:
@@ -51,7 +53,9 @@ struct bfs_ctx *bfs_ctx_new(void) {
 	ctx->maxdepth = INT_MAX;
 	ctx->flags = BFTW_RECOVER;
 	ctx->strategy = BFTW_BFS;
+	ctx->stat_fields = BFS_STAT_ALL;
 	ctx->optlevel = 3;
+	ctx->exec_jobs = 1;
 
 	trie_init(&ctx->files);
 
@@ -75,6 +79,7 @@ struct bfs_ctx *bfs_ctx_new(void) {
 	if (xgettime(&ctx->now) != 0) {
 		goto fail;
 	}
+	xtime_cache_init(&ctx->localtimes);
 
 	return ctx;
 
@@ -236,6 +241,10 @@ int bfs_ctx_free(struct bfs_ctx *ctx) {
 
 		bfs_mtab_free(ctx->mtab);
 
+		if (ctx->files0 && ctx->files0 != stdin) {
+			fclose(ctx->files0);
+		}
+
 		bfs_groups_free(ctx->groups);
 		bfs_users_free(ctx->users);
 
@@ -273,8 +282,15 @@ int bfs_ctx_free(struct bfs_ctx *ctx) {
 		for (size_t i = 0; i < darray_length(ctx->paths); ++i) {
 			free((char *)ctx->paths[i]);
 		}
+		for (size_t i = 0; i < darray_length(ctx->iolimits); ++i) {
+			free((char *)ctx->iolimits[i].fstype);
+		}
+		darray_free(ctx->iolimits);
+		darray_free(ctx->cpus);
 		darray_free(ctx->paths);
 
+		free(ctx->prune_glob);
+		free(ctx->trace_path);
 		free(ctx->argv);
 		free(ctx);
 	}
@@ -11,7 +11,9 @@
 #include "bftw.h"
 #include "config.h"
 #include "trie.h"
+#include "xtime.h"
 #include <stddef.h>
+#include <stdio.h>
 #include <sys/resource.h>
 #include <time.h>
 
@@ -25,16 +27,18 @@ enum debug_flags {
 	DEBUG_EXEC   = 1 << 1,
 	/** Print optimization details. */
 	DEBUG_OPT    = 1 << 2,
+	/** Print performance counters. */
+	DEBUG_PERF   = 1 << 3,
 	/** Print rate information. */
-	DEBUG_RATES  = 1 << 3,
+	DEBUG_RATES  = 1 << 4,
 	/** Trace the filesystem traversal. */
-	DEBUG_SEARCH = 1 << 4,
+	DEBUG_SEARCH = 1 << 5,
 	/** Trace all stat() calls. */
-	DEBUG_STAT   = 1 << 5,
+	DEBUG_STAT   = 1 << 6,
 	/** Print the parse tree. */
-	DEBUG_TREE   = 1 << 6,
+	DEBUG_TREE   = 1 << 7,
 	/** All debug flags. */
-	DEBUG_ALL    = (1 << 7) - 1,
+	DEBUG_ALL    = (1 << 8) - 1,
 };
 
 /**
@@ -53,6 +57,10 @@ struct bfs_ctx {
 
 	/** The root paths. */
 	const char **paths;
+	/** The rest of the -files0-from input, read incrementally during the search. */
+	FILE *files0;
+	/** The -files0-from path, for error messages. */
+	const char *files0_path;
 	/** The main command line expression. */
 	struct bfs_expr *expr;
 	/** An expression for files to filter out. */
@@ -62,26 +70,70 @@ struct bfs_ctx {
 	int mindepth;
 	/** -maxdepth option. */
 	int maxdepth;
+	/** The shard to search (-shard), counting from 1. */
+	int shard;
+	/** The number of shards, or 0 if not sharding. */
+	int nshards;
+	/** The depth at which the tree is split into shards. */
+	int shard_depth;
+	/** A glob that every path with side effects matches, for pruning (-O4). */
+	char *prune_glob;
+	/** Whether prune_glob is case-insensitive. */
+	bool prune_casefold;
 
 	/** bftw() flags. */
 	enum bftw_flags flags;
 	/** bftw() search strategy. */
 	enum bftw_strategy strategy;
+	/** The bfs_stat() fields the search needs (see bfs_optimize()). */
+	enum bfs_stat_field stat_fields;
 
 	/** Threads (-j). */
 	int threads;
+	/** Whether to tune the number of threads at runtime (-jauto). */
+	bool autotune;
+	/** The number of roots to search at once (-root-threads). */
+	int root_threads;
+	/** The CPUs to run on (-cpus, a darray), or NULL for any. */
+	unsigned int *cpus;
+	/** The number of successful actions before quitting (-limit), or 0. */
+	int limit;
+	/** Concurrent -exec ... + commands (-exec-jobs). */
+	int exec_jobs;
+	/** The memory limit for the breadth-first queue (-spill). */
+	size_t spill_limit;
+	/** Per-filesystem I/O limits (-iolimit, a darray). */
+	struct bftw_iolimit *iolimits;
 	/** Optimization level (-O). */
 	int optlevel;
 	/** Debugging flags (-D). */
 	enum debug_flags debug;
+	/** Whether to print -D perf counters as JSON. */
+	bool perf_json;
+	/** The file to write a -D trace to. */
+	char *trace_path;
+	/** The directory index file (-index). */
+	const char *index_path;
+	/** The snapshot file (-incremental). */
+	const char *incremental_path;
+	/** The expression profile (-profile). */
+	const char *profile_path;
 	/** Whether to ignore deletions that race with bfs (-ignore_readdir_race). */
 	bool ignore_races;
 	/** Whether to follow POSIXisms more closely ($POSIXLY_CORRECT). */
 	bool posixly_correct;
 	/** Whether to show a status bar (-status). */
 	bool status;
+	/** Whether to load the user and group databases up front (-preload_users). */
+	bool preload_users;
 	/** Whether to only return unique files (-unique). */
 	bool unique;
+	/** Whether to add up disk usage for -du. */
+	bool du;
+	/** Whether attribute checks should share an open fd for each file. */
+	bool attr_fds;
+	/** Whether to keep watching for changes after the search (-watch). */
+	bool watch;
 	/** Whether to print warnings (-warn/-nowarn). */
 	bool warn;
 	/** Whether to only handle paths with xargs-safe characters (-X). */
@@ -91,6 +143,8 @@ struct bfs_ctx {
 	struct colors *colors;
 	/** The error that occurred parsing the color table, if any. */
 	int colors_error;
+	/** Whether the color table has been parsed (it's only parsed when needed). */
+	bool colors_parsed;
 	/** Colored stdout. */
 	struct CFILE *cout;
 	/** Colored stderr. */
@@ -120,6 +174,8 @@ struct bfs_ctx {
 
 	/** The current time. */
 	struct timespec now;
+	/** Cached localtime() results, for -ls and -printf. */
+	struct xtime_cache localtimes;
 };
 
 /**
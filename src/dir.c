@@ -6,6 +6,7 @@
 #include "bfstd.h"
 #include "config.h"
 #include "diag.h"
+#include "perf.h"
 #include "sanity.h"
 #include <dirent.h>
 #include <errno.h>
@@ -23,6 +24,7 @@
 /** getdents() syscall wrapper. */
 static ssize_t bfs_getdents(int fd, void *buf, size_t size) {
 	sanitize_uninit(buf, size);
+	uint64_t start = perf_start();
 
 #if __linux__ && __GLIBC__ && !__GLIBC_PREREQ(2, 30)
 	ssize_t ret = syscall(SYS_getdents64, fd, buf, size);
@@ -32,6 +34,8 @@ static ssize_t bfs_getdents(int fd, void *buf, size_t size) {
 	ssize_t ret = getdents(fd, buf, size);
 #endif
 
+	perf_stop(PERF_GETDENTS, start);
+
 	if (ret > 0) {
 		sanitize_init(buf, ret);
 	}
@@ -99,9 +103,17 @@ enum bfs_type bfs_mode_to_type(mode_t mode) {
 struct bfs_dir {
 #if BFS_USE_GETDENTS
 	alignas(sys_dirent) int fd;
-	unsigned short pos;
-	unsigned short size;
-	// sys_dirent buf[];
+	unsigned int pos;
+	unsigned int size;
+	/** The capacity of buf. */
+	unsigned int cap;
+	/** Whether another buffer is reading ahead from our fd. */
+	bool ahead;
+	/** The buffer size to grow to before the next fill. */
+	unsigned int want;
+	/** The dirent buffer, either inline or (once grown) on the heap. */
+	char *buf;
+	// sys_dirent inline[];
 #else
 	DIR *dir;
 	struct dirent *de;
@@ -111,8 +123,13 @@ struct bfs_dir {
 };
 
 #if BFS_USE_GETDENTS
-#  define DIR_SIZE (64 << 10)
+// Most directories are small, so start with a small inline buffer (which also
+// keeps the dir arena compact), and grow by DIR_GROWTH every time a directory
+// needs refilling, up to DIR_MAX
+#  define DIR_SIZE (4 << 10)
 #  define BUF_SIZE (DIR_SIZE - sizeof(struct bfs_dir))
+#  define DIR_GROWTH 4
+#  define DIR_MAX (256 << 10)
 #else
 #  define DIR_SIZE sizeof(struct bfs_dir)
 #endif
@@ -126,6 +143,8 @@ void bfs_dir_arena(struct arena *arena) {
 }
 
 int bfs_opendir(struct bfs_dir *dir, int at_fd, const char *at_path) {
+	uint64_t start = perf_start();
+
 	int fd;
 	if (at_path) {
 		fd = openat(at_fd, at_path, O_RDONLY | O_CLOEXEC | O_DIRECTORY);
@@ -143,6 +162,10 @@ int bfs_opendir(struct bfs_dir *dir, int at_fd, const char *at_path) {
 	dir->fd = fd;
 	dir->pos = 0;
 	dir->size = 0;
+	dir->cap = BUF_SIZE;
+	dir->ahead = false;
+	dir->want = 0;
+	dir->buf = (char *)(dir + 1);
 #else
 	dir->dir = fdopendir(fd);
 	if (!dir->dir) {
@@ -155,6 +178,7 @@ int bfs_opendir(struct bfs_dir *dir, int at_fd, const char *at_path) {
 #endif
 
 	dir->eof = false;
+	perf_stop(PERF_OPENDIR, start);
 	return 0;
 }
 
@@ -166,16 +190,68 @@ int bfs_dirfd(const struct bfs_dir *dir) {
 #endif
 }
 
+#if BFS_USE_GETDENTS
+
+/** Check if a directory's buffer is on the heap. */
+static bool bfs_dir_grown(const struct bfs_dir *dir) {
+	return dir->buf != (const char *)(dir + 1);
+}
+
+/** Free a directory's heap buffer, if any. */
+static void bfs_dir_shrink(struct bfs_dir *dir) {
+	if (bfs_dir_grown(dir)) {
+		free(dir->buf);
+		dir->buf = (char *)(dir + 1);
+		dir->cap = BUF_SIZE;
+	}
+}
+
+/** Get the buffer size to use after a directory's current one. */
+static size_t bfs_dir_next_cap(const struct bfs_dir *dir) {
+	size_t cap = bfs_dir_grown(dir) ? dir->cap : DIR_SIZE;
+	cap *= DIR_GROWTH;
+	return cap < DIR_MAX ? cap : DIR_MAX;
+}
+
+/** Switch to a bigger buffer, if we can. */
+static void bfs_dir_grow(struct bfs_dir *dir) {
+	size_t cap = dir->want;
+	dir->want = 0;
+	if (cap <= dir->cap) {
+		return;
+	}
+
+	// Failure isn't fatal, we just keep the smaller buffer
+	char *buf = ALLOC_ARRAY(char, cap);
+	if (!buf) {
+		return;
+	}
+
+	bfs_dir_shrink(dir);
+	dir->buf = buf;
+	dir->cap = cap;
+}
+
+#endif // BFS_USE_GETDENTS
+
 int bfs_polldir(struct bfs_dir *dir) {
 #if BFS_USE_GETDENTS
 	if (dir->pos < dir->size) {
 		return 1;
 	} else if (dir->eof) {
 		return 0;
+	} else if (dir->ahead) {
+		// The next entries belong to the read-ahead buffer
+		errno = EAGAIN;
+		return -1;
 	}
 
-	char *buf = (char *)(dir + 1);
-	ssize_t size = bfs_getdents(dir->fd, buf, BUF_SIZE);
+	if (dir->want) {
+		bfs_dir_grow(dir);
+	}
+
+	char *buf = dir->buf;
+	ssize_t size = bfs_getdents(dir->fd, buf, dir->cap);
 	if (size == 0) {
 		dir->eof = true;
 		return 0;
@@ -188,7 +264,7 @@ int bfs_polldir(struct bfs_dir *dir) {
 
 	// Like read(), getdents() doesn't indicate EOF until another call returns zero.
 	// Check that eagerly here to hopefully avoid a syscall in the last bfs_readdir().
-	size_t rest = BUF_SIZE - size;
+	size_t rest = dir->cap - size;
 	if (rest >= sizeof(sys_dirent)) {
 		size = bfs_getdents(dir->fd, buf + size, rest);
 		if (size > 0) {
@@ -198,6 +274,11 @@ int bfs_polldir(struct bfs_dir *dir) {
 		}
 	}
 
+	// This directory is bigger than our buffer, so expect more of it
+	if (!dir->eof) {
+		dir->want = bfs_dir_next_cap(dir);
+	}
+
 	return 1;
 #else // !BFS_USE_GETDENTS
 	if (dir->de) {
@@ -206,8 +287,10 @@ int bfs_polldir(struct bfs_dir *dir) {
 		return 0;
 	}
 
+	uint64_t start = perf_start();
 	errno = 0;
 	dir->de = readdir(dir->dir);
+	perf_stop(PERF_GETDENTS, start);
 	if (dir->de) {
 		return 1;
 	} else if (errno == 0) {
@@ -224,8 +307,7 @@ static int bfs_getdent(struct bfs_dir *dir, const sys_dirent **de) {
 	int ret = bfs_polldir(dir);
 	if (ret > 0) {
 #if BFS_USE_GETDENTS
-		char *buf = (char *)(dir + 1);
-		*de = (const sys_dirent *)(buf + dir->pos);
+		*de = (const sys_dirent *)(dir->buf + dir->pos);
 		dir->pos += (*de)->d_reclen;
 #else
 		*de = dir->de;
@@ -271,16 +353,43 @@ int bfs_readdir(struct bfs_dir *dir, struct bfs_dirent *de) {
 
 		if (de) {
 			de->type = bfs_d_type(sysde);
+			de->ino = sysde->d_ino;
 			de->name = sysde->d_name;
 		}
 
+		perf_count(PERF_DIRENT, 1);
 		return 1;
 	}
 }
 
+#if BFS_USE_READAHEAD
+int bfs_readahead(struct bfs_dir *dir, struct bfs_dir *ahead) {
+	if (dir->eof || dir->ahead) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	ahead->fd = dir->fd;
+	ahead->pos = 0;
+	ahead->size = 0;
+	ahead->cap = BUF_SIZE;
+	ahead->ahead = false;
+	// Keep growing, since this directory didn't fit in dir's buffer
+	ahead->want = bfs_dir_next_cap(dir);
+	ahead->buf = (char *)(ahead + 1);
+	ahead->eof = false;
+
+	dir->ahead = true;
+	return 0;
+}
+#endif
+
 int bfs_closedir(struct bfs_dir *dir) {
+	uint64_t start = perf_start();
+
 #if BFS_USE_GETDENTS
 	int ret = xclose(dir->fd);
+	bfs_dir_shrink(dir);
 #else
 	int ret = closedir(dir->dir);
 	if (ret != 0) {
@@ -288,6 +397,7 @@ int bfs_closedir(struct bfs_dir *dir) {
 	}
 #endif
 
+	perf_stop(PERF_CLOSEDIR, start);
 	sanitize_uninit(dir, DIR_SIZE);
 	return ret;
 }
@@ -296,6 +406,7 @@ int bfs_closedir(struct bfs_dir *dir) {
 int bfs_unwrapdir(struct bfs_dir *dir) {
 #if BFS_USE_GETDENTS
 	int ret = dir->fd;
+	bfs_dir_shrink(dir);
 #elif __FreeBSD__
 	int ret = fdclosedir(dir->dir);
 #endif
@@ -66,6 +66,8 @@ enum bfs_type bfs_mode_to_type(mode_t mode);
 struct bfs_dirent {
 	/** The type of this file (possibly unknown). */
 	enum bfs_type type;
+	/** The inode number of this file (0 if unknown). */
+	ino_t ino;
 	/** The name of this file. */
 	const char *name;
 };
@@ -128,6 +130,32 @@ int bfs_polldir(struct bfs_dir *dir);
  */
 int bfs_readdir(struct bfs_dir *dir, struct bfs_dirent *de);
 
+/**
+ * Whether the bfs_readahead() function is supported.
+ */
+#ifndef BFS_USE_READAHEAD
+#  define BFS_USE_READAHEAD BFS_USE_GETDENTS
+#endif
+
+#if BFS_USE_READAHEAD
+/**
+ * Start reading ahead in a directory.  Once the entries already buffered in
+ * dir are exhausted, bfs_readdir(dir) will fail with EAGAIN, and the following
+ * entries must instead be read from ahead.  ahead may be polled from another
+ * thread, as long as dir is not polled concurrently.
+ *
+ * @param dir
+ *         The directory to read ahead in.
+ * @param ahead
+ *         The buffer to read ahead into, which shares the file descriptor of
+ *         dir.  It must not be closed, but should be released with
+ *         bfs_unwrapdir() once it's no longer needed.
+ * @return
+ *         0 on success, or -1 if there is nothing to read ahead.
+ */
+int bfs_readahead(struct bfs_dir *dir, struct bfs_dir *ahead);
+#endif
+
 /**
  * Close a directory.
  *
@@ -6,6 +6,8 @@
  */
 
 #include "eval.h"
+#include "alloc.h"
+#include "ascii.h"
 #include "bar.h"
 #include "bfstd.h"
 #include "bftw.h"
@@ -18,18 +20,27 @@
 #include "dstring.h"
 #include "exec.h"
 #include "expr.h"
+#include "fnset.h"
 #include "fsade.h"
+#include "idset.h"
+#include "index.h"
 #include "mtab.h"
+#include "perf.h"
 #include "printf.h"
+#include "profile.h"
 #include "pwcache.h"
 #include "stat.h"
+#include "trace.h"
 #include "trie.h"
+#include "watch.h"
 #include "xregex.h"
 #include "xtime.h"
 #include <errno.h>
 #include <fcntl.h>
 #include <fnmatch.h>
 #include <grp.h>
+#include <inttypes.h>
+#include <limits.h>
 #include <pwd.h>
 #include <stdarg.h>
 #include <stdint.h>
@@ -51,8 +62,24 @@ struct bfs_eval {
 	enum bftw_action action;
 	/** The bfs_eval() return value. */
 	int *ret;
+	/** The number of actions that have succeeded, for -limit. */
+	int *actions;
+	/** Storage that lasts until the callback returns (NULL when speculative). */
+	struct scratch *scratch;
 	/** Whether to quit immediately. */
 	bool quit;
+	/** Whether we're evaluating ahead of time in a background thread. */
+	bool speculative;
+	/** Whether eval_reorder() may swap operands during the search. */
+	bool reorder;
+	/** Whether an error occurred during speculative evaluation. */
+	bool failed;
+	/** Whether -empty found that the current directory has no entries. */
+	bool empty_dir;
+	/** The -delete action that may leave the deletion to bftw(), if any. */
+	const struct bfs_expr *async_delete;
+	/** The blocks used by this file and everything under it, for -du. */
+	uintmax_t du_blocks;
 };
 
 /**
@@ -60,6 +87,12 @@ struct bfs_eval {
  */
 BFS_FORMATTER(2, 3)
 static void eval_error(struct bfs_eval *state, const char *format, ...) {
+	if (state->speculative) {
+		// The main thread will re-evaluate the file and report the error
+		state->failed = true;
+		return;
+	}
+
 	// By POSIX, any errors should be accompanied by a non-zero exit status
 	*state->ret = EXIT_FAILURE;
 
@@ -94,6 +127,62 @@ static void eval_report_error(struct bfs_eval *state) {
 	}
 }
 
+/**
+ * Copy a string into temporary storage, which lasts until the callback returns.
+ */
+static char *eval_strndup(struct bfs_eval *state, const char *str, size_t n) {
+	if (state->scratch) {
+		return scratch_strndup(state->scratch, str, n);
+	} else {
+		return strndup(str, n);
+	}
+}
+
+/**
+ * Free temporary storage from eval_strndup() or eval_readlink().
+ */
+static void eval_free(struct bfs_eval *state, char *ptr) {
+	// Scratch allocations are freed all at once after the callback
+	if (!state->scratch) {
+		free(ptr);
+	}
+}
+
+/**
+ * Read the target of the current symbolic link into temporary storage.
+ */
+static char *eval_readlink(struct bfs_eval *state) {
+	const struct BFTW *ftwbuf = state->ftwbuf;
+	if (!state->scratch) {
+		return bftw_readlink(ftwbuf);
+	}
+
+	const struct bfs_stat *statbuf = bftw_cached_stat(ftwbuf, BFS_STAT_NOFOLLOW);
+	size_t size = statbuf && (statbuf->mask & BFS_STAT_SIZE) ? statbuf->size : 0;
+	if (size == 0) {
+		size = 64;
+	} else {
+		++size; // NUL terminator
+	}
+
+	while (true) {
+		char *name = scratch_alloc(state->scratch, size);
+		if (!name) {
+			return NULL;
+		}
+
+		ssize_t len = readlinkat(ftwbuf->at_fd, ftwbuf->at_path, name, size);
+		if (len < 0) {
+			return NULL;
+		} else if ((size_t)len < size) {
+			name[len] = '\0';
+			return name;
+		}
+
+		size *= 2;
+	}
+}
+
 /**
  * Report an I/O error that occurs during evaluation.
  */
@@ -276,6 +365,59 @@ bool eval_used(const struct bfs_expr *expr, struct bfs_eval *state) {
 	return bfs_expr_cmp(expr, diff);
 }
 
+/** Check a fused range against a file. */
+static bool eval_range_check(const struct bfs_range_check *check, const struct bfs_stat *statbuf, struct bfs_eval *state) {
+	long long value;
+	switch (check->field) {
+	case BFS_STAT_SIZE:
+		value = statbuf->size;
+		break;
+	case BFS_STAT_UID:
+		value = statbuf->uid;
+		break;
+	case BFS_STAT_GID:
+		value = statbuf->gid;
+		break;
+	case BFS_STAT_NLINK:
+		value = statbuf->nlink;
+		break;
+	case BFS_STAT_INO:
+		value = statbuf->ino;
+		break;
+	default: {
+		const struct timespec *time = eval_stat_time(statbuf, check->field, state);
+		if (!time) {
+			return false;
+		}
+
+		const struct timespec *after = &check->after;
+		const struct timespec *before = &check->before;
+		bool gt = (time->tv_sec > after->tv_sec) | ((time->tv_sec == after->tv_sec) & (time->tv_nsec > after->tv_nsec));
+		bool le = (time->tv_sec < before->tv_sec) | ((time->tv_sec == before->tv_sec) & (time->tv_nsec <= before->tv_nsec));
+		return (gt | !check->has_after) & (le | !check->has_before);
+	}
+	}
+
+	return (value >= check->min) & (value <= check->max);
+}
+
+/**
+ * Fused range tests, like -size +1M -size -100M -mtime -7.
+ */
+bool eval_ranges(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct bfs_stat *statbuf = eval_stat(state);
+	if (!statbuf) {
+		return false;
+	}
+
+	// Every check is cheap, so don't bother short-circuiting
+	bool ret = true;
+	for (size_t i = 0; i < darray_length(expr->checks); ++i) {
+		ret &= eval_range_check(&expr->checks[i], statbuf, state);
+	}
+	return ret;
+}
+
 /**
  * -gid test.
  */
@@ -332,6 +474,127 @@ bool eval_nouser(const struct bfs_expr *expr, struct bfs_eval *state) {
 	return pwd == NULL;
 }
 
+/** Get the *at() flags that match how the current file was stat()ed. */
+static int eval_at_flags(const struct BFTW *ftwbuf) {
+	if (ftwbuf->stat_flags & BFS_STAT_NOFOLLOW) {
+		return AT_SYMLINK_NOFOLLOW;
+	} else {
+		return 0;
+	}
+}
+
+/**
+ * -chmod action.
+ */
+bool eval_chmod(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct bfs_stat *statbuf = eval_stat(state);
+	if (!statbuf) {
+		return false;
+	}
+
+	// Like chmod -R, leave symbolic links alone (most platforms can't
+	// change their permissions anyway)
+	if (S_ISLNK(statbuf->mode)) {
+		return true;
+	}
+
+	mode_t old = statbuf->mode & 07777;
+	mode_t file_mode = expr->file_mode;
+	mode_t dir_mode = expr->dir_mode;
+
+	// Symbolic modes are relative to the current mode.  The string was
+	// already validated during parsing, so this can't fail.
+	const char *mode = expr->argv[1];
+	if (mode[0] < '0' || mode[0] > '9') {
+		file_mode = old;
+		dir_mode = old;
+		xstrtochmod(mode, expr->cmask, &file_mode, &dir_mode);
+	}
+
+	mode_t new = S_ISDIR(statbuf->mode) ? dir_mode : file_mode;
+	if (new == old) {
+		return true;
+	}
+
+	const struct BFTW *ftwbuf = state->ftwbuf;
+	if (fchmodat(ftwbuf->at_fd, ftwbuf->at_path, new, 0) != 0) {
+		eval_report_error(state);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * -chown action.
+ */
+bool eval_chown(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct bfs_stat *statbuf = eval_stat(state);
+	if (!statbuf) {
+		return false;
+	}
+
+	uid_t uid = expr->uid;
+	if (uid == statbuf->uid) {
+		uid = -1;
+	}
+
+	gid_t gid = expr->gid;
+	if (gid == statbuf->gid) {
+		gid = -1;
+	}
+
+	if (uid == (uid_t)-1 && gid == (gid_t)-1) {
+		return true;
+	}
+
+	const struct BFTW *ftwbuf = state->ftwbuf;
+	if (fchownat(ftwbuf->at_fd, ftwbuf->at_path, uid, gid, eval_at_flags(ftwbuf)) != 0) {
+		eval_report_error(state);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * -touch action.
+ */
+bool eval_touch(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct BFTW *ftwbuf = state->ftwbuf;
+	if (utimensat(ftwbuf->at_fd, ftwbuf->at_path, NULL, eval_at_flags(ftwbuf)) != 0) {
+		eval_report_error(state);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * -du action.
+ */
+bool eval_du(const struct bfs_expr *expr, struct bfs_eval *state) {
+	if (!eval_stat(state)) {
+		return false;
+	}
+
+	CFILE *cfile = expr->cfile;
+	uintmax_t block_size = state->ctx->posixly_correct ? 512 : 1024;
+	uintmax_t blocks = (state->du_blocks*BFS_STAT_BLKSIZE + block_size - 1)/block_size;
+	if (fprintf(cfile->file, "%ju\t", blocks) < 0) {
+		goto error;
+	}
+	if (cfprintf(cfile, "%pP\n", state->ftwbuf) < 0) {
+		goto error;
+	}
+
+	return true;
+
+error:
+	eval_io_error(expr, state);
+	return false;
+}
+
 /**
  * -delete action.
  */
@@ -354,6 +617,13 @@ bool eval_delete(const struct bfs_expr *expr, struct bfs_eval *state) {
 		return false;
 	}
 
+	// bftw() can delete it in the background if nothing else looks at
+	// our return value
+	if (expr == state->async_delete && state->action != BFTW_STOP) {
+		state->action = BFTW_DELETE;
+		return true;
+	}
+
 	if (unlinkat(ftwbuf->at_fd, ftwbuf->at_path, flag) != 0) {
 		eval_report_error(state);
 		return false;
@@ -389,7 +659,7 @@ static int eval_exec_finish(const struct bfs_expr *expr, const struct bfs_ctx *c
  * -exec[dir]/-ok[dir] actions.
  */
 bool eval_exec(const struct bfs_expr *expr, struct bfs_eval *state) {
-	bool ret = bfs_exec(expr->exec, state->ftwbuf) == 0;
+	bool ret = bfs_exec(expr->exec, state->ftwbuf, state->scratch) == 0;
 	if (errno != 0) {
 		eval_error(state, "%s %s: %m.\n", expr->argv[0], expr->argv[1]);
 	}
@@ -421,6 +691,11 @@ bool eval_empty(const struct bfs_expr *expr, struct bfs_eval *state) {
 	const struct BFTW *ftwbuf = state->ftwbuf;
 
 	if (ftwbuf->type == BFS_DIR) {
+		// bftw() just read the whole directory, so no need to read it again
+		if (ftwbuf->was_empty) {
+			return true;
+		}
+
 		struct bfs_dir *dir = bfs_allocdir();
 		if (!dir) {
 			eval_report_error(state);
@@ -437,6 +712,7 @@ bool eval_empty(const struct bfs_expr *expr, struct bfs_eval *state) {
 			eval_report_error(state);
 		} else {
 			ret = !did_read;
+			state->empty_dir = ret;
 		}
 
 		bfs_closedir(dir);
@@ -549,9 +825,18 @@ bool eval_links(const struct bfs_expr *expr, struct bfs_eval *state) {
 
 /** Common code for fnmatch() tests. */
 static bool eval_fnmatch(const struct bfs_expr *expr, const char *str) {
-	if (expr->literal) {
+	if (expr->fnset) {
+		return bfs_fnset_match(expr->fnset, str);
+	} else if (expr->literal) {
 #ifdef FNM_CASEFOLD
 		if (expr->fnm_flags & FNM_CASEFOLD) {
+			if (expr->ascii) {
+				// Fold whole blocks at a time, rather than calling
+				// tolower() for every byte like strcasecmp()
+				size_t len = strlen(str);
+				return len == expr->pattern_len
+					&& ascii_caseeq(expr->pattern, str, len);
+			}
 			return strcasecmp(expr->pattern, str) == 0;
 		}
 #endif
@@ -565,27 +850,25 @@ static bool eval_fnmatch(const struct bfs_expr *expr, const char *str) {
  * -i?lname test.
  */
 bool eval_lname(const struct bfs_expr *expr, struct bfs_eval *state) {
-	bool ret = false;
-	char *name = NULL;
-
 	const struct BFTW *ftwbuf = state->ftwbuf;
 	if (ftwbuf->type != BFS_LNK) {
-		goto done;
+		return false;
 	}
 
-	const struct bfs_stat *statbuf = bftw_cached_stat(ftwbuf, BFS_STAT_NOFOLLOW);
-	size_t len = statbuf ? statbuf->size : 0;
+	// Use the prefetched target if we have it, to avoid copying it
+	if (ftwbuf->link_target) {
+		return eval_fnmatch(expr, ftwbuf->link_target);
+	}
 
-	name = xreadlinkat(ftwbuf->at_fd, ftwbuf->at_path, len);
-	if (!name) {
+	bool ret = false;
+	char *name = eval_readlink(state);
+	if (name) {
+		ret = eval_fnmatch(expr, name);
+	} else {
 		eval_report_error(state);
-		goto done;
 	}
 
-	ret = eval_fnmatch(expr, name);
-
-done:
-	free(name);
+	eval_free(state, name);
 	return ret;
 }
 
@@ -600,11 +883,25 @@ bool eval_name(const struct bfs_expr *expr, struct bfs_eval *state) {
 	if (ftwbuf->depth == 0) {
 		// Any trailing slashes are not part of the name.  This can only
 		// happen for the root path.
-		name = copy = xbasename(name);
+		if (!name[0] || strchr(name, '/')) {
+			size_t i = xbaseoff(name);
+			size_t len = strcspn(name + i, "/");
+			if (len > 0) {
+				name = copy = eval_strndup(state, name + i, len);
+				if (!name) {
+					eval_report_error(state);
+					return false;
+				}
+			} else if (name[i] == '/') {
+				name = "/";
+			} else {
+				name = ".";
+			}
+		}
 	}
 
 	bool ret = eval_fnmatch(expr, name);
-	free(copy);
+	eval_free(state, copy);
 	return ret;
 }
 
@@ -723,20 +1020,33 @@ bool eval_fls(const struct bfs_expr *expr, struct bfs_eval *state) {
 	time_t now = ctx->now.tv_sec;
 	time_t six_months_ago = now - 6*30*24*60*60;
 	time_t tomorrow = now + 24*60*60;
-	struct tm tm;
-	if (xlocaltime(&time, &tm) != 0) {
-		goto error;
-	}
-	char time_str[256];
-	size_t time_ret;
-	if (time <= six_months_ago || time >= tomorrow) {
-		time_ret = strftime(time_str, sizeof(time_str), "%b %e  %Y", &tm);
-	} else {
-		time_ret = strftime(time_str, sizeof(time_str), "%b %e %H:%M", &tm);
-	}
-	if (time_ret == 0) {
-		errno = EOVERFLOW;
-		goto error;
+	bool recent = time > six_months_ago && time < tomorrow;
+
+	// Neighbouring files are often modified in the same minute, so reuse
+	// the last string if we can
+	static char time_str[256];
+	static time_t time_minute = -1;
+	static bool time_recent;
+	time_t minute = time >= 0 ? time / 60 : -1;
+	if (minute < 0 || minute != time_minute || recent != time_recent) {
+		struct tm tm;
+		struct xtime_cache *localtimes = (struct xtime_cache *)&ctx->localtimes;
+		if (xlocaltime_cached(localtimes, &time, &tm) != 0) {
+			goto error;
+		}
+		size_t time_ret;
+		if (recent) {
+			time_ret = strftime(time_str, sizeof(time_str), "%b %e %H:%M", &tm);
+		} else {
+			time_ret = strftime(time_str, sizeof(time_str), "%b %e  %Y", &tm);
+		}
+		if (time_ret == 0) {
+			time_minute = -1;
+			errno = EOVERFLOW;
+			goto error;
+		}
+		time_minute = minute;
+		time_recent = recent;
 	}
 	if (cfprintf(cfile, " %s${rs}", time_str) < 0) {
 		goto error;
@@ -768,10 +1078,23 @@ error:
  * -f?print action.
  */
 bool eval_fprint(const struct bfs_expr *expr, struct bfs_eval *state) {
-	if (cfprintf(expr->cfile, "%pP\n", state->ftwbuf) < 0) {
-		eval_io_error(expr, state);
+	CFILE *cfile = expr->cfile;
+	if (cfile->colors) {
+		if (cfprintf(cfile, "%pP\n", state->ftwbuf) < 0) {
+			goto error;
+		}
+	} else {
+		// Without colors, skip the formatting machinery
+		FILE *file = cfile->file;
+		if (fputs(state->ftwbuf->path, file) == EOF || putc('\n', file) == EOF) {
+			goto error;
+		}
 	}
 	return true;
+
+error:
+	eval_io_error(expr, state);
+	return true;
 }
 
 /**
@@ -786,6 +1109,128 @@ bool eval_fprint0(const struct bfs_expr *expr, struct bfs_eval *state) {
 	return true;
 }
 
+/**
+ * A timestamp in a -fprintb record.
+ */
+struct bfs_printb_time {
+	int64_t sec;
+	int64_t nsec;
+};
+
+/**
+ * The fixed-size part of a -fprintb record, which is followed by the
+ * NUL-terminated path and zero padding to a multiple of 8 bytes.  Everything is
+ * in native byte order, and fields missing from the mask are zero.  Keep this
+ * in sync with the schema in bfs(1).
+ */
+struct bfs_printb_header {
+	/** The size of the whole record. */
+	uint32_t reclen;
+	/** The length of the path, not counting the NUL terminator. */
+	uint32_t pathlen;
+	/** The valid fields (enum bfs_stat_field). */
+	uint32_t mask;
+	/** The file type and permissions. */
+	uint32_t mode;
+	/** The owner user ID. */
+	uint32_t uid;
+	/** The owner group ID. */
+	uint32_t gid;
+	/** The depth of the file in the search. */
+	uint32_t depth;
+	/** Reserved, always zero. */
+	uint32_t reserved;
+	/** The device ID containing the file. */
+	uint64_t dev;
+	/** The inode number. */
+	uint64_t ino;
+	/** The number of hard links. */
+	uint64_t nlink;
+	/** The device ID represented by this file. */
+	uint64_t rdev;
+	/** The file size in bytes. */
+	int64_t size;
+	/** The allocated size, in 512-byte blocks. */
+	int64_t blocks;
+	/** Attributes/flags set on the file. */
+	uint64_t attrs;
+	/** Access time. */
+	struct bfs_printb_time atime;
+	/** Birth time. */
+	struct bfs_printb_time btime;
+	/** Status change time. */
+	struct bfs_printb_time ctime;
+	/** Modification time. */
+	struct bfs_printb_time mtime;
+};
+
+bfs_static_assert(sizeof(struct bfs_printb_header) == 152);
+
+/** Convert a timestamp for a -fprintb record. */
+static struct bfs_printb_time printb_time(const struct timespec *ts) {
+	return (struct bfs_printb_time) {
+		.sec = ts->tv_sec,
+		.nsec = ts->tv_nsec,
+	};
+}
+
+/**
+ * -f?printb action.
+ */
+bool eval_fprintb(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct BFTW *ftwbuf = state->ftwbuf;
+	const struct bfs_stat *statbuf = eval_stat(state);
+	if (!statbuf) {
+		return true;
+	}
+
+	static const char zeros[8] = {0};
+	size_t pathlen = strlen(ftwbuf->path);
+	size_t unpadded = sizeof(struct bfs_printb_header) + pathlen + 1;
+	size_t padding = -unpadded % 8;
+	if (unpadded + padding > UINT32_MAX) {
+		eval_error(state, "%s.\n", strerror(ENAMETOOLONG));
+		return true;
+	}
+
+	// Don't leak uninitialized fields
+	enum bfs_stat_field mask = statbuf->mask;
+#define PRINTB_FIELD(field, value) ((mask & (field)) ? (value) : 0)
+#define PRINTB_TIME(field, ts) ((mask & (field)) ? printb_time(ts) : (struct bfs_printb_time) {0})
+
+	struct bfs_printb_header header = {
+		.reclen = unpadded + padding,
+		.pathlen = pathlen,
+		.mask = mask,
+		.mode = statbuf->mode,
+		.uid = PRINTB_FIELD(BFS_STAT_UID, statbuf->uid),
+		.gid = PRINTB_FIELD(BFS_STAT_GID, statbuf->gid),
+		.depth = ftwbuf->depth,
+		.dev = PRINTB_FIELD(BFS_STAT_DEV, statbuf->dev),
+		.ino = PRINTB_FIELD(BFS_STAT_INO, statbuf->ino),
+		.nlink = PRINTB_FIELD(BFS_STAT_NLINK, statbuf->nlink),
+		.rdev = PRINTB_FIELD(BFS_STAT_RDEV, statbuf->rdev),
+		.size = PRINTB_FIELD(BFS_STAT_SIZE, statbuf->size),
+		.blocks = PRINTB_FIELD(BFS_STAT_BLOCKS, (int64_t)statbuf->blocks * BFS_STAT_BLKSIZE / 512),
+		.attrs = PRINTB_FIELD(BFS_STAT_ATTRS, statbuf->attrs),
+		.atime = PRINTB_TIME(BFS_STAT_ATIME, &statbuf->atime),
+		.btime = PRINTB_TIME(BFS_STAT_BTIME, &statbuf->btime),
+		.ctime = PRINTB_TIME(BFS_STAT_CTIME, &statbuf->ctime),
+		.mtime = PRINTB_TIME(BFS_STAT_MTIME, &statbuf->mtime),
+	};
+
+#undef PRINTB_TIME
+#undef PRINTB_FIELD
+
+	FILE *file = expr->cfile->file;
+	if (fwrite(&header, sizeof(header), 1, file) != 1
+	    || fwrite(ftwbuf->path, 1, pathlen + 1, file) != pathlen + 1
+	    || fwrite(zeros, 1, padding, file) != padding) {
+		eval_io_error(expr, state);
+	}
+	return true;
+}
+
 /**
  * -f?printf action.
  */
@@ -852,6 +1297,17 @@ bool eval_quit(const struct bfs_expr *expr, struct bfs_eval *state) {
 	return true;
 }
 
+/**
+ * Count a successful action, quitting once -limit is reached.
+ */
+static void eval_count(struct bfs_eval *state) {
+	int limit = state->ctx->limit;
+	if (limit && ++*state->actions >= limit) {
+		state->action = BFTW_STOP;
+		state->quit = true;
+	}
+}
+
 /**
  * -i?regex test.
  */
@@ -884,16 +1340,8 @@ bool eval_samefile(const struct bfs_expr *expr, struct bfs_eval *state) {
 	return statbuf->dev == expr->dev && statbuf->ino == expr->ino;
 }
 
-/**
- * -size test.
- */
-bool eval_size(const struct bfs_expr *expr, struct bfs_eval *state) {
-	const struct bfs_stat *statbuf = eval_stat(state);
-	if (!statbuf) {
-		return false;
-	}
-
-	static const off_t scales[] = {
+long long bfs_size_scale(enum bfs_size_unit unit) {
+	static const long long scales[] = {
 		[BFS_BLOCKS] = 512,
 		[BFS_BYTES] = 1,
 		[BFS_WORDS] = 2,
@@ -904,7 +1352,19 @@ bool eval_size(const struct bfs_expr *expr, struct bfs_eval *state) {
 		[BFS_PB] = 1LL << 50,
 	};
 
-	off_t scale = scales[expr->size_unit];
+	return scales[unit];
+}
+
+/**
+ * -size test.
+ */
+bool eval_size(const struct bfs_expr *expr, struct bfs_eval *state) {
+	const struct bfs_stat *statbuf = eval_stat(state);
+	if (!statbuf) {
+		return false;
+	}
+
+	off_t scale = bfs_size_scale(expr->size_unit);
 	off_t size = (statbuf->size + scale - 1)/scale; // Round up
 	return bfs_expr_cmp(expr, size);
 }
@@ -1006,12 +1466,76 @@ static void timespec_elapsed(struct timespec *elapsed, const struct timespec *st
 	}
 }
 
+/** How often (in evaluations) to reconsider the order of an -a/-o. */
+#define REORDER_PERIOD 1024
+
+/** The minimum number of evaluations before trusting observed rates. */
+#define REORDER_MIN_EVALS 64
+
+/** How many files to evaluate before the order settles and can be compiled. */
+#define REORDER_SETTLE (16 * REORDER_PERIOD)
+
+/** The observed cost of an expression, falling back to the static estimate. */
+static float eval_observed_cost(const struct bfs_expr *expr) {
+	if (expr->evaluations >= REORDER_MIN_EVALS && (expr->elapsed.tv_sec || expr->elapsed.tv_nsec)) {
+		double ns = 1.0e9 * expr->elapsed.tv_sec + expr->elapsed.tv_nsec;
+		return ns / expr->evaluations;
+	} else {
+		return expr->cost;
+	}
+}
+
+/** The observed success rate of an expression, falling back to the static estimate. */
+static float eval_observed_probability(const struct bfs_expr *expr) {
+	if (expr->evaluations >= REORDER_MIN_EVALS) {
+		return (double)expr->successes / expr->evaluations;
+	} else {
+		return expr->probability;
+	}
+}
+
+/**
+ * Swap the operands of a pure -a/-o if the observed rates say the other order
+ * is cheaper.  This is the same rule as reorder_expr() in opt.c, but using the
+ * statistics gathered so far rather than the static estimates.
+ */
+static void eval_reorder(struct bfs_expr *expr) {
+	struct bfs_expr *lhs = expr->lhs;
+	struct bfs_expr *rhs = expr->rhs;
+	if (!lhs->pure || !rhs->pure) {
+		return;
+	}
+
+	float lhs_cost = eval_observed_cost(lhs);
+	float rhs_cost = eval_observed_cost(rhs);
+	float lhs_prob = eval_observed_probability(lhs);
+	float rhs_prob = eval_observed_probability(rhs);
+	if (expr->eval_fn == eval_or) {
+		lhs_prob = 1.0 - lhs_prob;
+		rhs_prob = 1.0 - rhs_prob;
+	}
+
+	float cost = lhs_cost + lhs_prob * rhs_cost;
+	float swapped_cost = rhs_cost + rhs_prob * lhs_cost;
+
+	// Leave some slack so noisy measurements don't flip-flop
+	if (swapped_cost < 0.9 * cost) {
+		expr->lhs = rhs;
+		expr->rhs = lhs;
+	}
+}
+
 /**
  * Evaluate an expression.
  */
 static bool eval_expr(struct bfs_expr *expr, struct bfs_eval *state) {
+	if (state->speculative) {
+		// Don't touch the shared statistics from background threads
+		return expr->eval_fn(expr, state);
+	}
+
 	struct timespec start, end;
-	bool time = state->ctx->debug & DEBUG_RATES;
+	bool time = (state->ctx->debug & DEBUG_RATES) || state->ctx->profile_path;
 	if (time) {
 		if (eval_gettime(state, &start) != 0) {
 			time = false;
@@ -1021,6 +1545,9 @@ static bool eval_expr(struct bfs_expr *expr, struct bfs_eval *state) {
 	bfs_assert(!state->quit);
 
 	bool ret = expr->eval_fn(expr, state);
+	if (ret && expr->counted) {
+		eval_count(state);
+	}
 
 	if (time) {
 		if (eval_gettime(state, &end) == 0) {
@@ -1033,6 +1560,12 @@ static bool eval_expr(struct bfs_expr *expr, struct bfs_eval *state) {
 		++expr->successes;
 	}
 
+	if (state->reorder
+	    && (expr->eval_fn == eval_and || expr->eval_fn == eval_or)
+	    && expr->evaluations % REORDER_PERIOD == 0) {
+		eval_reorder(expr);
+	}
+
 	if (bfs_expr_never_returns(expr)) {
 		bfs_assert(state->quit);
 	} else if (!state->quit) {
@@ -1093,42 +1626,189 @@ bool eval_comma(const struct bfs_expr *expr, struct bfs_eval *state) {
 	return eval_expr(expr->rhs, state);
 }
 
-/** Update the status bar. */
-static void eval_status(struct bfs_eval *state, struct bfs_bar *bar, struct timespec *last_status, size_t count) {
-	struct timespec now;
-	if (eval_gettime(state, &now) == 0) {
-		struct timespec elapsed = {0};
-		timespec_elapsed(&elapsed, last_status, &now);
+/**
+ * A compiled expression.  Each leaf of the tree becomes one instruction, and
+ * the operators become the jumps between them, so evaluating a file is a
+ * single loop over a contiguous array.
+ */
+struct eval_prog {
+	/** The number of instructions. */
+	uint32_t len;
+	/** The instructions themselves. */
+	struct eval_insn {
+		/** The leaf's evaluation function. */
+		bfs_eval_fn *eval_fn;
+		/** The leaf itself. */
+		const struct bfs_expr *expr;
+		/**
+		 * The next instruction, indexed by the leaf's result.  Targets
+		 * past the end are the result of the whole expression:
+		 * len for false, len + 1 for true.
+		 */
+		uint32_t next[2];
+		/**
+		 * Where to go instead of starting this instruction after
+		 * -quit, since every operator stops before its right-hand side.
+		 */
+		uint32_t skip;
+	} insns[];
+};
+
+/** Count the leaves of an expression. */
+static uint32_t eval_count_leaves(const struct bfs_expr *expr) {
+	if (!bfs_expr_is_parent(expr)) {
+		return 1;
+	}
+
+	uint32_t ret = eval_count_leaves(expr->rhs);
+	if (expr->lhs) {
+		ret += eval_count_leaves(expr->lhs);
+	}
+	return ret;
+}
+
+/**
+ * Compile an expression to prog->insns[pc...], jumping to t or f depending on
+ * its result.
+ *
+ * @return
+ *         The number of instructions emitted.
+ */
+static uint32_t eval_compile_expr(struct eval_prog *prog, const struct bfs_expr *expr, uint32_t pc, uint32_t t, uint32_t f) {
+	bfs_eval_fn *fn = expr->eval_fn;
+
+	if (fn == eval_not) {
+		return eval_compile_expr(prog, expr->rhs, pc, f, t);
+	} else if (fn != eval_and && fn != eval_or && fn != eval_comma) {
+		struct eval_insn *insn = &prog->insns[pc];
+		insn->eval_fn = fn;
+		insn->expr = expr;
+		insn->next[false] = f;
+		insn->next[true] = t;
+		insn->skip = f;
+		return 1;
+	}
+
+	uint32_t mid = pc + eval_count_leaves(expr->lhs);
+	uint32_t lhs;
+	if (fn == eval_and) {
+		lhs = eval_compile_expr(prog, expr->lhs, pc, mid, f);
+	} else if (fn == eval_or) {
+		lhs = eval_compile_expr(prog, expr->lhs, pc, t, mid);
+	} else {
+		lhs = eval_compile_expr(prog, expr->lhs, pc, mid, mid);
+	}
+
+	uint32_t rhs = eval_compile_expr(prog, expr->rhs, mid, t, f);
+
+	// The operator returns false if the left-hand side quits
+	prog->insns[mid].skip = f;
+	return lhs + rhs;
+}
+
+/** Compile an expression. */
+static struct eval_prog *eval_compile(const struct bfs_expr *expr) {
+	uint32_t len = eval_count_leaves(expr);
+	struct eval_prog *prog = ALLOC_FLEX(struct eval_prog, insns, len);
+	if (!prog) {
+		return NULL;
+	}
+
+	prog->len = len;
+	eval_compile_expr(prog, expr, 0, len + 1, len);
+	return prog;
+}
+
+/**
+ * Run a compiled expression.  Unlike eval_expr(), this skips all the
+ * bookkeeping for -D rates, -profile, and eval_reorder().
+ */
+static bool eval_run(const struct eval_prog *prog, struct bfs_eval *state) {
+	const struct eval_insn *insns = prog->insns;
+	uint32_t len = prog->len;
 
-		// Update every 0.1s
-		if (elapsed.tv_sec > 0 || elapsed.tv_nsec >= 100000000L) {
-			*last_status = now;
+	uint32_t pc = 0;
+	while (pc < len) {
+		const struct eval_insn *insn = &insns[pc];
+		bool ret = insn->eval_fn(insn->expr, state);
+		if (ret && insn->expr->counted) {
+			eval_count(state);
+		}
+		pc = insn->next[ret];
+
+		if (state->quit) {
+			while (pc < len) {
+				pc = insns[pc].skip;
+			}
 		} else {
-			return;
+			bfs_assert(!insn->expr->always_true || ret);
+			bfs_assert(!insn->expr->always_false || !ret);
 		}
 	}
 
+	return pc > len;
+}
+
+/**
+ * Progress information for the status bar.
+ */
+struct eval_progress {
+	/** The number of files visited so far. */
+	size_t files;
+	/** The number of directories visited so far. */
+	size_t dirs;
+	/** The time of the first status update. */
+	struct timespec start;
+	/** Whether start has been set. */
+	bool started;
+	/** Counters published by bftw(). */
+	struct bftw_progress bftw;
+};
+
+/** Update the status bar. */
+static void eval_status(struct bfs_eval *state, struct bfs_bar *bar, struct eval_progress *progress) {
+	// The bar's own timer keeps clock_gettime() off the per-file path
+	if (!bfs_bar_due(bar)) {
+		return;
+	}
+
 	size_t width = bfs_bar_width(bar);
 	if (width < 3) {
 		return;
 	}
 
-	const struct BFTW *ftwbuf = state->ftwbuf;
+	double seconds = 0.0;
+	struct timespec now;
+	if (eval_gettime(state, &now) == 0) {
+		if (!progress->started) {
+			progress->start = now;
+			progress->started = true;
+		}
 
-	char *rhs = dstrprintf(" (visited: %zu, depth: %2zu)", count, ftwbuf->depth);
-	if (!rhs) {
-		return;
+		struct timespec elapsed = {0};
+		timespec_elapsed(&elapsed, &progress->start, &now);
+		seconds = elapsed.tv_sec + elapsed.tv_nsec / 1.0e9;
 	}
 
-	size_t rhslen = dstrlen(rhs);
-	if (3 + rhslen > width) {
-		dstresize(&rhs, 0);
-		rhslen = 0;
+	double file_rate = 0.0, dir_rate = 0.0;
+	if (seconds > 0.0) {
+		file_rate = progress->files / seconds;
+		dir_rate = progress->dirs / seconds;
 	}
 
-	char *status = dstralloc(0);
-	if (!status) {
-		goto out_rhs;
+	const struct BFTW *ftwbuf = state->ftwbuf;
+	size_t queued = load(&progress->bftw.queued, relaxed);
+
+	char rhs[256];
+	int rhslen = snprintf(rhs, sizeof(rhs), " (visited: %zu, %.0f/s, dirs: %.0f/s, queued: %zu, depth: %2zu)",
+		progress->files, file_rate, dir_rate, queued, ftwbuf->depth);
+	if (rhslen < 0 || (size_t)rhslen >= sizeof(rhs) || 3 + (size_t)rhslen > width) {
+		// Fall back to the short form on narrow terminals
+		rhslen = snprintf(rhs, sizeof(rhs), " (visited: %zu, depth: %2zu)", progress->files, ftwbuf->depth);
+	}
+	if (rhslen < 0 || 3 + (size_t)rhslen > width) {
+		rhs[0] = '\0';
+		rhslen = 0;
 	}
 
 	const char *path = ftwbuf->path;
@@ -1137,6 +1817,13 @@ static void eval_status(struct bfs_eval *state, struct bfs_bar *bar, struct time
 		pathlen = strlen(path);
 	}
 
+	// At most the whole path, "...", the padding, and the right-hand side
+	char *status = scratch_alloc(state->scratch, pathlen + width + 1);
+	if (!status) {
+		return;
+	}
+	char *cur = status;
+
 	// Try to make sure even wide characters fit in the status bar
 	size_t pathmax = width - rhslen - 3;
 	size_t pathwidth = 0;
@@ -1166,58 +1853,40 @@ static void eval_status(struct bfs_eval *state, struct bfs_bar *bar, struct time
 			break;
 		}
 
-		if (dstrncat(&status, path, len) != 0) {
-			goto out_rhs;
-		}
-
+		memcpy(cur, path, len);
+		cur += len;
 		path += len;
 		pathlen -= len;
 		pathwidth += cwidth;
 	}
 
-	if (dstrcat(&status, "...") != 0) {
-		goto out_rhs;
-	}
-
+	cur = stpcpy(cur, "...");
 	while (pathwidth < pathmax) {
-		if (dstrapp(&status, ' ') != 0) {
-			goto out_rhs;
-		}
+		*cur++ = ' ';
 		++pathwidth;
 	}
-
-	if (dstrcat(&status, rhs) != 0) {
-		goto out_rhs;
-	}
+	stpcpy(cur, rhs);
 
 	bfs_bar_update(bar, status);
-
-	dstrfree(status);
-out_rhs:
-	dstrfree(rhs);
 }
 
 /** Check if we've seen a file before. */
-static bool eval_file_unique(struct bfs_eval *state, struct trie *seen) {
+static bool eval_file_unique(struct bfs_eval *state, struct idset *seen) {
 	const struct bfs_stat *statbuf = eval_stat(state);
 	if (!statbuf) {
 		return false;
 	}
 
-	bfs_file_id id;
-	bfs_stat_id(statbuf, &id);
-
-	struct trie_leaf *leaf = trie_insert_mem(seen, id, sizeof(id));
-	if (!leaf) {
+	int ret = idset_insert(seen, statbuf->dev, statbuf->ino);
+	if (ret < 0) {
 		eval_report_error(state);
 		return false;
 	}
 
-	if (leaf->value) {
+	if (ret == 0) {
 		state->action = BFTW_PRUNE;
 		return false;
 	} else {
-		leaf->value = leaf;
 		return true;
 	}
 }
@@ -1330,6 +1999,7 @@ static const char *dump_bftw_action(enum bftw_action action) {
 		DUMP_MAP(BFTW_CONTINUE),
 		DUMP_MAP(BFTW_PRUNE),
 		DUMP_MAP(BFTW_STOP),
+		DUMP_MAP(BFTW_DELETE),
 	};
 	return actions[action];
 }
@@ -1343,36 +2013,464 @@ struct callback_args {
 
 	/** The status bar. */
 	struct bfs_bar *bar;
-	/** The time of the last status update. */
-	struct timespec last_status;
-	/** The number of files visited so far. */
-	size_t count;
+	/** Progress information for the status bar. */
+	struct eval_progress progress;
 
 	/** The set of seen files. */
-	struct trie *seen;
+	struct idset *seen;
+
+	/** The last root path read from -files0-from. */
+	char *root;
+
+	/** The part of the expression evaluated by eval_filter(), if any. */
+	struct bfs_expr *filter;
+	/** The part of the expression evaluated by eval_batch(), if any. */
+	struct bfs_expr *batch;
+	/** Whether eval_reorder() may swap operands during the search. */
+	bool reorder;
+	/** The number of files left before compiling the expressions, if any. */
+	size_t settling;
+	/** The compiled -exclude expression, if any. */
+	struct eval_prog *exclude_prog;
+	/** The compiled main expression, if any. */
+	struct eval_prog *expr_prog;
+	/** The compiled right-hand side, for files that matched the filter. */
+	struct eval_prog *rhs_prog;
+	/** The compiled filter, if any. */
+	struct eval_prog *filter_prog;
+	/** Whether directories found empty by -empty can be pruned. */
+	bool prune_empty;
+	/** The -delete action that may run in the background, if any. */
+	const struct bfs_expr *async_delete;
+
+	/** The -incremental snapshot, if any. */
+	struct bfs_index *snapshot;
+	/** The unchanged directories, as prefixes ending in '/'. */
+	struct trie unchanged;
+	/** Temporary storage for path prefixes. */
+	char *prefix;
+	/** Whether the search ended early, so the snapshot can't be updated. */
+	bool incomplete;
+	/** Whether -quit or -exit stopped the search. */
+	bool quit;
+
+	/** The directories being watched for -watch, if any. */
+	struct bfs_watch *watch;
+	/** Whether this pass only visits files that changed since the last one. */
+	bool watch_filter;
+	/** The files that changed since the last pass. */
+	struct trie changed;
+	/** The new directories since the last pass, as prefixes ending in '/'. */
+	struct trie subtrees;
+	/** Whether we've already warned about failing to watch a directory. */
+	bool watch_warned;
+
+	/** The blocks used under each directory so far, for -du, keyed by prefixes ending in '/'. */
+	struct trie du_dirs;
+	/** The hard links already counted by -du. */
+	struct idset du_links;
+
+	/** The number of actions that have succeeded, for -limit. */
+	int actions;
+	/** Temporary allocations, freed after every callback. */
+	struct scratch scratch;
 
 	/** Eventual return value from bfs_eval(). */
 	int ret;
 };
 
+/** Free the compiled expressions. */
+static void eval_free_progs(struct callback_args *args) {
+	free(args->filter_prog);
+	free(args->rhs_prog);
+	free(args->expr_prog);
+	free(args->exclude_prog);
+	args->filter_prog = NULL;
+	args->rhs_prog = NULL;
+	args->expr_prog = NULL;
+	args->exclude_prog = NULL;
+}
+
+/** Compile the expressions, falling back to eval_expr() on failure. */
+static void eval_compile_progs(struct callback_args *args) {
+	const struct bfs_ctx *ctx = args->ctx;
+
+	args->exclude_prog = eval_compile(ctx->exclude);
+	args->expr_prog = eval_compile(ctx->expr);
+	if (!args->exclude_prog || !args->expr_prog) {
+		goto fail;
+	}
+
+	if (args->filter) {
+		args->rhs_prog = eval_compile(ctx->expr->rhs);
+		args->filter_prog = eval_compile(args->filter);
+		if (!args->rhs_prog || !args->filter_prog) {
+			goto fail;
+		}
+	}
+
+	return;
+fail:
+	eval_free_progs(args);
+}
+
+/** Evaluate an expression, compiled if possible. */
+static bool eval_top(const struct eval_prog *prog, struct bfs_expr *expr, struct bfs_eval *state) {
+	if (prog) {
+		return eval_run(prog, state);
+	} else {
+		return eval_expr(expr, state);
+	}
+}
+
+/** Check if a file's parent directory is unchanged since the snapshot. */
+static bool eval_parent_unchanged(struct callback_args *args, const struct BFTW *ftwbuf) {
+	if (!args->snapshot || ftwbuf->depth == 0) {
+		return false;
+	}
+
+	// Keys can be prefixes of each other, so look them up with a terminator
+	if (dstrxcpy(&args->prefix, ftwbuf->path, ftwbuf->nameoff) != 0) {
+		return false;
+	}
+
+	return trie_find_str(&args->unchanged, args->prefix);
+}
+
+/** Compare a directory we'll descend into against the snapshot, and update it. */
+static void eval_snapshot_dir(struct callback_args *args, const struct BFTW *ftwbuf) {
+	const struct bfs_stat *statbuf = bftw_stat(ftwbuf, ftwbuf->stat_flags);
+	if (!statbuf) {
+		// Not recording it means it will look changed next time
+		return;
+	}
+
+	struct bfs_index_cursor cursor;
+	if (bfs_index_lookup(args->snapshot, ftwbuf->path, statbuf, &cursor)) {
+		size_t len = strlen(ftwbuf->path);
+		if (dstrxcpy(&args->prefix, ftwbuf->path, len) != 0) {
+			goto fail;
+		}
+		if (len == 0 || ftwbuf->path[len - 1] != '/') {
+			if (dstrapp(&args->prefix, '/') != 0) {
+				goto fail;
+			}
+		}
+		if (!trie_insert_str(&args->unchanged, args->prefix)) {
+			goto fail;
+		}
+	}
+
+	if (bfs_index_begin(args->snapshot, ftwbuf->path, statbuf) != 0) {
+		goto fail;
+	}
+	bfs_index_end(args->snapshot, true);
+	return;
+
+fail:
+	args->incomplete = true;
+}
+
+/**
+ * How a -watch pass handles a file.
+ */
+enum eval_watch_visit {
+	/** Evaluate the file as usual. */
+	EVAL_WATCH_EVAL,
+	/** Descend without evaluating, since something below it changed. */
+	EVAL_WATCH_DESCEND,
+	/** Nothing here changed. */
+	EVAL_WATCH_SKIP,
+};
+
+/** Check if a file is relevant to this -watch pass. */
+static enum eval_watch_visit eval_watch_visit(struct callback_args *args, const struct BFTW *ftwbuf) {
+	if (!args->watch_filter) {
+		return EVAL_WATCH_EVAL;
+	}
+
+	const char *path = ftwbuf->path;
+	if (trie_find_str(&args->changed, path) || trie_find_prefix(&args->subtrees, path)) {
+		return EVAL_WATCH_EVAL;
+	}
+
+	if (ftwbuf->type != BFS_DIR) {
+		return EVAL_WATCH_SKIP;
+	}
+
+	// Look for changed files below this directory
+	size_t len = strlen(path);
+	if (dstrxcpy(&args->prefix, path, len) != 0) {
+		return EVAL_WATCH_EVAL;
+	}
+	if (len == 0 || path[len - 1] != '/') {
+		if (dstrapp(&args->prefix, '/') != 0) {
+			return EVAL_WATCH_EVAL;
+		}
+	}
+
+	if (trie_find_postfix(&args->changed, args->prefix)) {
+		return EVAL_WATCH_DESCEND;
+	} else {
+		return EVAL_WATCH_SKIP;
+	}
+}
+
+/** Start watching a directory we'll descend into. */
+static void eval_watch_dir(struct callback_args *args, const struct BFTW *ftwbuf) {
+	if (bfs_watch_add(args->watch, ftwbuf->path) == 0) {
+		return;
+	}
+
+	// It may have disappeared already, which we'll hear about from its parent
+	if (errno == ENOENT || errno == ENOTDIR) {
+		return;
+	}
+
+	// Most likely ENOSPC, from running out of inotify watches
+	if (!args->watch_warned) {
+		bfs_warning(args->ctx, "%pP: Couldn't watch for changes: %m.\n", ftwbuf);
+		args->watch_warned = true;
+	}
+}
+
+/**
+ * Check if a glob (as used by -path) could match a path that starts with a
+ * prefix.  Anything too complicated to rule out is assumed to match.
+ */
+static bool eval_glob_prefix(const char *glob, const char *str, size_t len, bool casefold) {
+	for (size_t i = 0; i < len; ++i) {
+		unsigned char c = str[i];
+
+		switch (*glob) {
+		case '*':
+		case '[':
+			return true;
+		case '?':
+			if (c >= 0x80) {
+				// Could be part of a multi-byte character
+				return true;
+			}
+			++glob;
+			continue;
+		case '\\':
+			++glob;
+			break;
+		}
+
+		unsigned char g = *glob++;
+		if (!g) {
+			return false;
+		}
+
+		if (casefold) {
+			if (c >= 0x80 || g >= 0x80) {
+				// Case folding depends on the locale
+				return true;
+			}
+			if (c >= 'A' && c <= 'Z') {
+				c += 'a' - 'A';
+			}
+			if (g >= 'A' && g <= 'Z') {
+				g += 'a' - 'A';
+			}
+		}
+
+		if (c != g) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/** Check if anything under a directory could match bfs_ctx::prune_glob. */
+static bool eval_may_match_under(struct callback_args *args, const struct BFTW *ftwbuf) {
+	const struct bfs_ctx *ctx = args->ctx;
+
+	// In -depth mode, pruning also skips the directory itself
+	if (ctx->flags & BFTW_POST_ORDER) {
+		return eval_glob_prefix(ctx->prune_glob, ftwbuf->path, strlen(ftwbuf->path), ctx->prune_casefold);
+	}
+
+	if (dstrcpy(&args->prefix, ftwbuf->path) != 0) {
+		return true;
+	}
+	size_t len = dstrlen(args->prefix);
+	if (len > 0 && args->prefix[len - 1] != '/') {
+		if (dstrapp(&args->prefix, '/') != 0) {
+			return true;
+		}
+		++len;
+	}
+
+	return eval_glob_prefix(ctx->prune_glob, args->prefix, len, ctx->prune_casefold);
+}
+
+/**
+ * Check if a file belongs to this -shard.  The path is hashed relative to its
+ * root, so searches of the same tree from different mount points still agree.
+ */
+static bool eval_shard_owns(const struct bfs_ctx *ctx, const struct BFTW *ftwbuf) {
+	const char *key = ftwbuf->path;
+	if (ftwbuf->depth > 0) {
+		key += strlen(ftwbuf->root);
+		while (*key == '/') {
+			++key;
+		}
+	}
+
+	// FNV-1a, then mix the bits so the low ones are usable
+	uint64_t hash = UINT64_C(0xCBF29CE484222325);
+	for (const char *c = key; *c; ++c) {
+		hash ^= (unsigned char)*c;
+		hash *= UINT64_C(0x100000001B3);
+	}
+	hash ^= hash >> 33;
+	hash *= UINT64_C(0xFF51AFD7ED558CCD);
+	hash ^= hash >> 33;
+
+	return hash % ctx->nshards == (uint64_t)(ctx->shard - 1);
+}
+
+/** Add to the -du total for the parent of the current file. */
+static int eval_du_add(struct callback_args *args, const struct BFTW *ftwbuf, uintmax_t blocks) {
+	if (dstrncpy(&args->prefix, ftwbuf->path, ftwbuf->nameoff) != 0) {
+		return -1;
+	}
+
+	struct trie_leaf *leaf = trie_insert_str(&args->du_dirs, args->prefix);
+	if (!leaf) {
+		return -1;
+	}
+
+	uintmax_t *total = leaf->value;
+	if (!total) {
+		total = ZALLOC(uintmax_t);
+		if (!total) {
+			trie_remove(&args->du_dirs, leaf);
+			return -1;
+		}
+		leaf->value = total;
+	}
+
+	*total += blocks;
+	return 0;
+}
+
+/**
+ * Add up disk usage for -du.  Every file is counted towards its parent on the
+ * pre-order visit; directories add the totals for their contents on the
+ * post-order visit, which comes after everything under them.
+ */
+static void eval_du_visit(struct callback_args *args, struct bfs_eval *state) {
+	const struct BFTW *ftwbuf = state->ftwbuf;
+	const struct bfs_stat *statbuf = bftw_stat(ftwbuf, ftwbuf->stat_flags);
+	if (!statbuf) {
+		// eval_du() will report the error
+		return;
+	}
+
+	uintmax_t blocks = statbuf->blocks;
+	if (ftwbuf->visit == BFTW_PRE && ftwbuf->type != BFS_DIR && statbuf->nlink > 1) {
+		// Count hard links once, like du.  Failure is okay, we'll
+		// just count them again.
+		if (idset_insert(&args->du_links, statbuf->dev, statbuf->ino) == 0) {
+			blocks = 0;
+		}
+	}
+
+	uintmax_t subtotal = 0;
+	if (ftwbuf->visit == BFTW_POST) {
+		if (dstrcpy(&args->prefix, ftwbuf->path) != 0) {
+			goto fail;
+		}
+		size_t len = dstrlen(args->prefix);
+		if (len > 0 && args->prefix[len - 1] != '/') {
+			if (dstrapp(&args->prefix, '/') != 0) {
+				goto fail;
+			}
+		}
+
+		struct trie_leaf *leaf = trie_find_str(&args->du_dirs, args->prefix);
+		if (leaf) {
+			uintmax_t *total = leaf->value;
+			subtotal = *total;
+			free(total);
+			trie_remove(&args->du_dirs, leaf);
+		}
+	}
+
+	state->du_blocks = blocks + subtotal;
+
+	// The directory itself was already counted on the pre-order visit
+	uintmax_t add = ftwbuf->visit == BFTW_PRE ? blocks : subtotal;
+	if (ftwbuf->depth > 0 && add > 0) {
+		if (eval_du_add(args, ftwbuf, add) != 0) {
+			goto fail;
+		}
+	}
+	return;
+
+fail:
+	eval_report_error(state);
+}
+
 /**
  * bftw() callback.
  */
 static enum bftw_action eval_callback(const struct BFTW *ftwbuf, void *ptr) {
 	struct callback_args *args = ptr;
-	++args->count;
 
 	const struct bfs_ctx *ctx = args->ctx;
 
+	uint64_t start = trace_eval_start(ftwbuf->depth);
+
+	if (args->settling > 0 && --args->settling == 0) {
+		eval_compile_progs(args);
+	}
+
 	struct bfs_eval state;
 	state.ftwbuf = ftwbuf;
 	state.ctx = ctx;
 	state.action = BFTW_CONTINUE;
 	state.ret = &args->ret;
+	state.actions = &args->actions;
+	state.scratch = &args->scratch;
 	state.quit = false;
+	state.speculative = false;
+	state.reorder = args->reorder && !args->expr_prog;
+	state.failed = false;
+	state.empty_dir = false;
+	state.async_delete = args->async_delete;
+	state.du_blocks = 0;
 
 	if (args->bar) {
-		eval_status(&state, args->bar, &args->last_status, args->count);
+		struct eval_progress *progress = &args->progress;
+		++progress->files;
+		if (ftwbuf->type == BFS_DIR && ftwbuf->visit == BFTW_PRE) {
+			++progress->dirs;
+		}
+		eval_status(&state, args->bar, progress);
+	}
+
+	switch (eval_watch_visit(args, ftwbuf)) {
+	case EVAL_WATCH_EVAL:
+		break;
+	case EVAL_WATCH_DESCEND:
+		goto done;
+	case EVAL_WATCH_SKIP:
+		state.action = BFTW_PRUNE;
+		goto done;
+	}
+
+	// Every shard walks the levels above the split, but only the owner
+	// evaluates each file, and only the owner descends below it
+	if (ctx->nshards && ftwbuf->depth <= (size_t)ctx->shard_depth && !eval_shard_owns(ctx, ftwbuf)) {
+		if (ftwbuf->depth == (size_t)ctx->shard_depth) {
+			state.action = BFTW_PRUNE;
+		}
+		goto done;
 	}
 
 	if (ftwbuf->type == BFS_ERROR) {
@@ -1380,42 +2478,91 @@ static enum bftw_action eval_callback(const struct BFTW *ftwbuf, void *ptr) {
 			eval_error(&state, "%s.\n", strerror(ftwbuf->error));
 		}
 		state.action = BFTW_PRUNE;
+		args->incomplete = true;
 		goto done;
 	}
 
-	if (ctx->unique && ftwbuf->visit == BFTW_PRE) {
+	// -du counts everything under -maxdepth, but doesn't evaluate it
+	bool du_only = ctx->du && ctx->maxdepth >= 0 && ftwbuf->depth > (size_t)ctx->maxdepth;
+
+	if (ctx->unique && ftwbuf->visit == BFTW_PRE && !du_only) {
 		if (!eval_file_unique(&state, args->seen)) {
 			goto done;
 		}
 	}
 
-	if (eval_expr(ctx->exclude, &state)) {
+	if (eval_top(args->exclude_prog, ctx->exclude, &state)) {
 		state.action = BFTW_PRUNE;
 		goto done;
 	}
 
-	if (ctx->xargs_safe && strpbrk(ftwbuf->path, " \t\n\'\"\\")) {
+	if (ctx->xargs_safe && !du_only && strpbrk(ftwbuf->path, " \t\n\'\"\\")) {
 		eval_error(&state, "Path is not safe for xargs.\n");
 		state.action = BFTW_PRUNE;
 		goto done;
 	}
 
-	if (ctx->maxdepth < 0 || ftwbuf->depth >= (size_t)ctx->maxdepth) {
+	if (ctx->du) {
+		eval_du_visit(args, &state);
+	}
+
+	if (du_only) {
+		goto done;
+	}
+
+	if (ctx->maxdepth < 0 || (ftwbuf->depth >= (size_t)ctx->maxdepth && !ctx->du)) {
 		state.action = BFTW_PRUNE;
 	}
 
 	// In -depth mode, only handle directories on the BFTW_POST visit
+	// (which directories at -maxdepth only get if -du keeps going)
 	enum bftw_visit expected_visit = BFTW_PRE;
 	if ((ctx->flags & BFTW_POST_ORDER)
 	    && (ctx->strategy == BFTW_IDS || ftwbuf->type == BFS_DIR)
-	    && ftwbuf->depth < (size_t)ctx->maxdepth) {
+	    && (ftwbuf->depth < (size_t)ctx->maxdepth || ctx->du)) {
 		expected_visit = BFTW_POST;
 	}
 
+	// Like -mindepth, -incremental skips files without pruning the search
 	if (ftwbuf->visit == expected_visit
 	    && ftwbuf->depth >= (size_t)ctx->mindepth
-	    && ftwbuf->depth <= (size_t)ctx->maxdepth) {
-		eval_expr(ctx->expr, &state);
+	    && ftwbuf->depth <= (size_t)ctx->maxdepth
+	    && !eval_parent_unchanged(args, ftwbuf)) {
+		if (ftwbuf->filtered < 0) {
+			eval_top(args->expr_prog, ctx->expr, &state);
+		} else if (ftwbuf->filtered > 0) {
+			// eval_filter() already matched the left-hand side
+			eval_top(args->rhs_prog, ctx->expr->rhs, &state);
+		}
+	}
+
+	// -empty already found nothing to descend into, so don't read it again
+	if (state.empty_dir && state.action == BFTW_CONTINUE && ftwbuf->visit == BFTW_PRE && args->prune_empty) {
+		state.action = BFTW_PRUNE;
+	}
+
+	// Nothing under this directory could match the -path that every side
+	// effect depends on
+	if (ctx->prune_glob && state.action == BFTW_CONTINUE && ftwbuf->visit == BFTW_PRE && ftwbuf->type == BFS_DIR) {
+		if (!eval_may_match_under(args, ftwbuf)) {
+			state.action = BFTW_PRUNE;
+		}
+	}
+
+	if (args->snapshot) {
+		if (state.action == BFTW_STOP) {
+			args->incomplete = true;
+		} else if (state.action == BFTW_CONTINUE && ftwbuf->visit == BFTW_PRE && ftwbuf->type == BFS_DIR) {
+			eval_snapshot_dir(args, ftwbuf);
+		}
+	}
+
+	if (args->watch && state.action == BFTW_CONTINUE && ftwbuf->visit == BFTW_PRE && ftwbuf->type == BFS_DIR) {
+		eval_watch_dir(args, ftwbuf);
+	}
+
+	if (state.action == BFTW_STOP) {
+		args->quit = true;
 	}
 
 done:
@@ -1431,15 +2578,121 @@ done:
 		fprintf(stderr, "}) == %s\n", dump_bftw_action(state.action));
 	}
 
+	scratch_reset(&args->scratch);
+	trace_eval_stop(start, ftwbuf->depth);
 	return state.action;
 }
 
-/** Check if an rlimit value is infinite. */
-static bool rlim_isinf(rlim_t r) {
-	// Consider RLIM_{INFINITY,SAVED_{CUR,MAX}} all equally infinite
-	if (r == RLIM_INFINITY) {
-		return true;
-	}
+/**
+ * Read the next root path from -files0-from.
+ */
+static const char *eval_more_paths(void *ptr) {
+	struct callback_args *args = ptr;
+	const struct bfs_ctx *ctx = args->ctx;
+
+	free(args->root);
+	args->root = xgetdelim(ctx->files0, '\0');
+	if (!args->root && errno) {
+		bfs_error(ctx, "${blu}-files0-from${rs} ${mag}%pq${rs}: %m.\n", ctx->files0_path);
+		args->ret = EXIT_FAILURE;
+	}
+
+	return args->root;
+}
+
+/**
+ * bftw() filter, evaluated in parallel on background threads.
+ */
+static int eval_filter(const struct BFTW *ftwbuf, void *ptr) {
+	const struct callback_args *args = ptr;
+	const struct bfs_ctx *ctx = args->ctx;
+
+	if (ftwbuf->depth < (size_t)ctx->mindepth || ftwbuf->depth > (size_t)ctx->maxdepth) {
+		// eval_callback() won't look at the result
+		return -1;
+	}
+
+	int ret = EXIT_SUCCESS;
+	struct bfs_eval state = {
+		.ftwbuf = ftwbuf,
+		.ctx = ctx,
+		.action = BFTW_CONTINUE,
+		.ret = &ret,
+		.speculative = true,
+	};
+
+	bool match = eval_top(args->filter_prog, args->filter, &state);
+	if (state.failed) {
+		return -1;
+	}
+	return match;
+}
+
+/**
+ * Evaluate an expression from just the name and readdir() type of a file.
+ *
+ * @return
+ *         1 if it matches, 0 if it doesn't, or -1 if we can't tell yet.
+ */
+static int eval_entry(const struct bfs_expr *expr, const char *name, enum bfs_type type, bool follow) {
+	bfs_eval_fn *fn = expr->eval_fn;
+
+	if (fn == eval_name) {
+		return eval_fnmatch(expr, name);
+	} else if (fn == eval_type) {
+		if (type == BFS_UNKNOWN || (type == BFS_LNK && follow)) {
+			return -1;
+		}
+		return !!((1 << type) & expr->num);
+	} else if (fn == eval_true) {
+		return 1;
+	} else if (fn == eval_false) {
+		return 0;
+	} else if (fn == eval_not) {
+		int ret = eval_entry(expr->rhs, name, type, follow);
+		return ret < 0 ? ret : !ret;
+	}
+
+	int lhs = eval_entry(expr->lhs, name, type, follow);
+	if (fn == eval_and) {
+		if (lhs == 0) {
+			return 0;
+		}
+		int rhs = eval_entry(expr->rhs, name, type, follow);
+		return rhs == 0 ? 0 : (lhs < 0 ? lhs : rhs);
+	} else {
+		bfs_assert(fn == eval_or);
+		if (lhs == 1) {
+			return 1;
+		}
+		int rhs = eval_entry(expr->rhs, name, type, follow);
+		return rhs == 1 ? 1 : (lhs < 0 ? lhs : rhs);
+	}
+}
+
+/**
+ * bftw() batch filter, which skips files that can't match based on their names
+ * and types alone, before bftw() builds their paths or calls stat().
+ */
+static void eval_batch(struct bftw_entries *entries, void *ptr) {
+	const struct callback_args *args = ptr;
+	const struct bfs_ctx *ctx = args->ctx;
+	const struct bfs_expr *expr = args->batch;
+	bool follow = ctx->flags & BFTW_FOLLOW_ALL;
+
+	for (size_t i = 0; i < entries->count; ++i) {
+		if (eval_entry(expr, entries->names[i], entries->types[i], follow) == 0) {
+			entries->visit[i] = false;
+		}
+	}
+}
+
+/** Check if an rlimit value is infinite. */
+static bool rlim_isinf(rlim_t r) {
+	// Consider RLIM_{INFINITY,SAVED_{CUR,MAX}} all equally infinite
+	if (r == RLIM_INFINITY) {
+		return true;
+	}
 
 #ifdef RLIM_SAVED_CUR
 	if (r == RLIM_SAVED_CUR) {
@@ -1507,7 +2760,7 @@ static void reserve_fds(int limit) {
 }
 
 /** Infer the number of file descriptors available to bftw(). */
-static int infer_fdlimit(const struct bfs_ctx *ctx, int limit) {
+static int infer_fdlimit(const struct bfs_ctx *ctx, int limit, int nthreads) {
 	// 3 for std{in,out,err}
 	int nopen = 3 + ctx->nfiles;
 
@@ -1536,6 +2789,10 @@ done:
 	int ret = limit - nopen;
 	ret -= ctx->expr->persistent_fds;
 	ret -= ctx->expr->ephemeral_fds;
+	if (ctx->attr_fds) {
+		// Every thread running the filter may hold an attribute fd too
+		ret -= nthreads;
+	}
 
 	// bftw() needs at least 2 available fds
 	if (ret < 2) {
@@ -1558,6 +2815,23 @@ static int infer_nproc(void) {
 	return nproc;
 }
 
+/** The most I/O threads -jauto may use. */
+#define MAX_AUTO_THREADS 64
+
+/** Infer the upper bound for -jauto. */
+static int infer_max_threads(void) {
+	long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nproc < 1) {
+		nproc = 1;
+	}
+
+	// Blocked I/O threads don't use a CPU, so allow a few per core
+	if (nproc > MAX_AUTO_THREADS / 8) {
+		return MAX_AUTO_THREADS;
+	}
+	return 8 * nproc;
+}
+
 /**
  * Dump the bftw() flags for -D search.
  */
@@ -1573,6 +2847,11 @@ static void dump_bftw_flags(enum bftw_flags flags) {
 	DEBUG_FLAG(flags, BFTW_PRUNE_MOUNTS);
 	DEBUG_FLAG(flags, BFTW_SORT);
 	DEBUG_FLAG(flags, BFTW_BUFFER);
+	DEBUG_FLAG(flags, BFTW_XATTRS);
+	DEBUG_FLAG(flags, BFTW_READLINK);
+	DEBUG_FLAG(flags, BFTW_STAT_LINKS);
+	DEBUG_FLAG(flags, BFTW_INO_ORDER);
+	DEBUG_FLAG(flags, BFTW_ATTR_FDS);
 
 	bfs_assert(flags == 0, "Missing bftw flag 0x%X", flags);
 }
@@ -1586,6 +2865,7 @@ static const char *dump_bftw_strategy(enum bftw_strategy strategy) {
 		DUMP_MAP(BFTW_DFS),
 		DUMP_MAP(BFTW_IDS),
 		DUMP_MAP(BFTW_EDS),
+		DUMP_MAP(BFTW_PARALLEL),
 	};
 	return strategies[strategy];
 }
@@ -1620,6 +2900,404 @@ static bool eval_must_buffer(const struct bfs_expr *expr) {
 	return false;
 }
 
+/** Check if an expression will always stat() the file it evaluates. */
+static bool eval_must_stat(const struct bfs_expr *expr) {
+	if (!expr) {
+		return false;
+	}
+
+	bfs_eval_fn *fn = expr->eval_fn;
+	if (fn == eval_flags
+	    || fn == eval_fls
+	    || fn == eval_fprintb
+	    || fn == eval_fstype
+	    || fn == eval_gid
+	    || fn == eval_inum
+	    || fn == eval_links
+	    || fn == eval_newer
+	    || fn == eval_nogroup
+	    || fn == eval_nouser
+	    || fn == eval_perm
+	    || fn == eval_ranges
+	    || fn == eval_samefile
+	    || fn == eval_size
+	    || fn == eval_sparse
+	    || fn == eval_time
+	    || fn == eval_uid
+	    || fn == eval_used) {
+		return true;
+	}
+
+	if (fn == eval_not) {
+		return eval_must_stat(expr->rhs);
+	} else if (fn == eval_and || fn == eval_or) {
+		// The right-hand side may be short-circuited
+		return eval_must_stat(expr->lhs);
+	} else if (fn == eval_comma) {
+		return eval_must_stat(expr->lhs) || eval_must_stat(expr->rhs);
+	}
+
+	return false;
+}
+
+/** Check if an expression can be evaluated by eval_filter(). */
+static bool eval_thread_safe(const struct bfs_expr *expr) {
+	if (!expr->pure) {
+		return false;
+	}
+
+	bfs_eval_fn *fn = expr->eval_fn;
+	if (fn == eval_fstype) {
+		// This fills in a cache that isn't thread-safe
+		return false;
+	}
+
+	if (bfs_expr_is_parent(expr)) {
+		if (expr->lhs && !eval_thread_safe(expr->lhs)) {
+			return false;
+		}
+		if (expr->rhs && !eval_thread_safe(expr->rhs)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/** Check if an expression might create files in the tree being searched. */
+static bool eval_may_create(const struct bfs_expr *expr) {
+	if (expr->eval_fn == eval_exec) {
+		return true;
+	}
+
+	if (bfs_expr_is_parent(expr)) {
+		if (expr->lhs && eval_may_create(expr->lhs)) {
+			return true;
+		}
+		if (expr->rhs && eval_may_create(expr->rhs)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+ * Find a -delete that is evaluated last, if any.  Nothing can depend on its
+ * return value, so it's safe to delete the file in the background.
+ */
+static const struct bfs_expr *eval_find_async_delete(const struct bfs_expr *expr) {
+	while (bfs_expr_is_parent(expr)) {
+		expr = expr->rhs;
+	}
+
+	if (expr->eval_fn == eval_delete) {
+		return expr;
+	} else {
+		return NULL;
+	}
+}
+
+/** Get the bftw() flags that prefetch what an expression will read. */
+static enum bftw_flags eval_prefetch_flags(const struct bfs_expr *expr) {
+	enum bftw_flags flags = 0;
+
+	bfs_eval_fn *fn = expr->eval_fn;
+	if (fn == eval_xattr || fn == eval_xattrname) {
+		flags |= BFTW_XATTRS;
+	}
+
+#if __linux__
+	// -acl and -capable check the attribute names first
+	if (fn == eval_acl || fn == eval_capable) {
+		flags |= BFTW_XATTRS;
+	}
+#endif
+
+	if (fn == eval_lname || fn == eval_fls) {
+		flags |= BFTW_READLINK;
+	}
+
+	if (fn == eval_xtype) {
+		flags |= BFTW_STAT_LINKS;
+	}
+
+	if (bfs_expr_is_parent(expr)) {
+		if (expr->lhs) {
+			flags |= eval_prefetch_flags(expr->lhs);
+		}
+		if (expr->rhs) {
+			flags |= eval_prefetch_flags(expr->rhs);
+		}
+	}
+
+	return flags;
+}
+
+/** Check if an expression is expensive enough to evaluate in parallel. */
+static bool eval_is_expensive(const struct bfs_expr *expr) {
+	bfs_eval_fn *fn = expr->eval_fn;
+	if (fn == eval_acl
+	    || fn == eval_capable
+	    || fn == eval_empty
+	    || fn == eval_lname
+	    || fn == eval_regex
+	    || fn == eval_xattr
+	    || fn == eval_xattrname) {
+		return true;
+	}
+
+	if (bfs_expr_is_parent(expr)) {
+		if (expr->lhs && eval_is_expensive(expr->lhs)) {
+			return true;
+		}
+		if (expr->rhs && eval_is_expensive(expr->rhs)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/** Find a subexpression to evaluate with eval_filter(), if any. */
+static struct bfs_expr *eval_find_filter(const struct bfs_ctx *ctx) {
+	// -D rates and -profile would miss the evaluations done in the background
+	if ((ctx->debug & DEBUG_RATES) || ctx->profile_path) {
+		return NULL;
+	}
+
+	// For a typical `-regex ... -print`, filter on the pure left-hand side
+	// and leave the side effects to the main thread
+	struct bfs_expr *expr = ctx->expr;
+	if (expr->eval_fn != eval_and) {
+		return NULL;
+	}
+
+	struct bfs_expr *lhs = expr->lhs;
+	if (eval_thread_safe(lhs) && eval_is_expensive(lhs)) {
+		return lhs;
+	} else {
+		return NULL;
+	}
+}
+
+/** Check if an expression can be evaluated by eval_entry(). */
+static bool eval_entry_safe(const struct bfs_expr *expr) {
+	bfs_eval_fn *fn = expr->eval_fn;
+	if (fn == eval_name || fn == eval_type || fn == eval_true || fn == eval_false) {
+		return true;
+	} else if (fn == eval_not) {
+		return eval_entry_safe(expr->rhs);
+	} else if (fn == eval_and || fn == eval_or) {
+		return eval_entry_safe(expr->lhs) && eval_entry_safe(expr->rhs);
+	} else {
+		return false;
+	}
+}
+
+/** Find a subexpression to evaluate with eval_batch(), if any. */
+static struct bfs_expr *eval_find_batch(const struct bfs_ctx *ctx) {
+	// Skipped files still need to be seen by anything that tracks every
+	// file, not just the ones that match
+	if (ctx->status || ctx->unique || ctx->xargs_safe || ctx->du || ctx->watch || ctx->incremental_path) {
+		return NULL;
+	}
+	if ((ctx->debug & DEBUG_RATES) || ctx->profile_path) {
+		return NULL;
+	}
+
+	// If any left-hand side in the chain of conjunctions is false, so is
+	// the whole expression, and nothing after it is evaluated
+	for (struct bfs_expr *expr = ctx->expr; expr->eval_fn == eval_and; expr = expr->lhs) {
+		if (eval_entry_safe(expr->lhs)) {
+			return expr->lhs;
+		}
+	}
+
+	return NULL;
+}
+
+/** Convert a struct timeval to seconds. */
+static double timeval_seconds(const struct timeval *tv) {
+	return tv->tv_sec + tv->tv_usec / 1.0e6;
+}
+
+/**
+ * Dump the performance counters for -D perf.
+ */
+static void dump_perf(const struct bfs_ctx *ctx) {
+	if (!(ctx->debug & DEBUG_PERF)) {
+		return;
+	}
+
+	double wall = perf_elapsed() / 1.0e9;
+	double user = 0.0, sys = 0.0;
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0) {
+		user = timeval_seconds(&usage.ru_utime);
+		sys = timeval_seconds(&usage.ru_stime);
+	}
+
+	if (ctx->perf_json) {
+		fprintf(stderr, "{\"wall\":%.6f,\"user\":%.6f,\"sys\":%.6f,\"events\":{", wall, user, sys);
+	} else {
+		bfs_debug(ctx, DEBUG_PERF, "wall: %gs, user: %gs, sys: %gs\n", wall, user, sys);
+	}
+
+	for (enum perf_event event = 0; event < PERF_EVENTS; ++event) {
+		const char *name = perf_event_name(event);
+		bool timed = perf_event_timed(event);
+		uint64_t count, ns;
+		perf_read(event, &count, &ns);
+
+		if (ctx->perf_json) {
+			fprintf(stderr, "%s\"%s\":{\"count\":%" PRIu64, event ? "," : "", name, count);
+			if (timed) {
+				fprintf(stderr, ",\"seconds\":%.6f", ns / 1.0e9);
+			}
+			fprintf(stderr, "}");
+		} else {
+			bfs_debug_prefix(ctx, DEBUG_PERF);
+			fprintf(stderr, "%-11s %12" PRIu64, name, count);
+			if (timed) {
+				fprintf(stderr, " in %12.6fs", ns / 1.0e9);
+			}
+			fprintf(stderr, "\n");
+		}
+	}
+
+	if (ctx->perf_json) {
+		fprintf(stderr, "}}\n");
+	}
+}
+
+/** How long to wait for more events before starting a -watch pass (ms). */
+#define WATCH_DELAY 100
+
+/** How often to check for mount table changes during -watch (ms). */
+#define WATCH_MOUNT_DELAY 1000
+
+/** Read the pending -watch events. */
+static int eval_watch_read(struct callback_args *args) {
+	const struct bfs_watch_event *event;
+	while ((event = bfs_watch_next(args->watch))) {
+		if (event->overflow) {
+			// We missed something, so look at everything again
+			args->watch_filter = false;
+			continue;
+		}
+
+		if (!trie_insert_str(&args->changed, event->path)) {
+			return -1;
+		}
+
+		if (event->new_dir) {
+			// Nothing below a new directory has been seen or watched yet
+			size_t len = strlen(event->path);
+			if (dstrxcpy(&args->prefix, event->path, len) != 0) {
+				return -1;
+			}
+			if (len == 0 || event->path[len - 1] != '/') {
+				if (dstrapp(&args->prefix, '/') != 0) {
+					return -1;
+				}
+			}
+			if (!trie_insert_str(&args->subtrees, args->prefix)) {
+				return -1;
+			}
+		}
+	}
+
+	return errno ? -1 : 0;
+}
+
+/** Re-evaluate files as they change, until -quit, -exit, or an error. */
+static void eval_watch(struct callback_args *args, const struct bftw_args *bftw_args) {
+	const struct bfs_ctx *ctx = args->ctx;
+
+	// Re-walk from the roots every time, so depths and %P etc. still work,
+	// but don't re-read the index or snapshot
+	struct bftw_args pass_args = *bftw_args;
+	pass_args.index = NULL;
+	pass_args.more_paths = NULL;
+	struct bfs_index *snapshot = args->snapshot;
+	args->snapshot = NULL;
+
+	trie_init(&args->changed);
+	trie_init(&args->subtrees);
+
+	// inotify doesn't report (un)mounts, so track the mount table too.
+	// No walk is running between passes, so it's safe to update.
+	struct bfs_mtab *mtab = ctx->mtab;
+	if (mtab && bfs_mtab_refresh(mtab) < 0) {
+		bfs_warning(ctx, "Couldn't track mount table changes: %m.\n\n");
+		mtab = NULL;
+	}
+
+	while (!args->quit) {
+		// Show everything from the last pass before we block
+		bfs_ctx_flush(ctx);
+
+		int ret = bfs_watch_wait(args->watch, mtab ? WATCH_MOUNT_DELAY : -1);
+
+		// Coalesce bursts of events into one pass
+		args->watch_filter = true;
+		while (ret > 0) {
+			if (eval_watch_read(args) != 0) {
+				ret = -1;
+				break;
+			}
+			ret = bfs_watch_wait(args->watch, WATCH_DELAY);
+		}
+		if (ret < 0) {
+			args->ret = EXIT_FAILURE;
+			bfs_error(ctx, "Couldn't watch for changes: %m.\n");
+			break;
+		}
+
+		if (mtab) {
+			ret = bfs_mtab_refresh(mtab);
+			if (ret < 0) {
+				args->ret = EXIT_FAILURE;
+				bfs_error(ctx, "Couldn't re-read the mount table: %m.\n");
+				break;
+			} else if (ret > 0) {
+				// A mount can hide or reveal a whole tree
+				args->watch_filter = false;
+			}
+		}
+
+		if (args->watch_filter && !args->changed.head) {
+			continue;
+		}
+
+		if (args->seen) {
+			idset_destroy(args->seen);
+			idset_init(args->seen);
+		}
+
+		if (bftw(&pass_args) != 0) {
+			args->ret = EXIT_FAILURE;
+			bfs_perror(ctx, "bftw()");
+			break;
+		}
+
+		if (eval_exec_finish(ctx->expr, ctx) != 0) {
+			args->ret = EXIT_FAILURE;
+		}
+
+		trie_destroy(&args->subtrees);
+		trie_init(&args->subtrees);
+		trie_destroy(&args->changed);
+		trie_init(&args->changed);
+	}
+
+	trie_destroy(&args->subtrees);
+	trie_destroy(&args->changed);
+	args->watch_filter = false;
+	args->snapshot = snapshot;
+}
+
 int bfs_eval(const struct bfs_ctx *ctx) {
 	if (!ctx->expr) {
 		return EXIT_SUCCESS;
@@ -1629,47 +3307,166 @@ int bfs_eval(const struct bfs_ctx *ctx) {
 		.ctx = ctx,
 		.ret = EXIT_SUCCESS,
 	};
+	scratch_init(&args.scratch);
+	trie_init(&args.du_dirs);
+	idset_init(&args.du_links);
+
+	// Do this first, so the I/O threads inherit it
+	if (ctx->cpus && xsetaffinity(ctx->cpus, darray_length(ctx->cpus)) != 0) {
+		bfs_error(ctx, "Couldn't set the CPU affinity: %m.\n");
+		return EXIT_FAILURE;
+	}
+
+	if (ctx->watch) {
+		args.watch = bfs_watch_new();
+		if (!args.watch) {
+			bfs_error(ctx, "Couldn't watch for changes: %m.\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	struct bfs_index *index = NULL;
+	if (ctx->index_path) {
+		index = bfs_index_new(ctx->index_path);
+		if (!index) {
+			bfs_perror(ctx, "bfs_index_new()");
+			bfs_watch_free(args.watch);
+			return EXIT_FAILURE;
+		}
+
+		if (bfs_index_load(index) != 0 && errno != ENOENT) {
+			bfs_warning(ctx, "Ignoring index %pq: %m.\n\n", ctx->index_path);
+		}
+	}
+
+	if (ctx->incremental_path) {
+		args.snapshot = bfs_index_new(ctx->incremental_path);
+		if (!args.snapshot) {
+			bfs_perror(ctx, "bfs_index_new()");
+			bfs_index_free(index);
+			bfs_watch_free(args.watch);
+			return EXIT_FAILURE;
+		}
+
+		if (bfs_index_load(args.snapshot) != 0 && errno != ENOENT) {
+			bfs_warning(ctx, "Ignoring snapshot %pq: %m.\n\n", ctx->incremental_path);
+		}
+
+		trie_init(&args.unchanged);
+	}
 
 	if (ctx->status) {
 		args.bar = bfs_bar_show();
 		if (!args.bar) {
 			bfs_warning(ctx, "Couldn't show status bar: %m.\n\n");
 		}
+		atomic_init(&args.progress.bftw.queued, 0);
 	}
 
-	struct trie seen;
+	struct idset seen;
 	if (ctx->unique) {
-		trie_init(&seen);
+		idset_init(&seen);
 		args.seen = &seen;
 	}
 
-	int fdlimit = raise_fdlimit(ctx);
-	reserve_fds(fdlimit);
-	fdlimit = infer_fdlimit(ctx, fdlimit);
-
-	int nthreads;
+	int nthreads, min_threads = 0;
 	if (ctx->threads > 0) {
 		nthreads = ctx->threads - 1;
+	} else if (ctx->autotune && ctx->strategy != BFTW_PARALLEL) {
+		// Start small, but allow for slow (e.g. network) file systems
+		// that want many more threads than CPUs
+		nthreads = infer_max_threads();
+		min_threads = 1;
 	} else {
 		nthreads = infer_nproc() - 1;
 	}
 
+	int fdlimit;
+	if (ctx->maxdepth > 1 || ctx->du) {
+		fdlimit = raise_fdlimit(ctx);
+		reserve_fds(fdlimit);
+	} else {
+		// Shallow searches only open the roots, so don't bother raising
+		// the limit and growing the fd table upfront
+		fdlimit = rlim_cmp(ctx->nofile_soft, INT_MAX) < 0 ? (int)ctx->nofile_soft : INT_MAX;
+	}
+	fdlimit = infer_fdlimit(ctx, fdlimit, nthreads);
+
 	struct bftw_args bftw_args = {
 		.paths = ctx->paths,
 		.npaths = darray_length(ctx->paths),
+		.more_paths = ctx->files0 ? eval_more_paths : NULL,
 		.callback = eval_callback,
 		.ptr = &args,
 		.nopenfd = fdlimit,
 		.nthreads = nthreads,
+		.min_threads = min_threads,
+		.root_threads = ctx->root_threads,
 		.flags = ctx->flags,
 		.strategy = ctx->strategy,
+		.stat_fields = ctx->stat_fields,
 		.mtab = bfs_ctx_mtab(ctx),
+		.index = index,
+		.spill_limit = ctx->spill_limit,
+		.iolimits = ctx->iolimits,
+		.niolimits = darray_length(ctx->iolimits),
+		.progress = args.bar ? &args.progress.bftw : NULL,
 	};
 
 	if (eval_must_buffer(ctx->expr)) {
 		bftw_args.flags |= BFTW_BUFFER;
 	}
 
+	bftw_args.flags |= eval_prefetch_flags(ctx->exclude);
+	bftw_args.flags |= eval_prefetch_flags(ctx->expr);
+	if (ctx->attr_fds) {
+		bftw_args.flags |= BFTW_ATTR_FDS;
+	}
+
+	// Pruning a directory skips its post-order visit, and -exec could
+	// have filled it in since -empty looked.  -watch also needs to see
+	// every directory, even empty ones, to watch them.
+	args.prune_empty = !(ctx->flags & BFTW_POST_ORDER)
+		&& !ctx->watch
+		&& !eval_may_create(ctx->exclude)
+		&& !eval_may_create(ctx->expr);
+
+	args.async_delete = eval_find_async_delete(ctx->expr);
+
+	if (nthreads > 0) {
+		args.filter = eval_find_filter(ctx);
+		if (args.filter) {
+			bftw_args.filter = eval_filter;
+		}
+	}
+
+	args.batch = eval_find_batch(ctx);
+	if (args.batch) {
+		bftw_args.batch = eval_batch;
+	}
+
+	// Background threads may be evaluating the filter concurrently
+	args.reorder = ctx->optlevel >= 3 && !args.filter;
+
+	// -D rates and -profile need the bookkeeping in eval_expr(), and
+	// eval_reorder() needs it until the order settles
+	if (!(ctx->debug & DEBUG_RATES) && !ctx->profile_path) {
+		if (args.reorder) {
+			args.settling = REORDER_SETTLE;
+		} else {
+			eval_compile_progs(&args);
+		}
+	}
+
+	// If every file will be stat()ed anyway, let bftw() do it ahead of
+	// time in the I/O queue.  In -depth mode, directories are evaluated
+	// on the post-order visit, so an eager stat() would be wasted.
+	if (nthreads > 0 && !(ctx->flags & BFTW_POST_ORDER)) {
+		if (ctx->unique || eval_must_stat(ctx->exclude) || eval_must_stat(ctx->expr)) {
+			bftw_args.flags |= BFTW_STAT;
+		}
+	}
+
 	if (bfs_debug(ctx, DEBUG_SEARCH, "bftw({\n")) {
 		fprintf(stderr, "\t.paths = {\n");
 		for (size_t i = 0; i < bftw_args.npaths; ++i) {
@@ -1677,10 +3474,40 @@ int bfs_eval(const struct bfs_ctx *ctx) {
 		}
 		fprintf(stderr, "\t},\n");
 		fprintf(stderr, "\t.npaths = %zu,\n", bftw_args.npaths);
+		if (bftw_args.more_paths) {
+			fprintf(stderr, "\t.more_paths = eval_more_paths,\n");
+		}
 		fprintf(stderr, "\t.callback = eval_callback,\n");
 		fprintf(stderr, "\t.ptr = &args,\n");
+		if (bftw_args.filter) {
+			fprintf(stderr, "\t.filter = eval_filter,\n");
+		}
+		if (bftw_args.batch) {
+			fprintf(stderr, "\t.batch = eval_batch,\n");
+		}
 		fprintf(stderr, "\t.nopenfd = %d,\n", bftw_args.nopenfd);
 		fprintf(stderr, "\t.nthreads = %d,\n", bftw_args.nthreads);
+		if (bftw_args.min_threads) {
+			fprintf(stderr, "\t.min_threads = %d,\n", bftw_args.min_threads);
+		}
+		if (bftw_args.root_threads) {
+			fprintf(stderr, "\t.root_threads = %d,\n", bftw_args.root_threads);
+		}
+		if (bftw_args.spill_limit) {
+			fprintf(stderr, "\t.spill_limit = %zu,\n", bftw_args.spill_limit);
+		}
+		if (bftw_args.niolimits > 0) {
+			fprintf(stderr, "\t.iolimits = {\n");
+			for (size_t i = 0; i < bftw_args.niolimits; ++i) {
+				const struct bftw_iolimit *iolimit = &bftw_args.iolimits[i];
+				fprintf(stderr, "\t\t{\"%s\", %zu},\n", iolimit->fstype, iolimit->limit);
+			}
+			fprintf(stderr, "\t},\n");
+			fprintf(stderr, "\t.niolimits = %zu,\n", bftw_args.niolimits);
+		}
+		if (bftw_args.progress) {
+			fprintf(stderr, "\t.progress = &args.progress,\n");
+		}
 		fprintf(stderr, "\t.flags = ");
 		dump_bftw_flags(bftw_args.flags);
 		fprintf(stderr, ",\n\t.strategy = %s,\n", dump_bftw_strategy(bftw_args.strategy));
@@ -1693,6 +3520,15 @@ int bfs_eval(const struct bfs_ctx *ctx) {
 		fprintf(stderr, ",\n})\n");
 	}
 
+	if (ctx->debug & DEBUG_PERF) {
+		perf_enable();
+	}
+
+	if (ctx->trace_path && trace_open(ctx->trace_path) != 0) {
+		args.ret = EXIT_FAILURE;
+		bfs_error(ctx, "Couldn't open trace file %pq: %m.\n", ctx->trace_path);
+	}
+
 	if (bftw(&bftw_args) != 0) {
 		args.ret = EXIT_FAILURE;
 		bfs_perror(ctx, "bftw()");
@@ -1702,13 +3538,55 @@ int bfs_eval(const struct bfs_ctx *ctx) {
 		args.ret = EXIT_FAILURE;
 	}
 
+	if (index && bfs_index_save(index) != 0) {
+		args.ret = EXIT_FAILURE;
+		bfs_error(ctx, "Couldn't save index %pq: %m.\n", ctx->index_path);
+	}
+
+	// Keep the old snapshot if we didn't see the whole tree
+	if (args.snapshot && !args.incomplete && bfs_index_save(args.snapshot) != 0) {
+		args.ret = EXIT_FAILURE;
+		bfs_error(ctx, "Couldn't save snapshot %pq: %m.\n", ctx->incremental_path);
+	}
+
+	if (ctx->profile_path && bfs_profile_save(ctx, ctx->profile_path) != 0) {
+		args.ret = EXIT_FAILURE;
+		bfs_error(ctx, "Couldn't save profile %pq: %m.\n", ctx->profile_path);
+	}
+
+	if (args.watch && !args.quit) {
+		eval_watch(&args, &bftw_args);
+	}
+
+	if (trace_close() != 0) {
+		args.ret = EXIT_FAILURE;
+		bfs_error(ctx, "Couldn't write trace file %pq: %m.\n", ctx->trace_path);
+	}
+
 	bfs_ctx_dump(ctx, DEBUG_RATES);
+	dump_perf(ctx);
+
+	if (args.snapshot) {
+		trie_destroy(&args.unchanged);
+		bfs_index_free(args.snapshot);
+	}
+	dstrfree(args.prefix);
+	scratch_destroy(&args.scratch);
+	TRIE_FOR_EACH(&args.du_dirs, leaf) {
+		free(leaf->value);
+	}
+	trie_destroy(&args.du_dirs);
+	idset_destroy(&args.du_links);
+	bfs_index_free(index);
+	bfs_watch_free(args.watch);
 
 	if (ctx->unique) {
-		trie_destroy(&seen);
+		idset_destroy(&seen);
 	}
 
 	bfs_bar_hide(args.bar);
+	free(args.root);
+	eval_free_progs(&args);
 
 	return args.ret;
 }
@@ -56,6 +56,7 @@ bool eval_xattrname(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_newer(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_time(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_used(const struct bfs_expr *expr, struct bfs_eval *state);
+bool eval_ranges(const struct bfs_expr *expr, struct bfs_eval *state);
 
 bool eval_gid(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_uid(const struct bfs_expr *expr, struct bfs_eval *state);
@@ -80,16 +81,21 @@ bool eval_name(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_path(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_regex(const struct bfs_expr *expr, struct bfs_eval *state);
 
+bool eval_chmod(const struct bfs_expr *expr, struct bfs_eval *state);
+bool eval_chown(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_delete(const struct bfs_expr *expr, struct bfs_eval *state);
+bool eval_du(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_exec(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_exit(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_fls(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_fprint(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_fprint0(const struct bfs_expr *expr, struct bfs_eval *state);
+bool eval_fprintb(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_fprintf(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_fprintx(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_prune(const struct bfs_expr *expr, struct bfs_eval *state);
 bool eval_quit(const struct bfs_expr *expr, struct bfs_eval *state);
+bool eval_touch(const struct bfs_expr *expr, struct bfs_eval *state);
 
 // Operator evaluation functions
 bool eval_not(const struct bfs_expr *expr, struct bfs_eval *state);
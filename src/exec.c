@@ -9,7 +9,7 @@
 #include "color.h"
 #include "config.h"
 #include "diag.h"
-#include "dstring.h"
+#include "trace.h"
 #include "xspawn.h"
 #include <errno.h>
 #include <fcntl.h>
@@ -196,70 +196,85 @@ fail:
 	return NULL;
 }
 
-/** Format the current path for use as a command line argument. */
-static char *bfs_exec_format_path(const struct bfs_exec *execbuf, const struct BFTW *ftwbuf) {
-	if (!(execbuf->flags & BFS_EXEC_CHDIR)) {
-		return strdup(ftwbuf->path);
+/** Allocate an argument, from the scratch arena if there is one. */
+static char *bfs_exec_arg_alloc(struct scratch *scratch, size_t size) {
+	if (scratch) {
+		return scratch_alloc(scratch, size);
+	} else {
+		return malloc(size);
 	}
+}
 
-	const char *name = ftwbuf->path + ftwbuf->nameoff;
+/** Free an argument from bfs_exec_arg_alloc(). */
+static void bfs_exec_arg_free(struct scratch *scratch, char *arg) {
+	if (!scratch) {
+		free(arg);
+	}
+}
+
+/** Format the current path for use as a command line argument. */
+static char *bfs_exec_format_path(const struct bfs_exec *execbuf, const struct BFTW *ftwbuf, struct scratch *scratch) {
+	const char *prefix = "";
+	const char *name = ftwbuf->path;
 
-	if (name[0] == '/') {
-		// Must be a root path ("/", "//", etc.)
-		return strdup(name);
+	if (execbuf->flags & BFS_EXEC_CHDIR) {
+		name += ftwbuf->nameoff;
+
+		// For compatibility with GNU find, use './name' instead of just
+		// 'name', unless it's a root path ("/", "//", etc.)
+		if (name[0] != '/') {
+			prefix = "./";
+		}
 	}
 
-	// For compatibility with GNU find, use './name' instead of just 'name'
-	char *path = malloc(2 + strlen(name) + 1);
+	char *path = bfs_exec_arg_alloc(scratch, strlen(prefix) + strlen(name) + 1);
 	if (!path) {
 		return NULL;
 	}
 
-	char *cur = stpcpy(path, "./");
-	cur = stpcpy(cur, name);
+	char *cur = stpcpy(path, prefix);
+	stpcpy(cur, name);
 	return path;
 }
 
 /** Format an argument, expanding "{}" to the current path. */
-static char *bfs_exec_format_arg(char *arg, const char *path) {
+static char *bfs_exec_format_arg(char *arg, const char *path, struct scratch *scratch) {
 	char *match = strstr(arg, "{}");
 	if (!match) {
 		return arg;
 	}
 
-	char *ret = dstralloc(0);
+	size_t count = 0;
+	for (const char *str = match; str; str = strstr(str + 2, "{}")) {
+		++count;
+	}
+
+	size_t pathlen = strlen(path);
+	char *ret = bfs_exec_arg_alloc(scratch, strlen(arg) - 2 * count + pathlen * count + 1);
 	if (!ret) {
 		return NULL;
 	}
 
-	char *last = arg;
+	char *cur = ret;
+	const char *last = arg;
 	do {
-		if (dstrncat(&ret, last, match - last) != 0) {
-			goto err;
-		}
-		if (dstrcat(&ret, path) != 0) {
-			goto err;
-		}
+		memcpy(cur, last, match - last);
+		cur += match - last;
+		memcpy(cur, path, pathlen);
+		cur += pathlen;
 
 		last = match + 2;
 		match = strstr(last, "{}");
 	} while (match);
 
-	if (dstrcat(&ret, last) != 0) {
-		goto err;
-	}
-
+	stpcpy(cur, last);
 	return ret;
-
-err:
-	dstrfree(ret);
-	return NULL;
 }
 
 /** Free a formatted argument. */
-static void bfs_exec_free_arg(char *arg, const char *tmpl) {
+static void bfs_exec_free_arg(char *arg, const char *tmpl, struct scratch *scratch) {
 	if (arg != tmpl) {
-		dstrfree(arg);
+		bfs_exec_arg_free(scratch, arg);
 	}
 }
 
@@ -325,8 +340,99 @@ static void bfs_exec_closewd(struct bfs_exec *execbuf, const struct BFTW *ftwbuf
 	}
 }
 
+/** Check the exit status of a finished command. */
+static int bfs_exec_status(const struct bfs_exec *execbuf, int wstatus) {
+	int ret = -1;
+
+	if (WIFEXITED(wstatus)) {
+		int status = WEXITSTATUS(wstatus);
+		if (status == EXIT_SUCCESS) {
+			ret = 0;
+		} else {
+			bfs_exec_debug(execbuf, "Command '%s' failed with status %d\n", execbuf->argv[0], status);
+		}
+	} else if (WIFSIGNALED(wstatus)) {
+		int sig = WTERMSIG(wstatus);
+		const char *str = strsignal(sig);
+		if (!str) {
+			str = "unknown";
+		}
+		bfs_warning(execbuf->ctx, "Command '${ex}%s${rs}' terminated by signal %d (%s)\n", execbuf->argv[0], sig, str);
+	} else {
+		bfs_warning(execbuf->ctx, "Command '${ex}%s${rs}' terminated abnormally\n", execbuf->argv[0]);
+	}
+
+	errno = 0;
+	return ret;
+}
+
+/** Wait for a command to finish. */
+static int bfs_exec_wait(const struct bfs_exec *execbuf, pid_t pid) {
+	int wstatus;
+	if (waitpid(pid, &wstatus, 0) < 0) {
+		return -1;
+	}
+
+	return bfs_exec_status(execbuf, wstatus);
+}
+
+/** Forget about the i'th running command. */
+static void bfs_exec_forget(struct bfs_exec *execbuf, size_t i) {
+	--execbuf->njobs;
+	memmove(execbuf->jobs + i, execbuf->jobs + i + 1, sizeof_array(pid_t, execbuf->njobs - i));
+}
+
+/** Reap any running commands that have finished. */
+static void bfs_exec_reap(struct bfs_exec *execbuf) {
+	for (size_t i = 0; i < execbuf->njobs;) {
+		int wstatus;
+		pid_t pid = waitpid(execbuf->jobs[i], &wstatus, WNOHANG);
+		if (pid == 0) {
+			++i;
+			continue;
+		}
+
+		if (pid < 0 || bfs_exec_status(execbuf, wstatus) != 0) {
+			execbuf->ret = -1;
+		}
+		bfs_exec_forget(execbuf, i);
+	}
+}
+
+/** Wait for the oldest running command. */
+static void bfs_exec_wait_oldest(struct bfs_exec *execbuf) {
+	bfs_exec_debug(execbuf, "Waiting for one of %zu running commands\n", execbuf->njobs);
+	if (bfs_exec_wait(execbuf, execbuf->jobs[0]) != 0) {
+		execbuf->ret = -1;
+	}
+	bfs_exec_forget(execbuf, 0);
+}
+
+/** Make room for another concurrent command, for -exec-jobs. */
+static int bfs_exec_reserve(struct bfs_exec *execbuf) {
+	size_t max_jobs = execbuf->ctx->exec_jobs;
+	if (!execbuf->jobs) {
+		execbuf->jobs = ALLOC_ARRAY(pid_t, max_jobs);
+		if (!execbuf->jobs) {
+			return -1;
+		}
+	}
+
+	bfs_exec_reap(execbuf);
+	while (execbuf->njobs >= max_jobs) {
+		bfs_exec_wait_oldest(execbuf);
+	}
+
+	return 0;
+}
+
+/** Check whether to run this command concurrently with others. */
+static bool bfs_exec_async(const struct bfs_exec *execbuf) {
+	return (execbuf->flags & BFS_EXEC_MULTI) && execbuf->ctx->exec_jobs > 1;
+}
+
 /** Actually spawn the process. */
-static int bfs_exec_spawn(const struct bfs_exec *execbuf) {
+static int bfs_exec_spawn(struct bfs_exec *execbuf) {
 	// Flush the context state for consistency with the external process
 	bfs_ctx_flush(execbuf->ctx);
 
@@ -346,6 +452,11 @@ static int bfs_exec_spawn(const struct bfs_exec *execbuf) {
 		}
 	}
 
+	bool async = bfs_exec_async(execbuf);
+	if (async && bfs_exec_reserve(execbuf) != 0) {
+		return -1;
+	}
+
 	if (execbuf->flags & BFS_EXEC_MULTI) {
 		bfs_exec_debug(execbuf, "Executing '%s' ... [%zu arguments] (size %zu)\n",
 		               execbuf->argv[0], execbuf->argc - 1, execbuf->arg_size);
@@ -380,7 +491,9 @@ static int bfs_exec_spawn(const struct bfs_exec *execbuf) {
 		}
 	}
 
+	uint64_t start = trace_spawn_start(0);
 	pid = bfs_spawn(execbuf->argv[0], &ctx, execbuf->argv, NULL);
+	trace_spawn_stop(start, pid > 0 ? pid : 0);
 fail:
 	error = errno;
 	bfs_spawn_destroy(&ctx);
@@ -389,47 +502,27 @@ fail:
 		return -1;
 	}
 
-	int wstatus;
-	if (waitpid(pid, &wstatus, 0) < 0) {
-		return -1;
-	}
-
-	int ret = -1;
-
-	if (WIFEXITED(wstatus)) {
-		int status = WEXITSTATUS(wstatus);
-		if (status == EXIT_SUCCESS) {
-			ret = 0;
-		} else {
-			bfs_exec_debug(execbuf, "Command '%s' failed with status %d\n", execbuf->argv[0], status);
-		}
-	} else if (WIFSIGNALED(wstatus)) {
-		int sig = WTERMSIG(wstatus);
-		const char *str = strsignal(sig);
-		if (!str) {
-			str = "unknown";
-		}
-		bfs_warning(execbuf->ctx, "Command '${ex}%s${rs}' terminated by signal %d (%s)\n", execbuf->argv[0], sig, str);
-	} else {
-		bfs_warning(execbuf->ctx, "Command '${ex}%s${rs}' terminated abnormally\n", execbuf->argv[0]);
+	if (async) {
+		// The child has already exec()'d, so our copy of argv can be reused
+		execbuf->jobs[execbuf->njobs++] = pid;
+		return 0;
 	}
 
-	errno = 0;
-	return ret;
+	return bfs_exec_wait(execbuf, pid);
 }
 
 /** exec() a command for a single file. */
-static int bfs_exec_single(struct bfs_exec *execbuf, const struct BFTW *ftwbuf) {
+static int bfs_exec_single(struct bfs_exec *execbuf, const struct BFTW *ftwbuf, struct scratch *scratch) {
 	int ret = -1, error = 0;
 
-	char *path = bfs_exec_format_path(execbuf, ftwbuf);
+	char *path = bfs_exec_format_path(execbuf, ftwbuf, scratch);
 	if (!path) {
 		goto out;
 	}
 
 	size_t i;
 	for (i = 0; i < execbuf->tmpl_argc; ++i) {
-		execbuf->argv[i] = bfs_exec_format_arg(execbuf->tmpl_argv[i], path);
+		execbuf->argv[i] = bfs_exec_format_arg(execbuf->tmpl_argv[i], path, scratch);
 		if (!execbuf->argv[i]) {
 			goto out_free;
 		}
@@ -451,10 +544,10 @@ out_free:
 	bfs_exec_closewd(execbuf, ftwbuf);
 
 	for (size_t j = 0; j < i; ++j) {
-		bfs_exec_free_arg(execbuf->argv[j], execbuf->tmpl_argv[j]);
+		bfs_exec_free_arg(execbuf->argv[j], execbuf->tmpl_argv[j], scratch);
 	}
 
-	free(path);
+	bfs_exec_arg_free(scratch, path);
 
 	errno = error;
 
@@ -619,7 +712,8 @@ static int bfs_exec_push(struct bfs_exec *execbuf, char *arg) {
 static int bfs_exec_multi(struct bfs_exec *execbuf, const struct BFTW *ftwbuf) {
 	int ret = 0;
 
-	char *arg = bfs_exec_format_path(execbuf, ftwbuf);
+	// The paths are kept until bfs_exec_flush(), so don't use a scratch arena
+	char *arg = bfs_exec_format_path(execbuf, ftwbuf, NULL);
 	if (!arg) {
 		ret = -1;
 		goto out;
@@ -655,7 +749,7 @@ out:
 	return ret;
 }
 
-int bfs_exec(struct bfs_exec *execbuf, const struct BFTW *ftwbuf) {
+int bfs_exec(struct bfs_exec *execbuf, const struct BFTW *ftwbuf, struct scratch *scratch) {
 	if (execbuf->flags & BFS_EXEC_MULTI) {
 		if (bfs_exec_multi(execbuf, ftwbuf) == 0) {
 			errno = 0;
@@ -665,7 +759,7 @@ int bfs_exec(struct bfs_exec *execbuf, const struct BFTW *ftwbuf) {
 		// -exec ... + never returns false
 		return 0;
 	} else {
-		return bfs_exec_single(execbuf, ftwbuf);
+		return bfs_exec_single(execbuf, ftwbuf, scratch);
 	}
 }
 
@@ -675,6 +769,9 @@ int bfs_exec_finish(struct bfs_exec *execbuf) {
 		while (bfs_exec_args_remain(execbuf)) {
 			execbuf->ret |= bfs_exec_flush(execbuf);
 		}
+		while (execbuf->njobs > 0) {
+			bfs_exec_wait_oldest(execbuf);
+		}
 		if (execbuf->ret != 0) {
 			bfs_exec_debug(execbuf, "One or more executions of '%s' failed\n", execbuf->argv[0]);
 		}
@@ -685,6 +782,10 @@ int bfs_exec_finish(struct bfs_exec *execbuf) {
 void bfs_exec_free(struct bfs_exec *execbuf) {
 	if (execbuf) {
 		bfs_exec_closewd(execbuf, NULL);
+		while (execbuf->njobs > 0) {
+			bfs_exec_wait_oldest(execbuf);
+		}
+		free(execbuf->jobs);
 		free(execbuf->argv);
 		free(execbuf);
 	}
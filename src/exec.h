@@ -9,9 +9,11 @@
 #define BFS_EXEC_H
 
 #include <stddef.h>
+#include <sys/types.h>
 
 struct BFTW;
 struct bfs_ctx;
+struct scratch;
 
 /**
  * Flags for the -exec actions.
@@ -60,6 +62,11 @@ struct bfs_exec {
 	/** Length of the working directory path. */
 	size_t wd_len;
 
+	/** The commands that are still running, for -exec-jobs. */
+	pid_t *jobs;
+	/** The number of running commands. */
+	size_t njobs;
+
 	/** The ultimate return value for bfs_exec_finish(). */
 	int ret;
 };
@@ -85,11 +92,13 @@ struct bfs_exec *bfs_exec_parse(const struct bfs_ctx *ctx, char **argv, enum bfs
  *         The parsed exec action.
  * @param ftwbuf
  *         The bftw() data for the current file.
+ * @param scratch
+ *         A scratch arena for the arguments of a single command, or NULL.
  * @return 0 if the command succeeded, -1 if it failed.  If the command could
  *         be executed, -1 is returned, and errno will be non-zero.  For
  *         BFS_EXEC_MULTI, errors will not be reported until bfs_exec_finish().
  */
-int bfs_exec(struct bfs_exec *execbuf, const struct BFTW *ftwbuf);
+int bfs_exec(struct bfs_exec *execbuf, const struct BFTW *ftwbuf, struct scratch *scratch);
 
 /**
  * Finish executing any commands.
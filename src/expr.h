@@ -74,6 +74,22 @@ enum bfs_size_unit {
 	BFS_PB,
 };
 
+/**
+ * A range check on a bfs_stat() field, from fused integer and time tests.
+ */
+struct bfs_range_check {
+	/** The field to check. */
+	enum bfs_stat_field field;
+	/** The inclusive bounds, for integer fields. */
+	long long min, max;
+	/** Whether the timestamp has a lower bound. */
+	bool has_after;
+	/** Whether the timestamp has an upper bound. */
+	bool has_before;
+	/** The timestamp bounds, for after < time <= before. */
+	struct timespec after, before;
+};
+
 /**
  * A command line expression.
  */
@@ -97,6 +113,8 @@ struct bfs_expr {
 	bool always_true;
 	/** Whether this expression always evaluates to false. */
 	bool always_false;
+	/** Whether this is an action that counts towards -limit. */
+	bool counted;
 
 	/** Estimated cost. */
 	float cost;
@@ -151,6 +169,12 @@ struct bfs_expr {
 			int fnm_flags;
 			/** Whether strcmp() can be used instead of fnmatch(). */
 			bool literal;
+			/** Whether a literal pattern is entirely ASCII. */
+			bool ascii;
+			/** The length of a literal pattern. */
+			size_t pattern_len;
+			/** Merged patterns, if this test was combined with others. */
+			struct bfs_fnset *fnset;
 		};
 
 		/** Printing actions. */
@@ -176,7 +200,7 @@ struct bfs_expr {
 			unsigned long long clear_flags;
 		};
 
-		/** -perm data. */
+		/** -perm and -chmod data. */
 		struct {
 			/** The comparison mode. */
 			enum bfs_mode_cmp mode_cmp;
@@ -184,10 +208,28 @@ struct bfs_expr {
 			mode_t file_mode;
 			/** Mode to use for directories (different due to X). */
 			mode_t dir_mode;
+			/** The umask for symbolic -chmod modes. */
+			mode_t cmask;
+		};
+
+		/** -chown data. */
+		struct {
+			/** The new owner, or -1 to leave it alone. */
+			uid_t uid;
+			/** The new group, or -1 to leave it alone. */
+			gid_t gid;
 		};
 
 		/** -regex data. */
-		struct bfs_regex *regex;
+		struct {
+			/** The compiled regex. */
+			struct bfs_regex *regex;
+			/** The arguments (darray) of merged regex tests, if any. */
+			char **regex_argv;
+		};
+
+		/** Fused range checks (darray), all of which must pass. */
+		struct bfs_range_check *checks;
 
 		/** -samefile data. */
 		struct {
@@ -219,6 +261,11 @@ bool bfs_expr_never_returns(const struct bfs_expr *expr);
  */
 bool bfs_expr_cmp(const struct bfs_expr *expr, long long n);
 
+/**
+ * @return The number of bytes in a -size unit.
+ */
+long long bfs_size_scale(enum bfs_size_unit unit);
+
 /**
  * Free an expression tree.
  */
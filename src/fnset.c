@@ -0,0 +1,252 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "fnset.h"
+#include "alloc.h"
+#include "ascii.h"
+#include "darray.h"
+#include "trie.h"
+#include <fnmatch.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Case-folded keys are built in a fixed-size buffer.  Longer strings (only
+ * possible for -ipath) use the slow path.
+ */
+#define FNSET_FOLD_MAX 256
+
+struct bfs_fnset {
+	/** The fnmatch() flags. */
+	int fnm_flags;
+	/** The test name and patterns (a darray). */
+	char **argv;
+
+	/** Whether some pattern matches everything. */
+	bool all;
+	/** Literal patterns. */
+	struct trie literals;
+	/** The literal parts of 'prefix*' patterns. */
+	struct trie prefixes;
+	/** The literal parts of '*suffix' patterns. */
+	struct trie suffixes;
+	/** The distinct lengths of the suffixes (a darray). */
+	size_t *suffix_lens;
+	/** The patterns that need fnmatch() (a darray). */
+	const char **fallbacks;
+};
+
+/** Check if a set is case-insensitive. */
+static bool fnset_casefold(const struct bfs_fnset *set) {
+#ifdef FNM_CASEFOLD
+	return set->fnm_flags & FNM_CASEFOLD;
+#else
+	return false;
+#endif
+}
+
+/** Check if a string has no wildcards, and no bytes we can't case-fold. */
+static bool fnset_is_literal(const struct bfs_fnset *set, const char *str, size_t len) {
+	if (strcspn(str, "?*\\[") < len) {
+		return false;
+	}
+
+	if (fnset_casefold(set)) {
+		for (size_t i = 0; i < len; ++i) {
+			if ((unsigned char)str[i] >= 0x80) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Copy a string into buf, folding case.
+ *
+ * @return
+ *         The folded string, or NULL if it is too long or not ASCII.
+ */
+static const char *fnset_fold_str(char buf[FNSET_FOLD_MAX], const char *str, size_t len) {
+	if (len >= FNSET_FOLD_MAX) {
+		return NULL;
+	}
+
+	if (!ascii_tolower(buf, str, len)) {
+		return NULL;
+	}
+	buf[len] = '\0';
+	return buf;
+}
+
+/** Insert the first len bytes of str into a trie. */
+static int fnset_insert(const struct bfs_fnset *set, struct trie *trie, const char *str, size_t len) {
+	char buf[FNSET_FOLD_MAX];
+	const char *key = str;
+
+	if (fnset_casefold(set)) {
+		key = fnset_fold_str(buf, str, len);
+		if (!key) {
+			return 1;
+		}
+	} else if (str[len] != '\0') {
+		if (len >= FNSET_FOLD_MAX) {
+			return 1;
+		}
+		memcpy(buf, str, len);
+		buf[len] = '\0';
+		key = buf;
+	}
+
+	return trie_insert_str(trie, key) ? 0 : -1;
+}
+
+struct bfs_fnset *bfs_fnset_new(char *arg, int fnm_flags) {
+	struct bfs_fnset *set = ZALLOC(struct bfs_fnset);
+	if (!set) {
+		return NULL;
+	}
+
+	set->fnm_flags = fnm_flags;
+	trie_init(&set->literals);
+	trie_init(&set->prefixes);
+	trie_init(&set->suffixes);
+
+	if (DARRAY_PUSH(&set->argv, &arg) != 0) {
+		bfs_fnset_free(set);
+		return NULL;
+	}
+
+	return set;
+}
+
+/** Record a new suffix length. */
+static int fnset_add_suffix_len(struct bfs_fnset *set, size_t len) {
+	size_t count = darray_length(set->suffix_lens);
+	for (size_t i = 0; i < count; ++i) {
+		if (set->suffix_lens[i] == len) {
+			return 0;
+		}
+	}
+
+	return DARRAY_PUSH(&set->suffix_lens, &len);
+}
+
+/** Try to add a pattern to one of the tries. */
+static int fnset_add_fast(struct bfs_fnset *set, const char *pattern) {
+	size_t len = strlen(pattern);
+
+	if (fnset_is_literal(set, pattern, len)) {
+		return fnset_insert(set, &set->literals, pattern, len);
+	}
+
+	if (len >= 1 && pattern[0] == '*' && fnset_is_literal(set, pattern + 1, len - 1)) {
+		if (len == 1) {
+			set->all = true;
+			return 0;
+		}
+
+		int ret = fnset_insert(set, &set->suffixes, pattern + 1, len - 1);
+		if (ret == 0) {
+			ret = fnset_add_suffix_len(set, len - 1);
+		}
+		return ret;
+	}
+
+	if (len >= 1 && pattern[len - 1] == '*' && fnset_is_literal(set, pattern, len - 1)) {
+		return fnset_insert(set, &set->prefixes, pattern, len - 1);
+	}
+
+	return 1;
+}
+
+int bfs_fnset_add(struct bfs_fnset *set, char *pattern) {
+	if (DARRAY_PUSH(&set->argv, &pattern) != 0) {
+		return -1;
+	}
+
+	int ret = fnset_add_fast(set, pattern);
+	if (ret > 0) {
+		const char *fallback = pattern;
+		ret = DARRAY_PUSH(&set->fallbacks, &fallback);
+	}
+	return ret;
+}
+
+char **bfs_fnset_argv(const struct bfs_fnset *set, size_t *argc) {
+	*argc = darray_length(set->argv);
+	return set->argv;
+}
+
+size_t bfs_fnset_fallbacks(const struct bfs_fnset *set) {
+	return darray_length(set->fallbacks);
+}
+
+/** Match every pattern with fnmatch(). */
+static bool fnset_match_slow(const struct bfs_fnset *set, const char *str) {
+	size_t argc = darray_length(set->argv);
+	for (size_t i = 1; i < argc; ++i) {
+		if (fnmatch(set->argv[i], str, set->fnm_flags) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool bfs_fnset_match(const struct bfs_fnset *set, const char *str) {
+	if (set->all) {
+		return true;
+	}
+
+	size_t len = strlen(str);
+
+	char buf[FNSET_FOLD_MAX];
+	if (fnset_casefold(set)) {
+		// Non-ASCII strings may fold in locale-specific ways
+		const char *folded = fnset_fold_str(buf, str, len);
+		if (!folded) {
+			return fnset_match_slow(set, str);
+		}
+		str = folded;
+	}
+
+	if (trie_find_str(&set->literals, str)) {
+		return true;
+	}
+
+	if (trie_find_prefix(&set->prefixes, str)) {
+		return true;
+	}
+
+	size_t nsuffixes = darray_length(set->suffix_lens);
+	for (size_t i = 0; i < nsuffixes; ++i) {
+		size_t suffix_len = set->suffix_lens[i];
+		if (suffix_len <= len && trie_find_str(&set->suffixes, str + len - suffix_len)) {
+			return true;
+		}
+	}
+
+	size_t nfallbacks = darray_length(set->fallbacks);
+	for (size_t i = 0; i < nfallbacks; ++i) {
+		if (fnmatch(set->fallbacks[i], str, set->fnm_flags) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void bfs_fnset_free(struct bfs_fnset *set) {
+	if (!set) {
+		return;
+	}
+
+	darray_free(set->fallbacks);
+	darray_free(set->suffix_lens);
+	trie_destroy(&set->suffixes);
+	trie_destroy(&set->prefixes);
+	trie_destroy(&set->literals);
+	darray_free(set->argv);
+	free(set);
+}
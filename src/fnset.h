@@ -0,0 +1,82 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * Sets of fnmatch() patterns, matched in a single pass.
+ *
+ * The optimizer merges chains like -name '*.o' -o -name '*.a' -o ... into one
+ * set.  Literal names, literal prefixes ('foo*'), and literal suffixes ('*.o')
+ * are looked up in tries, and only the remaining patterns need fnmatch().
+ */
+
+#ifndef BFS_FNSET_H
+#define BFS_FNSET_H
+
+#include "config.h"
+#include <stddef.h>
+
+/**
+ * A set of fnmatch() patterns.
+ */
+struct bfs_fnset;
+
+/**
+ * Create an empty pattern set.
+ *
+ * @param arg
+ *         The name of the test, e.g. "-name", used as argv[0].
+ * @param fnm_flags
+ *         The fnmatch() flags shared by every pattern.
+ * @return
+ *         The new set, or NULL on failure.
+ */
+struct bfs_fnset *bfs_fnset_new(char *arg, int fnm_flags);
+
+/**
+ * Add a pattern to a set.
+ *
+ * @param set
+ *         The set to add to.
+ * @param pattern
+ *         The pattern to add.  It must outlive the set.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_fnset_add(struct bfs_fnset *set, char *pattern);
+
+/**
+ * Get the arguments for an expression that evaluates this set.
+ *
+ * @param set
+ *         The pattern set.
+ * @param[out] argc
+ *         Will hold the number of arguments.
+ * @return
+ *         The test name, followed by each pattern.  Invalidated by
+ *         bfs_fnset_add().
+ */
+char **bfs_fnset_argv(const struct bfs_fnset *set, size_t *argc);
+
+/**
+ * @return The number of patterns that still need fnmatch().
+ */
+size_t bfs_fnset_fallbacks(const struct bfs_fnset *set);
+
+/**
+ * Check if a string matches any pattern in a set.
+ *
+ * @param set
+ *         The pattern set.
+ * @param str
+ *         The string to match.
+ * @return
+ *         Whether any pattern matched.
+ */
+bool bfs_fnset_match(const struct bfs_fnset *set, const char *str);
+
+/**
+ * Free a pattern set.
+ */
+void bfs_fnset_free(struct bfs_fnset *set);
+
+#endif // BFS_FNSET_H
@@ -8,10 +8,13 @@
 #include "bftw.h"
 #include "dir.h"
 #include "dstring.h"
+#include "perf.h"
 #include "sanity.h"
 #include <errno.h>
 #include <fcntl.h>
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
 #include <unistd.h>
 
 #if BFS_CAN_CHECK_ACL
@@ -30,49 +33,103 @@
 
 #if BFS_CAN_CHECK_ACL || BFS_CAN_CHECK_CAPABILITIES || BFS_CAN_CHECK_XATTRS
 
+/** The size of the buffer for fake_at_path(), enough for most names. */
+#define FAKE_AT_SIZE 512
+
 /**
  * Many of the APIs used here don't have *at() variants, but we can try to
  * emulate something similar if /proc/self/fd is available.
+ *
+ * @param buf
+ *         A buffer to build the path in, so that usually nothing needs to be
+ *         allocated.
+ * @param size
+ *         The size of the buffer.
+ * @return
+ *         A path to the file, or the fallback path if that's not possible.
  */
-static const char *fake_at(const struct BFTW *ftwbuf) {
+static const char *fake_at_path(int at_fd, const char *at_path, const char *fallback, char *buf, size_t size) {
 	static atomic int proc_works = -1;
 
-	char *path = NULL;
-	if (ftwbuf->at_fd == AT_FDCWD || load(&proc_works, relaxed) == 0) {
-		goto fail;
+	if (at_fd == AT_FDCWD || load(&proc_works, relaxed) == 0) {
+		return fallback;
 	}
 
-	path = dstrprintf("/proc/self/fd/%d/", ftwbuf->at_fd);
-	if (!path) {
-		goto fail;
+	int len = snprintf(buf, size, "/proc/self/fd/%d/", at_fd);
+	if (len < 0 || (size_t)len >= size) {
+		return fallback;
 	}
 
 	if (load(&proc_works, relaxed) < 0) {
-		if (xfaccessat(AT_FDCWD, path, F_OK) != 0) {
+		if (xfaccessat(AT_FDCWD, buf, F_OK) != 0) {
 			store(&proc_works, 0, relaxed);
-			goto fail;
+			return fallback;
 		} else {
 			store(&proc_works, 1, relaxed);
 		}
 	}
 
-	if (dstrcat(&path, ftwbuf->at_path) != 0) {
-		goto fail;
+	size_t at_len = strlen(at_path);
+	if (len + at_len < size) {
+		memcpy(buf + len, at_path, at_len + 1);
+		return buf;
 	}
 
-	return path;
-
-fail:
-	dstrfree(path);
-	return ftwbuf->path;
+	// Too long for the buffer, so fall back to the heap
+	char *path = dstrprintf("%s%s", buf, at_path);
+	return path ? path : fallback;
 }
 
-static void free_fake_at(const struct BFTW *ftwbuf, const char *path) {
-	if (path != ftwbuf->path) {
+static void free_fake_at_path(const char *fallback, const char *buf, const char *path) {
+	if (path != fallback && path != buf) {
 		dstrfree((char *)path);
 	}
 }
 
+/** fake_at_path() for a bftw() file. */
+static const char *fake_at(const struct BFTW *ftwbuf, char buf[FAKE_AT_SIZE]) {
+	return fake_at_path(ftwbuf->at_fd, ftwbuf->at_path, ftwbuf->path, buf, FAKE_AT_SIZE);
+}
+
+static void free_fake_at(const struct BFTW *ftwbuf, const char *buf, const char *path) {
+	free_fake_at_path(ftwbuf->path, buf, path);
+}
+
+/**
+ * Get a file descriptor for the attribute calls on a bftw() file, opening it
+ * the first time.  With BFTW_ATTR_FDS, a single openat() relative to the
+ * parent is shared by every predicate that checks the same file, which is
+ * cheaper than resolving a fake_at() path for each call.
+ *
+ * @return
+ *         The file descriptor, or -1 if fake_at() should be used instead.
+ */
+static int attr_fd(const struct BFTW *ftwbuf) {
+	struct bftw_xattrs *cache = (struct bftw_xattrs *)&ftwbuf->xattr_cache;
+	if (cache->fd >= 0 || cache->fd_error) {
+		return cache->fd;
+	}
+
+	// The fd variants can't see symbolic links themselves, and opening
+	// devices or FIFOs can have side effects
+	if (ftwbuf->type != BFS_REG && ftwbuf->type != BFS_DIR) {
+		cache->fd_error = ENOTSUP;
+		return -1;
+	}
+
+	int flags = O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK;
+	if (ftwbuf->stat_flags & BFS_STAT_NOFOLLOW) {
+		flags |= O_NOFOLLOW;
+	}
+
+	// Failure is okay (e.g. unreadable files), we'll just use the path
+	cache->fd = openat(ftwbuf->at_fd, ftwbuf->at_path, flags);
+	if (cache->fd < 0) {
+		cache->fd_error = errno;
+	}
+	return cache->fd;
+}
+
 /**
  * Check if an error was caused by the absence of support or data for a feature.
  */
@@ -116,6 +173,187 @@ static bool is_absence_error(int error) {
 
 #endif // BFS_CAN_CHECK_ACL || BFS_CAN_CHECK_CAPABILITIES || BFS_CAN_CHECK_XATTRS
 
+#if BFS_CAN_CHECK_XATTRS
+
+#if BFS_USE_SYS_EXTATTR_H
+
+/** Convert an extattr_list_*() result to NUL-terminated names, in place. */
+static void bfs_extattr_convert(char *names, size_t len) {
+	// Each name is preceded by its length, so shift it down over that byte
+	for (size_t i = 0; i < len;) {
+		size_t namelen = (unsigned char)names[i];
+		if (namelen > len - i - 1) {
+			namelen = len - i - 1;
+		}
+		memmove(names + i, names + i + 1, namelen);
+		names[i + namelen] = '\0';
+		i += namelen + 1;
+	}
+}
+
+#endif
+
+/**
+ * Read the names of a file's extended attributes, from fd if it's open, or
+ * otherwise from path.
+ */
+static int bfs_list_xattrs(int fd, const char *path, bool follow, struct bfs_xattrs *xattrs) {
+	char *names = xattrs->names;
+	size_t size = sizeof(xattrs->names);
+	xattrs->len = 0;
+	xattrs->truncated = false;
+
+	uint64_t start = perf_start();
+	int ret = -1, error = 0;
+
+#if BFS_USE_SYS_EXTATTR_H
+	ssize_t (*extattr_list)(const char *, int, void*, size_t) =
+		follow ? extattr_list_file : extattr_list_link;
+
+	static const int namespaces[] = {
+		EXTATTR_NAMESPACE_SYSTEM,
+		EXTATTR_NAMESPACE_USER,
+	};
+
+	for (size_t i = 0; i < countof(namespaces); ++i) {
+		size_t avail = size - xattrs->len;
+		ssize_t len;
+		if (fd >= 0) {
+			len = extattr_list_fd(fd, namespaces[i], names + xattrs->len, avail);
+		} else {
+			len = extattr_list(path, namespaces[i], names + xattrs->len, avail);
+		}
+		if (len < 0) {
+			// The system namespace is often off-limits, so only
+			// fail if neither one could be read
+			error = errno;
+			continue;
+		}
+
+		// extattr_list_*() silently truncates the list
+		if ((size_t)len == avail) {
+			xattrs->truncated = true;
+		}
+
+		bfs_extattr_convert(names + xattrs->len, len);
+		xattrs->len += len;
+		ret = 0;
+	}
+#else
+	ssize_t len;
+#  if __APPLE__
+	if (fd >= 0) {
+		len = flistxattr(fd, names, size, 0);
+	} else {
+		len = listxattr(path, names, size, follow ? 0 : XATTR_NOFOLLOW);
+	}
+#  else
+	if (fd >= 0) {
+		len = flistxattr(fd, names, size);
+	} else if (follow) {
+		len = listxattr(path, names, size);
+	} else {
+		len = llistxattr(path, names, size);
+	}
+#  endif
+
+	if (len >= 0) {
+		xattrs->len = len;
+		ret = 0;
+	} else if (errno == ERANGE || errno == E2BIG) {
+		// Too many names to cache, but there are definitely some
+		xattrs->truncated = true;
+		ret = 0;
+	} else {
+		error = errno;
+	}
+#endif
+
+	perf_stop(PERF_XATTRS, start);
+	errno = error;
+	return ret;
+}
+
+int bfs_read_xattrs(int at_fd, const char *at_path, enum bfs_stat_flags flags, struct bfs_xattrs *xattrs) {
+	const char *fallback = at_fd == AT_FDCWD ? at_path : NULL;
+	char buf[FAKE_AT_SIZE];
+	const char *path = fake_at_path(at_fd, at_path, fallback, buf, sizeof(buf));
+	if (!path) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	int ret = bfs_list_xattrs(-1, path, !(flags & BFS_STAT_NOFOLLOW), xattrs);
+	int error = errno;
+	free_fake_at_path(fallback, buf, path);
+	errno = error;
+	return ret;
+}
+
+/** Get the extended attribute names for a file, caching the result. */
+static const struct bfs_xattrs *bfs_xattrs(const struct BFTW *ftwbuf) {
+	struct bftw_xattrs *cache = (struct bftw_xattrs *)&ftwbuf->xattr_cache;
+	if (cache->buf) {
+		return cache->buf;
+	} else if (cache->error) {
+		errno = cache->error;
+		return NULL;
+	}
+
+	int ret, error;
+	int fd = attr_fd(ftwbuf);
+	if (fd >= 0) {
+		ret = bfs_list_xattrs(fd, NULL, true, &cache->storage);
+		error = errno;
+	} else {
+		char buf[FAKE_AT_SIZE];
+		const char *path = fake_at(ftwbuf, buf);
+		ret = bfs_list_xattrs(-1, path, ftwbuf->type != BFS_LNK, &cache->storage);
+		error = errno;
+		free_fake_at(ftwbuf, buf, path);
+	}
+
+	if (ret == 0) {
+		cache->buf = &cache->storage;
+	} else {
+		cache->error = error;
+		errno = error;
+	}
+	return cache->buf;
+}
+
+/** Check if an extended attribute name list contains a name. */
+static bool bfs_xattrs_find(const struct bfs_xattrs *xattrs, const char *name) {
+	size_t namelen = strlen(name);
+	const char *names = xattrs->names;
+
+	for (size_t i = 0; i < xattrs->len;) {
+		const char *end = memchr(names + i, '\0', xattrs->len - i);
+		size_t len = end ? (size_t)(end - names) - i : xattrs->len - i;
+		if (len == namelen && memcmp(names + i, name, len) == 0) {
+			return true;
+		}
+		i += len + 1;
+	}
+
+	return false;
+}
+
+#if __linux__ && (BFS_CAN_CHECK_ACL || BFS_CAN_CHECK_CAPABILITIES)
+
+/**
+ * On Linux, ACLs and capabilities are stored in extended attributes, so the
+ * (usually cached) name list can rule them out without reading them.
+ */
+static bool bfs_lacks_xattr(const struct BFTW *ftwbuf, const char *name) {
+	const struct bfs_xattrs *xattrs = bfs_xattrs(ftwbuf);
+	return xattrs && !xattrs->truncated && !bfs_xattrs_find(xattrs, name);
+}
+
+#endif
+
+#endif // BFS_CAN_CHECK_XATTRS
+
 #if BFS_CAN_CHECK_ACL
 
 /** Check if a POSIX.1e ACL is non-trivial. */
@@ -178,6 +416,22 @@ static int bfs_check_acl_type(acl_t acl, acl_type_t type) {
 #endif
 }
 
+/** Get an ACL of the given type, from fd if possible. */
+static acl_t bfs_get_acl(int fd, const char *path, acl_type_t type) {
+	if (fd >= 0) {
+#if __FreeBSD__ || __APPLE__
+		return acl_get_fd_np(fd, type);
+#else
+		// acl_get_fd() can only get the access ACL
+		if (type == ACL_TYPE_ACCESS) {
+			return acl_get_fd(fd);
+		}
+#endif
+	}
+
+	return acl_get_file(path, type);
+}
+
 int bfs_check_acl(const struct BFTW *ftwbuf) {
 	static const acl_type_t acl_types[] = {
 #if __APPLE__
@@ -199,7 +453,16 @@ int bfs_check_acl(const struct BFTW *ftwbuf) {
 		return 0;
 	}
 
-	const char *path = fake_at(ftwbuf);
+#if __linux__ && BFS_CAN_CHECK_XATTRS
+	if (bfs_lacks_xattr(ftwbuf, "system.posix_acl_access")
+	    && (ftwbuf->type != BFS_DIR || bfs_lacks_xattr(ftwbuf, "system.posix_acl_default"))) {
+		return 0;
+	}
+#endif
+
+	int fd = attr_fd(ftwbuf);
+	char buf[FAKE_AT_SIZE];
+	const char *path = fake_at(ftwbuf, buf);
 
 	int ret = -1, error = 0;
 	for (size_t i = 0; i < countof(acl_types) && ret <= 0; ++i) {
@@ -211,7 +474,7 @@ int bfs_check_acl(const struct BFTW *ftwbuf) {
 			continue;
 		}
 
-		acl_t acl = acl_get_file(path, type);
+		acl_t acl = bfs_get_acl(fd, path, type);
 		if (!acl) {
 			error = errno;
 			if (is_absence_error(error)) {
@@ -225,7 +488,7 @@ int bfs_check_acl(const struct BFTW *ftwbuf) {
 		acl_free(acl);
 	}
 
-	free_fake_at(ftwbuf, path);
+	free_fake_at(ftwbuf, buf, path);
 	errno = error;
 	return ret;
 }
@@ -246,10 +509,18 @@ int bfs_check_capabilities(const struct BFTW *ftwbuf) {
 		return 0;
 	}
 
+#if __linux__ && BFS_CAN_CHECK_XATTRS
+	if (bfs_lacks_xattr(ftwbuf, "security.capability")) {
+		return 0;
+	}
+#endif
+
 	int ret = -1, error;
-	const char *path = fake_at(ftwbuf);
+	int fd = attr_fd(ftwbuf);
+	char buf[FAKE_AT_SIZE];
+	const char *path = fd >= 0 ? NULL : fake_at(ftwbuf, buf);
 
-	cap_t caps = cap_get_file(path);
+	cap_t caps = fd >= 0 ? cap_get_fd(fd) : cap_get_file(path);
 	if (!caps) {
 		error = errno;
 		if (is_absence_error(error)) {
@@ -271,7 +542,9 @@ int bfs_check_capabilities(const struct BFTW *ftwbuf) {
 out_caps:
 	cap_free(caps);
 out_path:
-	free_fake_at(ftwbuf, path);
+	if (path) {
+		free_fake_at(ftwbuf, buf, path);
+	}
 	errno = error;
 	return ret;
 }
@@ -288,61 +561,49 @@ int bfs_check_capabilities(const struct BFTW *ftwbuf) {
 #if BFS_CAN_CHECK_XATTRS
 
 int bfs_check_xattrs(const struct BFTW *ftwbuf) {
-	const char *path = fake_at(ftwbuf);
-	ssize_t len;
-
-#if BFS_USE_SYS_EXTATTR_H
-	ssize_t (*extattr_list)(const char *, int, void*, size_t) =
-		ftwbuf->type == BFS_LNK ? extattr_list_link : extattr_list_file;
-
-	len = extattr_list(path, EXTATTR_NAMESPACE_SYSTEM, NULL, 0);
-	if (len <= 0) {
-		len = extattr_list(path, EXTATTR_NAMESPACE_USER, NULL, 0);
-	}
-#elif __APPLE__
-	int options = ftwbuf->type == BFS_LNK ? XATTR_NOFOLLOW : 0;
-	len = listxattr(path, NULL, 0, options);
-#else
-	if (ftwbuf->type == BFS_LNK) {
-		len = llistxattr(path, NULL, 0);
-	} else {
-		len = listxattr(path, NULL, 0);
-	}
-#endif
-
-	int error = errno;
-
-	free_fake_at(ftwbuf, path);
-
-	if (len > 0) {
-		return 1;
-	} else if (len == 0 || is_absence_error(error)) {
+	const struct bfs_xattrs *xattrs = bfs_xattrs(ftwbuf);
+	if (xattrs) {
+		return xattrs->len > 0 || xattrs->truncated;
+	} else if (is_absence_error(errno)) {
 		return 0;
-	} else if (error == E2BIG) {
-		return 1;
 	} else {
-		errno = error;
 		return -1;
 	}
 }
 
-int bfs_check_xattr_named(const struct BFTW *ftwbuf, const char *name) {
-	const char *path = fake_at(ftwbuf);
+/** Check for a single extended attribute directly. */
+static int bfs_get_xattr(const struct BFTW *ftwbuf, const char *name) {
+	int fd = attr_fd(ftwbuf);
+	char buf[FAKE_AT_SIZE];
+	const char *path = fd >= 0 ? NULL : fake_at(ftwbuf, buf);
 	ssize_t len;
 
 #if BFS_USE_SYS_EXTATTR_H
-	ssize_t (*extattr_get)(const char *, int, const char *, void*, size_t) =
-		ftwbuf->type == BFS_LNK ? extattr_get_link : extattr_get_file;
+	if (fd >= 0) {
+		len = extattr_get_fd(fd, EXTATTR_NAMESPACE_SYSTEM, name, NULL, 0);
+		if (len < 0) {
+			len = extattr_get_fd(fd, EXTATTR_NAMESPACE_USER, name, NULL, 0);
+		}
+	} else {
+		ssize_t (*extattr_get)(const char *, int, const char *, void*, size_t) =
+			ftwbuf->type == BFS_LNK ? extattr_get_link : extattr_get_file;
 
-	len = extattr_get(path, EXTATTR_NAMESPACE_SYSTEM, name, NULL, 0);
-	if (len < 0) {
-		len = extattr_get(path, EXTATTR_NAMESPACE_USER, name, NULL, 0);
+		len = extattr_get(path, EXTATTR_NAMESPACE_SYSTEM, name, NULL, 0);
+		if (len < 0) {
+			len = extattr_get(path, EXTATTR_NAMESPACE_USER, name, NULL, 0);
+		}
 	}
 #elif __APPLE__
-	int options = ftwbuf->type == BFS_LNK ? XATTR_NOFOLLOW : 0;
-	len = getxattr(path, name, NULL, 0, 0, options);
+	if (fd >= 0) {
+		len = fgetxattr(fd, name, NULL, 0, 0, 0);
+	} else {
+		int options = ftwbuf->type == BFS_LNK ? XATTR_NOFOLLOW : 0;
+		len = getxattr(path, name, NULL, 0, 0, options);
+	}
 #else
-	if (ftwbuf->type == BFS_LNK) {
+	if (fd >= 0) {
+		len = fgetxattr(fd, name, NULL, 0);
+	} else if (ftwbuf->type == BFS_LNK) {
 		len = lgetxattr(path, name, NULL, 0);
 	} else {
 		len = getxattr(path, name, NULL, 0);
@@ -351,7 +612,9 @@ int bfs_check_xattr_named(const struct BFTW *ftwbuf, const char *name) {
 
 	int error = errno;
 
-	free_fake_at(ftwbuf, path);
+	if (path) {
+		free_fake_at(ftwbuf, buf, path);
+	}
 
 	if (len >= 0) {
 		return 1;
@@ -365,8 +628,24 @@ int bfs_check_xattr_named(const struct BFTW *ftwbuf, const char *name) {
 	}
 }
 
+int bfs_check_xattr_named(const struct BFTW *ftwbuf, const char *name) {
+	const struct bfs_xattrs *xattrs = bfs_xattrs(ftwbuf);
+	if (xattrs && !xattrs->truncated) {
+		return bfs_xattrs_find(xattrs, name);
+	} else if (!xattrs && is_absence_error(errno)) {
+		return 0;
+	} else {
+		return bfs_get_xattr(ftwbuf, name);
+	}
+}
+
 #else // !BFS_CAN_CHECK_XATTRS
 
+int bfs_read_xattrs(int at_fd, const char *at_path, enum bfs_stat_flags flags, struct bfs_xattrs *xattrs) {
+	errno = ENOTSUP;
+	return -1;
+}
+
 int bfs_check_xattrs(const struct BFTW *ftwbuf) {
 	errno = ENOTSUP;
 	return -1;
@@ -10,6 +10,8 @@
 #define BFS_FSADE_H
 
 #include "config.h"
+#include "stat.h"
+#include <stddef.h>
 
 #define BFS_CAN_CHECK_ACL BFS_USE_SYS_ACL_H
 
@@ -24,6 +26,38 @@
 
 struct BFTW;
 
+/** The size of the extended attribute name buffer. */
+#define BFS_XATTRS_SIZE 256
+
+/**
+ * The names of a file's extended attributes.
+ */
+struct bfs_xattrs {
+	/** The length of the name list. */
+	size_t len;
+	/** Whether the list was too long to fit in the buffer. */
+	bool truncated;
+	/** The NUL-terminated names, one after another. */
+	char names[BFS_XATTRS_SIZE];
+};
+
+/**
+ * Read the names of a file's extended attributes, e.g. to prefetch them from
+ * the I/O queue.
+ *
+ * @param at_fd
+ *         The base directory for path resolution.
+ * @param at_path
+ *         The path to the file, relative to at_fd.
+ * @param flags
+ *         BFS_STAT_NOFOLLOW to read a symbolic link's own attributes.
+ * @param[out] xattrs
+ *         Will hold the attribute names.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_read_xattrs(int at_fd, const char *at_path, enum bfs_stat_flags flags, struct bfs_xattrs *xattrs);
+
 /**
  * Check if a file has a non-trivial Access Control List.
  *
@@ -0,0 +1,179 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "idset.h"
+#include "alloc.h"
+#include "darray.h"
+#include "diag.h"
+#include <stdint.h>
+#include <stdlib.h>
+
+/** The initial capacity of a shard. */
+#define IDSET_MIN_CAPACITY 64
+
+/**
+ * The IDs from a single device.  Empty slots hold inode number 0, so that
+ * inode is tracked separately.
+ */
+struct idset_shard {
+	/** The device number. */
+	dev_t dev;
+	/** Whether inode number 0 is in the set. */
+	bool zero;
+	/** The number of non-zero inode numbers in the table. */
+	size_t count;
+	/** The table capacity minus one (a power of two minus one). */
+	size_t mask;
+	/** The hash table. */
+	ino_t *table;
+};
+
+/** Mix the bits of an inode number, since they're often sequential. */
+static size_t idset_hash(ino_t ino) {
+	uint64_t x = ino;
+	x ^= x >> 33;
+	x *= UINT64_C(0xFF51AFD7ED558CCD);
+	x ^= x >> 33;
+	x *= UINT64_C(0xC4CEB9FE1A85EC53);
+	x ^= x >> 33;
+	return x;
+}
+
+/** Find the slot for an inode number, which may be empty. */
+static size_t idset_probe(const struct idset_shard *shard, ino_t ino) {
+	size_t i = idset_hash(ino) & shard->mask;
+	while (shard->table[i] != 0 && shard->table[i] != ino) {
+		i = (i + 1) & shard->mask;
+	}
+	return i;
+}
+
+/** Double the capacity of a shard. */
+static int idset_grow(struct idset_shard *shard) {
+	size_t capacity = shard->table ? 2 * (shard->mask + 1) : IDSET_MIN_CAPACITY;
+	ino_t *table = ZALLOC_ARRAY(ino_t, capacity);
+	if (!table) {
+		return -1;
+	}
+
+	ino_t *old = shard->table;
+	size_t old_capacity = old ? shard->mask + 1 : 0;
+	shard->table = table;
+	shard->mask = capacity - 1;
+
+	for (size_t i = 0; i < old_capacity; ++i) {
+		if (old[i] != 0) {
+			table[idset_probe(shard, old[i])] = old[i];
+		}
+	}
+
+	free(old);
+	return 0;
+}
+
+void idset_init(struct idset *set) {
+	set->shards = NULL;
+	set->last = 0;
+	set->size = 0;
+}
+
+/** Find the shard for a device, if it exists. */
+static struct idset_shard *idset_find_shard(const struct idset *set, dev_t dev) {
+	size_t nshards = darray_length(set->shards);
+
+	// Most searches only span a few devices, so check the last one first
+	if (set->last < nshards && set->shards[set->last].dev == dev) {
+		return &set->shards[set->last];
+	}
+
+	for (size_t i = 0; i < nshards; ++i) {
+		if (set->shards[i].dev == dev) {
+			return &set->shards[i];
+		}
+	}
+
+	return NULL;
+}
+
+bool idset_contains(const struct idset *set, dev_t dev, ino_t ino) {
+	const struct idset_shard *shard = idset_find_shard(set, dev);
+	if (!shard) {
+		return false;
+	}
+
+	if (ino == 0) {
+		return shard->zero;
+	}
+
+	if (!shard->table) {
+		return false;
+	}
+
+	return shard->table[idset_probe(shard, ino)] == ino;
+}
+
+/** Get the shard for a device, creating it if necessary. */
+static struct idset_shard *idset_get_shard(struct idset *set, dev_t dev) {
+	struct idset_shard *shard = idset_find_shard(set, dev);
+	if (!shard) {
+		struct idset_shard empty = {
+			.dev = dev,
+			.zero = false,
+			.count = 0,
+			.mask = 0,
+			.table = NULL,
+		};
+		if (DARRAY_PUSH(&set->shards, &empty) != 0) {
+			return NULL;
+		}
+		shard = &set->shards[darray_length(set->shards) - 1];
+	}
+
+	set->last = shard - set->shards;
+	return shard;
+}
+
+int idset_insert(struct idset *set, dev_t dev, ino_t ino) {
+	struct idset_shard *shard = idset_get_shard(set, dev);
+	if (!shard) {
+		return -1;
+	}
+
+	if (ino == 0) {
+		if (shard->zero) {
+			return 0;
+		}
+		shard->zero = true;
+		++set->size;
+		return 1;
+	}
+
+	if (shard->table) {
+		size_t i = idset_probe(shard, ino);
+		if (shard->table[i] == ino) {
+			return 0;
+		}
+	}
+
+	// Keep the load factor at or below 3/4
+	if (!shard->table || 4 * (shard->count + 1) > 3 * (shard->mask + 1)) {
+		if (idset_grow(shard) != 0) {
+			return -1;
+		}
+	}
+
+	size_t i = idset_probe(shard, ino);
+	bfs_assert(shard->table[i] == 0);
+	shard->table[i] = ino;
+	++shard->count;
+	++set->size;
+	return 1;
+}
+
+void idset_destroy(struct idset *set) {
+	size_t nshards = darray_length(set->shards);
+	for (size_t i = 0; i < nshards; ++i) {
+		free(set->shards[i].table);
+	}
+	darray_free(set->shards);
+}
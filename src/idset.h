@@ -0,0 +1,71 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * Sets of file IDs, i.e. (device, inode) pairs.
+ *
+ * The set is sharded by device number, and each shard is a flat open-addressed
+ * hash table of inode numbers.  That takes a fraction of the memory of a trie
+ * with a separate leaf for every file, and lookups touch only one or two cache
+ * lines.
+ */
+
+#ifndef BFS_IDSET_H
+#define BFS_IDSET_H
+
+#include "config.h"
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * A set of file IDs.
+ */
+struct idset {
+	/** The shards, one per device (a darray). */
+	struct idset_shard *shards;
+	/** The index of the most recently used shard. */
+	size_t last;
+	/** The total number of IDs in the set. */
+	size_t size;
+};
+
+/**
+ * Initialize an empty set.
+ */
+void idset_init(struct idset *set);
+
+/**
+ * Check if a set contains a file ID.
+ *
+ * @param set
+ *         The set to search.
+ * @param dev
+ *         The device number.
+ * @param ino
+ *         The inode number.
+ * @return
+ *         Whether the ID is in the set.
+ */
+bool idset_contains(const struct idset *set, dev_t dev, ino_t ino);
+
+/**
+ * Add a file ID to a set.
+ *
+ * @param set
+ *         The set to modify.
+ * @param dev
+ *         The device number.
+ * @param ino
+ *         The inode number.
+ * @return
+ *         1 if the ID was added, 0 if it was already in the set, or -1 on
+ *         failure.
+ */
+int idset_insert(struct idset *set, dev_t dev, ino_t ino);
+
+/**
+ * Destroy a set.
+ */
+void idset_destroy(struct idset *set);
+
+#endif // BFS_IDSET_H
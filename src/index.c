@@ -0,0 +1,545 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * The index file is laid out like this, in native byte order:
+ *
+ *     struct bfs_index_header header;
+ *     struct bfs_index_dir dirs[header.ndirs];
+ *     struct bfs_index_ent ents[header.nents];
+ *     char strtab[header.strsize];
+ *
+ * The directories are sorted by path so they can be binary searched in place.
+ * Each one refers to a contiguous range of entries, and all names are stored
+ * as NUL-terminated strings in the string table.
+ */
+
+#include "index.h"
+#include "alloc.h"
+#include "bfstd.h"
+#include "config.h"
+#include "darray.h"
+#include "diag.h"
+#include "dir.h"
+#include "dstring.h"
+#include "stat.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+/** The magic bytes at the start of an index file. */
+#define INDEX_MAGIC "bfsindex"
+/** The current index format version. */
+#define INDEX_VERSION 1
+/** Detects indices written on a host with a different byte order. */
+#define INDEX_BYTE_ORDER 0x01020304
+
+/**
+ * The index file header.
+ */
+struct bfs_index_header {
+	/** INDEX_MAGIC. */
+	char magic[8];
+	/** INDEX_VERSION. */
+	uint32_t version;
+	/** INDEX_BYTE_ORDER. */
+	uint32_t byte_order;
+	/** The number of directories. */
+	uint64_t ndirs;
+	/** The number of entries. */
+	uint64_t nents;
+	/** The size of the string table. */
+	uint64_t strsize;
+};
+
+/**
+ * An indexed directory.
+ */
+struct bfs_index_dir {
+	/** The device number of the directory. */
+	uint64_t dev;
+	/** The inode number of the directory. */
+	uint64_t ino;
+	/** The modification time of the directory. */
+	int64_t mtime_sec;
+	/** The change time of the directory. */
+	int64_t ctime_sec;
+	/** Nanoseconds for mtime_sec. */
+	uint32_t mtime_nsec;
+	/** Nanoseconds for ctime_sec. */
+	uint32_t ctime_nsec;
+	/** The offset of the path in the string table. */
+	uint64_t path;
+	/** The index of the first entry. */
+	uint64_t first;
+	/** The number of entries. */
+	uint64_t count;
+};
+
+/**
+ * An indexed directory entry.
+ */
+struct bfs_index_ent {
+	/** The offset of the name in the string table. */
+	uint64_t name;
+	/** The bfs_type of the entry. */
+	uint32_t type;
+	/** Padding. */
+	uint32_t reserved;
+};
+
+struct bfs_index {
+	/** The path to the index file. */
+	char *path;
+	/** When this search started. */
+	struct timespec start;
+
+	/** The mapped index file, if any. */
+	void *map;
+	/** The size of the mapping. */
+	size_t mapsize;
+	/** The loaded directories. */
+	const struct bfs_index_dir *dirs;
+	/** The number of loaded directories. */
+	size_t ndirs;
+	/** The loaded entries. */
+	const struct bfs_index_ent *ents;
+	/** The number of loaded entries. */
+	size_t nents;
+	/** The loaded string table. */
+	const char *strtab;
+	/** The size of the loaded string table. */
+	size_t strsize;
+
+	/** The recorded directories (darray). */
+	struct bfs_index_dir *new_dirs;
+	/** The recorded entries (darray). */
+	struct bfs_index_ent *new_ents;
+	/** The recorded string table (dstring). */
+	char *new_strtab;
+	/** The directory currently being recorded. */
+	struct bfs_index_dir current;
+	/** The size of new_strtab before the current directory. */
+	size_t mark;
+	/** Whether we're recording a directory. */
+	bool recording;
+};
+
+struct bfs_index *bfs_index_new(const char *path) {
+	struct bfs_index *index = ZALLOC(struct bfs_index);
+	if (!index) {
+		return NULL;
+	}
+
+	index->path = dstrdup(path);
+	if (!index->path) {
+		goto fail;
+	}
+
+	index->new_strtab = dstralloc(0);
+	if (!index->new_strtab) {
+		goto fail;
+	}
+
+	if (clock_gettime(CLOCK_REALTIME, &index->start) != 0) {
+		goto fail;
+	}
+
+	return index;
+
+fail:
+	bfs_index_free(index);
+	return NULL;
+}
+
+/** Check that a loaded directory refers to valid data. */
+static bool index_dir_valid(const struct bfs_index *index, const struct bfs_index_dir *dir) {
+	return dir->path < index->strsize
+		&& dir->first <= index->nents
+		&& dir->count <= index->nents - dir->first;
+}
+
+/** Validate a mapped index file. */
+static int index_parse(struct bfs_index *index, const char *map, size_t size) {
+	const struct bfs_index_header *header = (const void *)map;
+	if (size < sizeof(*header)) {
+		goto invalid;
+	}
+
+	if (memcmp(header->magic, INDEX_MAGIC, sizeof(header->magic)) != 0
+	    || header->version != INDEX_VERSION
+	    || header->byte_order != INDEX_BYTE_ORDER) {
+		goto invalid;
+	}
+
+	size_t rest = size - sizeof(*header);
+	if (header->ndirs > rest / sizeof(struct bfs_index_dir)) {
+		goto invalid;
+	}
+	rest -= header->ndirs * sizeof(struct bfs_index_dir);
+
+	if (header->nents > rest / sizeof(struct bfs_index_ent)) {
+		goto invalid;
+	}
+	rest -= header->nents * sizeof(struct bfs_index_ent);
+
+	if (header->strsize != rest || (rest > 0 && map[size - 1] != '\0')) {
+		goto invalid;
+	}
+
+	index->dirs = (const void *)(header + 1);
+	index->ndirs = header->ndirs;
+	index->ents = (const void *)(index->dirs + index->ndirs);
+	index->nents = header->nents;
+	index->strtab = (const char *)(index->ents + index->nents);
+	index->strsize = header->strsize;
+
+	for (size_t i = 0; i < index->ndirs; ++i) {
+		if (!index_dir_valid(index, &index->dirs[i])) {
+			goto invalid;
+		}
+	}
+
+	return 0;
+
+invalid:
+	index->dirs = NULL;
+	index->ndirs = 0;
+	index->ents = NULL;
+	index->nents = 0;
+	index->strtab = NULL;
+	index->strsize = 0;
+	errno = EINVAL;
+	return -1;
+}
+
+int bfs_index_load(struct bfs_index *index) {
+	bfs_assert(!index->map);
+
+	int fd = open(index->path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+
+	struct stat sb;
+	if (fstat(fd, &sb) != 0) {
+		goto fail;
+	}
+
+	if (!S_ISREG(sb.st_mode) || sb.st_size <= 0 || (uintmax_t)sb.st_size > SIZE_MAX) {
+		errno = EINVAL;
+		goto fail;
+	}
+
+	size_t size = sb.st_size;
+	void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		goto fail;
+	}
+	close_quietly(fd);
+
+	if (index_parse(index, map, size) != 0) {
+		int error = errno;
+		munmap(map, size);
+		errno = error;
+		return -1;
+	}
+
+	index->map = map;
+	index->mapsize = size;
+	return 0;
+
+fail:
+	close_quietly(fd);
+	return -1;
+}
+
+/** Check if an indexed directory matches the current stat() info. */
+static bool index_dir_fresh(const struct bfs_index_dir *dir, const struct bfs_stat *statbuf) {
+	enum bfs_stat_field mask = BFS_STAT_DEV | BFS_STAT_INO | BFS_STAT_MTIME | BFS_STAT_CTIME;
+	if ((statbuf->mask & mask) != mask) {
+		return false;
+	}
+
+	return dir->dev == (uint64_t)statbuf->dev
+		&& dir->ino == (uint64_t)statbuf->ino
+		&& dir->mtime_sec == statbuf->mtime.tv_sec
+		&& dir->mtime_nsec == (uint32_t)statbuf->mtime.tv_nsec
+		&& dir->ctime_sec == statbuf->ctime.tv_sec
+		&& dir->ctime_nsec == (uint32_t)statbuf->ctime.tv_nsec;
+}
+
+bool bfs_index_lookup(const struct bfs_index *index, const char *path, const struct bfs_stat *statbuf, struct bfs_index_cursor *cursor) {
+	size_t lo = 0, hi = index->ndirs;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		const struct bfs_index_dir *dir = &index->dirs[mid];
+
+		int cmp = strcmp(path, index->strtab + dir->path);
+		if (cmp < 0) {
+			hi = mid;
+		} else if (cmp > 0) {
+			lo = mid + 1;
+		} else if (index_dir_fresh(dir, statbuf)) {
+			const struct bfs_index_ent *ents = index->ents + dir->first;
+			for (size_t i = 0; i < dir->count; ++i) {
+				if (ents[i].name >= index->strsize) {
+					return false;
+				}
+			}
+
+			cursor->ent = ents;
+			cursor->end = ents + dir->count;
+			cursor->strtab = index->strtab;
+			return true;
+		} else {
+			return false;
+		}
+	}
+
+	return false;
+}
+
+int bfs_index_read(struct bfs_index_cursor *cursor, struct bfs_dirent *de) {
+	if (cursor->ent == cursor->end) {
+		return 0;
+	}
+
+	const struct bfs_index_ent *ent = cursor->ent++;
+	de->name = cursor->strtab + ent->name;
+	de->ino = 0;
+	if (ent->type <= BFS_WHT) {
+		de->type = ent->type;
+	} else {
+		de->type = BFS_UNKNOWN;
+	}
+	return 1;
+}
+
+int bfs_index_begin(struct bfs_index *index, const char *path, const struct bfs_stat *statbuf) {
+	bfs_assert(!index->recording);
+
+	enum bfs_stat_field mask = BFS_STAT_DEV | BFS_STAT_INO | BFS_STAT_MTIME | BFS_STAT_CTIME;
+	if ((statbuf->mask & mask) != mask) {
+		return 0;
+	}
+
+	// A directory modified in the same second as our search began could
+	// change again without its timestamps changing, so don't trust it
+	time_t start = index->start.tv_sec;
+	if (statbuf->mtime.tv_sec >= start || statbuf->ctime.tv_sec >= start) {
+		return 0;
+	}
+
+	index->mark = dstrlen(index->new_strtab);
+	if (dstrxcat(&index->new_strtab, path, strlen(path) + 1) != 0) {
+		return -1;
+	}
+
+	index->current = (struct bfs_index_dir) {
+		.dev = statbuf->dev,
+		.ino = statbuf->ino,
+		.mtime_sec = statbuf->mtime.tv_sec,
+		.mtime_nsec = statbuf->mtime.tv_nsec,
+		.ctime_sec = statbuf->ctime.tv_sec,
+		.ctime_nsec = statbuf->ctime.tv_nsec,
+		.path = index->mark,
+		.first = darray_length(index->new_ents),
+		.count = 0,
+	};
+	index->recording = true;
+	return 0;
+}
+
+int bfs_index_add(struct bfs_index *index, const struct bfs_dirent *de) {
+	if (!index->recording) {
+		return 0;
+	}
+
+	struct bfs_index_ent ent = {
+		.name = dstrlen(index->new_strtab),
+		.type = de->type,
+	};
+
+	if (de->type < BFS_UNKNOWN) {
+		ent.type = BFS_UNKNOWN;
+	}
+
+	if (dstrxcat(&index->new_strtab, de->name, strlen(de->name) + 1) != 0) {
+		goto fail;
+	}
+
+	if (DARRAY_PUSH(&index->new_ents, &ent) != 0) {
+		goto fail;
+	}
+
+	++index->current.count;
+	return 0;
+
+fail:
+	bfs_index_end(index, false);
+	return -1;
+}
+
+void bfs_index_end(struct bfs_index *index, bool complete) {
+	if (!index->recording) {
+		return;
+	}
+	index->recording = false;
+
+	if (complete && DARRAY_PUSH(&index->new_dirs, &index->current) == 0) {
+		return;
+	}
+
+	// Entries of an abandoned directory are left behind in new_ents, but
+	// they are dropped by bfs_index_save() since nothing refers to them
+	dstresize(&index->new_strtab, index->mark);
+}
+
+/** A recorded directory, for sorting. */
+struct index_sort {
+	/** The path of the directory. */
+	const char *path;
+	/** The order it was recorded in. */
+	size_t seq;
+};
+
+/** Compare recorded directories by path, then by recording order. */
+static int index_sort_cmp(const void *a, const void *b) {
+	const struct index_sort *lhs = a;
+	const struct index_sort *rhs = b;
+
+	int cmp = strcmp(lhs->path, rhs->path);
+	if (cmp != 0) {
+		return cmp;
+	}
+
+	return (lhs->seq > rhs->seq) - (lhs->seq < rhs->seq);
+}
+
+/** Write a whole buffer to a file. */
+static int index_write(int fd, const void *buf, size_t size) {
+	if (xwrite(fd, buf, size) != size) {
+		return -1;
+	}
+	return 0;
+}
+
+int bfs_index_save(struct bfs_index *index) {
+	bfs_assert(!index->recording);
+
+	int ret = -1;
+	int error;
+	int fd = -1;
+	char *tmp = NULL;
+	struct index_sort *sorted = NULL;
+	struct bfs_index_dir *dirs = NULL;
+	struct bfs_index_ent *ents = NULL;
+
+	size_t nrecorded = darray_length(index->new_dirs);
+	sorted = ALLOC_ARRAY(struct index_sort, nrecorded);
+	dirs = ALLOC_ARRAY(struct bfs_index_dir, nrecorded);
+	ents = ALLOC_ARRAY(struct bfs_index_ent, darray_length(index->new_ents));
+	if ((nrecorded > 0 && (!sorted || !dirs)) || (darray_length(index->new_ents) > 0 && !ents)) {
+		goto done;
+	}
+
+	for (size_t i = 0; i < nrecorded; ++i) {
+		sorted[i].path = index->new_strtab + index->new_dirs[i].path;
+		sorted[i].seq = i;
+	}
+	qsort(sorted, nrecorded, sizeof(*sorted), index_sort_cmp);
+
+	// Keep only the last listing of any directory that was read more than
+	// once (e.g. by -S ids), and pack the entries in path order
+	size_t ndirs = 0, nents = 0;
+	for (size_t i = 0; i < nrecorded; ++i) {
+		if (i + 1 < nrecorded && strcmp(sorted[i].path, sorted[i + 1].path) == 0) {
+			continue;
+		}
+
+		struct bfs_index_dir *dir = &dirs[ndirs++];
+		*dir = index->new_dirs[sorted[i].seq];
+		if (dir->count > 0) {
+			memcpy(ents + nents, index->new_ents + dir->first, dir->count * sizeof(*ents));
+		}
+		dir->first = nents;
+		nents += dir->count;
+	}
+
+	struct bfs_index_header header = {
+		.version = INDEX_VERSION,
+		.byte_order = INDEX_BYTE_ORDER,
+		.ndirs = ndirs,
+		.nents = nents,
+		.strsize = dstrlen(index->new_strtab),
+	};
+	memcpy(header.magic, INDEX_MAGIC, sizeof(header.magic));
+
+	tmp = dstrprintf("%s.XXXXXX", index->path);
+	if (!tmp) {
+		goto done;
+	}
+
+	fd = mkstemp(tmp);
+	if (fd < 0) {
+		goto done;
+	}
+
+	if (index_write(fd, &header, sizeof(header)) != 0
+	    || index_write(fd, dirs, ndirs * sizeof(*dirs)) != 0
+	    || index_write(fd, ents, nents * sizeof(*ents)) != 0
+	    || index_write(fd, index->new_strtab, header.strsize) != 0) {
+		goto unlink;
+	}
+
+	error = xclose(fd);
+	fd = -1;
+	if (error != 0) {
+		goto unlink;
+	}
+
+	if (rename(tmp, index->path) != 0) {
+		goto unlink;
+	}
+
+	ret = 0;
+	goto done;
+
+unlink:
+	error = errno;
+	if (fd >= 0) {
+		xclose(fd);
+	}
+	fd = -1;
+	unlink(tmp);
+	errno = error;
+done:
+	dstrfree(tmp);
+	free(ents);
+	free(dirs);
+	free(sorted);
+	return ret;
+}
+
+void bfs_index_free(struct bfs_index *index) {
+	if (!index) {
+		return;
+	}
+
+	if (index->map) {
+		munmap(index->map, index->mapsize);
+	}
+
+	dstrfree(index->new_strtab);
+	darray_free(index->new_ents);
+	darray_free(index->new_dirs);
+	dstrfree(index->path);
+	free(index);
+}
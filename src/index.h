@@ -0,0 +1,141 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * A persistent index of directory listings (-index).
+ *
+ * The index file holds the names and types of the entries of every directory
+ * that was completely read by a previous search, along with the identity and
+ * modification times of the directory itself.  A later search can skip reading
+ * any directory whose mtime and ctime haven't changed, and take its listing
+ * from the (memory-mapped) index instead.
+ */
+
+#ifndef BFS_INDEX_H
+#define BFS_INDEX_H
+
+#include "config.h"
+#include <stddef.h>
+
+struct bfs_dirent;
+struct bfs_stat;
+
+/**
+ * A directory index.
+ */
+struct bfs_index;
+
+/**
+ * An iterator over an indexed directory listing.
+ */
+struct bfs_index_cursor {
+	/** The current entry. */
+	const struct bfs_index_ent *ent;
+	/** The end of the listing. */
+	const struct bfs_index_ent *end;
+	/** The string table. */
+	const char *strtab;
+};
+
+/**
+ * Create a new, empty index that will be saved to the given path.
+ *
+ * @param path
+ *         The path to the index file.
+ * @return
+ *         The new index, or NULL on error.
+ */
+struct bfs_index *bfs_index_new(const char *path);
+
+/**
+ * Load the existing index file, if there is one.
+ *
+ * @param index
+ *         The index to load into.
+ * @return
+ *         0 on success, or -1 on failure.  If the index file doesn't exist,
+ *         errno is set to ENOENT; if it's not a valid index, EINVAL.
+ */
+int bfs_index_load(struct bfs_index *index);
+
+/**
+ * Look up a directory in the loaded index.
+ *
+ * @param index
+ *         The index to search.
+ * @param path
+ *         The path to the directory.
+ * @param statbuf
+ *         The current bfs_stat() info for the directory.
+ * @param[out] cursor
+ *         Will iterate over the indexed listing, if it's still up to date.
+ * @return
+ *         Whether an up-to-date listing was found.
+ */
+bool bfs_index_lookup(const struct bfs_index *index, const char *path, const struct bfs_stat *statbuf, struct bfs_index_cursor *cursor);
+
+/**
+ * Read the next entry from an indexed listing.
+ *
+ * @param cursor
+ *         The cursor from bfs_index_lookup().
+ * @param[out] de
+ *         The directory entry to fill in.
+ * @return
+ *         1 on success, or 0 at the end of the listing.
+ */
+int bfs_index_read(struct bfs_index_cursor *cursor, struct bfs_dirent *de);
+
+/**
+ * Start recording a directory listing for the new index.  Directories that
+ * changed too recently to be trusted later are silently not recorded.
+ *
+ * @param index
+ *         The index to record into.
+ * @param path
+ *         The path to the directory.
+ * @param statbuf
+ *         The bfs_stat() info for the directory.
+ * @return
+ *         0 on success, or -1 on failure.
+ */
+int bfs_index_begin(struct bfs_index *index, const char *path, const struct bfs_stat *statbuf);
+
+/**
+ * Record an entry of the current directory.
+ *
+ * @param index
+ *         The index to record into.
+ * @param de
+ *         The directory entry to record.
+ * @return
+ *         0 on success, or -1 on failure.
+ */
+int bfs_index_add(struct bfs_index *index, const struct bfs_dirent *de);
+
+/**
+ * Finish recording the current directory.
+ *
+ * @param index
+ *         The index to record into.
+ * @param complete
+ *         Whether the whole listing was recorded.  If not, it is discarded.
+ */
+void bfs_index_end(struct bfs_index *index, bool complete);
+
+/**
+ * Write the recorded listings to the index file, replacing it atomically.
+ *
+ * @param index
+ *         The index to save.
+ * @return
+ *         0 on success, or -1 on failure.
+ */
+int bfs_index_save(struct bfs_index *index);
+
+/**
+ * Free an index.
+ */
+void bfs_index_free(struct bfs_index *index);
+
+#endif // BFS_INDEX_H
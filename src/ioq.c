@@ -8,13 +8,35 @@
 #include "bit.h"
 #include "config.h"
 #include "diag.h"
+#include "perf.h"
 #include "dir.h"
+#include "fsade.h"
 #include "thread.h"
 #include "sanity.h"
+#include "stat.h"
+#include "trace.h"
 #include <assert.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if BFS_USE_LIBURING
+#  include <liburing.h>
+#endif
+
+#if __linux__
+#  include <limits.h>
+#  include <linux/futex.h>
+#  include <sys/syscall.h>
+#  define IOQ_FUTEX true
+#elif __APPLE__
+#  define IOQ_FUTEX true
+#else
+#  define IOQ_FUTEX false
+#endif
 
 /**
  * A monitor for an I/O queue slot.
@@ -73,10 +95,14 @@ struct ioqq {
 	/** Circular buffer index mask. */
 	size_t slot_mask;
 
+#if !IOQ_FUTEX
 	/** Monitor index mask. */
 	size_t monitor_mask;
 	/** Array of monitors used by the slots. */
 	struct ioq_monitor *monitors;
+#endif
+	/** The -D perf event for time spent blocked on this queue. */
+	enum perf_event wait_event;
 
 	/** Index of next writer. */
 	cache_align atomic size_t head;
@@ -100,10 +126,12 @@ bfs_static_assert(IOQ_STRIDE % 2 == 1);
 
 /** Destroy an I/O command queue. */
 static void ioqq_destroy(struct ioqq *ioqq) {
+#if !IOQ_FUTEX
 	for (size_t i = 0; i < ioqq->monitor_mask + 1; ++i) {
 		ioq_monitor_destroy(&ioqq->monitors[i]);
 	}
 	free(ioqq->monitors);
+#endif
 	free(ioqq);
 }
 
@@ -118,6 +146,8 @@ static struct ioqq *ioqq_create(size_t size) {
 	}
 
 	ioqq->slot_mask = size - 1;
+
+#if !IOQ_FUTEX
 	ioqq->monitor_mask = -1;
 
 	// Use a pool of monitors
@@ -135,6 +165,7 @@ static struct ioqq *ioqq_create(size_t size) {
 		}
 		++ioqq->monitor_mask;
 	}
+#endif
 
 	atomic_init(&ioqq->head, 0);
 	atomic_init(&ioqq->tail, 0);
@@ -146,8 +177,82 @@ static struct ioqq *ioqq_create(size_t size) {
 	return ioqq;
 }
 
-/** Atomically wait for a slot to change. */
-static uintptr_t ioq_slot_wait(struct ioqq *ioqq, ioq_slot *slot, uintptr_t value) {
+/** The number of times to re-check a slot before going to sleep. */
+#define IOQ_SPIN 128
+
+#if IOQ_FUTEX
+
+// Rather than a monitor, waiters sleep on the slot itself.  Futexes are only
+// 32 bits wide, so we use the half of the slot that holds IOQ_BLOCKED.  Every
+// change to a blocked slot clears that bit, so that half always changes too.
+
+#if __APPLE__
+// Not public API, but stable since macOS 10.12 (and used by libc++)
+extern int __ulock_wait(uint32_t operation, void *addr, uint64_t value, uint32_t timeout);
+extern int __ulock_wake(uint32_t operation, void *addr, uint64_t wake_value);
+#  define UL_COMPARE_AND_WAIT 1
+#  define ULF_WAKE_ALL 0x100
+#endif
+
+/** Get the futex word for a slot. */
+static void *ioq_slot_futex(ioq_slot *slot) {
+	char *addr = (char *)slot;
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	addr += sizeof(*slot) - sizeof(uint32_t);
+#endif
+	return addr;
+}
+
+/** Sleep until a slot (probably) no longer holds the given value. */
+static void ioq_futex_wait(ioq_slot *slot, uintptr_t value) {
+	// Spurious wakeups (EINTR, EAGAIN) are handled by the caller
+	void *addr = ioq_slot_futex(slot);
+#if __linux__
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, (uint32_t)value, NULL, NULL, 0);
+#else
+	__ulock_wait(UL_COMPARE_AND_WAIT, addr, (uint32_t)value, 0);
+#endif
+}
+
+/** Wake up every thread sleeping on a slot. */
+static void ioq_futex_wake(ioq_slot *slot) {
+	void *addr = ioq_slot_futex(slot);
+#if __linux__
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+#else
+	__ulock_wake(UL_COMPARE_AND_WAIT | ULF_WAKE_ALL, addr, 0);
+#endif
+}
+
+/** Sleep until a slot changes. */
+static uintptr_t ioq_slot_park(struct ioqq *ioqq, ioq_slot *slot, uintptr_t value) {
+	uintptr_t ret = value;
+	if (!(value & IOQ_BLOCKED)) {
+		value |= IOQ_BLOCKED;
+		if (!compare_exchange_strong(slot, &ret, value, relaxed, relaxed)) {
+			return ret;
+		}
+	}
+
+	uint64_t start = perf_start();
+	do {
+		ioq_futex_wait(slot, value);
+		ret = load(slot, relaxed);
+	} while (ret == value);
+	perf_stop(ioqq->wait_event, start);
+
+	return ret;
+}
+
+/** Wake up any threads waiting on a slot. */
+static void ioq_slot_wake(struct ioqq *ioqq, ioq_slot *slot) {
+	ioq_futex_wake(slot);
+}
+
+#else // !IOQ_FUTEX
+
+/** Sleep until a slot changes. */
+static uintptr_t ioq_slot_park(struct ioqq *ioqq, ioq_slot *slot, uintptr_t value) {
 	size_t i = slot - ioqq->slots;
 	struct ioq_monitor *monitor = &ioqq->monitors[i & ioqq->monitor_mask];
 	mutex_lock(&monitor->mutex);
@@ -164,12 +269,14 @@ static uintptr_t ioq_slot_wait(struct ioqq *ioqq, ioq_slot *slot, uintptr_t valu
 		}
 	}
 
+	uint64_t start = perf_start();
 	do {
 		// To avoid missed wakeups, it is important that
 		// cond_broadcast() is not called right here
 		cond_wait(&monitor->cond, &monitor->mutex);
 		ret = load(slot, relaxed);
 	} while (ret == value);
+	perf_stop(ioqq->wait_event, start);
 
 done:
 	mutex_unlock(&monitor->mutex);
@@ -182,7 +289,7 @@ static void ioq_slot_wake(struct ioqq *ioqq, ioq_slot *slot) {
 	struct ioq_monitor *monitor = &ioqq->monitors[i & ioqq->monitor_mask];
 
 	// The following implementation would clearly avoid the missed wakeup
-	// issue mentioned above in ioq_slot_wait():
+	// issue mentioned above in ioq_slot_park():
 	//
 	//     mutex_lock(&monitor->mutex);
 	//     cond_broadcast(&monitor->cond);
@@ -197,6 +304,23 @@ static void ioq_slot_wake(struct ioqq *ioqq, ioq_slot *slot) {
 	cond_broadcast(&monitor->cond);
 }
 
+#endif // !IOQ_FUTEX
+
+/** Atomically wait for a slot to change. */
+static uintptr_t ioq_slot_wait(struct ioqq *ioqq, ioq_slot *slot, uintptr_t value) {
+	// Slots are usually refilled (or drained) quickly, so spin for a bit
+	// before paying for a trip to sleep and back
+	for (int i = 0; i < IOQ_SPIN; ++i) {
+		spin_loop();
+		uintptr_t ret = load(slot, relaxed);
+		if (ret != value) {
+			return ret;
+		}
+	}
+
+	return ioq_slot_park(ioqq, slot, value);
+}
+
 /** Get the next slot for writing. */
 static ioq_slot *ioqq_write(struct ioqq *ioqq) {
 	size_t i = fetch_add(&ioqq->head, IOQ_STRIDE, relaxed);
@@ -226,6 +350,18 @@ static void ioqq_push(struct ioqq *ioqq, struct ioq_ent *ent) {
 	ioq_slot_push(ioqq, slot, ent);
 }
 
+/** Push a batch of entries onto the queue. */
+static void ioqq_push_batch(struct ioqq *ioqq, struct ioq_ent *batch[], size_t size) {
+	// Reserve all the slots at once
+	size_t i = fetch_add(&ioqq->head, size * IOQ_STRIDE, relaxed);
+
+	for (size_t j = 0; j < size; ++j) {
+		ioq_slot *slot = &ioqq->slots[i & ioqq->slot_mask];
+		ioq_slot_push(ioqq, slot, batch[j]);
+		i += IOQ_STRIDE;
+	}
+}
+
 /** Get the next slot for reading. */
 static ioq_slot *ioqq_read(struct ioqq *ioqq) {
 	size_t i = fetch_add(&ioqq->tail, IOQ_STRIDE, relaxed);
@@ -258,24 +394,207 @@ static struct ioq_ent *ioqq_pop(struct ioqq *ioqq) {
 	return ioq_slot_pop(ioqq, slot, true);
 }
 
-/** Pop an entry from the queue if one is available. */
-static struct ioq_ent *ioqq_trypop(struct ioqq *ioqq) {
+#if BFS_USE_LIBURING
+
+// Only the io_uring workers pop requests in batches.  The synchronous workers
+// take one at a time so that idle threads can pick up the rest.
+
+/**
+ * Pop a batch of entries from the queue, without blocking.  This is safe to
+ * call with multiple consumers.
+ */
+static size_t ioqq_trypop_batch(struct ioqq *ioqq, struct ioq_ent *batch[], size_t size) {
 	size_t i = load(&ioqq->tail, relaxed);
-	ioq_slot *slot = &ioqq->slots[i & ioqq->slot_mask];
+	size_t count;
+
+	do {
+		// Count the available entries, then try to claim them all at once
+		for (count = 0; count < size; ++count) {
+			size_t j = i + count * IOQ_STRIDE;
+			uintptr_t value = load(&ioqq->slots[j & ioqq->slot_mask], relaxed);
+			if (ioq_slot_empty(value)) {
+				break;
+			}
+		}
 
-	struct ioq_ent *ret = ioq_slot_pop(ioqq, slot, false);
-	if (ret) {
-		size_t j = exchange(&ioqq->tail, i + IOQ_STRIDE, relaxed);
-		bfs_assert(j == i, "Detected multiple consumers");
-		(void)j;
+		if (count == 0) {
+			return 0;
+		}
+	} while (!compare_exchange_weak(&ioqq->tail, &i, i + count * IOQ_STRIDE, relaxed, relaxed));
+
+	for (size_t j = 0; j < count; ++j) {
+		ioq_slot *slot = &ioqq->slots[i & ioqq->slot_mask];
+		batch[j] = ioq_slot_pop(ioqq, slot, true);
+		i += IOQ_STRIDE;
 	}
 
-	return ret;
+	return count;
+}
+
+/**
+ * Pop a batch of entries from the queue, blocking until at least one is
+ * available.
+ */
+static size_t ioqq_pop_batch(struct ioqq *ioqq, struct ioq_ent *batch[], size_t size) {
+	if (size == 0) {
+		return 0;
+	}
+
+	batch[0] = ioqq_pop(ioqq);
+	return 1 + ioqq_trypop_batch(ioqq, batch + 1, size - 1);
+}
+
+#endif // BFS_USE_LIBURING
+
+/**
+ * A single-producer, single-consumer ring of I/O responses.  Each background
+ * thread has its own, so completions never contend with each other.  The ring
+ * is as big as the whole queue, so pushing never has to wait for room.
+ */
+struct ioq_spsc {
+	/** Circular buffer index mask. */
+	size_t mask;
+	/** Index of the next write (only updated by the producer). */
+	cache_align atomic size_t head;
+	/** Index of the next read (only updated by the consumer). */
+	cache_align atomic size_t tail;
+	/** The circular buffer itself. */
+	cache_align struct ioq_ent *slots[];
+};
+
+/** Create a response ring. */
+static struct ioq_spsc *ioq_spsc_create(size_t size) {
+	size = bit_ceil(size);
+
+	struct ioq_spsc *spsc = ALLOC_FLEX(struct ioq_spsc, slots, size);
+	if (!spsc) {
+		return NULL;
+	}
+
+	spsc->mask = size - 1;
+	atomic_init(&spsc->head, 0);
+	atomic_init(&spsc->tail, 0);
+	return spsc;
+}
+
+/**
+ * Push entries into a response ring.  The caller must then check whether the
+ * consumer needs waking up; the seq_cst store pairs with the one in
+ * ioq_ready_pop() so that one side always sees the other.
+ */
+static void ioq_spsc_push(struct ioq_spsc *spsc, struct ioq_ent *batch[], size_t size) {
+	size_t head = load(&spsc->head, relaxed);
+	bfs_assert(head - load(&spsc->tail, relaxed) + size <= spsc->mask + 1, "Response ring overflow");
+
+	for (size_t i = 0; i < size; ++i) {
+		spsc->slots[(head + i) & spsc->mask] = batch[i];
+	}
+
+	store(&spsc->head, head + size, seq_cst);
+}
+
+/** Pop entries from a response ring, without blocking. */
+static size_t ioq_spsc_pop(struct ioq_spsc *spsc, struct ioq_ent *batch[], size_t size) {
+	size_t tail = load(&spsc->tail, relaxed);
+	size_t count = load(&spsc->head, seq_cst) - tail;
+	if (count > size) {
+		count = size;
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		batch[i] = spsc->slots[(tail + i) & spsc->mask];
+	}
+
+	store(&spsc->tail, tail + count, release);
+	return count;
 }
 
 /** Sentinel stop command. */
 static struct ioq_ent IOQ_STOP;
 
+/** The maximum number of requests to buffer before submitting them. */
+#define IOQ_BATCH 32
+
+#if BFS_USE_LIBURING
+
+/** The number of entries in each thread's io_uring. */
+#define IOQ_RING_ENTRIES 64
+
+/**
+ * An in-flight io_uring request.
+ */
+struct ioq_ring_slot {
+	/** The request itself. */
+	struct ioq_ent *ent;
+#if BFS_USE_STATX
+	/** Buffer for IOQ_STAT. */
+	struct statx xbuf;
+#endif
+};
+
+#endif // BFS_USE_LIBURING
+
+/**
+ * I/O queue thread-specific data.
+ */
+struct ioq_thread {
+	/** The thread handle. */
+	pthread_t id;
+	/** Pointer back to the I/O queue. */
+	struct ioq *parent;
+	/** This thread's index in the queue. */
+	size_t index;
+	/** This thread's completed requests. */
+	struct ioq_spsc *ready;
+	/** Total time spent handling requests, if the queue is being tuned. */
+	cache_align atomic uint64_t busy;
+
+#if BFS_USE_LIBURING
+	/** io_uring instance. */
+	struct io_uring ring;
+	/** Whether the io_uring was successfully initialized. */
+	bool ring_ok;
+	/** Storage for in-flight requests. */
+	struct ioq_ring_slot slots[IOQ_RING_ENTRIES];
+#endif
+};
+
+/** Tune the thread count after at least this many completions... */
+#define IOQ_TUNE_OPS 64
+/** ...and at least this many nanoseconds. */
+#define IOQ_TUNE_NS (10 * 1000 * 1000)
+/** How many intervals to wait after a fruitless grow before trying again. */
+#define IOQ_TUNE_HOLD 8
+
+/**
+ * Consumer-side state for ioq_autotune().
+ */
+struct ioq_tuner {
+	/** Whether tuning is enabled. */
+	bool enabled;
+	/** The minimum number of active threads. */
+	size_t min;
+	/** The number of active threads. */
+	size_t nactive;
+	/** The active thread count before the last grow. */
+	size_t prev;
+	/** Whether we grew at the end of the last interval. */
+	bool grew;
+	/** Intervals left before growing again. */
+	size_t hold;
+
+	/** The start of the current interval. */
+	uint64_t start;
+	/** Total thread busy time at the start of the interval. */
+	uint64_t busy;
+	/** Time the consumer spent waiting during the interval. */
+	uint64_t wait;
+	/** Completions during the interval. */
+	size_t done;
+	/** The completion rate (per second) of the last interval. */
+	uint64_t rate;
+};
+
 struct ioq {
 	/** The depth of the queue. */
 	size_t depth;
@@ -289,70 +608,424 @@ struct ioq {
 
 	/** Pending I/O requests. */
 	struct ioqq *pending;
-	/** Ready I/O responses. */
-	struct ioqq *ready;
+
+	/** The next thread's responses to check. */
+	size_t next_ready;
+	/** Whether the consumer is (about to be) blocked waiting for responses. */
+	cache_align atomic bool waiting;
+	/** Monitor for waiting for responses. */
+	struct ioq_monitor monitor;
+	/** Whether the monitor was initialized. */
+	bool monitor_ok;
+
+	/** Requests that have not yet been submitted. */
+	struct ioq_ent *batch[IOQ_BATCH];
+	/** The number of buffered requests. */
+	size_t nbatch;
+
+	/** Thread count tuning state. */
+	struct ioq_tuner tuner;
+	/** Whether the threads should time their requests. */
+	atomic bool timed;
+	/** The number of threads allowed to take requests. */
+	cache_align atomic size_t nactive;
+	/** Monitor for sleeping inactive threads. */
+	struct ioq_monitor park;
+	/** Whether the park monitor was initialized. */
+	bool park_ok;
 
 	/** The number of background threads. */
 	size_t nthreads;
 	/** The background threads themselves. */
-	pthread_t threads[];
+	struct ioq_thread threads[];
 };
 
-/** Background thread entry point. */
-static void *ioq_work(void *ptr) {
-	struct ioq *ioq = ptr;
+/** Fill in the error code for a completed request. */
+static void ioq_complete(struct ioq_ent *ent, bool cancel) {
+	if (cancel) {
+		ent->error = EINTR;
+	} else if (ent->ret < 0) {
+		ent->error = errno;
+	} else {
+		ent->error = 0;
+	}
+}
+
+/** Synchronously handle a single request. */
+static void ioq_handle(struct ioq *ioq, struct ioq_ent *ent) {
+	bool cancel = load(&ioq->cancel, relaxed);
+	uint64_t start = trace_ioq_handle_start(ent->op);
+
+	ent->ret = -1;
+
+	switch (ent->op) {
+	case IOQ_CLOSE:
+		// Always close(), even if we're cancelled, just like a real EINTR
+		ent->ret = xclose(ent->close.fd);
+		break;
+
+	case IOQ_OPENDIR:
+		if (!cancel) {
+			struct ioq_opendir *args = &ent->opendir;
+			ent->ret = bfs_opendir(args->dir, args->dfd, args->path);
+			if (ent->ret == 0 && args->poll) {
+				bfs_polldir(args->dir);
+			}
+		}
+		break;
+
+	case IOQ_CLOSEDIR:
+		ent->ret = bfs_closedir(ent->closedir.dir);
+		break;
+
+	case IOQ_READDIR:
+		if (!cancel) {
+			ent->ret = bfs_polldir(ent->readdir.dir);
+		}
+		break;
+
+	case IOQ_STAT:
+		if (!cancel) {
+			struct ioq_stat *args = &ent->stat;
+			ent->ret = bfs_stat_fields(args->dfd, args->path, args->flags, args->fields, args->buf);
+		}
+		break;
+
+	case IOQ_XATTRS:
+		if (!cancel) {
+			struct ioq_xattrs *args = &ent->xattrs;
+			ent->ret = bfs_read_xattrs(args->dfd, args->path, args->flags, args->buf);
+		}
+		break;
+
+	case IOQ_READLINK:
+		if (!cancel) {
+			struct ioq_readlink *args = &ent->readlink;
+			args->target = xreadlinkat(args->dfd, args->path, args->size);
+			ent->ret = args->target ? 0 : -1;
+		}
+		break;
+
+	case IOQ_UNLINK:
+		if (!cancel) {
+			struct ioq_unlink *args = &ent->unlink;
+			ent->ret = unlinkat(args->dfd, args->path, args->flags);
+		}
+		break;
+
+	case IOQ_CALL:
+		if (!cancel) {
+			struct ioq_call *args = &ent->call;
+			ent->ret = args->fn(args->arg);
+		}
+		break;
+
+	default:
+		bfs_bug("Unknown ioq_op %d", (int)ent->op);
+		errno = ENOSYS;
+		break;
+	}
+
+	trace_ioq_handle_stop(start, ent->op);
+	ioq_complete(ent, cancel);
+}
+
+/** Publish completed requests from a background thread. */
+static void ioq_ready_push(struct ioq_thread *thread, struct ioq_ent *batch[], size_t size) {
+	if (size == 0) {
+		return;
+	}
+
+	ioq_spsc_push(thread->ready, batch, size);
+
+	struct ioq *ioq = thread->parent;
+	if (load(&ioq->waiting, seq_cst)) {
+		// Like ioq_slot_wake(), the empty critical section keeps the
+		// wakeup from slipping in before the consumer starts waiting
+		struct ioq_monitor *monitor = &ioq->monitor;
+		mutex_lock(&monitor->mutex);
+		mutex_unlock(&monitor->mutex);
+		cond_signal(&monitor->cond);
+	}
+}
+
+/** Sleep while the tuner doesn't want this thread. */
+static void ioq_thread_park(struct ioq_thread *thread) {
+	struct ioq *ioq = thread->parent;
+	if (thread->index < load(&ioq->nactive, relaxed)) {
+		return;
+	}
+
+	struct ioq_monitor *monitor = &ioq->park;
+	mutex_lock(&monitor->mutex);
+	while (thread->index >= load(&ioq->nactive, relaxed)) {
+		cond_wait(&monitor->cond, &monitor->mutex);
+	}
+	mutex_unlock(&monitor->mutex);
+}
+
+/** Start timing a request, if the queue is being tuned. */
+static uint64_t ioq_busy_start(const struct ioq *ioq) {
+	return load(&ioq->timed, relaxed) ? perf_now() : 0;
+}
+
+/** Finish timing a request. */
+static void ioq_busy_stop(struct ioq_thread *thread, uint64_t start) {
+	if (start) {
+		// Only this thread writes its own total
+		uint64_t busy = load(&thread->busy, relaxed);
+		store(&thread->busy, busy + perf_now() - start, relaxed);
+	}
+}
+
+/** Synchronous background thread loop. */
+static void ioq_sync_work(struct ioq_thread *thread) {
+	struct ioq *ioq = thread->parent;
 
 	while (true) {
+		ioq_thread_park(thread);
+
 		struct ioq_ent *ent = ioqq_pop(ioq->pending);
 		if (ent == &IOQ_STOP) {
 			break;
 		}
 
-		bool cancel = load(&ioq->cancel, relaxed);
+		uint64_t start = ioq_busy_start(ioq);
+		ioq_handle(ioq, ent);
+		ioq_busy_stop(thread, start);
+
+		ioq_ready_push(thread, &ent, 1);
+	}
+}
+
+#if BFS_USE_LIBURING
 
-		ent->ret = -1;
+/** Initialize a thread's io_uring, sharing the kernel workers with the first one. */
+static void ioq_ring_init(struct ioq *ioq, struct ioq_thread *thread) {
+	struct io_uring_params params = {0};
 
-		switch (ent->op) {
-		case IOQ_CLOSE:
-			// Always close(), even if we're cancelled, just like a real EINTR
-			ent->ret = xclose(ent->close.fd);
-			break;
+	struct ioq_thread *first = &ioq->threads[0];
+	if (thread != first) {
+		// If the first ring failed, don't bother with the rest
+		if (!first->ring_ok) {
+			return;
+		}
+		params.flags |= IORING_SETUP_ATTACH_WQ;
+		params.wq_fd = first->ring.ring_fd;
+	}
+
+	if (io_uring_queue_init_params(IOQ_RING_ENTRIES, &thread->ring, &params) != 0) {
+		return;
+	}
+
+	// Fall back to the thread pool on kernels missing the operations we need
+	struct io_uring_probe *probe = io_uring_get_probe_ring(&thread->ring);
+	bool ok = probe
+		&& io_uring_opcode_supported(probe, IORING_OP_CLOSE)
+		&& io_uring_opcode_supported(probe, IORING_OP_OPENAT)
+		&& io_uring_opcode_supported(probe, IORING_OP_STATX);
+	io_uring_free_probe(probe);
+
+	if (ok) {
+		thread->ring_ok = true;
+	} else {
+		io_uring_queue_exit(&thread->ring);
+	}
+}
 
-		case IOQ_OPENDIR:
-			if (!cancel) {
-				struct ioq_opendir *args = &ent->opendir;
-				ent->ret = bfs_opendir(args->dir, args->dfd, args->path);
-				if (ent->ret == 0) {
+/**
+ * Prepare an io_uring submission for a request, or handle it synchronously.
+ *
+ * @return
+ *         Whether a submission was queued.
+ */
+static bool ioq_ring_prep(struct ioq_thread *thread, struct ioq_ring_slot *slot, struct ioq_ent *ent) {
+	struct ioq *ioq = thread->parent;
+	struct io_uring *ring = &thread->ring;
+
+	bool sync;
+	switch (ent->op) {
+	case IOQ_CLOSE:
+		sync = false;
+		break;
+	case IOQ_OPENDIR:
+#if BFS_USE_STATX
+	case IOQ_STAT:
+#endif
+		// Cancelled requests are handled immediately
+		sync = load(&ioq->cancel, relaxed);
+		break;
+	default:
+		// No io_uring equivalent
+		sync = true;
+		break;
+	}
+
+	if (sync) {
+		ioq_handle(ioq, ent);
+		return false;
+	}
+
+	struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+	bfs_assert(sqe, "io_uring submission queue overflow");
+
+	switch (ent->op) {
+	case IOQ_CLOSE:
+		io_uring_prep_close(sqe, ent->close.fd);
+		break;
+
+	case IOQ_OPENDIR: {
+		struct ioq_opendir *args = &ent->opendir;
+		io_uring_prep_openat(sqe, args->dfd, args->path, O_RDONLY | O_CLOEXEC | O_DIRECTORY, 0);
+		break;
+	}
+
+#if BFS_USE_STATX
+	case IOQ_STAT: {
+		struct ioq_stat *args = &ent->stat;
+		int flags = bfs_statx_flags(args->flags, args->fields);
+		unsigned int mask = bfs_statx_mask(args->fields);
+		io_uring_prep_statx(sqe, args->dfd, args->path, flags, mask, &slot->xbuf);
+		break;
+	}
+#endif
+
+	default:
+		bfs_bug("Unknown ioq_op %d", (int)ent->op);
+		break;
+	}
+
+	slot->ent = ent;
+	io_uring_sqe_set_data(sqe, slot);
+	return true;
+}
+
+/** Handle an io_uring completion. */
+static struct ioq_ent *ioq_ring_reap(struct ioq *ioq, struct io_uring_cqe *cqe) {
+	struct ioq_ring_slot *slot = io_uring_cqe_get_data(cqe);
+	struct ioq_ent *ent = slot->ent;
+	bool cancel = load(&ioq->cancel, relaxed);
+
+	ent->ret = cqe->res < 0 ? -1 : cqe->res;
+	if (cqe->res < 0) {
+		errno = -cqe->res;
+	}
+
+	switch (ent->op) {
+	case IOQ_OPENDIR:
+		if (ent->ret >= 0) {
+			struct ioq_opendir *args = &ent->opendir;
+			int fd = ent->ret;
+			ent->ret = bfs_opendir(args->dir, fd, NULL);
+			if (ent->ret == 0) {
+				if (args->poll) {
 					bfs_polldir(args->dir);
 				}
+			} else {
+				close_quietly(fd);
 			}
-			break;
+		}
+		break;
 
-		case IOQ_CLOSEDIR:
-			ent->ret = bfs_closedir(ent->closedir.dir);
+#if BFS_USE_STATX
+	case IOQ_STAT: {
+		struct ioq_stat *args = &ent->stat;
+		if (ent->ret == 0) {
+			ent->ret = bfs_statx_convert(&slot->xbuf, args->fields, args->buf);
 			break;
+		}
 
-		default:
-			bfs_bug("Unknown ioq_op %d", (int)ent->op);
-			errno = ENOSYS;
-			break;
+		// Let bfs_stat() handle the BFS_STAT_TRYFOLLOW and unsupported
+		// statx() fallbacks
+		bool tryfollow = (args->flags & BFS_STAT_TRYFOLLOW) && is_nonexistence_error(errno);
+		bool unsupported = errno == ENOSYS || errno == EPERM || errno == EINVAL;
+		if (!cancel && (tryfollow || unsupported)) {
+			ent->ret = bfs_stat_fields(args->dfd, args->path, args->flags, args->fields, args->buf);
 		}
+		break;
+	}
+#endif
+
+	default:
+		break;
+	}
+
+	ioq_complete(ent, cancel);
+	return ent;
+}
+
+/** io_uring background thread loop. */
+static void ioq_ring_work(struct ioq_thread *thread) {
+	struct ioq *ioq = thread->parent;
+	struct io_uring *ring = &thread->ring;
+
+	struct ioq_ent *batch[IOQ_RING_ENTRIES];
+
+	bool stop = false;
+	while (!stop) {
+		ioq_thread_park(thread);
+
+		// Block until we have at least one request, then grab as many as we can
+		size_t count = ioqq_pop_batch(ioq->pending, batch, IOQ_RING_ENTRIES);
+		uint64_t start = ioq_busy_start(ioq);
+
+		size_t nsqes = 0, ndone = 0;
+		for (size_t i = 0; i < count; ++i) {
+			struct ioq_ent *ent = batch[i];
+			if (ent == &IOQ_STOP) {
+				if (stop) {
+					// Leave the extra stop commands for the other threads
+					ioqq_push(ioq->pending, ent);
+				}
+				stop = true;
+			} else if (ioq_ring_prep(thread, &thread->slots[nsqes], ent)) {
+				++nsqes;
+			} else {
+				batch[ndone++] = ent;
+			}
+		}
+
+		int ret;
+		if (nsqes > 0) {
+			do {
+				ret = io_uring_submit_and_wait(ring, nsqes);
+			} while (ret == -EINTR);
+		}
+
+		for (size_t i = 0; i < nsqes; ++i) {
+			struct io_uring_cqe *cqe;
+			do {
+				ret = io_uring_wait_cqe(ring, &cqe);
+			} while (ret == -EINTR);
+			bfs_verify(ret == 0, "io_uring_wait_cqe(): %s", strerror(-ret));
 
-		if (cancel) {
-			ent->error = EINTR;
-		} else if (ent->ret < 0) {
-			ent->error = errno;
-		} else {
-			ent->error = 0;
+			batch[ndone++] = ioq_ring_reap(ioq, cqe);
+			io_uring_cqe_seen(ring, cqe);
 		}
 
-		ioqq_push(ioq->ready, ent);
+		ioq_busy_stop(thread, start);
+		ioq_ready_push(thread, batch, ndone);
 	}
+}
+
+#endif // BFS_USE_LIBURING
+
+/** Background thread entry point. */
+static void *ioq_work(void *ptr) {
+	struct ioq_thread *thread = ptr;
 
+#if BFS_USE_LIBURING
+	if (thread->ring_ok) {
+		ioq_ring_work(thread);
+		return NULL;
+	}
+#endif
+
+	ioq_sync_work(thread);
 	return NULL;
 }
 
-struct ioq *ioq_create(size_t depth, size_t nthreads) {
+struct ioq *ioq_create(size_t depth, size_t nthreads, size_t nfds) {
 	struct ioq *ioq = ZALLOC_FLEX(struct ioq, threads, nthreads);
 	if (!ioq) {
 		goto fail;
@@ -365,14 +1038,45 @@ struct ioq *ioq_create(size_t depth, size_t nthreads) {
 	if (!ioq->pending) {
 		goto fail;
 	}
+	ioq->pending->wait_event = PERF_IOQ_IDLE;
+
+	atomic_init(&ioq->waiting, false);
+	if (ioq_monitor_init(&ioq->monitor) != 0) {
+		goto fail;
+	}
+	ioq->monitor_ok = true;
 
-	ioq->ready = ioqq_create(depth);
-	if (!ioq->ready) {
+	atomic_init(&ioq->timed, false);
+	atomic_init(&ioq->nactive, nthreads);
+	if (ioq_monitor_init(&ioq->park) != 0) {
 		goto fail;
 	}
+	ioq->park_ok = true;
 
 	for (size_t i = 0; i < nthreads; ++i) {
-		if (thread_create(&ioq->threads[i], NULL, ioq_work, ioq) != 0) {
+		struct ioq_thread *thread = &ioq->threads[i];
+		thread->parent = ioq;
+		thread->index = i;
+		atomic_init(&thread->busy, 0);
+
+		thread->ready = ioq_spsc_create(depth);
+		if (!thread->ready) {
+			goto fail;
+		}
+
+#if BFS_USE_LIBURING
+		if (i < nfds) {
+			ioq_ring_init(ioq, thread);
+		}
+#endif
+
+		if (thread_create(&thread->id, NULL, ioq_work, thread) != 0) {
+#if BFS_USE_LIBURING
+			if (thread->ring_ok) {
+				io_uring_queue_exit(&thread->ring);
+			}
+#endif
+			free(thread->ready);
 			goto fail;
 		}
 		++ioq->nthreads;
@@ -388,10 +1092,145 @@ fail:
 	return NULL;
 }
 
+/** Change the number of active threads. */
+static void ioq_set_active(struct ioq *ioq, size_t nactive) {
+	struct ioq_monitor *monitor = &ioq->park;
+	mutex_lock(&monitor->mutex);
+	size_t prev = exchange(&ioq->nactive, nactive, relaxed);
+	mutex_unlock(&monitor->mutex);
+
+	if (nactive > prev) {
+		cond_broadcast(&monitor->cond);
+	}
+}
+
+void ioq_autotune(struct ioq *ioq, size_t min) {
+	struct ioq_tuner *tuner = &ioq->tuner;
+	bfs_assert(ioq->size == 0);
+
+	if (min < 1) {
+		min = 1;
+	}
+	if (min >= ioq->nthreads) {
+		return;
+	}
+
+	*tuner = (struct ioq_tuner) {
+		.enabled = true,
+		.min = min,
+		.nactive = min,
+		.start = perf_now(),
+	};
+
+	store(&ioq->timed, true, relaxed);
+	ioq_set_active(ioq, min);
+}
+
+/** Sum up the time the threads have spent handling requests. */
+static uint64_t ioq_busy_total(const struct ioq *ioq) {
+	uint64_t total = 0;
+	for (size_t i = 0; i < ioq->nthreads; ++i) {
+		total += load(&ioq->threads[i].busy, relaxed);
+	}
+	return total;
+}
+
+/**
+ * Account for some completions, and resize the thread pool if it's time.
+ *
+ * The active threads are grown when the consumer is mostly waiting on them
+ * and they are mostly busy (e.g. slow network file systems), and shrunk when
+ * they are mostly idle (e.g. a fast local disk that the consumer can't keep
+ * up with), to avoid needless contention.  A grow that doesn't improve
+ * throughput is undone.
+ */
+static void ioq_tune(struct ioq *ioq, size_t count) {
+	struct ioq_tuner *tuner = &ioq->tuner;
+	if (!tuner->enabled) {
+		return;
+	}
+
+	tuner->done += count;
+	if (tuner->done % IOQ_TUNE_OPS >= count) {
+		return;
+	}
+
+	uint64_t now = perf_now();
+	uint64_t elapsed = now - tuner->start;
+	if (elapsed < IOQ_TUNE_NS) {
+		return;
+	}
+
+	size_t nactive = tuner->nactive;
+	uint64_t total = ioq_busy_total(ioq);
+	uint64_t busy = 100 * (total - tuner->busy) / (elapsed * nactive);
+	uint64_t wait = 100 * tuner->wait / elapsed;
+	uint64_t rate = (uint64_t)tuner->done * 1000000000 / elapsed;
+
+	size_t target = nactive;
+	if (tuner->grew && rate <= tuner->rate) {
+		// Growing didn't help, so put it back
+		target = tuner->prev;
+		tuner->hold = IOQ_TUNE_HOLD;
+	} else if (busy < 40) {
+		target -= (nactive + 3) / 4;
+	} else if (wait > 25 && busy > 75 && tuner->hold == 0) {
+		tuner->prev = nactive;
+		target += (nactive + 1) / 2;
+	} else if (tuner->hold > 0) {
+		--tuner->hold;
+	}
+
+	if (target < tuner->min) {
+		target = tuner->min;
+	} else if (target > ioq->nthreads) {
+		target = ioq->nthreads;
+	}
+
+	tuner->grew = target > nactive;
+	if (target > nactive) {
+		perf_count(PERF_IOQ_GROW, target - nactive);
+	} else if (target < nactive) {
+		perf_count(PERF_IOQ_SHRINK, nactive - target);
+	}
+	if (target != nactive) {
+		tuner->nactive = target;
+		ioq_set_active(ioq, target);
+	}
+
+	tuner->start = now;
+	tuner->busy = total;
+	tuner->wait = 0;
+	tuner->done = 0;
+	tuner->rate = rate;
+}
+
 size_t ioq_capacity(const struct ioq *ioq) {
 	return ioq->depth - ioq->size;
 }
 
+size_t ioq_nfds(const struct ioq *ioq) {
+	size_t ret = 0;
+
+#if BFS_USE_LIBURING
+	for (size_t i = 0; i < ioq->nthreads; ++i) {
+		if (ioq->threads[i].ring_ok) {
+			++ret;
+		}
+	}
+#endif
+
+	return ret;
+}
+
+void ioq_submit_batch(struct ioq *ioq) {
+	if (ioq->nbatch > 0) {
+		ioqq_push_batch(ioq->pending, ioq->batch, ioq->nbatch);
+		perf_count(PERF_IOQ_SUBMIT, ioq->nbatch);
+		ioq->nbatch = 0;
+	}
+}
+
 static struct ioq_ent *ioq_request(struct ioq *ioq, enum ioq_op op, void *ptr) {
 	if (load(&ioq->cancel, relaxed)) {
 		errno = EINTR;
@@ -414,6 +1253,14 @@ static struct ioq_ent *ioq_request(struct ioq *ioq, enum ioq_op op, void *ptr) {
 	return ent;
 }
 
+/** Add a request to the current batch. */
+static void ioq_batch_push(struct ioq *ioq, struct ioq_ent *ent) {
+	ioq->batch[ioq->nbatch++] = ent;
+	if (ioq->nbatch == IOQ_BATCH) {
+		ioq_submit_batch(ioq);
+	}
+}
+
 int ioq_close(struct ioq *ioq, int fd, void *ptr) {
 	struct ioq_ent *ent = ioq_request(ioq, IOQ_CLOSE, ptr);
 	if (!ent) {
@@ -422,11 +1269,11 @@ int ioq_close(struct ioq *ioq, int fd, void *ptr) {
 
 	ent->close.fd = fd;
 
-	ioqq_push(ioq->pending, ent);
+	ioq_batch_push(ioq, ent);
 	return 0;
 }
 
-int ioq_opendir(struct ioq *ioq, struct bfs_dir *dir, int dfd, const char *path, void *ptr) {
+int ioq_opendir(struct ioq *ioq, struct bfs_dir *dir, int dfd, const char *path, bool poll, void *ptr) {
 	struct ioq_ent *ent = ioq_request(ioq, IOQ_OPENDIR, ptr);
 	if (!ent) {
 		return -1;
@@ -436,8 +1283,9 @@ int ioq_opendir(struct ioq *ioq, struct bfs_dir *dir, int dfd, const char *path,
 	args->dir = dir;
 	args->dfd = dfd;
 	args->path = path;
+	args->poll = poll;
 
-	ioqq_push(ioq->pending, ent);
+	ioq_batch_push(ioq, ent);
 	return 0;
 }
 
@@ -449,16 +1297,162 @@ int ioq_closedir(struct ioq *ioq, struct bfs_dir *dir, void *ptr) {
 
 	ent->closedir.dir = dir;
 
-	ioqq_push(ioq->pending, ent);
+	ioq_batch_push(ioq, ent);
+	return 0;
+}
+
+int ioq_readdir(struct ioq *ioq, struct bfs_dir *dir, void *ptr) {
+	struct ioq_ent *ent = ioq_request(ioq, IOQ_READDIR, ptr);
+	if (!ent) {
+		return -1;
+	}
+
+	ent->readdir.dir = dir;
+
+	ioq_batch_push(ioq, ent);
+	return 0;
+}
+
+int ioq_stat(struct ioq *ioq, int dfd, const char *path, enum bfs_stat_flags flags, enum bfs_stat_field fields, struct bfs_stat *buf, void *ptr) {
+	struct ioq_ent *ent = ioq_request(ioq, IOQ_STAT, ptr);
+	if (!ent) {
+		return -1;
+	}
+
+	struct ioq_stat *args = &ent->stat;
+	args->dfd = dfd;
+	args->path = path;
+	args->flags = flags;
+	args->fields = fields;
+	args->buf = buf;
+
+	ioq_batch_push(ioq, ent);
+	return 0;
+}
+
+int ioq_xattrs(struct ioq *ioq, int dfd, const char *path, enum bfs_stat_flags flags, struct bfs_xattrs *buf, void *ptr) {
+	struct ioq_ent *ent = ioq_request(ioq, IOQ_XATTRS, ptr);
+	if (!ent) {
+		return -1;
+	}
+
+	struct ioq_xattrs *args = &ent->xattrs;
+	args->dfd = dfd;
+	args->path = path;
+	args->flags = flags;
+	args->buf = buf;
+
+	ioq_batch_push(ioq, ent);
+	return 0;
+}
+
+int ioq_readlink(struct ioq *ioq, int dfd, const char *path, size_t size, void *ptr) {
+	struct ioq_ent *ent = ioq_request(ioq, IOQ_READLINK, ptr);
+	if (!ent) {
+		return -1;
+	}
+
+	struct ioq_readlink *args = &ent->readlink;
+	args->dfd = dfd;
+	args->path = path;
+	args->size = size;
+	args->target = NULL;
+
+	ioq_batch_push(ioq, ent);
+	return 0;
+}
+
+int ioq_unlink(struct ioq *ioq, int dfd, const char *path, int flags, void *ptr) {
+	struct ioq_ent *ent = ioq_request(ioq, IOQ_UNLINK, ptr);
+	if (!ent) {
+		return -1;
+	}
+
+	struct ioq_unlink *args = &ent->unlink;
+	args->dfd = dfd;
+	args->path = path;
+	args->flags = flags;
+
+	ioq_batch_push(ioq, ent);
+	return 0;
+}
+
+int ioq_call(struct ioq *ioq, ioq_fn *fn, void *arg, void *ptr) {
+	struct ioq_ent *ent = ioq_request(ioq, IOQ_CALL, ptr);
+	if (!ent) {
+		return -1;
+	}
+
+	struct ioq_call *args = &ent->call;
+	args->fn = fn;
+	args->arg = arg;
+
+	ioq_batch_push(ioq, ent);
 	return 0;
 }
 
+/** Collect responses from the background threads' rings, round-robin. */
+static size_t ioq_ready_trypop(struct ioq *ioq, struct ioq_ent *batch[], size_t size) {
+	size_t count = 0;
+
+	for (size_t i = 0; i < ioq->nthreads && count < size; ++i) {
+		struct ioq_thread *thread = &ioq->threads[ioq->next_ready];
+		count += ioq_spsc_pop(thread->ready, batch + count, size - count);
+
+		if (++ioq->next_ready == ioq->nthreads) {
+			ioq->next_ready = 0;
+		}
+	}
+
+	return count;
+}
+
+/** Pop responses, optionally blocking until there is at least one. */
+static size_t ioq_ready_pop(struct ioq *ioq, struct ioq_ent *batch[], size_t size, bool block) {
+	size_t count = ioq_ready_trypop(ioq, batch, size);
+	if (count > 0 || !block) {
+		return count;
+	}
+
+	struct ioq_monitor *monitor = &ioq->monitor;
+	mutex_lock(&monitor->mutex);
+
+	uint64_t start = ioq->tuner.enabled ? perf_now() : perf_start();
+	while (true) {
+		// Pairs with ioq_spsc_push(): either we see its entries, or it
+		// sees that we're waiting
+		store(&ioq->waiting, true, seq_cst);
+		count = ioq_ready_trypop(ioq, batch, size);
+		if (count > 0) {
+			break;
+		}
+		cond_wait(&monitor->cond, &monitor->mutex);
+	}
+
+	if (start) {
+		uint64_t ns = perf_now() - start;
+		ioq->tuner.wait += ns;
+		if (perf_enabled) {
+			perf_record(PERF_IOQ_WAIT, 1, ns);
+		}
+	}
+
+	store(&ioq->waiting, false, relaxed);
+	mutex_unlock(&monitor->mutex);
+	return count;
+}
+
 struct ioq_ent *ioq_pop(struct ioq *ioq) {
 	if (ioq->size == 0) {
 		return NULL;
 	}
 
-	return ioqq_pop(ioq->ready);
+	ioq_submit_batch(ioq);
+
+	struct ioq_ent *ent;
+	ioq_ready_pop(ioq, &ent, 1, true);
+	ioq_tune(ioq, 1);
+	return ent;
 }
 
 struct ioq_ent *ioq_trypop(struct ioq *ioq) {
@@ -466,7 +1460,27 @@ struct ioq_ent *ioq_trypop(struct ioq *ioq) {
 		return NULL;
 	}
 
-	return ioqq_trypop(ioq->ready);
+	ioq_submit_batch(ioq);
+
+	struct ioq_ent *ent;
+	if (ioq_ready_pop(ioq, &ent, 1, false) == 0) {
+		return NULL;
+	}
+
+	ioq_tune(ioq, 1);
+	return ent;
+}
+
+size_t ioq_pop_batch(struct ioq *ioq, struct ioq_ent *batch[], size_t size, bool block) {
+	if (ioq->size == 0 || size == 0) {
+		return 0;
+	}
+
+	ioq_submit_batch(ioq);
+
+	size_t count = ioq_ready_pop(ioq, batch, size, block);
+	ioq_tune(ioq, count);
+	return count;
 }
 
 void ioq_free(struct ioq *ioq, struct ioq_ent *ent) {
@@ -478,6 +1492,15 @@ void ioq_free(struct ioq *ioq, struct ioq_ent *ent) {
 
 void ioq_cancel(struct ioq *ioq) {
 	if (!exchange(&ioq->cancel, true, relaxed)) {
+		// Make sure the buffered requests come before the stop commands
+		ioq_submit_batch(ioq);
+
+		// Every thread needs to be awake to see its stop command
+		ioq->tuner.enabled = false;
+		if (ioq->nthreads > 0) {
+			ioq_set_active(ioq, ioq->nthreads);
+		}
+
 		for (size_t i = 0; i < ioq->nthreads; ++i) {
 			ioqq_push(ioq->pending, &IOQ_STOP);
 		}
@@ -492,11 +1515,27 @@ void ioq_destroy(struct ioq *ioq) {
 	ioq_cancel(ioq);
 
 	for (size_t i = 0; i < ioq->nthreads; ++i) {
-		thread_join(ioq->threads[i], NULL);
+		struct ioq_thread *thread = &ioq->threads[i];
+		thread_join(thread->id, NULL);
+
+#if BFS_USE_LIBURING
+		if (thread->ring_ok) {
+			io_uring_queue_exit(&thread->ring);
+		}
+#endif
+
+		free(thread->ready);
 	}
 
-	ioqq_destroy(ioq->ready);
-	ioqq_destroy(ioq->pending);
+	if (ioq->park_ok) {
+		ioq_monitor_destroy(&ioq->park);
+	}
+	if (ioq->monitor_ok) {
+		ioq_monitor_destroy(&ioq->monitor);
+	}
+	if (ioq->pending) {
+		ioqq_destroy(ioq->pending);
+	}
 
 	arena_destroy(&ioq->ents);
 
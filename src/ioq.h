@@ -8,6 +8,8 @@
 #ifndef BFS_IOQ_H
 #define BFS_IOQ_H
 
+#include "fsade.h"
+#include "stat.h"
 #include <stddef.h>
 
 /**
@@ -25,8 +27,30 @@ enum ioq_op {
 	IOQ_OPENDIR,
 	/** ioq_closedir(). */
 	IOQ_CLOSEDIR,
+	/** ioq_readdir(). */
+	IOQ_READDIR,
+	/** ioq_stat(). */
+	IOQ_STAT,
+	/** ioq_xattrs(). */
+	IOQ_XATTRS,
+	/** ioq_readlink(). */
+	IOQ_READLINK,
+	/** ioq_unlink(). */
+	IOQ_UNLINK,
+	/** ioq_call(). */
+	IOQ_CALL,
 };
 
+/**
+ * A function to run in the background with ioq_call().
+ *
+ * @param arg
+ *         The argument passed to ioq_call().
+ * @return
+ *         The return value of the operation.
+ */
+typedef int ioq_fn(void *arg);
+
 /**
  * An I/O queue entry.
  */
@@ -53,11 +77,49 @@ struct ioq_ent {
 			struct bfs_dir *dir;
 			int dfd;
 			const char *path;
+			bool poll;
 		} opendir;
 		/** ioq_closedir() args. */
 		struct ioq_closedir {
 			struct bfs_dir *dir;
 		} closedir;
+		/** ioq_readdir() args. */
+		struct ioq_readdir {
+			struct bfs_dir *dir;
+		} readdir;
+		/** ioq_stat() args. */
+		struct ioq_stat {
+			int dfd;
+			const char *path;
+			enum bfs_stat_flags flags;
+			enum bfs_stat_field fields;
+			struct bfs_stat *buf;
+		} stat;
+		/** ioq_xattrs() args. */
+		struct ioq_xattrs {
+			int dfd;
+			const char *path;
+			enum bfs_stat_flags flags;
+			struct bfs_xattrs *buf;
+		} xattrs;
+		/** ioq_readlink() args. */
+		struct ioq_readlink {
+			int dfd;
+			const char *path;
+			size_t size;
+			char *target;
+		} readlink;
+		/** ioq_unlink() args. */
+		struct ioq_unlink {
+			int dfd;
+			const char *path;
+			int flags;
+		} unlink;
+		/** ioq_call() args. */
+		struct ioq_call {
+			ioq_fn *fn;
+			void *arg;
+		} call;
 	};
 };
 
@@ -68,16 +130,37 @@ struct ioq_ent {
  *         The maximum depth of the queue.
  * @param nthreads
  *         The maximum number of background threads.
+ * @param nfds
+ *         The maximum number of file descriptors the queue may use internally
+ *         (e.g. for io_uring instances).
  * @return
  *         The new I/O queue, or NULL on failure.
  */
-struct ioq *ioq_create(size_t depth, size_t nthreads);
+struct ioq *ioq_create(size_t depth, size_t nthreads, size_t nfds);
+
+/**
+ * Let a queue adjust how many of its threads take requests, based on how long
+ * each request takes and how long the consumer spends waiting for them.  The
+ * remaining threads sleep until they are needed.
+ *
+ * @param ioq
+ *         The I/O queue, which must not have any requests yet.
+ * @param min
+ *         The minimum number of active threads (at least 1).  The queue starts
+ *         with this many, and grows as far as the nthreads it was created with.
+ */
+void ioq_autotune(struct ioq *ioq, size_t min);
 
 /**
  * Check the remaining capacity of a queue.
  */
 size_t ioq_capacity(const struct ioq *ioq);
 
+/**
+ * Get the number of file descriptors used internally by a queue.
+ */
+size_t ioq_nfds(const struct ioq *ioq);
+
 /**
  * Asynchronous close().
  *
@@ -103,12 +186,14 @@ int ioq_close(struct ioq *ioq, int fd, void *ptr);
  *         The base file descriptor.
  * @param path
  *         The path to open, relative to dfd.
+ * @param poll
+ *         Whether to read the first batch of entries too.
  * @param ptr
  *         An arbitrary pointer to associate with the request.
  * @return
  *         0 on success, or -1 on failure.
  */
-int ioq_opendir(struct ioq *ioq, struct bfs_dir *dir, int dfd, const char *path, void *ptr);
+int ioq_opendir(struct ioq *ioq, struct bfs_dir *dir, int dfd, const char *path, bool poll, void *ptr);
 
 /**
  * Asynchronous bfs_closedir().
@@ -124,6 +209,127 @@ int ioq_opendir(struct ioq *ioq, struct bfs_dir *dir, int dfd, const char *path,
  */
 int ioq_closedir(struct ioq *ioq, struct bfs_dir *dir, void *ptr);
 
+/**
+ * Asynchronous bfs_polldir(), to fill a directory's buffer in the background.
+ * Typically used with bfs_readahead().
+ *
+ * @param ioq
+ *         The I/O queue.
+ * @param dir
+ *         The directory to read.
+ * @param ptr
+ *         An arbitrary pointer to associate with the request.
+ * @return
+ *         0 on success, or -1 on failure.
+ */
+int ioq_readdir(struct ioq *ioq, struct bfs_dir *dir, void *ptr);
+
+/**
+ * Asynchronous bfs_stat().
+ *
+ * @param ioq
+ *         The I/O queue.
+ * @param dfd
+ *         The base file descriptor.
+ * @param path
+ *         The path to stat, relative to dfd.
+ * @param flags
+ *         Flags that affect the lookup.
+ * @param fields
+ *         The bfs_stat fields that are needed.
+ * @param buf
+ *         A place to store the stat buffer, if successful.
+ * @param ptr
+ *         An arbitrary pointer to associate with the request.
+ * @return
+ *         0 on success, or -1 on failure.
+ */
+int ioq_stat(struct ioq *ioq, int dfd, const char *path, enum bfs_stat_flags flags, enum bfs_stat_field fields, struct bfs_stat *buf, void *ptr);
+
+/**
+ * Asynchronous bfs_read_xattrs().
+ *
+ * @param ioq
+ *         The I/O queue.
+ * @param dfd
+ *         The base file descriptor.
+ * @param path
+ *         The path to the file, relative to dfd.
+ * @param flags
+ *         Flags that affect the lookup.
+ * @param buf
+ *         A place to store the attribute names, if successful.
+ * @param ptr
+ *         An arbitrary pointer to associate with the request.
+ * @return
+ *         0 on success, or -1 on failure.
+ */
+int ioq_xattrs(struct ioq *ioq, int dfd, const char *path, enum bfs_stat_flags flags, struct bfs_xattrs *buf, void *ptr);
+
+/**
+ * Asynchronous xreadlinkat().
+ *
+ * @param ioq
+ *         The I/O queue.
+ * @param dfd
+ *         The base file descriptor.
+ * @param path
+ *         The path to the link, relative to dfd.
+ * @param size
+ *         The size of the link target, if known, otherwise 0.
+ * @param ptr
+ *         An arbitrary pointer to associate with the request.
+ * @return
+ *         0 on success, or -1 on failure.  If the request succeeds, the
+ *         target is returned in ent->readlink.target and must be free()d.
+ */
+int ioq_readlink(struct ioq *ioq, int dfd, const char *path, size_t size, void *ptr);
+
+/**
+ * Asynchronous unlinkat().
+ *
+ * @param ioq
+ *         The I/O queue.
+ * @param dfd
+ *         The base file descriptor.
+ * @param path
+ *         The path to remove, relative to dfd.
+ * @param flags
+ *         Flags for unlinkat(), e.g. AT_REMOVEDIR to remove a directory.
+ * @param ptr
+ *         An arbitrary pointer to associate with the request.
+ * @return
+ *         0 on success, or -1 on failure.
+ */
+int ioq_unlink(struct ioq *ioq, int dfd, const char *path, int flags, void *ptr);
+
+/**
+ * Run an arbitrary function in a background thread.  The function may run
+ * concurrently with other requests, so it must be thread-safe.
+ *
+ * @param ioq
+ *         The I/O queue.
+ * @param fn
+ *         The function to call.
+ * @param arg
+ *         The argument to pass to fn.
+ * @param ptr
+ *         An arbitrary pointer to associate with the request.
+ * @return
+ *         0 on success, or -1 on failure.
+ */
+int ioq_call(struct ioq *ioq, ioq_fn *fn, void *arg, void *ptr);
+
+/**
+ * Submit any buffered requests.  Requests are batched to reduce contention on
+ * the queue, and are automatically submitted when enough of them accumulate,
+ * or when popping responses.  Call this to start them early.
+ *
+ * @param ioq
+ *         The I/O queue.
+ */
+void ioq_submit_batch(struct ioq *ioq);
+
 /**
  * Pop a response from the queue.
  *
@@ -144,6 +350,22 @@ struct ioq_ent *ioq_pop(struct ioq *ioq);
  */
 struct ioq_ent *ioq_trypop(struct ioq *ioq);
 
+/**
+ * Pop a batch of responses from the queue.
+ *
+ * @param ioq
+ *         The I/O queue.
+ * @param[out] batch
+ *         An array to hold the responses.
+ * @param size
+ *         The maximum number of responses to pop.
+ * @param block
+ *         Whether to wait for at least one response.
+ * @return
+ *         The number of responses popped.
+ */
+size_t ioq_pop_batch(struct ioq *ioq, struct ioq_ent *batch[], size_t size, bool block);
+
 /**
  * Free a queue entry.
  *
@@ -21,6 +21,7 @@
  *
  * - Utilities:
  *     - alloc.[ch]    (memory allocation)
+ *     - ascii.[ch]    (vectorized ASCII string operations)
  *     - atomic.h      (atomic operations)
  *     - bar.[ch]      (a terminal status bar)
  *     - bit.h         (bit manipulation)
@@ -31,16 +32,22 @@
  *     - diag.[ch]     (formats diagnostic messages)
  *     - dir.[ch]      (a directory API facade)
  *     - dstring.[ch]  (a dynamic string library)
+ *     - fnset.[ch]    (sets of fnmatch() patterns)
  *     - fsade.[ch]    (a facade over non-standard filesystem features)
+ *     - idset.[ch]    (hash sets of file IDs)
+ *     - index.[ch]    (a persistent index of directory listings)
  *     - ioq.[ch]      (an async I/O queue)
  *     - list.h        (linked list macros)
  *     - mtab.[ch]     (parses the system's mount table)
+ *     - perf.[ch]     (performance counters for -D perf)
+ *     - profile.[ch]  (expression profiles for -profile)
  *     - pwcache.[ch]  (a cache for the user/group tables)
  *     - sanity.h      (sanitizer interfaces)
  *     - stat.[ch]     (wraps stat(), or statx() on Linux)
  *     - thread.h      (multi-threading)
  *     - trie.[ch]     (a trie set/map implementation)
  *     - typo.[ch]     (fuzzy matching for typos)
+ *     - watch.[ch]    (change notifications for -watch)
  *     - xregex.[ch]   (regular expression support)
  *     - xspawn.[ch]   (spawns processes)
  *     - xtime.[ch]    (date/time handling utilities)
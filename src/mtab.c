@@ -14,6 +14,11 @@
 #include <string.h>
 #include <sys/types.h>
 
+#if __linux__
+#  include <poll.h>
+#  include <stdio.h>
+#endif
+
 #if !defined(BFS_USE_MNTENT) && BFS_USE_MNTENT_H
 #  define BFS_USE_MNTENT true
 #elif !defined(BFS_USE_MNTINFO) && BSD
@@ -42,6 +47,10 @@ struct bfs_mtab_entry {
 	char *path;
 	/** The filesystem type. */
 	char *type;
+	/** The device ID of the mounted filesystem, if known. */
+	dev_t dev;
+	/** Whether dev is known. */
+	bool has_dev;
 };
 
 struct bfs_mtab {
@@ -54,15 +63,25 @@ struct bfs_mtab {
 	struct trie types;
 	/** Whether the types map has been populated. */
 	bool types_filled;
+
+#if __linux__
+	/** /proc/self/mountinfo, kept open by bfs_mtab_refresh() to poll() for changes. */
+	FILE *mountinfo;
+#endif
 };
 
 /**
  * Add an entry to the mount table.
+ *
+ * @param dev
+ *         The device ID of the mounted filesystem, or NULL if unknown.
  */
-static inline int bfs_mtab_add(struct bfs_mtab *mtab, const char *path, const char *type) {
+static inline int bfs_mtab_add(struct bfs_mtab *mtab, const char *path, const char *type, const dev_t *dev) {
 	struct bfs_mtab_entry entry = {
 		.path = strdup(path),
 		.type = strdup(type),
+		.dev = dev ? *dev : 0,
+		.has_dev = dev,
 	};
 
 	if (!entry.path || !entry.type) {
@@ -87,7 +106,117 @@ fail:
 	return -1;
 }
 
-struct bfs_mtab *bfs_mtab_parse(void) {
+#if __linux__
+
+/** Decode the octal escapes (like \040 for ' ') in a mountinfo field. */
+static void bfs_mtab_unescape(char *str) {
+	char *out = str;
+	for (const char *in = str; *in; ++in) {
+		if (in[0] == '\\'
+		    && in[1] >= '0' && in[1] <= '3'
+		    && in[2] >= '0' && in[2] <= '7'
+		    && in[3] >= '0' && in[3] <= '7') {
+			*out++ = ((in[1] - '0') << 6) | ((in[2] - '0') << 3) | (in[3] - '0');
+			in += 3;
+		} else {
+			*out++ = *in;
+		}
+	}
+	*out = '\0';
+}
+
+/**
+ * Parse a line of /proc/self/mountinfo, e.g.
+ *
+ *     36 35 98:0 /mnt1 /mnt/parent rw,noatime master:1 - ext3 /dev/root rw
+ *
+ * The third field is the device ID, the fifth is the mount point, and the
+ * filesystem type comes after the variable-length list of optional fields,
+ * which is terminated by "-".
+ */
+static int bfs_mtab_parse_mountinfo_line(struct bfs_mtab *mtab, char *line) {
+	const char *devstr = NULL;
+	char *path = NULL;
+	char *type = NULL;
+
+	bool sep = false;
+	char *saveptr;
+	char *field = strtok_r(line, " \n", &saveptr);
+	for (size_t i = 0; field; ++i, field = strtok_r(NULL, " \n", &saveptr)) {
+		if (i == 2) {
+			devstr = field;
+		} else if (i == 4) {
+			path = field;
+		} else if (i > 5 && !sep) {
+			sep = strcmp(field, "-") == 0;
+		} else if (sep) {
+			type = field;
+			break;
+		}
+	}
+
+	unsigned int major, minor;
+	if (!devstr || !path || !type || sscanf(devstr, "%u:%u", &major, &minor) != 2) {
+		// Skip malformed lines
+		return 0;
+	}
+
+	bfs_mtab_unescape(path);
+	bfs_mtab_unescape(type);
+	dev_t dev = xmakedev(major, minor);
+	return bfs_mtab_add(mtab, path, type, &dev);
+}
+
+/** Read the mount table from /proc/self/mountinfo. */
+static int bfs_mtab_read_mountinfo(struct bfs_mtab *mtab, FILE *file) {
+	if (fseek(file, 0, SEEK_SET) != 0) {
+		return -1;
+	}
+
+	int ret = 0;
+	char *line = NULL;
+	size_t size = 0;
+	while (getline(&line, &size, file) >= 0) {
+		ret = bfs_mtab_parse_mountinfo_line(mtab, line);
+		if (ret != 0) {
+			break;
+		}
+	}
+	if (ret == 0 && ferror(file)) {
+		ret = -1;
+	}
+
+	free(line);
+	return ret;
+}
+
+#endif // __linux__
+
+/** Compact the names trie once the mount table has been read. */
+static void bfs_mtab_freeze_names(struct bfs_mtab *mtab) {
+	// Failing to freeze just leaves the trie as it was
+	trie_freeze(&mtab->names);
+}
+
+/** Reset a mount table to empty. */
+static void bfs_mtab_clear(struct bfs_mtab *mtab) {
+	trie_destroy(&mtab->types);
+	trie_init(&mtab->types);
+	mtab->types_filled = false;
+
+	trie_destroy(&mtab->names);
+	trie_init(&mtab->names);
+
+	for (size_t i = 0; i < darray_length(mtab->entries); ++i) {
+		free(mtab->entries[i].type);
+		free(mtab->entries[i].path);
+	}
+	darray_free(mtab->entries);
+	mtab->entries = NULL;
+}
+
+/** Allocate an empty mount table. */
+static struct bfs_mtab *bfs_mtab_new(void) {
 	struct bfs_mtab *mtab = ZALLOC(struct bfs_mtab);
 	if (!mtab) {
 		return NULL;
@@ -95,6 +224,51 @@ struct bfs_mtab *bfs_mtab_parse(void) {
 
 	trie_init(&mtab->names);
 	trie_init(&mtab->types);
+	return mtab;
+}
+
+struct bfs_mtab *bfs_mtab_parse_mountinfo(FILE *file) {
+#if __linux__
+	struct bfs_mtab *mtab = bfs_mtab_new();
+	if (!mtab) {
+		return NULL;
+	}
+
+	if (bfs_mtab_read_mountinfo(mtab, file) != 0) {
+		int error = errno;
+		bfs_mtab_free(mtab);
+		errno = error;
+		return NULL;
+	}
+
+	bfs_mtab_freeze_names(mtab);
+	return mtab;
+#else
+	(void)file;
+	errno = ENOTSUP;
+	return NULL;
+#endif
+}
+
+struct bfs_mtab *bfs_mtab_parse(void) {
+#if __linux__
+	// mountinfo already has the device IDs, so bfs_fstype() doesn't need
+	// to stat() every mount point
+	FILE *mountinfo = xfopen("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC);
+	if (mountinfo) {
+		struct bfs_mtab *ret = bfs_mtab_parse_mountinfo(mountinfo);
+		int error = errno;
+		fclose(mountinfo);
+		errno = error;
+		return ret;
+	}
+	// Fall back to /etc/mtab if /proc isn't mounted
+#endif
+
+	struct bfs_mtab *mtab = bfs_mtab_new();
+	if (!mtab) {
+		return NULL;
+	}
 
 	int error = 0;
 
@@ -112,7 +286,7 @@ struct bfs_mtab *bfs_mtab_parse(void) {
 
 	struct mntent *mnt;
 	while ((mnt = getmntent(file))) {
-		if (bfs_mtab_add(mtab, mnt->mnt_dir, mnt->mnt_type) != 0) {
+		if (bfs_mtab_add(mtab, mnt->mnt_dir, mnt->mnt_type, NULL) != 0) {
 			error = errno;
 			endmntent(file);
 			goto fail;
@@ -137,7 +311,7 @@ struct bfs_mtab *bfs_mtab_parse(void) {
 	}
 
 	for (bfs_statfs *mnt = mntbuf; mnt < mntbuf + size; ++mnt) {
-		if (bfs_mtab_add(mtab, mnt->f_mntonname, mnt->f_fstypename) != 0) {
+		if (bfs_mtab_add(mtab, mnt->f_mntonname, mnt->f_fstypename, NULL) != 0) {
 			error = errno;
 			goto fail;
 		}
@@ -153,7 +327,7 @@ struct bfs_mtab *bfs_mtab_parse(void) {
 
 	struct mnttab mnt;
 	while (getmntent(file, &mnt) == 0) {
-		if (bfs_mtab_add(mtab, mnt.mnt_mountp, mnt.mnt_fstype) != 0) {
+		if (bfs_mtab_add(mtab, mnt.mnt_mountp, mnt.mnt_fstype, NULL) != 0) {
 			error = errno;
 			fclose(file);
 			goto fail;
@@ -169,6 +343,7 @@ struct bfs_mtab *bfs_mtab_parse(void) {
 
 #endif
 
+	bfs_mtab_freeze_names(mtab);
 	return mtab;
 
 fail:
@@ -195,6 +370,15 @@ static int bfs_mtab_fill_types(struct bfs_mtab *mtab) {
 
 	for (size_t i = 0; i < darray_length(mtab->entries); ++i) {
 		struct bfs_mtab_entry *entry = &mtab->entries[i];
+		if (entry->has_dev) {
+			struct trie_leaf *leaf = trie_insert_mem(&mtab->types, &entry->dev, sizeof(entry->dev));
+			if (!leaf) {
+				goto fail;
+			}
+			leaf->value = entry->type;
+			continue;
+		}
+
 		const char *path = entry->path;
 		int fd = AT_FDCWD;
 
@@ -245,6 +429,7 @@ static int bfs_mtab_fill_types(struct bfs_mtab *mtab) {
 	}
 
 	mtab->types_filled = true;
+	trie_freeze(&mtab->types);
 	ret = 0;
 
 fail:
@@ -256,13 +441,22 @@ fail:
 }
 
 const char *bfs_fstype(const struct bfs_mtab *mtab, const struct bfs_stat *statbuf) {
-	if (!mtab->types_filled) {
-		if (bfs_mtab_fill_types((struct bfs_mtab *)mtab) != 0) {
-			return NULL;
-		}
+	return bfs_dev_fstype(mtab, statbuf->dev);
+}
+
+int bfs_mtab_load_types(const struct bfs_mtab *mtab) {
+	if (mtab->types_filled) {
+		return 0;
 	}
+	return bfs_mtab_fill_types((struct bfs_mtab *)mtab);
+}
 
-	const struct trie_leaf *leaf = trie_find_mem(&mtab->types, &statbuf->dev, sizeof(statbuf->dev));
+const char *bfs_dev_fstype(const struct bfs_mtab *mtab, dev_t dev) {
+	if (bfs_mtab_load_types(mtab) != 0) {
+		return NULL;
+	}
+
+	const struct trie_leaf *leaf = trie_find_mem(&mtab->types, &dev, sizeof(dev));
 	if (leaf) {
 		return leaf->value;
 	} else {
@@ -275,16 +469,49 @@ bool bfs_might_be_mount(const struct bfs_mtab *mtab, const char *path) {
 	return trie_find_str(&mtab->names, name);
 }
 
+int bfs_mtab_refresh(struct bfs_mtab *mtab) {
+#if __linux__
+	if (mtab->mountinfo) {
+		// The kernel reports mount table changes as an exceptional condition
+		struct pollfd pfd = {
+			.fd = fileno(mtab->mountinfo),
+			.events = POLLPRI,
+		};
+		int ret = poll(&pfd, 1, 0);
+		if (ret < 0) {
+			return -1;
+		} else if (ret == 0 || !(pfd.revents & (POLLPRI | POLLERR))) {
+			return 0;
+		}
+	} else {
+		// Start watching, and catch up on anything since bfs_mtab_parse()
+		mtab->mountinfo = xfopen("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC);
+		if (!mtab->mountinfo) {
+			return errno == ENOENT ? 0 : -1;
+		}
+	}
+
+	bfs_mtab_clear(mtab);
+	if (bfs_mtab_read_mountinfo(mtab, mtab->mountinfo) != 0) {
+		return -1;
+	}
+	bfs_mtab_freeze_names(mtab);
+	return 1;
+#else
+	(void)mtab;
+	return 0;
+#endif
+}
+
 void bfs_mtab_free(struct bfs_mtab *mtab) {
 	if (mtab) {
-		trie_destroy(&mtab->types);
-		trie_destroy(&mtab->names);
+		bfs_mtab_clear(mtab);
 
-		for (size_t i = 0; i < darray_length(mtab->entries); ++i) {
-			free(mtab->entries[i].type);
-			free(mtab->entries[i].path);
+#if __linux__
+		if (mtab->mountinfo) {
+			fclose(mtab->mountinfo);
 		}
-		darray_free(mtab->entries);
+#endif
 
 		free(mtab);
 	}
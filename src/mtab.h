@@ -9,6 +9,8 @@
 #define BFS_MTAB_H
 
 #include "config.h"
+#include <stdio.h>
+#include <sys/types.h>
 
 struct bfs_stat;
 
@@ -25,6 +27,17 @@ struct bfs_mtab;
  */
 struct bfs_mtab *bfs_mtab_parse(void);
 
+/**
+ * Parse a mount table in the format of /proc/self/mountinfo.  Only supported
+ * on Linux.
+ *
+ * @param file
+ *         The file to read.
+ * @return
+ *         The parsed mount table, or NULL on error.
+ */
+struct bfs_mtab *bfs_mtab_parse_mountinfo(FILE *file);
+
 /**
  * Determine the file system type that a file is on.
  *
@@ -38,6 +51,30 @@ struct bfs_mtab *bfs_mtab_parse(void);
  */
 const char *bfs_fstype(const struct bfs_mtab *mtab, const struct bfs_stat *statbuf);
 
+/**
+ * Fill in the file system types now, rather than on the first lookup.  After
+ * this succeeds, bfs_fstype() and bfs_dev_fstype() no longer modify the table,
+ * so they can be called from multiple threads.
+ *
+ * @param mtab
+ *         The current mount table.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_mtab_load_types(const struct bfs_mtab *mtab);
+
+/**
+ * Determine the type of the file system with a given device ID.
+ *
+ * @param mtab
+ *         The current mount table.
+ * @param dev
+ *         The device ID.
+ * @return
+ *         The file system type, "unknown" if not known, or NULL on error.
+ */
+const char *bfs_dev_fstype(const struct bfs_mtab *mtab, dev_t dev);
+
 /**
  * Check if a file could be a mount point.
  *
@@ -50,6 +87,18 @@ const char *bfs_fstype(const struct bfs_mtab *mtab, const struct bfs_stat *statb
  */
 bool bfs_might_be_mount(const struct bfs_mtab *mtab, const char *path);
 
+/**
+ * Re-read the mount table if it has changed.  On Linux, the first call opens
+ * /proc/self/mountinfo and re-reads it, and later calls poll() it for changes.
+ * Elsewhere, this is a no-op.  The table must not be in use by another thread.
+ *
+ * @param mtab
+ *         The mount table to refresh.
+ * @return
+ *         1 if the table was re-read, 0 if it was unchanged, or -1 on error.
+ */
+int bfs_mtab_refresh(struct bfs_mtab *mtab);
+
 /**
  * Free a mount table.
  */
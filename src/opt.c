@@ -19,26 +19,39 @@
  * (-foo -and -bar), if both -foo and -bar are pure (no side effects), they can
  * be re-ordered to (-bar -and -foo).  This is profitable if the expected cost
  * is lower for the re-ordered expression, for example if -foo is very slow or
- * -bar is likely to return false.
+ * -bar is likely to return false.  The same rule is re-applied periodically
+ * during the search (see eval_reorder()), using the observed success rates.
+ * Chains like (-name '*.c' -o -name '*.h') are also merged into a single
+ * bfs_fnset that matches all the patterns at once, and conjunctions like
+ * (-size +1M -mtime -7) are fused into a single eval_ranges() that checks
+ * precomputed bounds on the raw stat() fields.
  *
  * -O4/-Ofast: aggressive optimizations that may affect correctness in corner
  * cases.  The main effect is to use facts_when_impure to determine if any side-
- * effects are reachable at all, and skipping the traversal if not.
+ * effects are reachable at all, and skipping the traversal if not.  If a
+ * -profile from a previous run is available, its measured costs and
+ * probabilities also replace the built-in estimates used for re-ordering.
  */
 
 #include "opt.h"
 #include "color.h"
 #include "config.h"
 #include "ctx.h"
+#include "darray.h"
 #include "diag.h"
 #include "eval.h"
 #include "exec.h"
 #include "expr.h"
+#include "fnset.h"
+#include "profile.h"
 #include "pwcache.h"
+#include "xregex.h"
 #include <errno.h>
+#include <fnmatch.h>
 #include <limits.h>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -206,6 +219,63 @@ enum pred_type {
 	PRED_TYPES,
 };
 
+/**
+ * A pattern that the path is known to match.
+ */
+struct known_path {
+	/** The pattern, or NULL if unknown. */
+	const char *pattern;
+	/** Whether the pattern is a literal prefix rather than a glob. */
+	bool prefix;
+	/** Whether the pattern is case-insensitive. */
+	bool casefold;
+	/** Whether the state is impossible to reach. */
+	bool impossible;
+};
+
+/** Get the length of the literal part of a known path. */
+static size_t known_path_length(const struct known_path *path) {
+	if (path->prefix) {
+		return strlen(path->pattern);
+	} else {
+		return strcspn(path->pattern, "?*[\\");
+	}
+}
+
+/** Record that the path matches a pattern. */
+static void constrain_path(struct known_path *path, const char *pattern, bool prefix, bool casefold) {
+	if (path->impossible) {
+		return;
+	}
+
+	struct known_path new = {
+		.pattern = pattern,
+		.prefix = prefix,
+		.casefold = casefold,
+	};
+
+	// Both patterns match, so keep whichever one rules out more paths
+	if (!path->pattern || known_path_length(&new) > known_path_length(path)) {
+		*path = new;
+	}
+}
+
+/** Compute the union of two known paths. */
+static struct known_path path_union(const struct known_path *lhs, const struct known_path *rhs) {
+	if (lhs->impossible) {
+		return *rhs;
+	} else if (rhs->impossible) {
+		return *lhs;
+	} else if (lhs->pattern && rhs->pattern
+	           && lhs->prefix == rhs->prefix
+	           && lhs->casefold == rhs->casefold
+	           && strcmp(lhs->pattern, rhs->pattern) == 0) {
+		return *lhs;
+	} else {
+		return (struct known_path){0};
+	}
+}
+
 /**
  * Data flow facts about an evaluation point.
  */
@@ -220,6 +290,9 @@ struct opt_facts {
 	unsigned int types;
 	/** Bitmask of possible link target types. */
 	unsigned int xtypes;
+
+	/** A pattern from -path or -regex that the path matches. */
+	struct known_path path;
 };
 
 /** Initialize some data flow facts. */
@@ -236,6 +309,8 @@ static void facts_init(struct opt_facts *facts) {
 
 	facts->types = ~0;
 	facts->xtypes = ~0;
+
+	facts->path = (struct known_path){0};
 }
 
 /** Compute the union of two fact sets. */
@@ -250,6 +325,8 @@ static void facts_union(struct opt_facts *result, const struct opt_facts *lhs, c
 
 	result->types = lhs->types | rhs->types;
 	result->xtypes = lhs->xtypes | rhs->xtypes;
+
+	result->path = path_union(&lhs->path, &rhs->path);
 }
 
 /** Determine whether a fact set is impossible. */
@@ -285,8 +362,15 @@ static void set_facts_impossible(struct opt_facts *facts) {
 
 	facts->types = 0;
 	facts->xtypes = 0;
+
+	facts->path = (struct known_path){.impossible = true};
 }
 
+#define FAST_COST       40.0
+#define FNMATCH_COST   400.0
+#define STAT_COST     1000.0
+#define PRINT_COST   20000.0
+
 /**
  * Optimizer state.
  */
@@ -302,6 +386,8 @@ struct opt_state {
 	struct opt_facts facts_when_false;
 	/** Data flow facts before any side-effecting expressions are evaluated. */
 	struct opt_facts *facts_when_impure;
+	/** Measurements from a previous -profile, if any. */
+	const struct bfs_profile *profile;
 };
 
 /** Log an optimization. */
@@ -495,6 +581,249 @@ fail:
 	return NULL;
 }
 
+/** Convert an integer comparison to an inclusive range, if it's not empty. */
+static bool icmp_bounds(const struct bfs_expr *expr, long long *min, long long *max) {
+	long long num = expr->num;
+
+	switch (expr->int_cmp) {
+	case BFS_INT_EQUAL:
+		*min = num;
+		*max = num;
+		return true;
+	case BFS_INT_LESS:
+		*min = LLONG_MIN;
+		*max = num - 1;
+		return num != LLONG_MIN;
+	case BFS_INT_GREATER:
+		*min = num + 1;
+		*max = LLONG_MAX;
+		return num != LLONG_MAX;
+	}
+
+	bfs_bug("Invalid comparison mode");
+	return false;
+}
+
+/** The largest time difference (in seconds) that a fused -[acm]time may use. */
+#define MAX_FUSED_TIME (1LL << 40)
+
+/** Convert a time bound from seconds ago to an absolute time, if it fits. */
+static bool time_bound(struct timespec *result, const struct timespec *reftime, long long seconds) {
+	long long sec = reftime->tv_sec - seconds;
+	result->tv_sec = sec;
+	result->tv_nsec = reftime->tv_nsec;
+	return result->tv_sec == sec;
+}
+
+/** Convert -[acm]{min,time} to an absolute time range, like eval_time(). */
+static bool time_check(const struct bfs_expr *expr, struct bfs_range_check *check) {
+	long long unit;
+	switch (expr->time_unit) {
+	case BFS_SECONDS:
+		unit = 1;
+		break;
+	case BFS_MINUTES:
+		unit = 60;
+		break;
+	case BFS_DAYS:
+		unit = 60 * 60 * 24;
+		break;
+	default:
+		bfs_bug("Invalid time unit");
+		return false;
+	}
+
+	long long min, max;
+	if (!icmp_bounds(expr, &min, &max)) {
+		return false;
+	}
+
+	long long limit = MAX_FUSED_TIME / unit;
+	check->has_before = min != LLONG_MIN;
+	check->has_after = max != LLONG_MAX;
+	if ((check->has_before && (min < -limit || min > limit))
+	    || (check->has_after && (max < -limit || max > limit))) {
+		return false;
+	}
+
+	// eval_time() computes the difference in whole seconds, rounded down,
+	// then divides by the unit, rounding towards zero
+	if (check->has_before) {
+		long long lo = min > 0 ? min * unit : (min - 1) * unit + 1;
+		if (!time_bound(&check->before, &expr->reftime, lo)) {
+			return false;
+		}
+	}
+
+	if (check->has_after) {
+		long long hi = max >= 0 ? max * unit + unit - 1 : max * unit;
+		if (!time_bound(&check->after, &expr->reftime, hi + 1)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/** Convert -size to a range of bytes, like eval_size(). */
+static bool size_check(const struct bfs_expr *expr, struct bfs_range_check *check) {
+	long long min, max;
+	if (!icmp_bounds(expr, &min, &max)) {
+		return false;
+	}
+
+	long long scale = bfs_size_scale(expr->size_unit);
+	long long limit = LLONG_MAX / scale;
+	if ((min != LLONG_MIN && (min < -limit || min > limit))
+	    || (max != LLONG_MAX && (max < -limit || max > limit))) {
+		return false;
+	}
+
+	// eval_size() rounds up to whole units
+	check->min = min > 0 ? (min - 1) * scale + 1 : LLONG_MIN;
+	check->max = max != LLONG_MAX ? max * scale : LLONG_MAX;
+	return true;
+}
+
+/** Convert a test to a range check, if possible. */
+static bool range_check(const struct bfs_expr *expr, struct bfs_range_check *check) {
+	*check = (struct bfs_range_check){0};
+
+	bfs_eval_fn *fn = expr->eval_fn;
+	if (fn == eval_newer || fn == eval_time) {
+		// -Bmin etc. may fail to find the birth time, which must be
+		// reported only if the test is actually reached
+		switch (expr->stat_field) {
+		case BFS_STAT_ATIME:
+		case BFS_STAT_CTIME:
+		case BFS_STAT_MTIME:
+			break;
+		default:
+			return false;
+		}
+
+		check->field = expr->stat_field;
+		if (fn == eval_time) {
+			return time_check(expr, check);
+		}
+
+		check->has_after = true;
+		check->after = expr->reftime;
+		return true;
+	}
+
+	if (fn == eval_size) {
+		check->field = BFS_STAT_SIZE;
+		return size_check(expr, check);
+	} else if (fn == eval_uid) {
+		check->field = BFS_STAT_UID;
+	} else if (fn == eval_gid) {
+		check->field = BFS_STAT_GID;
+	} else if (fn == eval_links) {
+		check->field = BFS_STAT_NLINK;
+	} else if (fn == eval_inum) {
+		check->field = BFS_STAT_INO;
+	} else {
+		return false;
+	}
+
+	return icmp_bounds(expr, &check->min, &check->max);
+}
+
+/** Check if an expression can be fused into a single eval_ranges(). */
+static bool can_fuse_range(const struct bfs_expr *expr) {
+	struct bfs_range_check check;
+	return expr->eval_fn == eval_ranges || range_check(expr, &check);
+}
+
+/** Compare two timespecs. */
+static bool timespec_lt(const struct timespec *lhs, const struct timespec *rhs) {
+	return lhs->tv_sec < rhs->tv_sec
+		|| (lhs->tv_sec == rhs->tv_sec && lhs->tv_nsec < rhs->tv_nsec);
+}
+
+/** Add a check to a fused expression, intersecting it with any on the same field. */
+static int add_range_check(struct bfs_expr *fused, const struct bfs_range_check *check) {
+	for (size_t i = 0; i < darray_length(fused->checks); ++i) {
+		struct bfs_range_check *prev = &fused->checks[i];
+		if (prev->field != check->field) {
+			continue;
+		}
+
+		prev->min = max_value(prev->min, check->min);
+		prev->max = min_value(prev->max, check->max);
+
+		if (check->has_after && (!prev->has_after || timespec_lt(&prev->after, &check->after))) {
+			prev->has_after = true;
+			prev->after = check->after;
+		}
+		if (check->has_before && (!prev->has_before || timespec_lt(&check->before, &prev->before))) {
+			prev->has_before = true;
+			prev->before = check->before;
+		}
+
+		return 0;
+	}
+
+	return DARRAY_PUSH(&fused->checks, check);
+}
+
+/** Add a test (or already-fused tests) to a fused expression. */
+static int add_range_checks(struct bfs_expr *fused, const struct bfs_expr *expr) {
+	if (expr->eval_fn == eval_ranges) {
+		for (size_t i = 0; i < darray_length(expr->checks); ++i) {
+			if (add_range_check(fused, &expr->checks[i]) != 0) {
+				return -1;
+			}
+		}
+	} else {
+		struct bfs_range_check check;
+		bool ok = range_check(expr, &check);
+		bfs_assert(ok);
+		(void)ok;
+		if (add_range_check(fused, &check) != 0) {
+			return -1;
+		}
+	}
+
+	for (size_t i = 0; i < expr->argc; ++i) {
+		if (DARRAY_PUSH(&fused->argv, &expr->argv[i]) != 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/** Fuse a conjunction of stat() range tests into a single eval_ranges(). */
+static struct bfs_expr *fuse_ranges(const struct opt_state *state, struct bfs_expr *expr) {
+	const struct bfs_expr *lhs = expr->lhs;
+	const struct bfs_expr *rhs = expr->rhs;
+
+	struct bfs_expr *fused = bfs_expr_new(eval_ranges, 0, NULL);
+	if (!fused) {
+		goto fail;
+	}
+
+	if (add_range_checks(fused, lhs) != 0 || add_range_checks(fused, rhs) != 0) {
+		goto fail;
+	}
+
+	fused->argc = darray_length(fused->argv);
+	fused->pure = true;
+	fused->cost = STAT_COST;
+	fused->probability = lhs->probability * rhs->probability;
+
+	opt_debug(state, 3, "range fusion: %pe <==> %pe\n", expr, fused);
+	bfs_expr_free(expr);
+	return fused;
+
+fail:
+	bfs_expr_free(fused);
+	bfs_expr_free(expr);
+	return NULL;
+}
+
 /** Optimize a conjunction. */
 static struct bfs_expr *optimize_and_expr(const struct opt_state *state, struct bfs_expr *expr) {
 	bfs_assert(expr->eval_fn == eval_and);
@@ -529,6 +858,8 @@ static struct bfs_expr *optimize_and_expr(const struct opt_state *state, struct
 			return extract_child_expr(expr, &expr->rhs);
 		} else if (lhs->eval_fn == eval_not && rhs->eval_fn == eval_not) {
 			return de_morgan(state, expr, expr->lhs->argv);
+		} else if (optlevel >= 3 && can_fuse_range(lhs) && can_fuse_range(rhs)) {
+			return fuse_ranges(state, expr);
 		}
 	}
 
@@ -566,6 +897,121 @@ fail:
 	return NULL;
 }
 
+/** Check if (lhs -o rhs) can be merged into a single bfs_fnset. */
+static bool can_merge_fnmatch(const struct bfs_expr *lhs, const struct bfs_expr *rhs) {
+	if (lhs->eval_fn != eval_name && lhs->eval_fn != eval_path) {
+		return false;
+	}
+
+	return rhs->eval_fn == lhs->eval_fn && rhs->fnm_flags == lhs->fnm_flags;
+}
+
+/** Add the patterns of an fnmatch() test to a set. */
+static int add_fnmatch_patterns(struct bfs_fnset *set, const struct bfs_expr *expr) {
+	for (size_t i = 1; i < expr->argc; ++i) {
+		if (bfs_fnset_add(set, expr->argv[i]) != 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void estimate_fnmatch(struct bfs_expr *expr);
+
+/** Merge a disjunction of fnmatch() tests into a single pattern set. */
+static struct bfs_expr *merge_fnmatch(const struct opt_state *state, struct bfs_expr *expr) {
+	const struct bfs_expr *lhs = expr->lhs;
+	const struct bfs_expr *rhs = expr->rhs;
+
+	struct bfs_fnset *set = bfs_fnset_new(lhs->argv[0], lhs->fnm_flags);
+	if (!set) {
+		goto fail;
+	}
+
+	if (add_fnmatch_patterns(set, lhs) != 0 || add_fnmatch_patterns(set, rhs) != 0) {
+		goto fail;
+	}
+
+	size_t argc;
+	char **argv = bfs_fnset_argv(set, &argc);
+	struct bfs_expr *merged = bfs_expr_new(lhs->eval_fn, argc, argv);
+	if (!merged) {
+		goto fail;
+	}
+
+	merged->fnm_flags = lhs->fnm_flags;
+	merged->fnset = set;
+	merged->pure = true;
+	estimate_fnmatch(merged);
+
+	opt_debug(state, 3, "pattern set: %pe <==> %pe\n", expr, merged);
+	bfs_expr_free(expr);
+	return merged;
+
+fail:
+	bfs_fnset_free(set);
+	bfs_expr_free(expr);
+	return NULL;
+}
+
+/** Check if (lhs -o rhs) can be merged into a single regex set. */
+static bool can_merge_regex(const struct bfs_expr *lhs, const struct bfs_expr *rhs) {
+	if (lhs->eval_fn != eval_regex || rhs->eval_fn != eval_regex) {
+		return false;
+	}
+
+	return bfs_regmergeable(lhs->regex, rhs->regex);
+}
+
+/** Add the arguments of a regex test to a merged argv. */
+static int add_regex_args(char ***argv, const struct bfs_expr *expr) {
+	for (size_t i = 1; i < expr->argc; ++i) {
+		if (DARRAY_PUSH(argv, &expr->argv[i]) != 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/** Merge a disjunction of regex tests into a single regex set. */
+static struct bfs_expr *merge_regex(const struct opt_state *state, struct bfs_expr *expr) {
+	struct bfs_expr *lhs = expr->lhs;
+	struct bfs_expr *rhs = expr->rhs;
+
+	char **argv = NULL;
+	if (DARRAY_PUSH(&argv, &lhs->argv[0]) != 0) {
+		goto fail;
+	}
+	if (add_regex_args(&argv, lhs) != 0 || add_regex_args(&argv, rhs) != 0) {
+		goto fail;
+	}
+
+	struct bfs_expr *merged = bfs_expr_new(eval_regex, darray_length(argv), argv);
+	if (!merged) {
+		goto fail;
+	}
+	merged->regex_argv = argv;
+
+	if (bfs_regmerge(&merged->regex, &lhs->regex, &rhs->regex) != 0) {
+		bfs_expr_free(merged);
+		bfs_expr_free(expr);
+		return NULL;
+	}
+
+	merged->pure = true;
+	merged->cost = lhs->cost;
+	merged->probability = 1.0 - (1.0 - lhs->probability) * (1.0 - rhs->probability);
+
+	opt_debug(state, 3, "regex set: %pe <==> %pe\n", expr, merged);
+	bfs_expr_free(expr);
+	return merged;
+
+fail:
+	darray_free(argv);
+	bfs_expr_free(expr);
+	return NULL;
+}
+
 /** Optimize a disjunction. */
 static struct bfs_expr *optimize_or_expr(const struct opt_state *state, struct bfs_expr *expr) {
 	bfs_assert(expr->eval_fn == eval_or);
@@ -600,6 +1046,10 @@ static struct bfs_expr *optimize_or_expr(const struct opt_state *state, struct b
 			return extract_child_expr(expr, &expr->rhs);
 		} else if (lhs->eval_fn == eval_not && rhs->eval_fn == eval_not) {
 			return de_morgan(state, expr, expr->lhs->argv);
+		} else if (optlevel >= 3 && can_merge_fnmatch(lhs, rhs)) {
+			return merge_fnmatch(state, expr);
+		} else if (optlevel >= 3 && can_merge_regex(lhs, rhs)) {
+			return merge_regex(state, expr);
 		}
 	}
 
@@ -805,12 +1255,56 @@ static struct bfs_expr *optimize_exec(struct opt_state *state, struct bfs_expr *
 	return expr;
 }
 
+/** Estimate the probability that a single fnmatch() pattern matches. */
+static float fnmatch_probability(const char *pattern) {
+	if (strchr(pattern, '*')) {
+		return 0.5;
+	} else {
+		return 0.1;
+	}
+}
+
+/** Estimate the cost and probability of -name/-lname/-path. */
+static void estimate_fnmatch(struct bfs_expr *expr) {
+	if (!expr->fnset) {
+		expr->probability = fnmatch_probability(expr->argv[1]);
+		return;
+	}
+
+	// A few trie lookups, plus fnmatch() for whatever's left
+	expr->cost = 3 * FAST_COST + bfs_fnset_fallbacks(expr->fnset) * FNMATCH_COST;
+
+	float miss = 1.0;
+	for (size_t i = 1; i < expr->argc; ++i) {
+		miss *= 1.0 - fnmatch_probability(expr->argv[i]);
+	}
+	expr->probability = 1.0 - miss;
+}
+
 /** Optimize -name/-lname/-path. */
 static struct bfs_expr *optimize_fnmatch(struct opt_state *state, struct bfs_expr *expr) {
-	if (strchr(expr->argv[1], '*')) {
-		expr->probability = 0.5;
-	} else {
-		expr->probability = 0.1;
+	estimate_fnmatch(expr);
+	return expr;
+}
+
+/** Optimize -path. */
+static struct bfs_expr *optimize_path(struct opt_state *state, struct bfs_expr *expr) {
+	if (!expr->fnset) {
+		bool casefold = false;
+#ifdef FNM_CASEFOLD
+		casefold = expr->fnm_flags & FNM_CASEFOLD;
+#endif
+		constrain_path(&state->facts_when_true.path, expr->pattern, false, casefold);
+	}
+
+	return optimize_fnmatch(state, expr);
+}
+
+/** Optimize -regex. */
+static struct bfs_expr *optimize_regex(struct opt_state *state, struct bfs_expr *expr) {
+	const char *prefix = bfs_regprefix(expr->regex);
+	if (prefix) {
+		constrain_path(&state->facts_when_true.path, prefix, true, false);
 	}
 
 	return expr;
@@ -868,6 +1362,38 @@ static struct bfs_expr *optimize_uid(struct opt_state *state, struct bfs_expr *e
 	return expr;
 }
 
+/** Optimize fused range checks. */
+static struct bfs_expr *optimize_ranges(struct opt_state *state, struct bfs_expr *expr) {
+	for (size_t i = 0; i < darray_length(expr->checks); ++i) {
+		const struct bfs_range_check *check = &expr->checks[i];
+
+		// -size facts are in the units of each test, not bytes
+		enum range_type type;
+		switch (check->field) {
+		case BFS_STAT_GID:
+			type = GID_RANGE;
+			break;
+		case BFS_STAT_INO:
+			type = INUM_RANGE;
+			break;
+		case BFS_STAT_NLINK:
+			type = LINKS_RANGE;
+			break;
+		case BFS_STAT_UID:
+			type = UID_RANGE;
+			break;
+		default:
+			continue;
+		}
+
+		struct range *range = &state->facts_when_true.ranges[type];
+		constrain_min(range, check->min);
+		constrain_max(range, check->max);
+	}
+
+	return expr;
+}
+
 /** Optimize -samefile. */
 static struct bfs_expr *optimize_samefile(struct opt_state *state, struct bfs_expr *expr) {
 	struct range *range_when_true = &state->facts_when_true.ranges[INUM_RANGE];
@@ -971,6 +1497,7 @@ static bfs_eval_fn *const opt_pure[] = {
 	eval_nouser,
 	eval_path,
 	eval_perm,
+	eval_ranges,
 	eval_regex,
 	eval_samefile,
 	eval_size,
@@ -988,9 +1515,11 @@ static bfs_eval_fn *const opt_pure[] = {
  * Table of always-true expressions.
  */
 static bfs_eval_fn *const opt_always_true[] = {
+	eval_du,
 	eval_fls,
 	eval_fprint,
 	eval_fprint0,
+	eval_fprintb,
 	eval_fprintf,
 	eval_fprintx,
 	eval_prune,
@@ -1012,11 +1541,6 @@ static bfs_eval_fn *const opt_always_false[] = {
 	eval_quit,
 };
 
-#define FAST_COST       40.0
-#define FNMATCH_COST   400.0
-#define STAT_COST     1000.0
-#define PRINT_COST   20000.0
-
 /**
  * Table of expression costs.
  */
@@ -1029,10 +1553,12 @@ static const struct {
 	{eval_access,    STAT_COST},
 	{eval_acl,       STAT_COST},
 	{eval_capable,   STAT_COST},
+	{eval_du,       PRINT_COST},
 	{eval_empty, 2 * STAT_COST}, // readdir() is worse than stat()
 	{eval_fls,      PRINT_COST},
 	{eval_fprint,   PRINT_COST},
 	{eval_fprint0,  PRINT_COST},
+	{eval_fprintb,  PRINT_COST},
 	{eval_fprintf,  PRINT_COST},
 	{eval_fprintx,  PRINT_COST},
 	{eval_fstype,    STAT_COST},
@@ -1046,6 +1572,7 @@ static const struct {
 	{eval_nouser,    STAT_COST},
 	{eval_path,   FNMATCH_COST},
 	{eval_perm,      STAT_COST},
+	{eval_ranges,    STAT_COST},
 	{eval_samefile,  STAT_COST},
 	{eval_size,      STAT_COST},
 	{eval_sparse,    STAT_COST},
@@ -1134,7 +1661,9 @@ static const struct {
 	{eval_links,    optimize_links},
 	{eval_lname,    optimize_fnmatch},
 	{eval_name,     optimize_fnmatch},
-	{eval_path,     optimize_fnmatch},
+	{eval_path,     optimize_path},
+	{eval_ranges,   optimize_ranges},
+	{eval_regex,    optimize_regex},
 	{eval_samefile, optimize_samefile},
 	{eval_size,     optimize_size},
 	{eval_type,     optimize_type},
@@ -1211,6 +1740,26 @@ static struct bfs_expr *optimize_expr_lookup(struct opt_state *state, struct bfs
 	return expr;
 }
 
+/** Replace the estimated cost and probability with measured ones, if possible. */
+static void optimize_profile(const struct opt_state *state, struct bfs_expr *expr) {
+	const struct bfs_profile_rates *rates = bfs_profile_find(state->profile, expr);
+	if (!rates || rates->evaluations == 0) {
+		return;
+	}
+
+	float cost = expr->cost;
+	if (rates->elapsed > 0.0) {
+		cost = rates->elapsed / rates->evaluations;
+	}
+	float probability = (double)rates->successes / rates->evaluations;
+
+	opt_debug(state, 4, "profile: %pe (~${ylw}%g${rs}, ${ylw}%g${rs}) --> (~${ylw}%g${rs}, ${ylw}%g${rs})\n",
+		expr, expr->cost, expr->probability, cost, probability);
+
+	expr->cost = cost;
+	expr->probability = probability;
+}
+
 static struct bfs_expr *optimize_expr_recursive(struct opt_state *state, struct bfs_expr *expr) {
 	int optlevel = state->ctx->optlevel;
 
@@ -1230,6 +1779,10 @@ static struct bfs_expr *optimize_expr_recursive(struct opt_state *state, struct
 		return NULL;
 	}
 
+	if (state->profile && !bfs_expr_is_parent(expr)) {
+		optimize_profile(state, expr);
+	}
+
 	if (bfs_expr_is_parent(expr)) {
 		struct bfs_expr *lhs = expr->lhs;
 		struct bfs_expr *rhs = expr->rhs;
@@ -1362,20 +1915,172 @@ static struct bfs_expr *optimize_expr(struct opt_state *state, struct bfs_expr *
 	return expr;
 }
 
+/** Convert a known path to a glob for bfs_ctx::prune_glob. */
+static char *known_path_glob(const struct known_path *path) {
+	if (!path->prefix) {
+		return strdup(path->pattern);
+	}
+
+	size_t len = strlen(path->pattern);
+	char *glob = malloc(2 * len + 2);
+	if (!glob) {
+		return NULL;
+	}
+
+	char *cur = glob;
+	for (size_t i = 0; i < len; ++i) {
+		char c = path->pattern[i];
+		if (strchr("?*[\\", c)) {
+			*cur++ = '\\';
+		}
+		*cur++ = c;
+	}
+	*cur++ = '*';
+	*cur = '\0';
+	return glob;
+}
+
+/** Count the attribute checks in an expression, which may share an fd. */
+static int expr_attr_checks(const struct bfs_expr *expr) {
+	if (!expr) {
+		return 0;
+	}
+
+	if (bfs_expr_is_parent(expr)) {
+		return expr_attr_checks(expr->lhs) + expr_attr_checks(expr->rhs);
+	}
+
+	bfs_eval_fn *fn = expr->eval_fn;
+	if (fn == eval_acl
+	    || fn == eval_capable
+	    || fn == eval_xattr
+	    || fn == eval_xattrname) {
+		return 1;
+	} else {
+		return 0;
+	}
+}
+
+/** Get the bfs_stat() fields that an expression might need. */
+static enum bfs_stat_field expr_stat_fields(const struct bfs_expr *expr) {
+	if (!expr) {
+		return 0;
+	}
+
+	if (bfs_expr_is_parent(expr)) {
+		return expr_stat_fields(expr->lhs) | expr_stat_fields(expr->rhs);
+	}
+
+	bfs_eval_fn *fn = expr->eval_fn;
+	if (fn == eval_true
+	    || fn == eval_false
+	    || fn == eval_access
+	    || fn == eval_acl
+	    || fn == eval_capable
+	    || fn == eval_xattr
+	    || fn == eval_xattrname
+	    || fn == eval_depth
+	    || fn == eval_hidden
+	    || fn == eval_name
+	    || fn == eval_path
+	    || fn == eval_regex
+	    || fn == eval_lname
+	    || fn == eval_type
+	    || fn == eval_xtype
+	    || fn == eval_delete
+	    || fn == eval_touch
+	    || fn == eval_exec
+	    || fn == eval_exit
+	    || fn == eval_prune
+	    || fn == eval_quit) {
+		// At most the file type, which is always requested
+		return 0;
+	} else if (fn == eval_fprint || fn == eval_fprint0 || fn == eval_fprintx) {
+		// Colored output looks at the mode and link count
+		return expr->cfile->colors ? BFS_STAT_MODE | BFS_STAT_NLINK : 0;
+	} else if (fn == eval_perm || fn == eval_chmod) {
+		return BFS_STAT_MODE;
+	} else if (fn == eval_chown) {
+		return BFS_STAT_UID | BFS_STAT_GID;
+	} else if (fn == eval_gid || fn == eval_nogroup) {
+		return BFS_STAT_GID;
+	} else if (fn == eval_uid || fn == eval_nouser) {
+		return BFS_STAT_UID;
+	} else if (fn == eval_ranges) {
+		enum bfs_stat_field fields = 0;
+		for (size_t i = 0; i < darray_length(expr->checks); ++i) {
+			fields |= expr->checks[i].field;
+		}
+		return fields;
+	} else if (fn == eval_newer || fn == eval_time) {
+		return expr->stat_field;
+	} else if (fn == eval_used) {
+		return BFS_STAT_ATIME | BFS_STAT_CTIME;
+	} else if (fn == eval_empty || fn == eval_size) {
+		return BFS_STAT_SIZE;
+	} else if (fn == eval_sparse) {
+		return BFS_STAT_SIZE | BFS_STAT_BLOCKS;
+	} else if (fn == eval_flags) {
+		return BFS_STAT_ATTRS;
+	} else if (fn == eval_fstype) {
+		return BFS_STAT_DEV;
+	} else if (fn == eval_inum) {
+		return BFS_STAT_INO;
+	} else if (fn == eval_links) {
+		return BFS_STAT_NLINK;
+	} else if (fn == eval_samefile) {
+		return BFS_STAT_DEV | BFS_STAT_INO;
+	} else {
+		// -ls, -printf, etc. may need anything
+		return BFS_STAT_ALL;
+	}
+}
+
+/** Compile the regex sets built by merge_regex(). */
+static int finish_regexes(const struct bfs_ctx *ctx, const struct bfs_expr *expr) {
+	if (!expr) {
+		return 0;
+	}
+
+	if (bfs_expr_is_parent(expr)) {
+		if (finish_regexes(ctx, expr->lhs) != 0) {
+			return -1;
+		}
+		return finish_regexes(ctx, expr->rhs);
+	}
+
+	if (expr->eval_fn == eval_regex && bfs_regfinish(expr->regex) != 0) {
+		bfs_perror(ctx, "bfs_regfinish()");
+		return -1;
+	}
+
+	return 0;
+}
+
 int bfs_optimize(struct bfs_ctx *ctx) {
 	bfs_ctx_dump(ctx, DEBUG_OPT);
 
 	struct opt_facts facts_when_impure;
 	set_facts_impossible(&facts_when_impure);
 
+	struct bfs_profile *profile = NULL;
+	if (ctx->profile_path && ctx->optlevel >= 4) {
+		profile = bfs_profile_load(ctx->profile_path);
+		if (!profile && errno != ENOENT) {
+			bfs_warning(ctx, "Ignoring profile %pq: %m.\n\n", ctx->profile_path);
+		}
+	}
+
 	struct opt_state state = {
 		.ctx = ctx,
 		.facts_when_impure = &facts_when_impure,
+		.profile = profile,
 	};
 	facts_init(&state.facts);
 
 	ctx->exclude = optimize_expr(&state, ctx->exclude);
 	if (!ctx->exclude) {
+		bfs_profile_free(profile);
 		return -1;
 	}
 
@@ -1387,12 +2092,35 @@ int bfs_optimize(struct bfs_ctx *ctx) {
 	constrain_max(depth, ctx->maxdepth);
 
 	ctx->expr = optimize_expr(&state, ctx->expr);
+	bfs_profile_free(profile);
+	state.profile = NULL;
 	if (!ctx->expr) {
 		return -1;
 	}
 
 	ctx->expr = ignore_result(&state, ctx->expr);
 
+	if (finish_regexes(ctx, ctx->exclude) != 0 || finish_regexes(ctx, ctx->expr) != 0) {
+		return -1;
+	}
+
+	ctx->stat_fields = expr_stat_fields(ctx->exclude) | expr_stat_fields(ctx->expr);
+	if (ctx->unique) {
+		ctx->stat_fields |= BFS_STAT_DEV | BFS_STAT_INO;
+	}
+	if (ctx->du) {
+		// Every file counts towards -du, not just the ones it prints
+		ctx->stat_fields |= BFS_STAT_DEV | BFS_STAT_INO | BFS_STAT_NLINK | BFS_STAT_BLOCKS;
+	}
+	// Opening each file only pays off if more than one check can use the fd,
+	// and the open itself can have side effects (e.g. virus scans)
+	ctx->attr_fds = expr_attr_checks(ctx->exclude) + expr_attr_checks(ctx->expr) > 1;
+
+	if (ctx->incremental_path) {
+		// For bfs_index_lookup()
+		ctx->stat_fields |= BFS_STAT_DEV | BFS_STAT_INO | BFS_STAT_CTIME | BFS_STAT_MTIME;
+	}
+
 	if (facts_are_impossible(&facts_when_impure)) {
 		bfs_warning(ctx, "This command won't do anything.\n\n");
 	}
@@ -1419,5 +2147,18 @@ int bfs_optimize(struct bfs_ctx *ctx) {
 		opt_debug(&state, 4, "data flow: maxdepth --> %d\n", ctx->maxdepth);
 	}
 
+	// Like lowering -maxdepth, pruning can skip reporting errors for
+	// directories that we'd never have done anything with.  But -du still
+	// has to count everything under them (it walks past -maxdepth itself).
+	const struct known_path *path = &facts_when_impure.path;
+	if (optlevel >= 4 && path->pattern && !path->impossible && !ctx->du) {
+		ctx->prune_glob = known_path_glob(path);
+		if (!ctx->prune_glob) {
+			return -1;
+		}
+		ctx->prune_casefold = path->casefold;
+		opt_debug(&state, 4, "data flow: prune unless -path %pq\n", ctx->prune_glob);
+	}
+
 	return 0;
 }
@@ -21,6 +21,7 @@
 #include "eval.h"
 #include "exec.h"
 #include "expr.h"
+#include "fnset.h"
 #include "fsade.h"
 #include "opt.h"
 #include "printf.h"
@@ -28,6 +29,7 @@
 #include "sanity.h"
 #include "stat.h"
 #include "typo.h"
+#include "watch.h"
 #include "xregex.h"
 #include "xspawn.h"
 #include "xtime.h"
@@ -95,6 +97,13 @@ void bfs_expr_free(struct bfs_expr *expr) {
 		bfs_printf_free(expr->printf);
 	} else if (expr->eval_fn == eval_regex) {
 		bfs_regfree(expr->regex);
+		darray_free(expr->regex_argv);
+	} else if (expr->eval_fn == eval_name || expr->eval_fn == eval_path) {
+		bfs_fnset_free(expr->fnset);
+	} else if (expr->eval_fn == eval_ranges) {
+		// The fused tests' arguments are collected in a darray
+		darray_free(expr->checks);
+		darray_free(expr->argv);
 	}
 
 	free(expr);
@@ -200,6 +209,8 @@ struct parser_state {
 	char **files0_stdin_arg;
 	/** An "-ok"-type expression, if any. */
 	const struct bfs_expr *ok_expr;
+	/** An "-exec"-type expression, if any. */
+	const struct bfs_expr *exec_expr;
 
 	/** The current time (maybe modified by -daystart). */
 	struct timespec now;
@@ -399,6 +410,21 @@ static void init_print_expr(struct parser_state *state, struct bfs_expr *expr) {
 	expr->path = NULL;
 }
 
+/**
+ * Get the color table, parsing $LS_COLORS the first time it's needed.
+ */
+static struct colors *parse_get_colors(struct bfs_ctx *ctx) {
+	if (!ctx->colors_parsed) {
+		ctx->colors_parsed = true;
+		ctx->colors = parse_colors();
+		if (!ctx->colors) {
+			ctx->colors_error = errno;
+		}
+	}
+
+	return ctx->colors;
+}
+
 /**
  * Open a file for an expression.
  */
@@ -412,8 +438,14 @@ static int expr_open(struct parser_state *state, struct bfs_expr *expr, const ch
 	if (!file) {
 		goto fail;
 	}
+	xoutput_stream(file);
 
-	cfile = cfwrap(file, state->use_color ? ctx->colors : NULL, true);
+	const struct colors *colors = NULL;
+	if (state->use_color && isatty(fileno(file))) {
+		colors = parse_get_colors(ctx);
+	}
+
+	cfile = cfwrap(file, colors, true);
 	if (!cfile) {
 		goto fail;
 	}
@@ -482,17 +514,11 @@ static char **parser_advance(struct parser_state *state, enum token_type type, s
 /**
  * Parse a root path.
  */
-static int parse_root(struct parser_state *state, const char *path) {
-	char *copy = strdup(path);
-	if (!copy) {
-		parse_perror(state, "strdup()");
-		return -1;
-	}
-
+static int parse_push_root(struct parser_state *state, char *path) {
 	struct bfs_ctx *ctx = state->ctx;
-	if (DARRAY_PUSH(&ctx->paths, &copy) != 0) {
+	if (DARRAY_PUSH(&ctx->paths, &path) != 0) {
 		parse_perror(state, "DARRAY_PUSH()");
-		free(copy);
+		free(path);
 		return -1;
 	}
 
@@ -500,6 +526,59 @@ static int parse_root(struct parser_state *state, const char *path) {
 	return 0;
 }
 
+/**
+ * Read the rest of a -files0-from stream into ctx->paths, for when it can't
+ * be streamed during the search.
+ */
+static int parse_drain_files0(struct parser_state *state) {
+	struct bfs_ctx *ctx = state->ctx;
+	FILE *file = ctx->files0;
+	if (!file) {
+		return 0;
+	}
+
+	int ret = 0;
+	while (true) {
+		char *path = xgetdelim(file, '\0');
+		if (!path) {
+			if (errno) {
+				parse_argv_error(state, state->files0_arg, 2, "%m.\n");
+				ret = -1;
+			}
+			break;
+		}
+
+		ret = parse_push_root(state, path);
+		if (ret != 0) {
+			break;
+		}
+	}
+
+	if (file != stdin) {
+		fclose(file);
+	}
+	ctx->files0 = NULL;
+	return ret;
+}
+
+/**
+ * Add a root path.
+ */
+static int parse_root(struct parser_state *state, const char *path) {
+	// Keep the roots in order if there is a -files0-from stream before this
+	if (parse_drain_files0(state) != 0) {
+		return -1;
+	}
+
+	char *copy = strdup(path);
+	if (!copy) {
+		parse_perror(state, "strdup()");
+		return -1;
+	}
+
+	return parse_push_root(state, copy);
+}
+
 /**
  * While parsing an expression, skip any paths and add them to ctx->paths.
  */
@@ -778,11 +857,16 @@ static struct bfs_expr *parse_action(struct parser_state *state, bfs_eval_fn *ev
 		return NULL;
 	}
 
+	bool counted = eval_fn != eval_prune && eval_fn != eval_quit && eval_fn != eval_exit;
 	if (eval_fn != eval_prune && eval_fn != eval_quit) {
 		state->implicit_print = false;
 	}
 
-	return bfs_expr_new(eval_fn, argc, argv);
+	struct bfs_expr *expr = bfs_expr_new(eval_fn, argc, argv);
+	if (expr) {
+		expr->counted = counted;
+	}
+	return expr;
 }
 
 /**
@@ -846,9 +930,11 @@ static void debug_help(CFILE *cfile) {
 	cfprintf(cfile, "  ${bld}cost${rs}:   Show cost estimates.\n");
 	cfprintf(cfile, "  ${bld}exec${rs}:   Print executed command details.\n");
 	cfprintf(cfile, "  ${bld}opt${rs}:    Print optimization details.\n");
+	cfprintf(cfile, "  ${bld}perf${rs}:   Print performance counters at exit (${bld}perf=json${rs} for JSON).\n");
 	cfprintf(cfile, "  ${bld}rates${rs}:  Print predicate success rates.\n");
 	cfprintf(cfile, "  ${bld}search${rs}: Trace the filesystem traversal.\n");
 	cfprintf(cfile, "  ${bld}stat${rs}:   Trace all stat() calls.\n");
+	cfprintf(cfile, "  ${bld}trace=FILE${rs}: Write a timeline of the search to ${bld}FILE${rs} (Chrome trace JSON).\n");
 	cfprintf(cfile, "  ${bld}tree${rs}:   Print the parse tree.\n");
 	cfprintf(cfile, "  ${bld}all${rs}:    All debug flags at once.\n");
 }
@@ -893,6 +979,19 @@ static struct bfs_expr *parse_debug(struct parser_state *state, int arg1, int ar
 		} else if (parse_debug_flag(flag, len, "all")) {
 			ctx->debug = DEBUG_ALL;
 			continue;
+		} else if (parse_debug_flag(flag, len, "perf=json")) {
+			ctx->debug |= DEBUG_PERF;
+			ctx->perf_json = true;
+			continue;
+		} else if (len > strlen("trace=") && strncmp(flag, "trace=", strlen("trace=")) == 0) {
+			free(ctx->trace_path);
+			ctx->trace_path = strndup(flag + strlen("trace="), len - strlen("trace="));
+			if (!ctx->trace_path) {
+				parse_perror(state, "strndup()");
+				bfs_expr_free(expr);
+				return NULL;
+			}
+			continue;
 		}
 
 		enum debug_flags i;
@@ -985,7 +1084,12 @@ static struct bfs_expr *parse_access(struct parser_state *state, int flag, int a
  */
 static struct bfs_expr *parse_acl(struct parser_state *state, int flag, int arg2) {
 #if BFS_CAN_CHECK_ACL
-	return parse_nullary_test(state, eval_acl);
+	struct bfs_expr *expr = parse_nullary_test(state, eval_acl);
+	if (expr) {
+		// For the fd that attribute checks may share
+		expr->ephemeral_fds = 1;
+	}
+	return expr;
 #else
 	parse_error(state, "Missing platform support.\n");
 	return NULL;
@@ -1105,7 +1209,12 @@ fail:
  */
 static struct bfs_expr *parse_capable(struct parser_state *state, int flag, int arg2) {
 #if BFS_CAN_CHECK_CAPABILITIES
-	return parse_nullary_test(state, eval_capable);
+	struct bfs_expr *expr = parse_nullary_test(state, eval_capable);
+	if (expr) {
+		// For the fd that attribute checks may share
+		expr->ephemeral_fds = 1;
+	}
+	return expr;
 #else
 	parse_error(state, "Missing platform support.\n");
 	return NULL;
@@ -1122,9 +1231,9 @@ static struct bfs_expr *parse_color(struct parser_state *state, int color, int a
 	}
 
 	struct bfs_ctx *ctx = state->ctx;
-	struct colors *colors = ctx->colors;
 
 	if (color) {
+		struct colors *colors = parse_get_colors(ctx);
 		if (!colors) {
 			parse_expr_error(state, expr, "Error parsing $$LS_COLORS: %s.\n", strerror(ctx->colors_error));
 			bfs_expr_free(expr);
@@ -1150,6 +1259,69 @@ static struct bfs_expr *parse_const(struct parser_state *state, int value, int a
 	return parse_nullary_test(state, value ? eval_true : eval_false);
 }
 
+/** The largest CPU number -cpus accepts. */
+#define MAX_CPU 65535
+
+/**
+ * Parse -cpus LIST.
+ */
+static struct bfs_expr *parse_cpus(struct parser_state *state, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(state);
+	if (!expr) {
+		return NULL;
+	}
+
+	// Later -cpus replace earlier ones
+	darray_free(state->ctx->cpus);
+	state->ctx->cpus = NULL;
+
+	const char *str = expr->argv[1];
+	while (true) {
+		int lo, hi;
+		str = parse_int(state, &expr->argv[1], str, &lo, IF_INT | IF_UNSIGNED | IF_PARTIAL_OK);
+		if (!str) {
+			goto fail;
+		}
+
+		hi = lo;
+		if (*str == '-') {
+			str = parse_int(state, &expr->argv[1], str + 1, &hi, IF_INT | IF_UNSIGNED | IF_PARTIAL_OK);
+			if (!str) {
+				goto fail;
+			}
+		}
+
+		if (hi < lo) {
+			parse_expr_error(state, expr, "Empty CPU range ${bld}%d-%d${rs}.\n", lo, hi);
+			goto fail;
+		} else if (hi > MAX_CPU) {
+			parse_expr_error(state, expr, "CPU ${bld}%d${rs} is too large.\n", hi);
+			goto fail;
+		}
+
+		for (unsigned int cpu = lo; cpu <= (unsigned int)hi; ++cpu) {
+			if (DARRAY_PUSH(&state->ctx->cpus, &cpu) != 0) {
+				parse_perror(state, "DARRAY_PUSH()");
+				goto fail;
+			}
+		}
+
+		if (*str == '\0') {
+			break;
+		} else if (*str != ',') {
+			parse_expr_error(state, expr, "Expected a list like ${bld}0-3,8${rs}.\n");
+			goto fail;
+		}
+		++str;
+	}
+
+	return expr;
+
+fail:
+	bfs_expr_free(expr);
+	return NULL;
+}
+
 /**
  * Parse -daystart.
  */
@@ -1188,6 +1360,23 @@ static struct bfs_expr *parse_delete(struct parser_state *state, int arg1, int a
 	return parse_nullary_action(state, eval_delete);
 }
 
+/**
+ * Parse -du.
+ */
+static struct bfs_expr *parse_du(struct parser_state *state, int arg1, int arg2) {
+	state->ctx->flags |= BFTW_POST_ORDER;
+	state->ctx->du = true;
+	state->depth_arg = state->argv;
+
+	struct bfs_expr *expr = parse_nullary_action(state, eval_du);
+	if (!expr) {
+		return NULL;
+	}
+
+	init_print_expr(state, expr);
+	return expr;
+}
+
 /**
  * Parse -d.
  */
@@ -1268,11 +1457,38 @@ static struct bfs_expr *parse_exec(struct parser_state *state, int flags, int ar
 
 	if (execbuf->flags & BFS_EXEC_CONFIRM) {
 		state->ok_expr = expr;
+	} else {
+		state->exec_expr = expr;
 	}
 
 	return expr;
 }
 
+/**
+ * Parse -exec-jobs N.
+ */
+static struct bfs_expr *parse_exec_jobs(struct parser_state *state, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(state);
+	if (!expr) {
+		return NULL;
+	}
+
+	int n;
+	if (!parse_int(state, &expr->argv[1], expr->argv[1], &n, IF_INT | IF_UNSIGNED)) {
+		bfs_expr_free(expr);
+		return NULL;
+	}
+
+	if (n == 0) {
+		parse_expr_error(state, expr, "${bld}0${rs} is not enough jobs.\n");
+		bfs_expr_free(expr);
+		return NULL;
+	}
+
+	state->ctx->exec_jobs = n;
+	return expr;
+}
+
 /**
  * Parse -exit [STATUS].
  */
@@ -1318,6 +1534,10 @@ static struct bfs_expr *parse_files0_from(struct parser_state *state, int arg1,
 		return NULL;
 	}
 
+	if (parse_drain_files0(state) != 0) {
+		goto fail_expr;
+	}
+
 	state->files0_arg = expr->argv;
 	const char *from = expr->argv[1];
 
@@ -1332,26 +1552,23 @@ static struct bfs_expr *parse_files0_from(struct parser_state *state, int arg1,
 		goto fail;
 	}
 
-	while (true) {
-		char *path = xgetdelim(file, '\0');
-		if (!path) {
-			if (errno) {
-				goto fail;
-			} else {
-				break;
-			}
-		}
+	if (file == stdin) {
+		state->files0_stdin_arg = state->files0_arg;
+	}
 
-		int ret = parse_root(state, path);
-		free(path);
-		if (ret != 0) {
+	// Read the first path now, and the rest as the search goes, to keep
+	// memory bounded for huge inputs
+	char *path = xgetdelim(file, '\0');
+	if (path) {
+		if (parse_push_root(state, path) != 0) {
 			goto fail;
 		}
-	}
-
-	if (file == stdin) {
-		state->files0_stdin_arg = state->files0_arg;
-	} else {
+		state->ctx->files0 = file;
+		state->ctx->files0_path = from;
+	} else if (errno) {
+		parse_expr_error(state, expr, "%m.\n");
+		goto fail;
+	} else if (file != stdin) {
 		fclose(file);
 	}
 
@@ -1362,6 +1579,7 @@ fail:
 	if (file && file != stdin) {
 		fclose(file);
 	}
+fail_expr:
 	bfs_expr_free(expr);
 	return NULL;
 }
@@ -1457,6 +1675,23 @@ fail:
 	return NULL;
 }
 
+/**
+ * Parse -fprintb FILE.
+ */
+static struct bfs_expr *parse_fprintb(struct parser_state *state, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_action(state, eval_fprintb);
+	if (expr) {
+		if (expr_open(state, expr, expr->argv[1]) != 0) {
+			goto fail;
+		}
+	}
+	return expr;
+
+fail:
+	bfs_expr_free(expr);
+	return NULL;
+}
+
 /**
  * Parse -fprintf FILE FORMAT.
  */
@@ -1592,6 +1827,99 @@ fail:
 	return NULL;
 }
 
+/**
+ * Parse a user name or ID for -chown.
+ */
+static int parse_chown_user(struct parser_state *state, struct bfs_expr *expr, const char *name, uid_t *uid) {
+	const struct passwd *pwd = bfs_getpwnam(state->ctx->users, name);
+	if (pwd) {
+		*uid = pwd->pw_uid;
+		return 0;
+	} else if (errno) {
+		parse_expr_error(state, expr, "%m.\n");
+		return -1;
+	}
+
+	long long id;
+	if (!parse_int(state, NULL, name, &id, 10 | IF_LONG_LONG | IF_UNSIGNED | IF_QUIET) || (uid_t)id != id) {
+		parse_expr_error(state, expr, "No such user.\n");
+		return -1;
+	}
+
+	*uid = id;
+	return 0;
+}
+
+/**
+ * Parse a group name or ID for -chown.
+ */
+static int parse_chown_group(struct parser_state *state, struct bfs_expr *expr, const char *name, gid_t *gid) {
+	const struct group *grp = bfs_getgrnam(state->ctx->groups, name);
+	if (grp) {
+		*gid = grp->gr_gid;
+		return 0;
+	} else if (errno) {
+		parse_expr_error(state, expr, "%m.\n");
+		return -1;
+	}
+
+	long long id;
+	if (!parse_int(state, NULL, name, &id, 10 | IF_LONG_LONG | IF_UNSIGNED | IF_QUIET) || (gid_t)id != id) {
+		parse_expr_error(state, expr, "No such group.\n");
+		return -1;
+	}
+
+	*gid = id;
+	return 0;
+}
+
+/**
+ * Parse -chown [USER][:GROUP].
+ */
+static struct bfs_expr *parse_chown(struct parser_state *state, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_action(state, eval_chown);
+	if (!expr) {
+		return NULL;
+	}
+
+	expr->uid = -1;
+	expr->gid = -1;
+
+	const char *arg = expr->argv[1];
+	const char *group = strchr(arg, ':');
+	size_t len = group ? (size_t)(group++ - arg) : strlen(arg);
+	if (len == 0 && (!group || !group[0])) {
+		parse_expr_error(state, expr, "Expected a user and/or group.\n");
+		goto fail;
+	}
+
+	if (len > 0) {
+		char *user = strndup(arg, len);
+		if (!user) {
+			parse_perror(state, "strndup()");
+			goto fail;
+		}
+
+		int ret = parse_chown_user(state, expr, user, &expr->uid);
+		free(user);
+		if (ret != 0) {
+			goto fail;
+		}
+	}
+
+	if (group && group[0]) {
+		if (parse_chown_group(state, expr, group, &expr->gid) != 0) {
+			goto fail;
+		}
+	}
+
+	return expr;
+
+fail:
+	bfs_expr_free(expr);
+	return NULL;
+}
+
 /**
  * Parse -hidden.
  */
@@ -1607,6 +1935,36 @@ static struct bfs_expr *parse_ignore_races(struct parser_state *state, int ignor
 	return parse_nullary_option(state);
 }
 
+/**
+ * Parse -incremental FILE.
+ */
+static struct bfs_expr *parse_incremental(struct parser_state *state, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(state);
+	if (expr) {
+		state->ctx->incremental_path = expr->argv[1];
+	}
+	return expr;
+}
+
+/**
+ * Parse -index FILE.
+ */
+static struct bfs_expr *parse_index(struct parser_state *state, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(state);
+	if (expr) {
+		state->ctx->index_path = expr->argv[1];
+	}
+	return expr;
+}
+
+/**
+ * Parse -inode_order.
+ */
+static struct bfs_expr *parse_inode_order(struct parser_state *state, int arg1, int arg2) {
+	state->ctx->flags |= BFTW_INO_ORDER;
+	return parse_nullary_option(state);
+}
+
 /**
  * Parse -inum N.
  */
@@ -1615,7 +1973,80 @@ static struct bfs_expr *parse_inum(struct parser_state *state, int arg1, int arg
 }
 
 /**
- * Parse -j<n>.
+ * Parse -iolimit TYPE=N.
+ */
+static struct bfs_expr *parse_iolimit(struct parser_state *state, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(state);
+	if (!expr) {
+		return NULL;
+	}
+
+	const char *arg = expr->argv[1];
+	const char *eq = strrchr(arg, '=');
+	if (!eq || eq == arg) {
+		parse_expr_error(state, expr, "Expected ${bld}TYPE=N${rs}.\n");
+		goto fail;
+	}
+
+	int limit;
+	if (!parse_int(state, &expr->argv[1], eq + 1, &limit, IF_INT | IF_UNSIGNED)) {
+		goto fail;
+	}
+
+	if (!bfs_ctx_mtab(state->ctx)) {
+		parse_expr_error(state, expr, "Couldn't parse the mount table: %m.\n");
+		goto fail;
+	}
+
+	struct bftw_iolimit iolimit = {
+		.fstype = strndup(arg, eq - arg),
+		.limit = limit,
+	};
+	if (!iolimit.fstype) {
+		parse_perror(state, "strndup()");
+		goto fail;
+	}
+
+	if (DARRAY_PUSH(&state->ctx->iolimits, &iolimit) != 0) {
+		parse_perror(state, "DARRAY_PUSH()");
+		free((char *)iolimit.fstype);
+		goto fail;
+	}
+
+	return expr;
+
+fail:
+	bfs_expr_free(expr);
+	return NULL;
+}
+
+/**
+ * Parse -limit N.
+ */
+static struct bfs_expr *parse_limit(struct parser_state *state, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(state);
+	if (!expr) {
+		return NULL;
+	}
+
+	int n;
+	if (!parse_int(state, &expr->argv[1], expr->argv[1], &n, IF_INT | IF_UNSIGNED)) {
+		bfs_expr_free(expr);
+		return NULL;
+	}
+
+	if (n == 0) {
+		parse_expr_error(state, expr, "${bld}0${rs} is not enough actions.\n");
+		bfs_expr_free(expr);
+		return NULL;
+	}
+
+	state->ctx->limit = n;
+	return expr;
+}
+
+/**
+ * Parse -j<n>, or -jauto.
  */
 static struct bfs_expr *parse_jobs(struct parser_state *state, int arg1, int arg2) {
 	struct bfs_expr *expr = parse_nullary_flag(state);
@@ -1623,6 +2054,12 @@ static struct bfs_expr *parse_jobs(struct parser_state *state, int arg1, int arg
 		return NULL;
 	}
 
+	if (strcmp(expr->argv[0] + 2, "auto") == 0) {
+		state->ctx->threads = 0;
+		state->ctx->autotune = true;
+		return expr;
+	}
+
 	unsigned int n;
 	if (!parse_int(state, expr->argv, expr->argv[0] + 2, &n, IF_INT | IF_UNSIGNED)) {
 		bfs_expr_free(expr);
@@ -1636,6 +2073,7 @@ static struct bfs_expr *parse_jobs(struct parser_state *state, int arg1, int arg
 	}
 
 	state->ctx->threads = n;
+	state->ctx->autotune = false;
 	return expr;
 }
 
@@ -1721,6 +2159,16 @@ static struct bfs_expr *parse_fnmatch(const struct parser_state *state, struct b
 	//
 	//     https://pubs.opengroup.org/onlinepubs/9699919799/utilities/V3_chap02.html#tag_18_13_01
 	expr->literal = strcspn(expr->pattern, "?*\\[") == len;
+	if (expr->literal) {
+		expr->pattern_len = len;
+		expr->ascii = true;
+		for (i = 0; i < len; ++i) {
+			if ((unsigned char)expr->pattern[i] >= 0x80) {
+				expr->ascii = false;
+				break;
+			}
+		}
+	}
 
 	return expr;
 }
@@ -1892,247 +2340,57 @@ static struct bfs_expr *parse_nohidden(struct parser_state *state, int arg1, int
 
 	if (parse_exclude(state, hidden) != 0) {
 		return NULL;
-	}
-
-	return parse_nullary_option(state);
-}
-
-/**
- * Parse -noleaf.
- */
-static struct bfs_expr *parse_noleaf(struct parser_state *state, int arg1, int arg2) {
-	parse_warning(state, "${ex}%s${rs} does not apply the optimization that ${blu}%s${rs} inhibits.\n\n",
-	              BFS_COMMAND, state->argv[0]);
-	return parse_nullary_option(state);
-}
-
-/**
- * Parse -nouser.
- */
-static struct bfs_expr *parse_nouser(struct parser_state *state, int arg1, int arg2) {
-	struct bfs_expr *expr = parse_nullary_test(state, eval_nouser);
-	if (expr) {
-		// Who knows how many FDs getpwuid_r() needs?  Probably at least
-		// one for /etc/passwd
-		expr->ephemeral_fds = 1;
-	}
-	return expr;
-}
-
-/**
- * Parse a permission mode like chmod(1).
- */
-static int parse_mode(const struct parser_state *state, const char *mode, struct bfs_expr *expr) {
-	if (mode[0] >= '0' && mode[0] <= '9') {
-		unsigned int parsed;
-		if (!parse_int(state, NULL, mode, &parsed, 8 | IF_INT | IF_UNSIGNED | IF_QUIET)) {
-			goto fail;
-		}
-		if (parsed > 07777) {
-			goto fail;
-		}
-
-		expr->file_mode = parsed;
-		expr->dir_mode = parsed;
-		return 0;
-	}
-
-	expr->file_mode = 0;
-	expr->dir_mode = 0;
-
-	// Parse the same grammar as chmod(1), which looks like this:
-	//
-	// MODE : CLAUSE ["," CLAUSE]*
-	//
-	// CLAUSE : WHO* ACTION+
-	//
-	// WHO : "u" | "g" | "o" | "a"
-	//
-	// ACTION : OP PERM*
-	//        | OP PERMCOPY
-	//
-	// OP : "+" | "-" | "="
-	//
-	// PERM : "r" | "w" | "x" | "X" | "s" | "t"
-	//
-	// PERMCOPY : "u" | "g" | "o"
-
-	// State machine state
-	enum {
-		MODE_CLAUSE,
-		MODE_WHO,
-		MODE_ACTION,
-		MODE_ACTION_APPLY,
-		MODE_OP,
-		MODE_PERM,
-	} mstate = MODE_CLAUSE;
-
-	enum {
-		MODE_PLUS,
-		MODE_MINUS,
-		MODE_EQUALS,
-	} op = uninit(op, MODE_EQUALS);
-
-	mode_t who = uninit(who, 0);
-	mode_t file_change = uninit(file_change, 0);
-	mode_t dir_change = uninit(dir_change, 0);
-
-	const char *i = mode;
-	while (true) {
-		switch (mstate) {
-		case MODE_CLAUSE:
-			who = 0;
-			mstate = MODE_WHO;
-			fallthru;
-
-		case MODE_WHO:
-			switch (*i) {
-			case 'u':
-				who |= 0700;
-				break;
-			case 'g':
-				who |= 0070;
-				break;
-			case 'o':
-				who |= 0007;
-				break;
-			case 'a':
-				who |= 0777;
-				break;
-			default:
-				mstate = MODE_ACTION;
-				continue;
-			}
-			break;
-
-		case MODE_ACTION_APPLY:
-			switch (op) {
-			case MODE_EQUALS:
-				expr->file_mode &= ~who;
-				expr->dir_mode &= ~who;
-				fallthru;
-			case MODE_PLUS:
-				expr->file_mode |= file_change;
-				expr->dir_mode |= dir_change;
-				break;
-			case MODE_MINUS:
-				expr->file_mode &= ~file_change;
-				expr->dir_mode &= ~dir_change;
-				break;
-			}
-			fallthru;
-
-		case MODE_ACTION:
-			if (who == 0) {
-				who = 0777;
-			}
-
-			switch (*i) {
-			case '+':
-				op = MODE_PLUS;
-				mstate = MODE_OP;
-				break;
-			case '-':
-				op = MODE_MINUS;
-				mstate = MODE_OP;
-				break;
-			case '=':
-				op = MODE_EQUALS;
-				mstate = MODE_OP;
-				break;
-
-			case ',':
-				if (mstate == MODE_ACTION_APPLY) {
-					mstate = MODE_CLAUSE;
-				} else {
-					goto fail;
-				}
-				break;
-
-			case '\0':
-				if (mstate == MODE_ACTION_APPLY) {
-					goto done;
-				} else {
-					goto fail;
-				}
-
-			default:
-				goto fail;
-			}
-			break;
+	}
 
-		case MODE_OP:
-			switch (*i) {
-			case 'u':
-				file_change = (expr->file_mode >> 6) & 07;
-				dir_change = (expr->dir_mode >> 6) & 07;
-				break;
-			case 'g':
-				file_change = (expr->file_mode >> 3) & 07;
-				dir_change = (expr->dir_mode >> 3) & 07;
-				break;
-			case 'o':
-				file_change = expr->file_mode & 07;
-				dir_change = expr->dir_mode & 07;
-				break;
+	return parse_nullary_option(state);
+}
 
-			default:
-				file_change = 0;
-				dir_change = 0;
-				mstate = MODE_PERM;
-				continue;
-			}
+/**
+ * Parse -noleaf.
+ */
+static struct bfs_expr *parse_noleaf(struct parser_state *state, int arg1, int arg2) {
+	parse_warning(state, "${ex}%s${rs} does not apply the optimization that ${blu}%s${rs} inhibits.\n\n",
+	              BFS_COMMAND, state->argv[0]);
+	return parse_nullary_option(state);
+}
 
-			file_change |= (file_change << 6) | (file_change << 3);
-			file_change &= who;
-			dir_change |= (dir_change << 6) | (dir_change << 3);
-			dir_change &= who;
-			mstate = MODE_ACTION_APPLY;
-			break;
+/**
+ * Parse -nouser.
+ */
+static struct bfs_expr *parse_nouser(struct parser_state *state, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_nullary_test(state, eval_nouser);
+	if (expr) {
+		// Who knows how many FDs getpwuid_r() needs?  Probably at least
+		// one for /etc/passwd
+		expr->ephemeral_fds = 1;
+	}
+	return expr;
+}
 
-		case MODE_PERM:
-			switch (*i) {
-			case 'r':
-				file_change |= who & 0444;
-				dir_change |= who & 0444;
-				break;
-			case 'w':
-				file_change |= who & 0222;
-				dir_change |= who & 0222;
-				break;
-			case 'x':
-				file_change |= who & 0111;
-				fallthru;
-			case 'X':
-				dir_change |= who & 0111;
-				break;
-			case 's':
-				if (who & 0700) {
-					file_change |= S_ISUID;
-					dir_change |= S_ISUID;
-				}
-				if (who & 0070) {
-					file_change |= S_ISGID;
-					dir_change |= S_ISGID;
-				}
-				break;
-			case 't':
-				if (who & 0007) {
-					file_change |= S_ISVTX;
-					dir_change |= S_ISVTX;
-				}
-				break;
-			default:
-				mstate = MODE_ACTION_APPLY;
-				continue;
-			}
-			break;
+/**
+ * Parse a permission mode like chmod(1).
+ */
+static int parse_mode(const struct parser_state *state, const char *mode, struct bfs_expr *expr) {
+	if (mode[0] >= '0' && mode[0] <= '9') {
+		unsigned int parsed;
+		if (!parse_int(state, NULL, mode, &parsed, 8 | IF_INT | IF_UNSIGNED | IF_QUIET)) {
+			goto fail;
+		}
+		if (parsed > 07777) {
+			goto fail;
 		}
 
-		++i;
+		expr->file_mode = parsed;
+		expr->dir_mode = parsed;
+		return 0;
+	}
+
+	expr->file_mode = 0;
+	expr->dir_mode = 0;
+	if (xstrtomode(mode, &expr->file_mode, &expr->dir_mode) != 0) {
+		goto fail;
 	}
 
-done:
 	return 0;
 
 fail:
@@ -2182,6 +2440,49 @@ fail:
 	return NULL;
 }
 
+/**
+ * Parse -chmod MODE.
+ */
+static struct bfs_expr *parse_chmod(struct parser_state *state, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_action(state, eval_chmod);
+	if (!expr) {
+		return NULL;
+	}
+
+	if (parse_mode(state, expr->argv[1], expr) != 0) {
+		bfs_expr_free(expr);
+		return NULL;
+	}
+
+	// Like chmod(1), symbolic modes with no user class respect the umask.
+	// There's no way to read it without setting it, but nothing else is
+	// running yet.
+	expr->cmask = umask(0);
+	umask(expr->cmask);
+
+	return expr;
+}
+
+/**
+ * Parse -preload_users.
+ */
+static struct bfs_expr *parse_preload_users(struct parser_state *state, int arg1, int arg2) {
+	struct bfs_ctx *ctx = state->ctx;
+	if (!ctx->preload_users) {
+		if (bfs_users_preload(ctx->users) != 0) {
+			parse_error(state, "Couldn't load the user database: %m.\n");
+			return NULL;
+		}
+		if (bfs_groups_preload(ctx->groups) != 0) {
+			parse_error(state, "Couldn't load the group database: %m.\n");
+			return NULL;
+		}
+		ctx->preload_users = true;
+	}
+
+	return parse_nullary_option(state);
+}
+
 /**
  * Parse -print.
  */
@@ -2204,6 +2505,17 @@ static struct bfs_expr *parse_print0(struct parser_state *state, int arg1, int a
 	return expr;
 }
 
+/**
+ * Parse -printb.
+ */
+static struct bfs_expr *parse_printb(struct parser_state *state, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_nullary_action(state, eval_fprintb);
+	if (expr) {
+		init_print_expr(state, expr);
+	}
+	return expr;
+}
+
 /**
  * Parse -printf FORMAT.
  */
@@ -2242,6 +2554,17 @@ static struct bfs_expr *parse_prune(struct parser_state *state, int arg1, int ar
 	return parse_nullary_action(state, eval_prune);
 }
 
+/**
+ * Parse -profile FILE.
+ */
+static struct bfs_expr *parse_profile(struct parser_state *state, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(state);
+	if (expr) {
+		state->ctx->profile_path = expr->argv[1];
+	}
+	return expr;
+}
+
 /**
  * Parse -quit.
  */
@@ -2343,6 +2666,31 @@ list_types:
 	return NULL;
 }
 
+/**
+ * Parse -root-threads N.
+ */
+static struct bfs_expr *parse_root_threads(struct parser_state *state, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(state);
+	if (!expr) {
+		return NULL;
+	}
+
+	int n;
+	if (!parse_int(state, &expr->argv[1], expr->argv[1], &n, IF_INT | IF_UNSIGNED)) {
+		bfs_expr_free(expr);
+		return NULL;
+	}
+
+	if (n == 0) {
+		parse_expr_error(state, expr, "${bld}0${rs} is not enough threads.\n");
+		bfs_expr_free(expr);
+		return NULL;
+	}
+
+	state->ctx->root_threads = n;
+	return expr;
+}
+
 /**
  * Parse -s.
  */
@@ -2393,6 +2741,8 @@ static struct bfs_expr *parse_search_strategy(struct parser_state *state, int ar
 		ctx->strategy = BFTW_IDS;
 	} else if (strcmp(arg, "eds") == 0) {
 		ctx->strategy = BFTW_EDS;
+	} else if (strcmp(arg, "par") == 0) {
+		ctx->strategy = BFTW_PARALLEL;
 	} else if (strcmp(arg, "help") == 0) {
 		state->just_info = true;
 		cfile = ctx->cout;
@@ -2410,6 +2760,7 @@ list_strategies:
 	cfprintf(cfile, "  ${bld}dfs${rs}: depth-first search\n");
 	cfprintf(cfile, "  ${bld}ids${rs}: iterative deepening search\n");
 	cfprintf(cfile, "  ${bld}eds${rs}: exponential deepening search\n");
+	cfprintf(cfile, "  ${bld}par${rs}: parallel search (unordered)\n");
 
 	bfs_expr_free(expr);
 	return NULL;
@@ -2436,6 +2787,56 @@ fail:
 	return NULL;
 }
 
+/**
+ * Parse -shard I/N[:DEPTH].
+ */
+static struct bfs_expr *parse_shard(struct parser_state *state, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(state);
+	if (!expr) {
+		return NULL;
+	}
+
+	int shard, nshards, depth = 1;
+	const char *str = parse_int(state, &expr->argv[1], expr->argv[1], &shard, IF_INT | IF_UNSIGNED | IF_PARTIAL_OK);
+	if (!str) {
+		goto fail;
+	} else if (*str != '/') {
+		goto bad;
+	}
+
+	str = parse_int(state, &expr->argv[1], str + 1, &nshards, IF_INT | IF_UNSIGNED | IF_PARTIAL_OK);
+	if (!str) {
+		goto fail;
+	}
+
+	if (*str == ':') {
+		str = parse_int(state, &expr->argv[1], str + 1, &depth, IF_INT | IF_UNSIGNED | IF_PARTIAL_OK);
+		if (!str) {
+			goto fail;
+		}
+	}
+
+	if (*str) {
+		goto bad;
+	}
+
+	if (shard < 1 || shard > nshards) {
+		parse_expr_error(state, expr, "Shard ${bld}%d${rs} is not between ${bld}1${rs} and ${bld}%d${rs}.\n", shard, nshards);
+		goto fail;
+	}
+
+	state->ctx->shard = shard;
+	state->ctx->nshards = nshards;
+	state->ctx->shard_depth = depth;
+	return expr;
+
+bad:
+	parse_expr_error(state, expr, "Expected ${bld}I/N${rs} or ${bld}I/N:DEPTH${rs}.\n");
+fail:
+	bfs_expr_free(expr);
+	return NULL;
+}
+
 /**
  * Parse -size N[cwbkMGTP]?.
  */
@@ -2501,6 +2902,63 @@ static struct bfs_expr *parse_sparse(struct parser_state *state, int arg1, int a
 	return parse_nullary_test(state, eval_sparse);
 }
 
+/**
+ * Parse -spill SIZE[kMG]?.
+ */
+static struct bfs_expr *parse_spill(struct parser_state *state, int arg1, int arg2) {
+	struct bfs_expr *expr = parse_unary_option(state);
+	if (!expr) {
+		return NULL;
+	}
+
+	long long size;
+	const char *unit = parse_int(state, &expr->argv[1], expr->argv[1], &size, IF_PARTIAL_OK | IF_LONG_LONG | IF_UNSIGNED);
+	if (!unit) {
+		goto fail;
+	}
+
+	if (strlen(unit) > 1) {
+		goto bad_unit;
+	}
+
+	int shift;
+	switch (*unit) {
+	case '\0':
+		shift = 0;
+		break;
+	case 'k':
+		shift = 10;
+		break;
+	case 'M':
+		shift = 20;
+		break;
+	case 'G':
+		shift = 30;
+		break;
+	default:
+		goto bad_unit;
+	}
+
+	if (size == 0) {
+		parse_expr_error(state, expr, "${bld}0${rs} is not enough memory.\n");
+		goto fail;
+	}
+
+	if ((unsigned long long)size > SIZE_MAX >> shift) {
+		parse_expr_error(state, expr, "${bld}%pq${rs} is too big.\n", expr->argv[1]);
+		goto fail;
+	}
+
+	state->ctx->spill_limit = (size_t)size << shift;
+	return expr;
+
+bad_unit:
+	parse_expr_error(state, expr, "Expected a size unit (one of ${bld}kMG${rs}); found ${err}%pq${rs}.\n", unit);
+fail:
+	bfs_expr_free(expr);
+	return NULL;
+}
+
 /**
  * Parse -status.
  */
@@ -2509,6 +2967,13 @@ static struct bfs_expr *parse_status(struct parser_state *state, int arg1, int a
 	return parse_nullary_option(state);
 }
 
+/**
+ * Parse -touch.
+ */
+static struct bfs_expr *parse_touch(struct parser_state *state, int arg1, int arg2) {
+	return parse_nullary_action(state, eval_touch);
+}
+
 /**
  * Parse -x?type [bcdpflsD].
  */
@@ -2588,12 +3053,30 @@ static struct bfs_expr *parse_warn(struct parser_state *state, int warn, int arg
 	return parse_nullary_option(state);
 }
 
+/**
+ * Parse -watch.
+ */
+static struct bfs_expr *parse_watch(struct parser_state *state, int arg1, int arg2) {
+#if BFS_CAN_WATCH
+	state->ctx->watch = true;
+	return parse_nullary_option(state);
+#else
+	parse_error(state, "Missing platform support.\n");
+	return NULL;
+#endif
+}
+
 /**
  * Parse -xattr.
  */
 static struct bfs_expr *parse_xattr(struct parser_state *state, int arg1, int arg2) {
 #if BFS_CAN_CHECK_XATTRS
-	return parse_nullary_test(state, eval_xattr);
+	struct bfs_expr *expr = parse_nullary_test(state, eval_xattr);
+	if (expr) {
+		// For the fd that attribute checks may share
+		expr->ephemeral_fds = 1;
+	}
+	return expr;
 #else
 	parse_error(state, "Missing platform support.\n");
 	return NULL;
@@ -2605,7 +3088,12 @@ static struct bfs_expr *parse_xattr(struct parser_state *state, int arg1, int ar
  */
 static struct bfs_expr *parse_xattrname(struct parser_state *state, int arg1, int arg2) {
 #if BFS_CAN_CHECK_XATTRS
-	return parse_unary_test(state, eval_xattrname);
+	struct bfs_expr *expr = parse_unary_test(state, eval_xattrname);
+	if (expr) {
+		// For the fd that attribute checks may share
+		expr->ephemeral_fds = 1;
+	}
+	return expr;
 #else
 	parse_error(state, "Missing platform support.\n");
 	return NULL;
@@ -2761,11 +3249,15 @@ static struct bfs_expr *parse_help(struct parser_state *state, int arg1, int arg
 	cfprintf(cout, "      Turn on a debugging flag (see ${cyn}-D${rs} ${bld}help${rs})\n");
 	cfprintf(cout, "  ${cyn}-O${bld}N${rs}\n");
 	cfprintf(cout, "      Enable optimization level ${bld}N${rs} (default: ${bld}3${rs})\n");
-	cfprintf(cout, "  ${cyn}-S${rs} ${bld}bfs${rs}|${bld}dfs${rs}|${bld}ids${rs}|${bld}eds${rs}\n");
-	cfprintf(cout, "      Use ${bld}b${rs}readth-${bld}f${rs}irst/${bld}d${rs}epth-${bld}f${rs}irst/${bld}i${rs}terative/${bld}e${rs}xponential ${bld}d${rs}eepening ${bld}s${rs}earch\n");
+	cfprintf(cout, "  ${cyn}-S${rs} ${bld}bfs${rs}|${bld}dfs${rs}|${bld}ids${rs}|${bld}eds${rs}|${bld}par${rs}\n");
+	cfprintf(cout, "      Use ${bld}b${rs}readth-${bld}f${rs}irst/${bld}d${rs}epth-${bld}f${rs}irst/${bld}i${rs}terative/${bld}e${rs}xponential ${bld}d${rs}eepening ${bld}s${rs}earch,\n");
+	cfprintf(cout, "      or an unordered ${bld}par${rs}allel search\n");
 	cfprintf(cout, "      (default: ${cyn}-S${rs} ${bld}bfs${rs})\n");
 	cfprintf(cout, "  ${cyn}-j${bld}N${rs}\n");
-	cfprintf(cout, "      Search with ${bld}N${rs} threads in parallel (default: number of CPUs, up to ${bld}8${rs})\n\n");
+	cfprintf(cout, "      Search with ${bld}N${rs} threads in parallel (default: number of CPUs, up to ${bld}8${rs})\n");
+	cfprintf(cout, "  ${cyn}-j${bld}auto${rs}\n");
+	cfprintf(cout, "      Adjust the number of I/O threads as the search runs, based on how slow the file\n");
+	cfprintf(cout, "      system is\n\n");
 
 	cfprintf(cout, "${bld}Operators:${rs}\n\n");
 
@@ -2794,10 +3286,14 @@ static struct bfs_expr *parse_help(struct parser_state *state, int arg1, int arg
 	cfprintf(cout, "  ${blu}-nocolor${rs}\n");
 	cfprintf(cout, "      Turn colors on or off (default: ${blu}-color${rs} if outputting to a terminal,\n");
 	cfprintf(cout, "      ${blu}-nocolor${rs} otherwise)\n");
+	cfprintf(cout, "  ${blu}-cpus${rs} ${bld}LIST${rs}\n");
+	cfprintf(cout, "      Run all threads on the CPUs in ${bld}LIST${rs} (e.g. ${bld}0-7,16-23${rs})\n");
 	cfprintf(cout, "  ${blu}-daystart${rs}\n");
 	cfprintf(cout, "      Measure times relative to the start of today\n");
 	cfprintf(cout, "  ${blu}-depth${rs}\n");
 	cfprintf(cout, "      Search in post-order (descendents first)\n");
+	cfprintf(cout, "  ${blu}-exec-jobs${rs} ${bld}N${rs}\n");
+	cfprintf(cout, "      Run up to ${bld}N${rs} ${blu}-exec${rs}/${blu}-execdir${rs} ... ${bld}{} +${rs} commands at once (default: ${bld}1${rs})\n");
 	cfprintf(cout, "  ${blu}-files0-from${rs} ${bld}FILE${rs}\n");
 	cfprintf(cout, "      Search the NUL ('\\0')-separated paths from ${bld}FILE${rs} (${bld}-${rs} for standard input).\n");
 	cfprintf(cout, "  ${blu}-follow${rs}\n");
@@ -2807,6 +3303,19 @@ static struct bfs_expr *parse_help(struct parser_state *state, int arg1, int arg
 	cfprintf(cout, "      Whether to report an error if ${ex}%s${rs} detects that the file tree is modified\n",
 	         BFS_COMMAND);
 	cfprintf(cout, "      during the search (default: ${blu}-noignore_readdir_race${rs})\n");
+	cfprintf(cout, "  ${blu}-incremental${rs} ${bld}FILE${rs}\n");
+	cfprintf(cout, "      Skip files in directories that haven't changed since the last search that used\n");
+	cfprintf(cout, "      the same snapshot ${bld}FILE${rs} (but still search their subdirectories), and update it\n");
+	cfprintf(cout, "  ${blu}-index${rs} ${bld}FILE${rs}\n");
+	cfprintf(cout, "      Skip reading directories that haven't changed since the last search that used\n");
+	cfprintf(cout, "      the same index ${bld}FILE${rs}, and update it\n");
+	cfprintf(cout, "  ${blu}-inode_order${rs}\n");
+	cfprintf(cout, "      Open and ${blu}stat()${rs} each directory's entries in inode number order, to reduce\n");
+	cfprintf(cout, "      seeking on rotational disks\n");
+	cfprintf(cout, "  ${blu}-iolimit${rs} ${bld}TYPE${rs}=${bld}N${rs}\n");
+	cfprintf(cout, "      Keep at most ${bld}N${rs} background I/O requests outstanding to each ${bld}TYPE${rs} filesystem\n");
+	cfprintf(cout, "  ${blu}-limit${rs} ${bld}N${rs}\n");
+	cfprintf(cout, "      Quit (like ${blu}-quit${rs}) after ${bld}N${rs} actions have succeeded\n");
 	cfprintf(cout, "  ${blu}-maxdepth${rs} ${bld}N${rs}\n");
 	cfprintf(cout, "  ${blu}-mindepth${rs} ${bld}N${rs}\n");
 	cfprintf(cout, "      Ignore files deeper/shallower than ${bld}N${rs}\n");
@@ -2817,8 +3326,22 @@ static struct bfs_expr *parse_help(struct parser_state *state, int arg1, int arg
 	cfprintf(cout, "      Exclude hidden files\n");
 	cfprintf(cout, "  ${blu}-noleaf${rs}\n");
 	cfprintf(cout, "      Ignored; for compatibility with GNU find\n");
+	cfprintf(cout, "  ${blu}-preload_users${rs}\n");
+	cfprintf(cout, "      Load the whole user and group databases up front, rather than one ID at a time\n");
+	cfprintf(cout, "  ${blu}-profile${rs} ${bld}FILE${rs}\n");
+	cfprintf(cout, "      Save the measured cost and selectivity of each test to ${bld}FILE${rs}; at ${cyn}-O4${rs}, use\n");
+	cfprintf(cout, "      the previously saved measurements to order the tests\n");
 	cfprintf(cout, "  ${blu}-regextype${rs} ${bld}TYPE${rs}\n");
 	cfprintf(cout, "      Use ${bld}TYPE${rs}-flavored regexes (default: ${bld}posix-basic${rs}; see ${blu}-regextype${rs} ${bld}help${rs})\n");
+	cfprintf(cout, "  ${blu}-root-threads${rs} ${bld}N${rs}\n");
+	cfprintf(cout, "      Search up to ${bld}N${rs} root paths at once, each on its own thread (but still in order\n");
+	cfprintf(cout, "      within each root)\n");
+	cfprintf(cout, "  ${blu}-shard${rs} ${bld}I${rs}/${bld}N${rs}[:${bld}DEPTH${rs}]\n");
+	cfprintf(cout, "      Only search shard ${bld}I${rs} of ${bld}N${rs}, split by hashing the paths at ${bld}DEPTH${rs} (default: ${bld}1${rs}),\n");
+	cfprintf(cout, "      so that ${bld}N${rs} independent searches cover the tree exactly once\n");
+	cfprintf(cout, "  ${blu}-spill${rs} ${bld}SIZE${rs}\n");
+	cfprintf(cout, "      Once the breadth-first queue uses more than ${bld}SIZE${rs} bytes (${bld}k${rs}/${bld}M${rs}/${bld}G${rs} suffixes\n");
+	cfprintf(cout, "      allowed) of memory, spill queued directories to a temporary file\n");
 	cfprintf(cout, "  ${blu}-status${rs}\n");
 	cfprintf(cout, "      Display a status bar while searching\n");
 	cfprintf(cout, "  ${blu}-unique${rs}\n");
@@ -2826,6 +3349,9 @@ static struct bfs_expr *parse_help(struct parser_state *state, int arg1, int arg
 	cfprintf(cout, "  ${blu}-warn${rs}\n");
 	cfprintf(cout, "  ${blu}-nowarn${rs}\n");
 	cfprintf(cout, "      Turn on or off warnings about the command line\n");
+	cfprintf(cout, "  ${blu}-watch${rs}\n");
+	cfprintf(cout, "      After searching, keep running and re-evaluate the expression on files as they\n");
+	cfprintf(cout, "      change\n");
 	cfprintf(cout, "  ${blu}-xdev${rs}\n");
 	cfprintf(cout, "      Don't descend into other mount points\n\n");
 
@@ -2928,9 +3454,16 @@ static struct bfs_expr *parse_help(struct parser_state *state, int arg1, int arg
 
 	cfprintf(cout, "${bld}Actions:${rs}\n\n");
 
+	cfprintf(cout, "  ${blu}-chmod${rs} ${bld}MODE${rs}\n");
+	cfprintf(cout, "      Change the permissions of the found file, like ${ex}chmod${rs} ${bld}MODE${rs}\n");
+	cfprintf(cout, "  ${blu}-chown${rs} [${bld}USER${rs}][:${bld}GROUP${rs}]\n");
+	cfprintf(cout, "      Change the owner and/or group of the found file, like ${ex}chown${rs}\n");
 	cfprintf(cout, "  ${blu}-delete${rs}\n");
 	cfprintf(cout, "  ${blu}-rm${rs}\n");
 	cfprintf(cout, "      Delete any found files (implies ${blu}-depth${rs})\n");
+	cfprintf(cout, "  ${blu}-du${rs}\n");
+	cfprintf(cout, "      Print the disk usage of the found file and everything under it, like ${ex}du${rs}\n");
+	cfprintf(cout, "      (implies ${blu}-depth${rs})\n");
 	cfprintf(cout, "  ${blu}-exec${rs} ${bld}command ... {} ;${rs}\n");
 	cfprintf(cout, "      Execute a command\n");
 	cfprintf(cout, "  ${blu}-exec${rs} ${bld}command ... {} +${rs}\n");
@@ -2947,9 +3480,10 @@ static struct bfs_expr *parse_help(struct parser_state *state, int arg1, int arg
 	cfprintf(cout, "  ${blu}-fls${rs} ${bld}FILE${rs}\n");
 	cfprintf(cout, "  ${blu}-fprint${rs} ${bld}FILE${rs}\n");
 	cfprintf(cout, "  ${blu}-fprint0${rs} ${bld}FILE${rs}\n");
+	cfprintf(cout, "  ${blu}-fprintb${rs} ${bld}FILE${rs}\n");
 	cfprintf(cout, "  ${blu}-fprintf${rs} ${bld}FILE${rs} ${bld}FORMAT${rs}\n");
-	cfprintf(cout, "      Like ${blu}-ls${rs}/${blu}-print${rs}/${blu}-print0${rs}/${blu}-printf${rs}, but write to ${bld}FILE${rs} instead of standard\n"
-	               "      output\n");
+	cfprintf(cout, "      Like ${blu}-ls${rs}/${blu}-print${rs}/${blu}-print0${rs}/${blu}-printb${rs}/${blu}-printf${rs}, but write to ${bld}FILE${rs}\n"
+	               "      instead of standard output\n");
 	cfprintf(cout, "  ${blu}-ls${rs}\n");
 	cfprintf(cout, "      List files like ${ex}ls${rs} ${bld}-dils${rs}\n");
 	cfprintf(cout, "  ${blu}-print${rs}\n");
@@ -2957,6 +3491,9 @@ static struct bfs_expr *parse_help(struct parser_state *state, int arg1, int arg
 	cfprintf(cout, "  ${blu}-print0${rs}\n");
 	cfprintf(cout, "      Like ${blu}-print${rs}, but use the null character ('\\0') as a separator rather than\n");
 	cfprintf(cout, "      newlines\n");
+	cfprintf(cout, "  ${blu}-printb${rs}\n");
+	cfprintf(cout, "      Write a binary record with the path and metadata of the found file (see ${ex}man${rs}\n");
+	cfprintf(cout, "      ${bld}bfs${rs} for the format)\n");
 	cfprintf(cout, "  ${blu}-printf${rs} ${bld}FORMAT${rs}\n");
 	cfprintf(cout, "      Print according to a format string (see ${ex}man${rs} ${bld}find${rs}).  The additional format\n");
 	cfprintf(cout, "      directives %%w and %%W${bld}k${rs} for printing file birth times are supported.\n");
@@ -2967,6 +3504,8 @@ static struct bfs_expr *parse_help(struct parser_state *state, int arg1, int arg
 	cfprintf(cout, "      Don't descend into this directory\n");
 	cfprintf(cout, "  ${blu}-quit${rs}\n");
 	cfprintf(cout, "      Quit immediately\n");
+	cfprintf(cout, "  ${blu}-touch${rs}\n");
+	cfprintf(cout, "      Set the access and modification times of the found file to now\n");
 	cfprintf(cout, "  ${blu}-version${rs}\n");
 	cfprintf(cout, "      Print version information\n");
 	cfprintf(cout, "  ${blu}-help${rs}\n");
@@ -3036,18 +3575,23 @@ static const struct table_entry parse_table[] = {
 	{"-asince", T_TEST, parse_since, BFS_STAT_ATIME},
 	{"-atime", T_TEST, parse_time, BFS_STAT_ATIME},
 	{"-capable", T_TEST, parse_capable},
+	{"-chmod", T_ACTION, parse_chmod},
+	{"-chown", T_ACTION, parse_chown},
 	{"-cmin", T_TEST, parse_min, BFS_STAT_CTIME},
 	{"-cnewer", T_TEST, parse_newer, BFS_STAT_CTIME},
 	{"-color", T_OPTION, parse_color, true},
+	{"-cpus", T_OPTION, parse_cpus},
 	{"-csince", T_TEST, parse_since, BFS_STAT_CTIME},
 	{"-ctime", T_TEST, parse_time, BFS_STAT_CTIME},
 	{"-d", T_FLAG, parse_depth},
 	{"-daystart", T_OPTION, parse_daystart},
 	{"-delete", T_ACTION, parse_delete},
 	{"-depth", T_OPTION, parse_depth_n},
+	{"-du", T_ACTION, parse_du},
 	{"-empty", T_TEST, parse_empty},
 	{"-exclude", T_OPERATOR},
 	{"-exec", T_ACTION, parse_exec, 0},
+	{"-exec-jobs", T_OPTION, parse_exec_jobs},
 	{"-execdir", T_ACTION, parse_exec, BFS_EXEC_CHDIR},
 	{"-executable", T_TEST, parse_access, X_OK},
 	{"-exit", T_ACTION, parse_exit},
@@ -3059,6 +3603,7 @@ static const struct table_entry parse_table[] = {
 	{"-follow", T_OPTION, parse_follow, BFTW_FOLLOW_ALL, true},
 	{"-fprint", T_ACTION, parse_fprint},
 	{"-fprint0", T_ACTION, parse_fprint0},
+	{"-fprintb", T_ACTION, parse_fprintb},
 	{"-fprintf", T_ACTION, parse_fprintf},
 	{"-fstype", T_TEST, parse_fstype},
 	{"-gid", T_TEST, parse_group},
@@ -3068,11 +3613,16 @@ static const struct table_entry parse_table[] = {
 	{"-ignore_readdir_race", T_OPTION, parse_ignore_races, true},
 	{"-ilname", T_TEST, parse_lname, true},
 	{"-iname", T_TEST, parse_name, true},
+	{"-incremental", T_OPTION, parse_incremental},
+	{"-index", T_OPTION, parse_index},
+	{"-inode_order", T_OPTION, parse_inode_order},
 	{"-inum", T_TEST, parse_inum},
+	{"-iolimit", T_OPTION, parse_iolimit},
 	{"-ipath", T_TEST, parse_path, true},
 	{"-iregex", T_TEST, parse_regex, BFS_REGEX_ICASE},
 	{"-iwholename", T_TEST, parse_path, true},
 	{"-j", T_FLAG, parse_jobs, 0, 0, true},
+	{"-limit", T_OPTION, parse_limit},
 	{"-links", T_TEST, parse_links},
 	{"-lname", T_TEST, parse_lname, false},
 	{"-ls", T_ACTION, parse_ls},
@@ -3100,22 +3650,29 @@ static const struct table_entry parse_table[] = {
 	{"-or", T_OPERATOR},
 	{"-path", T_TEST, parse_path, false},
 	{"-perm", T_TEST, parse_perm},
+	{"-preload_users", T_OPTION, parse_preload_users},
 	{"-print", T_ACTION, parse_print},
 	{"-print0", T_ACTION, parse_print0},
+	{"-printb", T_ACTION, parse_printb},
 	{"-printf", T_ACTION, parse_printf},
 	{"-printx", T_ACTION, parse_printx},
+	{"-profile", T_OPTION, parse_profile},
 	{"-prune", T_ACTION, parse_prune},
 	{"-quit", T_ACTION, parse_quit},
 	{"-readable", T_TEST, parse_access, R_OK},
 	{"-regex", T_TEST, parse_regex, 0},
 	{"-regextype", T_OPTION, parse_regextype},
 	{"-rm", T_ACTION, parse_delete},
+	{"-root-threads", T_OPTION, parse_root_threads},
 	{"-s", T_FLAG, parse_s},
 	{"-samefile", T_TEST, parse_samefile},
 	{"-since", T_TEST, parse_since, BFS_STAT_MTIME},
+	{"-shard", T_OPTION, parse_shard},
 	{"-size", T_TEST, parse_size},
 	{"-sparse", T_TEST, parse_sparse},
+	{"-spill", T_OPTION, parse_spill},
 	{"-status", T_OPTION, parse_status},
+	{"-touch", T_ACTION, parse_touch},
 	{"-true", T_TEST, parse_const, true},
 	{"-type", T_TEST, parse_type, false},
 	{"-uid", T_TEST, parse_user},
@@ -3124,6 +3681,7 @@ static const struct table_entry parse_table[] = {
 	{"-user", T_TEST, parse_user},
 	{"-version", T_ACTION, parse_version},
 	{"-warn", T_OPTION, parse_warn, true},
+	{"-watch", T_OPTION, parse_watch},
 	{"-wholename", T_TEST, parse_path, false},
 	{"-writable", T_TEST, parse_access, W_OK},
 	{"-x", T_FLAG, parse_xdev},
@@ -3450,6 +4008,7 @@ static struct bfs_expr *parse_whole_expr(struct parser_state *state) {
 		if (!print) {
 			goto fail;
 		}
+		print->counted = true;
 		init_print_expr(state, print);
 
 		expr = new_binary_expr(eval_and, expr, print, &fake_and_arg);
@@ -3503,6 +4062,8 @@ static const char *bftw_strategy_name(enum bftw_strategy strategy) {
 		return "ids";
 	case BFTW_EDS:
 		return "eds";
+	case BFTW_PARALLEL:
+		return "par";
 	}
 
 	bfs_bug("Invalid strategy");
@@ -3565,7 +4126,9 @@ void bfs_ctx_dump(const struct bfs_ctx *ctx, enum debug_flags flag) {
 		cfprintf(cerr, " ${cyn}-O${bld}%d${rs}", ctx->optlevel);
 	}
 
-	if (ctx->threads > 0) {
+	if (ctx->autotune) {
+		cfprintf(cerr, " ${cyn}-j${bld}auto${rs}");
+	} else if (ctx->threads > 0) {
 		cfprintf(cerr, " ${cyn}-j${bld}%d${rs}", ctx->threads);
 	}
 
@@ -3586,6 +4149,9 @@ void bfs_ctx_dump(const struct bfs_ctx *ctx, enum debug_flags flag) {
 			}
 		}
 	}
+	if (ctx->trace_path) {
+		cfprintf(cerr, " ${cyn}-D${rs} ${bld}trace=%pq${rs}", ctx->trace_path);
+	}
 
 	for (size_t i = 0; i < darray_length(ctx->paths); ++i) {
 		const char *path = ctx->paths[i];
@@ -3595,18 +4161,62 @@ void bfs_ctx_dump(const struct bfs_ctx *ctx, enum debug_flags flag) {
 		}
 		cfprintf(cerr, " ${mag}%pq${rs}", path);
 	}
+	if (ctx->files0) {
+		cfprintf(cerr, " ${blu}-files0-from${rs} ${mag}%pq${rs}", ctx->files0_path);
+	}
 
 	if (ctx->cout->colors) {
 		cfprintf(cerr, " ${blu}-color${rs}");
 	} else {
 		cfprintf(cerr, " ${blu}-nocolor${rs}");
 	}
+	size_t ncpus = darray_length(ctx->cpus);
+	if (ncpus > 0) {
+		cfprintf(cerr, " ${blu}-cpus${rs} ${bld}");
+		for (size_t i = 0; i < ncpus;) {
+			// Collapse runs of consecutive CPUs back into ranges
+			size_t j = i + 1;
+			while (j < ncpus && ctx->cpus[j] == ctx->cpus[j - 1] + 1) {
+				++j;
+			}
+
+			if (i > 0) {
+				cfprintf(cerr, ",");
+			}
+			if (j - i > 1) {
+				cfprintf(cerr, "%d-%d", (int)ctx->cpus[i], (int)ctx->cpus[j - 1]);
+			} else {
+				cfprintf(cerr, "%d", (int)ctx->cpus[i]);
+			}
+			i = j;
+		}
+		cfprintf(cerr, "${rs}");
+	}
 	if (ctx->flags & BFTW_POST_ORDER) {
 		cfprintf(cerr, " ${blu}-depth${rs}");
 	}
+	if (ctx->exec_jobs != 1) {
+		cfprintf(cerr, " ${blu}-exec-jobs${rs} ${bld}%d${rs}", ctx->exec_jobs);
+	}
 	if (ctx->ignore_races) {
 		cfprintf(cerr, " ${blu}-ignore_readdir_race${rs}");
 	}
+	if (ctx->incremental_path) {
+		cfprintf(cerr, " ${blu}-incremental${rs} ${mag}%pq${rs}", ctx->incremental_path);
+	}
+	if (ctx->index_path) {
+		cfprintf(cerr, " ${blu}-index${rs} ${mag}%pq${rs}", ctx->index_path);
+	}
+	if (ctx->flags & BFTW_INO_ORDER) {
+		cfprintf(cerr, " ${blu}-inode_order${rs}");
+	}
+	for (size_t i = 0; i < darray_length(ctx->iolimits); ++i) {
+		const struct bftw_iolimit *iolimit = &ctx->iolimits[i];
+		cfprintf(cerr, " ${blu}-iolimit${rs} ${bld}%s=%zu${rs}", iolimit->fstype, iolimit->limit);
+	}
+	if (ctx->limit) {
+		cfprintf(cerr, " ${blu}-limit${rs} ${bld}%d${rs}", ctx->limit);
+	}
 	if (ctx->mindepth != 0) {
 		cfprintf(cerr, " ${blu}-mindepth${rs} ${bld}%d${rs}", ctx->mindepth);
 	}
@@ -3616,12 +4226,34 @@ void bfs_ctx_dump(const struct bfs_ctx *ctx, enum debug_flags flag) {
 	if (ctx->flags & BFTW_SKIP_MOUNTS) {
 		cfprintf(cerr, " ${blu}-mount${rs}");
 	}
+	if (ctx->profile_path) {
+		cfprintf(cerr, " ${blu}-profile${rs} ${mag}%pq${rs}", ctx->profile_path);
+	}
+	if (ctx->root_threads) {
+		cfprintf(cerr, " ${blu}-root-threads${rs} ${bld}%d${rs}", ctx->root_threads);
+	}
+	if (ctx->nshards) {
+		cfprintf(cerr, " ${blu}-shard${rs} ${bld}%d/%d", ctx->shard, ctx->nshards);
+		if (ctx->shard_depth != 1) {
+			cfprintf(cerr, ":%d", ctx->shard_depth);
+		}
+		cfprintf(cerr, "${rs}");
+	}
+	if (ctx->spill_limit) {
+		cfprintf(cerr, " ${blu}-spill${rs} ${bld}%zu${rs}", ctx->spill_limit);
+	}
+	if (ctx->preload_users) {
+		cfprintf(cerr, " ${blu}-preload_users${rs}");
+	}
 	if (ctx->status) {
 		cfprintf(cerr, " ${blu}-status${rs}");
 	}
 	if (ctx->unique) {
 		cfprintf(cerr, " ${blu}-unique${rs}");
 	}
+	if (ctx->watch) {
+		cfprintf(cerr, " ${blu}-watch${rs}");
+	}
 	if ((ctx->flags & (BFTW_SKIP_MOUNTS | BFTW_PRUNE_MOUNTS)) == BFTW_PRUNE_MOUNTS) {
 		cfprintf(cerr, " ${blu}-xdev${rs}");
 	}
@@ -3671,18 +4303,26 @@ struct bfs_ctx *bfs_parse_cmdline(int argc, char *argv[]) {
 		use_color = COLOR_NEVER;
 	}
 
-	ctx->colors = parse_colors();
-	if (!ctx->colors) {
-		ctx->colors_error = errno;
+	bool stdin_tty = isatty(STDIN_FILENO);
+	bool stdout_tty = isatty(STDOUT_FILENO);
+	bool stderr_tty = isatty(STDERR_FILENO);
+
+	// Parsing $LS_COLORS takes a while, so skip it when no terminal will
+	// see the colors (-color and -fprint can still ask for them later)
+	struct colors *colors = NULL;
+	if (use_color && (stdout_tty || stderr_tty)) {
+		colors = parse_get_colors(ctx);
 	}
 
-	ctx->cerr = cfwrap(stderr, use_color ? ctx->colors : NULL, false);
+	ctx->cerr = cfwrap(stderr, colors, false);
 	if (!ctx->cerr) {
 		perror("cfwrap()");
 		goto fail;
 	}
 
-	ctx->cout = cfwrap(stdout, use_color ? ctx->colors : NULL, false);
+	// bftw() serializes its callbacks, so stdout can skip stdio's locking
+	xoutput_stream(stdout);
+	ctx->cout = cfwrap(stdout, colors, false);
 	if (!ctx->cout) {
 		bfs_perror(ctx, "cfwrap()");
 		goto fail;
@@ -3693,10 +4333,6 @@ struct bfs_ctx *bfs_parse_cmdline(int argc, char *argv[]) {
 		goto fail;
 	}
 
-	bool stdin_tty = isatty(STDIN_FILENO);
-	bool stdout_tty = isatty(STDOUT_FILENO);
-	bool stderr_tty = isatty(STDERR_FILENO);
-
 	if (getenv("POSIXLY_CORRECT")) {
 		ctx->posixly_correct = true;
 	} else {
@@ -3723,6 +4359,7 @@ struct bfs_ctx *bfs_parse_cmdline(int argc, char *argv[]) {
 		.files0_arg = NULL,
 		.files0_stdin_arg = NULL,
 		.ok_expr = NULL,
+		.exec_expr = NULL,
 		.now = ctx->now,
 	};
 
@@ -3740,7 +4377,7 @@ struct bfs_ctx *bfs_parse_cmdline(int argc, char *argv[]) {
 		}
 	}
 
-	if (state.use_color == COLOR_AUTO && !ctx->colors) {
+	if (state.use_color == COLOR_AUTO && ctx->colors_parsed && !ctx->colors) {
 		bfs_warning(ctx, "Error parsing $$LS_COLORS: %s.\n\n", strerror(ctx->colors_error));
 	}
 
@@ -3748,6 +4385,20 @@ struct bfs_ctx *bfs_parse_cmdline(int argc, char *argv[]) {
 		goto fail;
 	}
 
+	if (ctx->files0 == stdin && state.exec_expr) {
+		// Commands would inherit stdin, and could eat the rest of the input
+		if (parse_drain_files0(&state) != 0) {
+			goto fail;
+		}
+	}
+
+	if (ctx->watch) {
+		// Every pass starts again from the roots
+		if (parse_drain_files0(&state) != 0) {
+			goto fail;
+		}
+	}
+
 	if (darray_length(ctx->paths) == 0) {
 		if (!state.implicit_root) {
 			parse_argv_error(&state, state.files0_arg, 2, "No root paths specified.\n");
@@ -0,0 +1,98 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "perf.h"
+#include "atomic.h"
+#include "config.h"
+#include "diag.h"
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+bool perf_enabled = false;
+
+/** Accumulated totals for an event, padded to avoid false sharing. */
+struct perf_total {
+	/** The number of occurrences. */
+	cache_align atomic uint64_t count;
+	/** The total time, in nanoseconds. */
+	atomic uint64_t ns;
+};
+
+/** Event totals. */
+static struct perf_total totals[PERF_EVENTS];
+
+/** The time perf_enable() was called. */
+static uint64_t epoch;
+
+/** Event names and types. */
+static const struct {
+	const char *name;
+	bool timed;
+} events[] = {
+	[PERF_OPENDIR] = {"opendir", true},
+	[PERF_GETDENTS] = {"getdents", true},
+	[PERF_DIRENT] = {"dirent", false},
+	[PERF_CLOSEDIR] = {"closedir", true},
+	[PERF_STAT] = {"stat", true},
+	[PERF_XATTRS] = {"listxattr", true},
+	[PERF_OPEN] = {"open", true},
+	[PERF_FD_HIT] = {"fd_hit", false},
+	[PERF_FD_MISS] = {"fd_miss", false},
+	[PERF_FD_EVICT] = {"fd_evict", false},
+	[PERF_SPILL] = {"spill", false},
+	[PERF_LISTING_HIT] = {"listing_hit", false},
+	[PERF_IOQ_SUBMIT] = {"ioq_submit", false},
+	[PERF_IOQ_WAIT] = {"ioq_wait", true},
+	[PERF_IOQ_IDLE] = {"ioq_idle", true},
+	[PERF_IOQ_GROW] = {"ioq_grow", false},
+	[PERF_IOQ_SHRINK] = {"ioq_shrink", false},
+};
+
+const char *perf_event_name(enum perf_event event) {
+	bfs_assert(event < PERF_EVENTS);
+	return events[event].name;
+}
+
+bool perf_event_timed(enum perf_event event) {
+	bfs_assert(event < PERF_EVENTS);
+	return events[event].timed;
+}
+
+uint64_t perf_now(void) {
+	struct timespec ts;
+	bfs_verify(clock_gettime(CLOCK_MONOTONIC, &ts) == 0, "clock_gettime(): %s", strerror(errno));
+
+	// Never return 0, which perf_stop() interprets as disabled
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec + 1;
+}
+
+void perf_enable(void) {
+	epoch = perf_now();
+	perf_enabled = true;
+}
+
+void perf_record(enum perf_event event, uint64_t count, uint64_t ns) {
+	bfs_assert(event < PERF_EVENTS);
+	struct perf_total *total = &totals[event];
+	fetch_add(&total->count, count, relaxed);
+	if (ns) {
+		fetch_add(&total->ns, ns, relaxed);
+	}
+}
+
+void perf_read(enum perf_event event, uint64_t *count, uint64_t *ns) {
+	bfs_assert(event < PERF_EVENTS);
+	const struct perf_total *total = &totals[event];
+	*count = load(&total->count, relaxed);
+	*ns = load(&total->ns, relaxed);
+}
+
+uint64_t perf_elapsed(void) {
+	if (perf_enabled) {
+		return perf_now() - epoch;
+	} else {
+		return 0;
+	}
+}
@@ -0,0 +1,145 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * Performance counters and timers (-D perf).
+ */
+
+#ifndef BFS_PERF_H
+#define BFS_PERF_H
+
+#include "config.h"
+#include <stdint.h>
+
+/**
+ * The events that can be counted and timed.
+ */
+enum perf_event {
+	/** bfs_opendir() calls. */
+	PERF_OPENDIR,
+	/** Reads of directory entries from the kernel. */
+	PERF_GETDENTS,
+	/** Directory entries returned by bfs_readdir(). */
+	PERF_DIRENT,
+	/** bfs_closedir() calls. */
+	PERF_CLOSEDIR,
+	/** bfs_stat() calls. */
+	PERF_STAT,
+	/** Extended attribute name list reads. */
+	PERF_XATTRS,
+	/** Directories opened by bftw(). */
+	PERF_OPEN,
+	/** bftw() fd cache hits. */
+	PERF_FD_HIT,
+	/** bftw() fd cache misses. */
+	PERF_FD_MISS,
+	/** bftw() fd cache evictions. */
+	PERF_FD_EVICT,
+	/** Directories spilled to disk by bftw(). */
+	PERF_SPILL,
+	/** Directory listings replayed from memory by iterative deepening. */
+	PERF_LISTING_HIT,
+	/** ioq requests submitted. */
+	PERF_IOQ_SUBMIT,
+	/** Time spent waiting for ioq responses. */
+	PERF_IOQ_WAIT,
+	/** Time the ioq threads spent waiting for requests. */
+	PERF_IOQ_IDLE,
+	/** ioq threads woken up by the tuner. */
+	PERF_IOQ_GROW,
+	/** ioq threads put to sleep by the tuner. */
+	PERF_IOQ_SHRINK,
+	/** The number of events. */
+	PERF_EVENTS,
+};
+
+/**
+ * Get the name of an event.
+ */
+const char *perf_event_name(enum perf_event event);
+
+/**
+ * Check whether an event is timed, or just counted.
+ */
+bool perf_event_timed(enum perf_event event);
+
+/**
+ * Whether the counters are enabled.  Only written by perf_enable().
+ */
+extern bool perf_enabled;
+
+/**
+ * Enable the performance counters.  Must be called before any other threads
+ * are started.
+ */
+void perf_enable(void);
+
+/**
+ * Get the current time for perf_stop(), in nanoseconds.
+ */
+uint64_t perf_now(void);
+
+/**
+ * Record some occurrences of an event.
+ *
+ * @param event
+ *         The event that happened.
+ * @param count
+ *         The number of occurrences.
+ * @param ns
+ *         The time they took, in nanoseconds.
+ */
+void perf_record(enum perf_event event, uint64_t count, uint64_t ns);
+
+/**
+ * Read the totals for an event.
+ *
+ * @param event
+ *         The event to read.
+ * @param[out] count
+ *         The number of occurrences.
+ * @param[out] ns
+ *         The total time they took, in nanoseconds.
+ */
+void perf_read(enum perf_event event, uint64_t *count, uint64_t *ns);
+
+/**
+ * Get the time since perf_enable(), in nanoseconds.
+ */
+uint64_t perf_elapsed(void);
+
+/**
+ * Count some occurrences of an event.
+ */
+static inline void perf_count(enum perf_event event, uint64_t count) {
+	if (perf_enabled) {
+		perf_record(event, count, 0);
+	}
+}
+
+/**
+ * Start timing an event.
+ *
+ * @return
+ *         The start time to pass to perf_stop(), or 0 if the counters are
+ *         disabled.
+ */
+static inline uint64_t perf_start(void) {
+	return perf_enabled ? perf_now() : 0;
+}
+
+/**
+ * Finish timing an event, and count one occurrence of it.
+ *
+ * @param event
+ *         The event that happened.
+ * @param start
+ *         The time returned by perf_start().
+ */
+static inline void perf_stop(enum perf_event event, uint64_t start) {
+	if (start) {
+		perf_record(event, 1, perf_now() - start);
+	}
+}
+
+#endif // BFS_PERF_H
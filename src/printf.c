@@ -43,6 +43,8 @@ struct bfs_printf {
 	enum bfs_stat_field stat_field;
 	/** Character data associated with this directive. */
 	char c;
+	/** Whether this directive has no flags, width, or precision. */
+	bool plain;
 	/** Some data used by the directive. */
 	void *ptr;
 };
@@ -64,7 +66,7 @@ static int bfs_printf_flush(CFILE *cfile, const struct bfs_printf *directive, co
 
 /** Check if we can safely colorize this directive. */
 static bool should_color(CFILE *cfile, const struct bfs_printf *directive) {
-	return cfile->colors && strcmp(directive->str, "%s") == 0;
+	return cfile->colors && directive->plain;
 }
 
 /**
@@ -91,6 +93,41 @@ static int dyn_fprintf(FILE *file, const struct bfs_printf *directive, ...) {
 	return ret;
 }
 
+/** Print a string for a directive, skipping fprintf() if possible. */
+static int bfs_printf_str(CFILE *cfile, const struct bfs_printf *directive, const char *str) {
+	if (directive->plain) {
+		return fputs(str, cfile->file) == EOF ? -1 : 0;
+	} else {
+		return dyn_fprintf(cfile->file, directive, str);
+	}
+}
+
+/** Enough space for any uintmax_t in octal or decimal. */
+#define BFS_ITOA_SIZE (sizeof(uintmax_t) * 3)
+
+/**
+ * Write the digits of an integer backwards, ending just before `end`.
+ *
+ * @return
+ *         A pointer to the first digit.
+ */
+static char *bfs_printf_itoa(char *end, uintmax_t n, unsigned int base) {
+	do {
+		*--end = '0' + n % base;
+		n /= base;
+	} while (n > 0);
+
+	return end;
+}
+
+/** Print an unsigned integer for a directive. */
+static int bfs_printf_uint(CFILE *cfile, const struct bfs_printf *directive, uintmax_t n, unsigned int base) {
+	char buf[BFS_ITOA_SIZE + 1];
+	char *end = buf + sizeof(buf) - 1;
+	*end = '\0';
+	return bfs_printf_str(cfile, directive, bfs_printf_itoa(end, n, base));
+}
+
 /** %a, %c, %t: ctime() */
 static int bfs_printf_ctime(CFILE *cfile, const struct bfs_printf *directive, const struct BFTW *ftwbuf) {
 	// Not using ctime() itself because GNU find adds nanoseconds
@@ -108,7 +145,7 @@ static int bfs_printf_ctime(CFILE *cfile, const struct bfs_printf *directive, co
 	}
 
 	struct tm tm;
-	if (xlocaltime(&ts->tv_sec, &tm) != 0) {
+	if (xlocaltime_cached(directive->ptr, &ts->tv_sec, &tm) != 0) {
 		return -1;
 	}
 
@@ -122,7 +159,34 @@ static int bfs_printf_ctime(CFILE *cfile, const struct bfs_printf *directive, co
 	               (long)ts->tv_nsec,
 	               1900 + tm.tm_year);
 
-	return dyn_fprintf(cfile->file, directive, buf);
+	return bfs_printf_str(cfile, directive, buf);
+}
+
+/** %A@, %B@/%W@, %C@, %T@: seconds since the epoch */
+static int bfs_printf_epoch(CFILE *cfile, const struct bfs_printf *directive, const struct timespec *ts) {
+	// Like "%lld.%09ld0", written backwards
+	char buf[BFS_ITOA_SIZE + 14];
+	char *str = buf + sizeof(buf);
+	*--str = '\0';
+	*--str = '0';
+
+	long nsec = ts->tv_nsec;
+	for (int i = 0; i < 9; ++i) {
+		*--str = '0' + nsec % 10;
+		nsec /= 10;
+	}
+	*--str = '.';
+
+	uintmax_t sec = ts->tv_sec;
+	if (ts->tv_sec < 0) {
+		sec = -sec;
+	}
+	str = bfs_printf_itoa(str, sec, 10);
+	if (ts->tv_sec < 0) {
+		*--str = '-';
+	}
+
+	return bfs_printf_str(cfile, directive, str);
 }
 
 /** %A, %B/%W, %C, %T: strftime() */
@@ -137,8 +201,12 @@ static int bfs_printf_strftime(CFILE *cfile, const struct bfs_printf *directive,
 		return -1;
 	}
 
+	if (directive->c == '@') {
+		return bfs_printf_epoch(cfile, directive, ts);
+	}
+
 	struct tm tm;
-	if (xlocaltime(&ts->tv_sec, &tm) != 0) {
+	if (xlocaltime_cached(directive->ptr, &ts->tv_sec, &tm) != 0) {
 		return -1;
 	}
 
@@ -147,9 +215,6 @@ static int bfs_printf_strftime(CFILE *cfile, const struct bfs_printf *directive,
 	char format[] = "% ";
 	switch (directive->c) {
 	// Non-POSIX strftime() features
-	case '@':
-		ret = snprintf(buf, sizeof(buf), "%lld.%09ld0", (long long)ts->tv_sec, (long)ts->tv_nsec);
-		break;
 	case '+':
 		ret = snprintf(buf, sizeof(buf), "%4d-%.2d-%.2d+%.2d:%.2d:%.2d.%09ld0",
 		               1900 + tm.tm_year,
@@ -192,7 +257,7 @@ static int bfs_printf_strftime(CFILE *cfile, const struct bfs_printf *directive,
 	bfs_assert(ret >= 0 && (size_t)ret < sizeof(buf));
 	(void)ret;
 
-	return dyn_fprintf(cfile->file, directive, buf);
+	return bfs_printf_str(cfile, directive, buf);
 }
 
 /** %b: blocks */
@@ -203,12 +268,15 @@ static int bfs_printf_b(CFILE *cfile, const struct bfs_printf *directive, const
 	}
 
 	uintmax_t blocks = ((uintmax_t)statbuf->blocks*BFS_STAT_BLKSIZE + 511)/512;
-	BFS_PRINTF_BUF(buf, "%ju", blocks);
-	return dyn_fprintf(cfile->file, directive, buf);
+	return bfs_printf_uint(cfile, directive, blocks, 10);
 }
 
 /** %d: depth */
 static int bfs_printf_d(CFILE *cfile, const struct bfs_printf *directive, const struct BFTW *ftwbuf) {
+	if (directive->plain) {
+		return bfs_printf_uint(cfile, directive, ftwbuf->depth, 10);
+	}
+
 	return dyn_fprintf(cfile->file, directive, (intmax_t)ftwbuf->depth);
 }
 
@@ -219,8 +287,7 @@ static int bfs_printf_D(CFILE *cfile, const struct bfs_printf *directive, const
 		return -1;
 	}
 
-	BFS_PRINTF_BUF(buf, "%ju", (uintmax_t)statbuf->dev);
-	return dyn_fprintf(cfile->file, directive, buf);
+	return bfs_printf_uint(cfile, directive, (uintmax_t)statbuf->dev, 10);
 }
 
 /** %f: file name */
@@ -228,7 +295,7 @@ static int bfs_printf_f(CFILE *cfile, const struct bfs_printf *directive, const
 	if (should_color(cfile, directive)) {
 		return cfprintf(cfile, "%pF", ftwbuf);
 	} else {
-		return dyn_fprintf(cfile->file, directive, ftwbuf->path + ftwbuf->nameoff);
+		return bfs_printf_str(cfile, directive, ftwbuf->path + ftwbuf->nameoff);
 	}
 }
 
@@ -244,7 +311,7 @@ static int bfs_printf_F(CFILE *cfile, const struct bfs_printf *directive, const
 		return -1;
 	}
 
-	return dyn_fprintf(cfile->file, directive, type);
+	return bfs_printf_str(cfile, directive, type);
 }
 
 /** %G: gid */
@@ -254,8 +321,7 @@ static int bfs_printf_G(CFILE *cfile, const struct bfs_printf *directive, const
 		return -1;
 	}
 
-	BFS_PRINTF_BUF(buf, "%ju", (uintmax_t)statbuf->gid);
-	return dyn_fprintf(cfile->file, directive, buf);
+	return bfs_printf_uint(cfile, directive, (uintmax_t)statbuf->gid, 10);
 }
 
 /** %g: group name */
@@ -271,11 +337,13 @@ static int bfs_printf_g(CFILE *cfile, const struct bfs_printf *directive, const
 		return bfs_printf_G(cfile, directive, ftwbuf);
 	}
 
-	return dyn_fprintf(cfile->file, directive, grp->gr_name);
+	return bfs_printf_str(cfile, directive, grp->gr_name);
 }
 
 /** %h: leading directories */
 static int bfs_printf_h(CFILE *cfile, const struct bfs_printf *directive, const struct BFTW *ftwbuf) {
+	// Most directories fit on the stack, so this rarely needs malloc()
+	char stack[1024];
 	char *copy = NULL;
 	const char *buf;
 
@@ -285,7 +353,13 @@ static int bfs_printf_h(CFILE *cfile, const struct bfs_printf *directive, const
 			--len;
 		}
 
-		buf = copy = strndup(ftwbuf->path, len);
+		if (len < sizeof(stack)) {
+			memcpy(stack, ftwbuf->path, len);
+			stack[len] = '\0';
+			buf = stack;
+		} else {
+			buf = copy = strndup(ftwbuf->path, len);
+		}
 	} else if (ftwbuf->path[0] == '/') {
 		buf = "/";
 	} else {
@@ -300,7 +374,7 @@ static int bfs_printf_h(CFILE *cfile, const struct bfs_printf *directive, const
 	if (should_color(cfile, directive)) {
 		ret = cfprintf(cfile, "${di}%pQ${rs}", buf);
 	} else {
-		ret = dyn_fprintf(cfile->file, directive, buf);
+		ret = bfs_printf_str(cfile, directive, buf);
 	}
 
 	free(copy);
@@ -316,7 +390,7 @@ static int bfs_printf_H(CFILE *cfile, const struct bfs_printf *directive, const
 			return cfprintf(cfile, "${di}%pQ${rs}", ftwbuf->root);
 		}
 	} else {
-		return dyn_fprintf(cfile->file, directive, ftwbuf->root);
+		return bfs_printf_str(cfile, directive, ftwbuf->root);
 	}
 }
 
@@ -327,8 +401,7 @@ static int bfs_printf_i(CFILE *cfile, const struct bfs_printf *directive, const
 		return -1;
 	}
 
-	BFS_PRINTF_BUF(buf, "%ju", (uintmax_t)statbuf->ino);
-	return dyn_fprintf(cfile->file, directive, buf);
+	return bfs_printf_uint(cfile, directive, (uintmax_t)statbuf->ino, 10);
 }
 
 /** %k: 1K blocks */
@@ -339,8 +412,7 @@ static int bfs_printf_k(CFILE *cfile, const struct bfs_printf *directive, const
 	}
 
 	uintmax_t blocks = ((uintmax_t)statbuf->blocks*BFS_STAT_BLKSIZE + 1023)/1024;
-	BFS_PRINTF_BUF(buf, "%ju", blocks);
-	return dyn_fprintf(cfile->file, directive, buf);
+	return bfs_printf_uint(cfile, directive, blocks, 10);
 }
 
 /** %l: link target */
@@ -353,16 +425,13 @@ static int bfs_printf_l(CFILE *cfile, const struct bfs_printf *directive, const
 			return cfprintf(cfile, "%pL", ftwbuf);
 		}
 
-		const struct bfs_stat *statbuf = bftw_cached_stat(ftwbuf, BFS_STAT_NOFOLLOW);
-		size_t len = statbuf ? statbuf->size : 0;
-
-		target = buf = xreadlinkat(ftwbuf->at_fd, ftwbuf->at_path, len);
+		target = buf = bftw_readlink(ftwbuf);
 		if (!target) {
 			return -1;
 		}
 	}
 
-	int ret = dyn_fprintf(cfile->file, directive, target);
+	int ret = bfs_printf_str(cfile, directive, target);
 	free(buf);
 	return ret;
 }
@@ -374,7 +443,12 @@ static int bfs_printf_m(CFILE *cfile, const struct bfs_printf *directive, const
 		return -1;
 	}
 
-	return dyn_fprintf(cfile->file, directive, (unsigned int)(statbuf->mode & 07777));
+	unsigned int mode = statbuf->mode & 07777;
+	if (directive->plain) {
+		return bfs_printf_uint(cfile, directive, mode, 8);
+	}
+
+	return dyn_fprintf(cfile->file, directive, mode);
 }
 
 /** %M: symbolic mode */
@@ -386,7 +460,7 @@ static int bfs_printf_M(CFILE *cfile, const struct bfs_printf *directive, const
 
 	char buf[11];
 	xstrmode(statbuf->mode, buf);
-	return dyn_fprintf(cfile->file, directive, buf);
+	return bfs_printf_str(cfile, directive, buf);
 }
 
 /** %n: link count */
@@ -396,8 +470,7 @@ static int bfs_printf_n(CFILE *cfile, const struct bfs_printf *directive, const
 		return -1;
 	}
 
-	BFS_PRINTF_BUF(buf, "%ju", (uintmax_t)statbuf->nlink);
-	return dyn_fprintf(cfile->file, directive, buf);
+	return bfs_printf_uint(cfile, directive, (uintmax_t)statbuf->nlink, 10);
 }
 
 /** %p: full path */
@@ -405,7 +478,7 @@ static int bfs_printf_p(CFILE *cfile, const struct bfs_printf *directive, const
 	if (should_color(cfile, directive)) {
 		return cfprintf(cfile, "%pP", ftwbuf);
 	} else {
-		return dyn_fprintf(cfile->file, directive, ftwbuf->path);
+		return bfs_printf_str(cfile, directive, ftwbuf->path);
 	}
 }
 
@@ -426,7 +499,7 @@ static int bfs_printf_P(CFILE *cfile, const struct bfs_printf *directive, const
 		copybuf.nameoff -= offset;
 		return cfprintf(cfile, "%pP", &copybuf);
 	} else {
-		return dyn_fprintf(cfile->file, directive, ftwbuf->path + offset);
+		return bfs_printf_str(cfile, directive, ftwbuf->path + offset);
 	}
 }
 
@@ -437,8 +510,7 @@ static int bfs_printf_s(CFILE *cfile, const struct bfs_printf *directive, const
 		return -1;
 	}
 
-	BFS_PRINTF_BUF(buf, "%ju", (uintmax_t)statbuf->size);
-	return dyn_fprintf(cfile->file, directive, buf);
+	return bfs_printf_uint(cfile, directive, (uintmax_t)statbuf->size, 10);
 }
 
 /** %S: sparseness */
@@ -464,8 +536,7 @@ static int bfs_printf_U(CFILE *cfile, const struct bfs_printf *directive, const
 		return -1;
 	}
 
-	BFS_PRINTF_BUF(buf, "%ju", (uintmax_t)statbuf->uid);
-	return dyn_fprintf(cfile->file, directive, buf);
+	return bfs_printf_uint(cfile, directive, (uintmax_t)statbuf->uid, 10);
 }
 
 /** %u: user name */
@@ -481,7 +552,7 @@ static int bfs_printf_u(CFILE *cfile, const struct bfs_printf *directive, const
 		return bfs_printf_U(cfile, directive, ftwbuf);
 	}
 
-	return dyn_fprintf(cfile->file, directive, pwd->pw_name);
+	return bfs_printf_str(cfile, directive, pwd->pw_name);
 }
 
 static const char *bfs_printf_type(enum bfs_type type) {
@@ -510,7 +581,7 @@ static const char *bfs_printf_type(enum bfs_type type) {
 /** %y: type */
 static int bfs_printf_y(CFILE *cfile, const struct bfs_printf *directive, const struct BFTW *ftwbuf) {
 	const char *type = bfs_printf_type(ftwbuf->type);
-	return dyn_fprintf(cfile->file, directive, type);
+	return bfs_printf_str(cfile, directive, type);
 }
 
 /** %Y: target type */
@@ -542,7 +613,7 @@ static int bfs_printf_Y(CFILE *cfile, const struct bfs_printf *directive, const
 		}
 	}
 
-	int ret = dyn_fprintf(cfile->file, directive, type);
+	int ret = bfs_printf_str(cfile, directive, type);
 	if (error != 0) {
 		ret = -1;
 		errno = error;
@@ -719,6 +790,7 @@ int bfs_printf_parse(const struct bfs_ctx *ctx, struct bfs_expr *expr, const cha
 			switch (c) {
 			case 'a':
 				directive.fn = bfs_printf_ctime;
+				directive.ptr = (void *)&ctx->localtimes;
 				directive.stat_field = BFS_STAT_ATIME;
 				break;
 			case 'b':
@@ -726,6 +798,7 @@ int bfs_printf_parse(const struct bfs_ctx *ctx, struct bfs_expr *expr, const cha
 				break;
 			case 'c':
 				directive.fn = bfs_printf_ctime;
+				directive.ptr = (void *)&ctx->localtimes;
 				directive.stat_field = BFS_STAT_CTIME;
 				break;
 			case 'd':
@@ -795,6 +868,7 @@ int bfs_printf_parse(const struct bfs_ctx *ctx, struct bfs_expr *expr, const cha
 				break;
 			case 't':
 				directive.fn = bfs_printf_ctime;
+				directive.ptr = (void *)&ctx->localtimes;
 				directive.stat_field = BFS_STAT_MTIME;
 				break;
 			case 'u':
@@ -806,6 +880,7 @@ int bfs_printf_parse(const struct bfs_ctx *ctx, struct bfs_expr *expr, const cha
 				break;
 			case 'w':
 				directive.fn = bfs_printf_ctime;
+				directive.ptr = (void *)&ctx->localtimes;
 				directive.stat_field = BFS_STAT_BTIME;
 				break;
 			case 'y':
@@ -831,6 +906,7 @@ int bfs_printf_parse(const struct bfs_ctx *ctx, struct bfs_expr *expr, const cha
 
 			directive_strftime:
 				directive.fn = bfs_printf_strftime;
+				directive.ptr = (void *)&ctx->localtimes;
 				c = *++i;
 				if (!c) {
 					bfs_expr_error(ctx, expr);
@@ -862,6 +938,7 @@ int bfs_printf_parse(const struct bfs_ctx *ctx, struct bfs_expr *expr, const cha
 				goto directive_error;
 			}
 
+			directive.plain = dstrlen(directive.str) == 1;
 			if (dstrcat(&directive.str, specifier) != 0) {
 				bfs_perror(ctx, "dstrcat()");
 				goto directive_error;
@@ -0,0 +1,309 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * Profiles are text files with one line per expression:
+ *
+ *     bfs-profile 1
+ *     <evaluations> <successes> <nanoseconds> <key>
+ *     ...
+ *
+ * The key is the expression's arguments joined by spaces, with backslashes,
+ * spaces, and newlines escaped by a backslash.
+ */
+
+#include "profile.h"
+#include "alloc.h"
+#include "bfstd.h"
+#include "ctx.h"
+#include "dstring.h"
+#include "expr.h"
+#include "trie.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/** The first line of a profile. */
+#define PROFILE_HEADER "bfs-profile 1\n"
+
+struct bfs_profile {
+	/** Maps expression keys to their rates. */
+	struct trie rates;
+};
+
+/** Create an empty profile. */
+static struct bfs_profile *profile_new(void) {
+	struct bfs_profile *profile = ALLOC(struct bfs_profile);
+	if (profile) {
+		trie_init(&profile->rates);
+	}
+	return profile;
+}
+
+/** Compute the key for an expression. */
+static char *profile_key(const struct bfs_expr *expr) {
+	char *key = dstralloc(0);
+	if (!key) {
+		return NULL;
+	}
+
+	for (size_t i = 0; i < expr->argc; ++i) {
+		if (i > 0 && dstrapp(&key, ' ') != 0) {
+			goto fail;
+		}
+
+		for (const char *c = expr->argv[i]; *c; ++c) {
+			int ret;
+			if (*c == '\\' || *c == ' ') {
+				ret = dstrapp(&key, '\\') || dstrapp(&key, *c);
+			} else if (*c == '\n') {
+				ret = dstrcat(&key, "\\n");
+			} else {
+				ret = dstrapp(&key, *c);
+			}
+			if (ret != 0) {
+				goto fail;
+			}
+		}
+	}
+
+	return key;
+
+fail:
+	dstrfree(key);
+	return NULL;
+}
+
+/** Add some measurements to a profile. */
+static int profile_add(struct bfs_profile *profile, const char *key, const struct bfs_profile_rates *rates) {
+	struct trie_leaf *leaf = trie_insert_str(&profile->rates, key);
+	if (!leaf) {
+		return -1;
+	}
+
+	struct bfs_profile_rates *sum = leaf->value;
+	if (!sum) {
+		sum = ZALLOC(struct bfs_profile_rates);
+		if (!sum) {
+			return -1;
+		}
+		leaf->value = sum;
+	}
+
+	sum->evaluations += rates->evaluations;
+	sum->successes += rates->successes;
+	sum->elapsed += rates->elapsed;
+	return 0;
+}
+
+/** Parse one line of a profile. */
+static int profile_parse(struct bfs_profile *profile, char *line) {
+	size_t len = strlen(line);
+	if (len == 0 || line[len - 1] != '\n') {
+		errno = EINVAL;
+		return -1;
+	}
+	line[len - 1] = '\0';
+
+	struct bfs_profile_rates rates;
+	int offset = -1;
+	sscanf(line, "%zu %zu %lf %n", &rates.evaluations, &rates.successes, &rates.elapsed, &offset);
+	if (offset < 0 || rates.successes > rates.evaluations || !(rates.elapsed >= 0.0)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	return profile_add(profile, line + offset, &rates);
+}
+
+struct bfs_profile *bfs_profile_load(const char *path) {
+	struct bfs_profile *profile = profile_new();
+	if (!profile) {
+		return NULL;
+	}
+
+	FILE *file = xfopen(path, O_RDONLY | O_CLOEXEC);
+	if (!file) {
+		goto fail;
+	}
+
+	char *header = xgetdelim(file, '\n');
+	if (!header) {
+		if (errno == 0) {
+			errno = EINVAL;
+		}
+		goto fail;
+	}
+
+	bool valid = strcmp(header, PROFILE_HEADER) == 0;
+	free(header);
+	if (!valid) {
+		errno = EINVAL;
+		goto fail;
+	}
+
+	while (true) {
+		char *line = xgetdelim(file, '\n');
+		if (!line) {
+			if (errno) {
+				goto fail;
+			}
+			break;
+		}
+
+		int ret = profile_parse(profile, line);
+		free(line);
+		if (ret != 0) {
+			goto fail;
+		}
+	}
+
+	fclose(file);
+	return profile;
+
+fail:
+	if (file) {
+		int error = errno;
+		fclose(file);
+		errno = error;
+	}
+	bfs_profile_free(profile);
+	return NULL;
+}
+
+const struct bfs_profile_rates *bfs_profile_find(const struct bfs_profile *profile, const struct bfs_expr *expr) {
+	char *key = profile_key(expr);
+	if (!key) {
+		return NULL;
+	}
+
+	const struct trie_leaf *leaf = trie_find_str(&profile->rates, key);
+	dstrfree(key);
+	return leaf ? leaf->value : NULL;
+}
+
+/** Record the measurements for an expression and its children. */
+static int profile_record(struct bfs_profile *profile, const struct bfs_expr *expr) {
+	if (!expr) {
+		return 0;
+	}
+
+	if (bfs_expr_is_parent(expr)) {
+		if (profile_record(profile, expr->lhs) != 0) {
+			return -1;
+		}
+		return profile_record(profile, expr->rhs);
+	}
+
+	if (expr->evaluations == 0) {
+		return 0;
+	}
+
+	char *key = profile_key(expr);
+	if (!key) {
+		return -1;
+	}
+
+	struct bfs_profile_rates rates = {
+		.evaluations = expr->evaluations,
+		.successes = expr->successes,
+		.elapsed = 1.0e9 * expr->elapsed.tv_sec + expr->elapsed.tv_nsec,
+	};
+	int ret = profile_add(profile, key, &rates);
+	dstrfree(key);
+	return ret;
+}
+
+/** Write a profile to a file. */
+static int profile_write(const struct bfs_profile *profile, FILE *file) {
+	if (fputs(PROFILE_HEADER, file) == EOF) {
+		return -1;
+	}
+
+	TRIE_FOR_EACH(&profile->rates, leaf) {
+		const struct bfs_profile_rates *rates = leaf->value;
+		if (fprintf(file, "%zu %zu %.0f %s\n", rates->evaluations, rates->successes, rates->elapsed, leaf->key) < 0) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int bfs_profile_save(const struct bfs_ctx *ctx, const char *path) {
+	int ret = -1;
+	int error;
+	char *tmp = NULL;
+	FILE *file = NULL;
+
+	struct bfs_profile *profile = profile_new();
+	if (!profile) {
+		return -1;
+	}
+
+	if (profile_record(profile, ctx->exclude) != 0 || profile_record(profile, ctx->expr) != 0) {
+		goto done;
+	}
+
+	tmp = dstrprintf("%s.XXXXXX", path);
+	if (!tmp) {
+		goto done;
+	}
+
+	int fd = mkstemp(tmp);
+	if (fd < 0) {
+		goto done;
+	}
+
+	file = fdopen(fd, "w");
+	if (!file) {
+		close_quietly(fd);
+		goto unlink;
+	}
+
+	if (profile_write(profile, file) != 0) {
+		goto unlink;
+	}
+
+	error = fclose(file);
+	file = NULL;
+	if (error != 0) {
+		goto unlink;
+	}
+
+	if (rename(tmp, path) != 0) {
+		goto unlink;
+	}
+
+	ret = 0;
+	goto done;
+
+unlink:
+	error = errno;
+	if (file) {
+		fclose(file);
+	}
+	unlink(tmp);
+	errno = error;
+done:
+	error = errno;
+	dstrfree(tmp);
+	bfs_profile_free(profile);
+	errno = error;
+	return ret;
+}
+
+void bfs_profile_free(struct bfs_profile *profile) {
+	if (!profile) {
+		return;
+	}
+
+	TRIE_FOR_EACH(&profile->rates, leaf) {
+		free(leaf->value);
+	}
+	trie_destroy(&profile->rates);
+	free(profile);
+}
@@ -0,0 +1,78 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * Expression profiles (-profile), for profile-guided optimization.
+ *
+ * A profile records how often each primary expression was evaluated, how
+ * often it returned true, and how long it took, as measured by -D rates.  At
+ * -O4, a saved profile replaces the optimizer's built-in cost and probability
+ * estimates for any expression it has measurements for.
+ */
+
+#ifndef BFS_PROFILE_H
+#define BFS_PROFILE_H
+
+#include <stddef.h>
+
+struct bfs_ctx;
+struct bfs_expr;
+
+/**
+ * Measurements for a single expression.
+ */
+struct bfs_profile_rates {
+	/** The number of times the expression was evaluated. */
+	size_t evaluations;
+	/** The number of times it returned true. */
+	size_t successes;
+	/** The total time spent evaluating it, in nanoseconds. */
+	double elapsed;
+};
+
+/**
+ * A loaded profile.
+ */
+struct bfs_profile;
+
+/**
+ * Load a profile from a file.
+ *
+ * @param path
+ *         The path to the profile.
+ * @return
+ *         The loaded profile, or NULL on failure.  If the file is not a
+ *         valid profile, errno is set to EINVAL.
+ */
+struct bfs_profile *bfs_profile_load(const char *path);
+
+/**
+ * Find the measurements for an expression.
+ *
+ * @param profile
+ *         The profile to search.
+ * @param expr
+ *         The (non-parent) expression to look up.
+ * @return
+ *         The recorded rates, or NULL if there are none.
+ */
+const struct bfs_profile_rates *bfs_profile_find(const struct bfs_profile *profile, const struct bfs_expr *expr);
+
+/**
+ * Save the measurements from a search to a profile, replacing it atomically.
+ *
+ * @param ctx
+ *         The bfs context whose expressions were evaluated.
+ * @param path
+ *         The path to the profile.
+ * @return
+ *         0 on success, or -1 on failure.
+ */
+int bfs_profile_save(const struct bfs_ctx *ctx, const char *path);
+
+/**
+ * Free a profile.
+ */
+void bfs_profile_free(struct bfs_profile *profile);
+
+#endif // BFS_PROFILE_H
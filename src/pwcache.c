@@ -5,12 +5,15 @@
 #include "alloc.h"
 #include "config.h"
 #include "darray.h"
+#include "thread.h"
 #include "trie.h"
 #include <errno.h>
 #include <grp.h>
+#include <pthread.h>
 #include <pwd.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
 #include <unistd.h>
 
 /** Represents cache hits for negative results. */
@@ -52,6 +55,206 @@ static void *bfs_getent(struct trie_leaf *leaf, bfs_getent_fn *fn, const void *k
 	}
 }
 
+/** Look up an entry in a lazily filled map. */
+static void *bfs_getent_locked(pthread_mutex_t *mutex, struct trie *trie, bfs_getent_fn *fn, const void *key, size_t keylen, size_t entsize, size_t bufsize) {
+	mutex_lock(mutex);
+
+	void *ret = NULL;
+	struct trie_leaf *leaf = trie_insert_mem(trie, key, keylen);
+	if (leaf) {
+		ret = bfs_getent(leaf, fn, key, entsize, bufsize);
+	}
+
+	int error = errno;
+	mutex_unlock(mutex);
+	errno = error;
+	return ret;
+}
+
+/** An entry in a preloaded table. */
+struct bfs_pwent {
+	/** The user or group ID. */
+	id_t id;
+	/** The order the entry was read in. */
+	size_t index;
+	/** The entry itself. */
+	void *ent;
+};
+
+/**
+ * A preloaded user or group database.  It is never modified after it is
+ * loaded, so it can be searched from any thread without locking.
+ */
+struct bfs_pwtable {
+	/** The entries (a darray), sorted by ID. */
+	struct bfs_pwent *entries;
+	/** The number of distinct IDs. */
+	size_t count;
+};
+
+/** Initialize an empty table. */
+static void bfs_pwtable_init(struct bfs_pwtable *table) {
+	table->entries = NULL;
+	table->count = 0;
+}
+
+/** Add an entry to a table being loaded. */
+static int bfs_pwtable_push(struct bfs_pwtable *table, id_t id, void *ent) {
+	struct bfs_pwent pwent = {
+		.id = id,
+		.index = darray_length(table->entries),
+		.ent = ent,
+	};
+
+	if (DARRAY_PUSH(&table->entries, &pwent) != 0) {
+		free(ent);
+		return -1;
+	}
+
+	return 0;
+}
+
+/** qsort() comparator for table entries. */
+static int bfs_pwent_cmp(const void *a, const void *b) {
+	const struct bfs_pwent *lhs = a;
+	const struct bfs_pwent *rhs = b;
+
+	if (lhs->id != rhs->id) {
+		return lhs->id < rhs->id ? -1 : 1;
+	} else if (lhs->index != rhs->index) {
+		return lhs->index < rhs->index ? -1 : 1;
+	} else {
+		return 0;
+	}
+}
+
+/** Sort a freshly loaded table, keeping only the first entry for each ID. */
+static void bfs_pwtable_sort(struct bfs_pwtable *table) {
+	struct bfs_pwent *entries = table->entries;
+	size_t len = darray_length(entries);
+	qsort(entries, len, sizeof(*entries), bfs_pwent_cmp);
+
+	// get{pw,gr}?id() return the first match, so the rest are unreachable
+	size_t count = 0;
+	for (size_t i = 0; i < len; ++i) {
+		if (count > 0 && entries[count - 1].id == entries[i].id) {
+			free(entries[i].ent);
+		} else {
+			entries[count++] = entries[i];
+		}
+	}
+
+	table->count = count;
+}
+
+/** Binary search a table for an ID. */
+static void *bfs_pwtable_find(const struct bfs_pwtable *table, id_t id) {
+	const struct bfs_pwent *entries = table->entries;
+	size_t lo = 0, hi = table->count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (entries[mid].id < id) {
+			lo = mid + 1;
+		} else if (entries[mid].id > id) {
+			hi = mid;
+		} else {
+			return entries[mid].ent;
+		}
+	}
+
+	return NULL;
+}
+
+/** Free a table. */
+static void bfs_pwtable_destroy(struct bfs_pwtable *table) {
+	for (size_t i = 0; i < table->count; ++i) {
+		free(table->entries[i].ent);
+	}
+	darray_free(table->entries);
+}
+
+/** Get the size of a string to copy, including the terminator. */
+static size_t bfs_pwstr_size(const char *str) {
+	return str ? strlen(str) + 1 : 0;
+}
+
+/** Copy a string to the end of an entry, advancing the cursor. */
+static void bfs_pwstr_copy(char **str, char **cursor) {
+	if (*str) {
+		size_t size = strlen(*str) + 1;
+		*str = memcpy(*cursor, *str, size);
+		*cursor += size;
+	}
+}
+
+/**
+ * Copy a passwd entry into a single allocation, like getpwuid_r() would fill
+ * in, since getpwent() overwrites it on every call.
+ */
+static struct passwd *bfs_pwdup(const struct passwd *pwd) {
+	size_t size = sizeof(*pwd);
+	size += bfs_pwstr_size(pwd->pw_name);
+	size += bfs_pwstr_size(pwd->pw_passwd);
+	size += bfs_pwstr_size(pwd->pw_gecos);
+	size += bfs_pwstr_size(pwd->pw_dir);
+	size += bfs_pwstr_size(pwd->pw_shell);
+
+	struct passwd *ret = malloc(size);
+	if (!ret) {
+		return NULL;
+	}
+
+	*ret = *pwd;
+	char *cursor = (char *)(ret + 1);
+	bfs_pwstr_copy(&ret->pw_name, &cursor);
+	bfs_pwstr_copy(&ret->pw_passwd, &cursor);
+	bfs_pwstr_copy(&ret->pw_gecos, &cursor);
+	bfs_pwstr_copy(&ret->pw_dir, &cursor);
+	bfs_pwstr_copy(&ret->pw_shell, &cursor);
+	return ret;
+}
+
+/** Copy a group entry into a single allocation. */
+static struct group *bfs_grdup(const struct group *grp) {
+	size_t nmem = 0;
+	if (grp->gr_mem) {
+		while (grp->gr_mem[nmem]) {
+			++nmem;
+		}
+	}
+
+	size_t size = sizeof(*grp) + (nmem + 1) * sizeof(char *);
+	size += bfs_pwstr_size(grp->gr_name);
+	size += bfs_pwstr_size(grp->gr_passwd);
+	for (size_t i = 0; i < nmem; ++i) {
+		size += bfs_pwstr_size(grp->gr_mem[i]);
+	}
+
+	struct group *ret = malloc(size);
+	if (!ret) {
+		return NULL;
+	}
+
+	*ret = *grp;
+	char **mem = (char **)(ret + 1);
+	char *cursor = (char *)(mem + nmem + 1);
+	bfs_pwstr_copy(&ret->gr_name, &cursor);
+	bfs_pwstr_copy(&ret->gr_passwd, &cursor);
+	for (size_t i = 0; i < nmem; ++i) {
+		mem[i] = grp->gr_mem[i];
+		bfs_pwstr_copy(&mem[i], &cursor);
+	}
+	mem[nmem] = NULL;
+	ret->gr_mem = mem;
+	return ret;
+}
+
+/** Check if get{pw,gr}ent() returned NULL because there are no more entries. */
+static bool bfs_getent_done(void) {
+	// Some implementations report the end of the database with ENOENT
+	return errno == 0 || errno == ENOENT;
+}
+
 /** Flush a single cache. */
 static void bfs_pwcache_flush(struct trie *trie) {
 	TRIE_FOR_EACH(trie, leaf) {
@@ -63,6 +266,10 @@ static void bfs_pwcache_flush(struct trie *trie) {
 }
 
 struct bfs_users {
+	/** The preloaded user database, if any. */
+	struct bfs_pwtable table;
+	/** Protects the lazily filled maps below. */
+	pthread_mutex_t mutex;
 	/** Initial buffer size for getpw*_r(). */
 	size_t bufsize;
 	/** A map from usernames to entries. */
@@ -77,6 +284,13 @@ struct bfs_users *bfs_users_new(void) {
 		return NULL;
 	}
 
+	if (mutex_init(&users->mutex, NULL) != 0) {
+		free(users);
+		return NULL;
+	}
+
+	bfs_pwtable_init(&users->table);
+
 	long bufsize = sysconf(_SC_GETPW_R_SIZE_MAX);
 	if (bufsize > 0) {
 		users->bufsize = bufsize;
@@ -97,12 +311,7 @@ static void *bfs_getpwnam_impl(const void *key, void *ent, void *buf, size_t buf
 }
 
 const struct passwd *bfs_getpwnam(struct bfs_users *users, const char *name) {
-	struct trie_leaf *leaf = trie_insert_str(&users->by_name, name);
-	if (!leaf) {
-		return NULL;
-	}
-
-	return bfs_getent(leaf, bfs_getpwnam_impl, name, sizeof(struct passwd), users->bufsize);
+	return bfs_getent_locked(&users->mutex, &users->by_name, bfs_getpwnam_impl, name, strlen(name) + 1, sizeof(struct passwd), users->bufsize);
 }
 
 /** bfs_getent() callback for getpwuid_r(). */
@@ -113,17 +322,54 @@ static void *bfs_getpwuid_impl(const void *key, void *ent, void *buf, size_t buf
 }
 
 const struct passwd *bfs_getpwuid(struct bfs_users *users, uid_t uid) {
-	struct trie_leaf *leaf = trie_insert_mem(&users->by_uid, &uid, sizeof(uid));
-	if (!leaf) {
-		return NULL;
+	const struct passwd *pwd = bfs_pwtable_find(&users->table, uid);
+	if (pwd) {
+		errno = 0;
+		return pwd;
 	}
 
-	return bfs_getent(leaf, bfs_getpwuid_impl, &uid, sizeof(struct passwd), users->bufsize);
+	// Not every user database can be enumerated, so fall back to lookups
+	return bfs_getent_locked(&users->mutex, &users->by_uid, bfs_getpwuid_impl, &uid, sizeof(uid), sizeof(struct passwd), users->bufsize);
+}
+
+int bfs_users_preload(struct bfs_users *users) {
+	if (users->table.entries) {
+		return 0;
+	}
+
+	struct bfs_pwtable *table = &users->table;
+	int ret = -1;
+
+	setpwent();
+	while (true) {
+		errno = 0;
+		struct passwd *pwd = getpwent();
+		if (!pwd) {
+			if (bfs_getent_done()) {
+				ret = 0;
+			}
+			break;
+		}
+
+		struct passwd *copy = bfs_pwdup(pwd);
+		if (!copy || bfs_pwtable_push(table, copy->pw_uid, copy) != 0) {
+			break;
+		}
+	}
+
+	int error = errno;
+	endpwent();
+
+	bfs_pwtable_sort(table);
+	errno = error;
+	return ret;
 }
 
 void bfs_users_flush(struct bfs_users *users) {
+	mutex_lock(&users->mutex);
 	bfs_pwcache_flush(&users->by_name);
 	bfs_pwcache_flush(&users->by_uid);
+	mutex_unlock(&users->mutex);
 }
 
 void bfs_users_free(struct bfs_users *users) {
@@ -131,11 +377,17 @@ void bfs_users_free(struct bfs_users *users) {
 		bfs_users_flush(users);
 		trie_destroy(&users->by_uid);
 		trie_destroy(&users->by_name);
+		mutex_destroy(&users->mutex);
+		bfs_pwtable_destroy(&users->table);
 		free(users);
 	}
 }
 
 struct bfs_groups {
+	/** The preloaded group database, if any. */
+	struct bfs_pwtable table;
+	/** Protects the lazily filled maps below. */
+	pthread_mutex_t mutex;
 	/** Initial buffer size for getgr*_r(). */
 	size_t bufsize;
 	/** A map from group names to entries. */
@@ -150,6 +402,13 @@ struct bfs_groups *bfs_groups_new(void) {
 		return NULL;
 	}
 
+	if (mutex_init(&groups->mutex, NULL) != 0) {
+		free(groups);
+		return NULL;
+	}
+
+	bfs_pwtable_init(&groups->table);
+
 	long bufsize = sysconf(_SC_GETGR_R_SIZE_MAX);
 	if (bufsize > 0) {
 		groups->bufsize = bufsize;
@@ -170,12 +429,7 @@ static void *bfs_getgrnam_impl(const void *key, void *ent, void *buf, size_t buf
 }
 
 const struct group *bfs_getgrnam(struct bfs_groups *groups, const char *name) {
-	struct trie_leaf *leaf = trie_insert_str(&groups->by_name, name);
-	if (!leaf) {
-		return NULL;
-	}
-
-	return bfs_getent(leaf, bfs_getgrnam_impl, name, sizeof(struct group), groups->bufsize);
+	return bfs_getent_locked(&groups->mutex, &groups->by_name, bfs_getgrnam_impl, name, strlen(name) + 1, sizeof(struct group), groups->bufsize);
 }
 
 /** bfs_getent() callback for getgrgid_r(). */
@@ -186,17 +440,53 @@ static void *bfs_getgrgid_impl(const void *key, void *ent, void *buf, size_t buf
 }
 
 const struct group *bfs_getgrgid(struct bfs_groups *groups, gid_t gid) {
-	struct trie_leaf *leaf = trie_insert_mem(&groups->by_gid, &gid, sizeof(gid));
-	if (!leaf) {
-		return NULL;
+	const struct group *grp = bfs_pwtable_find(&groups->table, gid);
+	if (grp) {
+		errno = 0;
+		return grp;
 	}
 
-	return bfs_getent(leaf, bfs_getgrgid_impl, &gid, sizeof(struct group), groups->bufsize);
+	return bfs_getent_locked(&groups->mutex, &groups->by_gid, bfs_getgrgid_impl, &gid, sizeof(gid), sizeof(struct group), groups->bufsize);
+}
+
+int bfs_groups_preload(struct bfs_groups *groups) {
+	if (groups->table.entries) {
+		return 0;
+	}
+
+	struct bfs_pwtable *table = &groups->table;
+	int ret = -1;
+
+	setgrent();
+	while (true) {
+		errno = 0;
+		struct group *grp = getgrent();
+		if (!grp) {
+			if (bfs_getent_done()) {
+				ret = 0;
+			}
+			break;
+		}
+
+		struct group *copy = bfs_grdup(grp);
+		if (!copy || bfs_pwtable_push(table, copy->gr_gid, copy) != 0) {
+			break;
+		}
+	}
+
+	int error = errno;
+	endgrent();
+
+	bfs_pwtable_sort(table);
+	errno = error;
+	return ret;
 }
 
 void bfs_groups_flush(struct bfs_groups *groups) {
+	mutex_lock(&groups->mutex);
 	bfs_pwcache_flush(&groups->by_name);
 	bfs_pwcache_flush(&groups->by_gid);
+	mutex_unlock(&groups->mutex);
 }
 
 void bfs_groups_free(struct bfs_groups *groups) {
@@ -204,6 +494,8 @@ void bfs_groups_free(struct bfs_groups *groups) {
 		bfs_groups_flush(groups);
 		trie_destroy(&groups->by_gid);
 		trie_destroy(&groups->by_name);
+		mutex_destroy(&groups->mutex);
+		bfs_pwtable_destroy(&groups->table);
 		free(groups);
 	}
 }
@@ -3,6 +3,11 @@
 
 /**
  * A caching wrapper for /etc/{passwd,group}.
+ *
+ * Lookups are safe to do from multiple threads.  By default, entries are
+ * looked up lazily and cached, but the whole database can also be loaded up
+ * front with bfs_{users,groups}_preload().  That saves a round-trip per ID for
+ * network databases like LDAP, and lets ID lookups skip the lock entirely.
  */
 
 #ifndef BFS_PWCACHE_H
@@ -50,6 +55,20 @@ const struct passwd *bfs_getpwnam(struct bfs_users *users, const char *name);
  */
 const struct passwd *bfs_getpwuid(struct bfs_users *users, uid_t uid);
 
+/**
+ * Load the entire user database with getpwent().
+ *
+ * The preloaded entries are not affected by bfs_users_flush().  IDs that are
+ * missing from it (e.g. because the database can't be enumerated) are still
+ * looked up lazily.
+ *
+ * @param users
+ *         The user cache.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_users_preload(struct bfs_users *users);
+
 /**
  * Flush a user cache.
  *
@@ -105,6 +124,16 @@ const struct group *bfs_getgrnam(struct bfs_groups *groups, const char *name);
  */
 const struct group *bfs_getgrgid(struct bfs_groups *groups, gid_t gid);
 
+/**
+ * Load the entire group database with getgrent().
+ *
+ * @param groups
+ *         The group cache.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_groups_preload(struct bfs_groups *groups);
+
 /**
  * Flush a group cache.
  *
@@ -6,6 +6,7 @@
 #include "bfstd.h"
 #include "config.h"
 #include "diag.h"
+#include "perf.h"
 #include "sanity.h"
 #include <errno.h>
 #include <fcntl.h>
@@ -13,20 +14,11 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 
-#if defined(STATX_BASIC_STATS) && (!__ANDROID__ || __ANDROID_API__ >= 30)
-#  define BFS_HAS_LIBC_STATX true
-#elif __linux__
-#  include <linux/stat.h>
+#if BFS_USE_STATX && !BFS_HAS_LIBC_STATX
 #  include <sys/syscall.h>
 #  include <unistd.h>
 #endif
 
-#ifndef BFS_USE_STATX
-#  if BFS_HAS_LIBC_STATX || defined(SYS_statx)
-#    define BFS_USE_STATX true
-#  endif
-#endif
-
 const char *bfs_stat_field_name(enum bfs_stat_field field) {
 	switch (field) {
 	case BFS_STAT_DEV:
@@ -150,19 +142,55 @@ static int bfs_statx(int at_fd, const char *at_path, int at_flags, unsigned int
 	return ret;
 }
 
-/**
- * bfs_stat() implementation backed by statx().
- */
-static int bfs_statx_impl(int at_fd, const char *at_path, int at_flags, struct bfs_stat *buf) {
-	unsigned int mask = STATX_BASIC_STATS | STATX_BTIME;
-	struct statx xbuf;
-	int ret = bfs_statx(at_fd, at_path, at_flags, mask, &xbuf);
-	if (ret != 0) {
-		return ret;
+unsigned int bfs_statx_mask(enum bfs_stat_field fields) {
+	// DEV, RDEV, and ATTRS are always returned
+	unsigned int mask = 0;
+
+	if (fields & BFS_STAT_INO) {
+		mask |= STATX_INO;
+	}
+	if (fields & BFS_STAT_TYPE) {
+		mask |= STATX_TYPE;
+	}
+	if (fields & BFS_STAT_MODE) {
+		mask |= STATX_MODE;
+	}
+	if (fields & BFS_STAT_NLINK) {
+		mask |= STATX_NLINK;
+	}
+	if (fields & BFS_STAT_GID) {
+		mask |= STATX_GID;
+	}
+	if (fields & BFS_STAT_UID) {
+		mask |= STATX_UID;
+	}
+	if (fields & BFS_STAT_SIZE) {
+		mask |= STATX_SIZE;
+	}
+	if (fields & BFS_STAT_BLOCKS) {
+		mask |= STATX_BLOCKS;
+	}
+	if (fields & BFS_STAT_ATIME) {
+		mask |= STATX_ATIME;
+	}
+	if (fields & BFS_STAT_BTIME) {
+		mask |= STATX_BTIME;
+	}
+	if (fields & BFS_STAT_CTIME) {
+		mask |= STATX_CTIME;
+	}
+	if (fields & BFS_STAT_MTIME) {
+		mask |= STATX_MTIME;
 	}
 
-	// Callers shouldn't have to check anything except the times
-	const unsigned int guaranteed = STATX_BASIC_STATS ^ (STATX_ATIME | STATX_CTIME | STATX_MTIME);
+	return mask;
+}
+
+int bfs_statx_convert(const struct statx *src, enum bfs_stat_field fields, struct bfs_stat *buf) {
+	const struct statx xbuf = *src;
+
+	// Callers shouldn't have to check anything they asked for except the times
+	const unsigned int guaranteed = bfs_statx_mask(fields) & STATX_BASIC_STATS & ~(STATX_ATIME | STATX_CTIME | STATX_MTIME);
 	if ((xbuf.stx_mask & guaranteed) != guaranteed) {
 		errno = ENOTSUP;
 		return -1;
@@ -241,7 +269,20 @@ static int bfs_statx_impl(int at_fd, const char *at_path, int at_flags, struct b
 		buf->mask |= BFS_STAT_MTIME;
 	}
 
-	return ret;
+	return 0;
+}
+
+/**
+ * bfs_stat() implementation backed by statx().
+ */
+static int bfs_statx_impl(int at_fd, const char *at_path, int at_flags, enum bfs_stat_field fields, struct bfs_stat *buf) {
+	struct statx xbuf;
+	int ret = bfs_statx(at_fd, at_path, at_flags, bfs_statx_mask(fields), &xbuf);
+	if (ret != 0) {
+		return ret;
+	}
+
+	return bfs_statx_convert(&xbuf, fields, buf);
 }
 
 #endif // BFS_USE_STATX
@@ -249,12 +290,12 @@ static int bfs_statx_impl(int at_fd, const char *at_path, int at_flags, struct b
 /**
  * Calls the stat() implementation with explicit flags.
  */
-static int bfs_stat_explicit(int at_fd, const char *at_path, int at_flags, int x_flags, struct bfs_stat *buf) {
+static int bfs_stat_explicit(int at_fd, const char *at_path, int at_flags, int x_flags, enum bfs_stat_field fields, struct bfs_stat *buf) {
 #if BFS_USE_STATX
 	static atomic bool has_statx = true;
 
 	if (load(&has_statx, relaxed)) {
-		int ret = bfs_statx_impl(at_fd, at_path, at_flags | x_flags, buf);
+		int ret = bfs_statx_impl(at_fd, at_path, at_flags | x_flags, fields, buf);
 		// EPERM is commonly returned in a seccomp() sandbox that does
 		// not allow statx()
 		if (ret != 0 && (errno == ENOSYS || errno == EPERM)) {
@@ -271,21 +312,22 @@ static int bfs_stat_explicit(int at_fd, const char *at_path, int at_flags, int x
 /**
  * Implements the BFS_STAT_TRYFOLLOW retry logic.
  */
-static int bfs_stat_tryfollow(int at_fd, const char *at_path, int at_flags, int x_flags, enum bfs_stat_flags bfs_flags, struct bfs_stat *buf) {
-	int ret = bfs_stat_explicit(at_fd, at_path, at_flags, x_flags, buf);
+static int bfs_stat_tryfollow(int at_fd, const char *at_path, int at_flags, int x_flags, enum bfs_stat_flags bfs_flags, enum bfs_stat_field fields, struct bfs_stat *buf) {
+	int ret = bfs_stat_explicit(at_fd, at_path, at_flags, x_flags, fields, buf);
 
 	if (ret != 0
 	    && (bfs_flags & (BFS_STAT_NOFOLLOW | BFS_STAT_TRYFOLLOW)) == BFS_STAT_TRYFOLLOW
 	    && is_nonexistence_error(errno))
 	{
 		at_flags |= AT_SYMLINK_NOFOLLOW;
-		ret = bfs_stat_explicit(at_fd, at_path, at_flags, x_flags, buf);
+		ret = bfs_stat_explicit(at_fd, at_path, at_flags, x_flags, fields, buf);
 	}
 
 	return ret;
 }
 
-int bfs_stat(int at_fd, const char *at_path, enum bfs_stat_flags flags, struct bfs_stat *buf) {
+/** Convert bfs_stat_flags to *at() flags. */
+static int bfs_at_flags(enum bfs_stat_flags flags) {
 	int at_flags = 0;
 	if (flags & BFS_STAT_NOFOLLOW) {
 		at_flags |= AT_SYMLINK_NOFOLLOW;
@@ -295,15 +337,41 @@ int bfs_stat(int at_fd, const char *at_path, enum bfs_stat_flags flags, struct b
 	at_flags |= AT_NO_AUTOMOUNT;
 #endif
 
+	return at_flags;
+}
+
+/** Convert bfs_stat_flags to statx()-specific flags. */
+static int bfs_x_flags(enum bfs_stat_flags flags, enum bfs_stat_field fields) {
+	// The identity and type of an inode never change, so there's no need
+	// to synchronize with the server just to get them
+	if (!(fields & ~(BFS_STAT_DEV | BFS_STAT_INO | BFS_STAT_TYPE))) {
+		flags |= BFS_STAT_NOSYNC;
+	}
+
 	int x_flags = 0;
 #ifdef AT_STATX_DONT_SYNC
 	if (flags & BFS_STAT_NOSYNC) {
 		x_flags |= AT_STATX_DONT_SYNC;
 	}
 #endif
+	return x_flags;
+}
+
+#if BFS_USE_STATX
+
+int bfs_statx_flags(enum bfs_stat_flags flags, enum bfs_stat_field fields) {
+	return bfs_at_flags(flags) | bfs_x_flags(flags, fields);
+}
+
+#endif
+
+/** bfs_stat() implementation. */
+static int bfs_stat_any(int at_fd, const char *at_path, enum bfs_stat_flags flags, enum bfs_stat_field fields, struct bfs_stat *buf) {
+	int at_flags = bfs_at_flags(flags);
+	int x_flags = bfs_x_flags(flags, fields);
 
 	if (at_path) {
-		return bfs_stat_tryfollow(at_fd, at_path, at_flags, x_flags, flags, buf);
+		return bfs_stat_tryfollow(at_fd, at_path, at_flags, x_flags, flags, fields, buf);
 	}
 
 	// Check __GNU__ to work around https://lists.gnu.org/archive/html/bug-hurd/2021-12/msg00001.html
@@ -311,7 +379,7 @@ int bfs_stat(int at_fd, const char *at_path, enum bfs_stat_flags flags, struct b
 	static atomic bool has_at_ep = true;
 	if (load(&has_at_ep, relaxed)) {
 		at_flags |= AT_EMPTY_PATH;
-		int ret = bfs_stat_explicit(at_fd, "", at_flags, x_flags, buf);
+		int ret = bfs_stat_explicit(at_fd, "", at_flags, x_flags, fields, buf);
 		if (ret != 0 && errno == EINVAL) {
 			store(&has_at_ep, false, relaxed);
 		} else {
@@ -329,6 +397,17 @@ int bfs_stat(int at_fd, const char *at_path, enum bfs_stat_flags flags, struct b
 	}
 }
 
+int bfs_stat_fields(int at_fd, const char *at_path, enum bfs_stat_flags flags, enum bfs_stat_field fields, struct bfs_stat *buf) {
+	uint64_t start = perf_start();
+	int ret = bfs_stat_any(at_fd, at_path, flags, fields, buf);
+	perf_stop(PERF_STAT, start);
+	return ret;
+}
+
+int bfs_stat(int at_fd, const char *at_path, enum bfs_stat_flags flags, struct bfs_stat *buf) {
+	return bfs_stat_fields(at_fd, at_path, flags, BFS_STAT_ALL, buf);
+}
+
 const struct timespec *bfs_stat_time(const struct bfs_stat *buf, enum bfs_stat_field field) {
 	if (!(buf->mask & field)) {
 		errno = ENOTSUP;
@@ -13,6 +13,7 @@
 #define BFS_STAT_H
 
 #include "config.h"
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
 
@@ -20,6 +21,19 @@
 #  include <sys/param.h>
 #endif
 
+#if defined(STATX_BASIC_STATS) && (!__ANDROID__ || __ANDROID_API__ >= 30)
+#  define BFS_HAS_LIBC_STATX true
+#elif __linux__
+#  include <linux/stat.h>
+#  include <sys/syscall.h>
+#endif
+
+#ifndef BFS_USE_STATX
+#  if BFS_HAS_LIBC_STATX || defined(SYS_statx)
+#    define BFS_USE_STATX true
+#  endif
+#endif
+
 /**
  * bfs_stat field bitmask.
  */
@@ -41,6 +55,11 @@ enum bfs_stat_field {
 	BFS_STAT_MTIME  = 1 << 14,
 };
 
+/**
+ * All the bfs_stat fields.
+ */
+#define BFS_STAT_ALL ((enum bfs_stat_field)((BFS_STAT_MTIME << 1) - 1))
+
 /**
  * Get the human-readable name of a bfs_stat field.
  */
@@ -124,6 +143,57 @@ struct bfs_stat {
  */
 int bfs_stat(int at_fd, const char *at_path, enum bfs_stat_flags flags, struct bfs_stat *buf);
 
+/**
+ * Like bfs_stat(), but only some fields are required.  Asking for fewer fields
+ * lets statx() skip work, e.g. synchronizing attributes on network file
+ * systems.  Fields that weren't asked for may still be filled in; check
+ * buf->mask before using them.
+ *
+ * @param at_fd
+ *         The base file descriptor for the lookup.
+ * @param at_path
+ *         The path to stat, relative to at_fd.
+ * @param flags
+ *         Flags that affect the lookup.
+ * @param fields
+ *         The fields that are needed.
+ * @param[out] buf
+ *         A place to store the stat buffer, if successful.
+ * @return
+ *         0 on success, -1 on error.
+ */
+int bfs_stat_fields(int at_fd, const char *at_path, enum bfs_stat_flags flags, enum bfs_stat_field fields, struct bfs_stat *buf);
+
+#if BFS_USE_STATX
+
+/**
+ * Get the statx() mask that requests some bfs_stat fields.
+ */
+unsigned int bfs_statx_mask(enum bfs_stat_field fields);
+
+/**
+ * Convert bfs_stat_flags to the flags for a statx() call.  Useful for issuing
+ * statx() calls through other interfaces, like io_uring.  Note that
+ * BFS_STAT_TRYFOLLOW is not handled; callers must retry themselves.
+ */
+int bfs_statx_flags(enum bfs_stat_flags flags, enum bfs_stat_field fields);
+
+/**
+ * Convert a statx() buffer to a bfs_stat() buffer.
+ *
+ * @param src
+ *         The filled statx() buffer.
+ * @param fields
+ *         The fields that were requested.
+ * @param[out] buf
+ *         The bfs_stat() buffer to fill.
+ * @return
+ *         0 on success, -1 on error.
+ */
+int bfs_statx_convert(const struct statx *src, enum bfs_stat_field fields, struct bfs_stat *buf);
+
+#endif
+
 /**
  * Get a particular time field from a bfs_stat() buffer.
  */
@@ -0,0 +1,250 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "trace.h"
+#include "alloc.h"
+#include "bfstd.h"
+#include "config.h"
+#include "diag.h"
+#include "perf.h"
+#include "thread.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+bool trace_enabled = false;
+
+/** A recorded span. */
+struct trace_event {
+	/** The start time, in nanoseconds. */
+	uint64_t start;
+	/** The duration, in nanoseconds. */
+	uint64_t dur;
+	/** The probe argument. */
+	uint64_t arg;
+	/** The thread that recorded it. */
+	uint32_t tid;
+	/** The probe that fired. */
+	uint32_t probe;
+};
+
+/** The number of events each thread buffers before writing them out. */
+#define TRACE_BUFSIZE 4096
+
+/** A per-thread event buffer. */
+struct trace_buffer {
+	/** The next buffer in the global list. */
+	struct trace_buffer *next;
+	/** The thread ID used in the trace. */
+	uint32_t tid;
+	/** The number of buffered events. */
+	size_t len;
+	/** The buffered events. */
+	struct trace_event events[TRACE_BUFSIZE];
+};
+
+/** This thread's buffer. */
+static _Thread_local struct trace_buffer *trace_local;
+
+/** Protects the fields below. */
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+/** Every thread's buffer. */
+static struct trace_buffer *trace_buffers;
+/** The number of threads seen so far. */
+static uint32_t trace_nthreads;
+/** Full buffers are spilled here, in binary. */
+static FILE *trace_spill;
+/** The first error writing the spill file. */
+static int trace_error;
+
+/** The JSON output file. */
+static FILE *trace_out;
+/** The time tracing started. */
+static uint64_t trace_epoch;
+
+/** Probe names and argument names. */
+static const struct {
+	const char *name;
+	const char *arg;
+} probes[] = {
+	[TRACE_IOQ_OPENDIR] = {"ioq_opendir", "depth"},
+	[TRACE_IOQ_POP] = {"ioq_pop", "block"},
+	[TRACE_READDIR] = {"readdir", "depth"},
+	[TRACE_STAT] = {"stat", "flags"},
+	[TRACE_EVAL] = {"eval", "depth"},
+	[TRACE_SPAWN] = {"spawn", "pid"},
+	[TRACE_IOQ_HANDLE] = {"ioq_handle", "op"},
+};
+
+/** Get (or create) the current thread's buffer. */
+static struct trace_buffer *trace_buffer(void) {
+	struct trace_buffer *buffer = trace_local;
+	if (buffer) {
+		return buffer;
+	}
+
+	buffer = ALLOC(struct trace_buffer);
+	if (!buffer) {
+		return NULL;
+	}
+	buffer->len = 0;
+
+	mutex_lock(&trace_mutex);
+	buffer->tid = trace_nthreads++;
+	buffer->next = trace_buffers;
+	trace_buffers = buffer;
+	mutex_unlock(&trace_mutex);
+
+	trace_local = buffer;
+	return buffer;
+}
+
+/** Write out a buffer's events.  Call with trace_mutex held. */
+static void trace_flush_locked(struct trace_buffer *buffer) {
+	size_t len = buffer->len;
+	if (len > 0 && fwrite(buffer->events, sizeof(buffer->events[0]), len, trace_spill) != len) {
+		if (!trace_error) {
+			trace_error = errno ? errno : EIO;
+		}
+	}
+	buffer->len = 0;
+}
+
+void trace_record(enum trace_probe probe, uint64_t start, uint64_t arg) {
+	bfs_assert(probe < TRACE_PROBES);
+
+	uint64_t end = perf_now();
+
+	struct trace_buffer *buffer = trace_buffer();
+	if (!buffer) {
+		// Lose the event rather than disturbing the search
+		return;
+	}
+
+	if (buffer->len == TRACE_BUFSIZE) {
+		mutex_lock(&trace_mutex);
+		trace_flush_locked(buffer);
+		mutex_unlock(&trace_mutex);
+	}
+
+	struct trace_event *event = &buffer->events[buffer->len++];
+	event->start = start;
+	event->dur = end - start;
+	event->arg = arg;
+	event->tid = buffer->tid;
+	event->probe = probe;
+}
+
+int trace_open(const char *path) {
+	bfs_assert(!trace_enabled);
+
+	trace_out = xfopen(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC);
+	if (!trace_out) {
+		return -1;
+	}
+
+	trace_spill = tmpfile();
+	if (!trace_spill) {
+		int error = errno;
+		fclose(trace_out);
+		trace_out = NULL;
+		errno = error;
+		return -1;
+	}
+
+	trace_epoch = perf_now();
+	trace_enabled = true;
+
+	// Make sure the main thread shows up as thread 0
+	trace_buffer();
+	return 0;
+}
+
+/** Write one event as JSON. */
+static void trace_write_event(const struct trace_event *event, bool *first) {
+	const char *name = "???";
+	const char *arg = "arg";
+	if (event->probe < TRACE_PROBES) {
+		name = probes[event->probe].name;
+		arg = probes[event->probe].arg;
+	}
+
+	// Chrome traces count microseconds
+	double ts = (double)(event->start - trace_epoch) / 1000.0;
+	double dur = (double)event->dur / 1000.0;
+
+	fprintf(trace_out, "%s\n{\"name\":\"%s\",\"cat\":\"bfs\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u,\"args\":{\"%s\":%ju}}",
+		*first ? "" : ",", name, ts, dur, (int)getpid(), (unsigned int)event->tid, arg, (uintmax_t)event->arg);
+	*first = false;
+}
+
+int trace_close(void) {
+	if (!trace_enabled) {
+		return 0;
+	}
+	trace_enabled = false;
+
+	int ret = 0;
+
+	mutex_lock(&trace_mutex);
+
+	fprintf(trace_out, "{\"traceEvents\":[");
+	bool first = true;
+
+	// Name the threads, so the main thread is easy to find
+	for (uint32_t tid = 0; tid < trace_nthreads; ++tid) {
+		fprintf(trace_out, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"%s %u\"}}",
+			first ? "" : ",", (int)getpid(), (unsigned int)tid, tid == 0 ? "main" : "thread", (unsigned int)tid);
+		first = false;
+	}
+
+	struct trace_buffer *buffer = trace_buffers;
+	while (buffer) {
+		trace_flush_locked(buffer);
+		struct trace_buffer *next = buffer->next;
+		free(buffer);
+		buffer = next;
+	}
+	trace_buffers = NULL;
+	trace_local = NULL;
+
+	if (trace_error) {
+		errno = trace_error;
+		ret = -1;
+	} else if (fflush(trace_spill) != 0 || fseek(trace_spill, 0, SEEK_SET) != 0) {
+		ret = -1;
+	}
+
+	if (ret == 0) {
+		struct trace_event events[256];
+		size_t len;
+		while ((len = fread(events, sizeof(events[0]), countof(events), trace_spill)) > 0) {
+			for (size_t i = 0; i < len; ++i) {
+				trace_write_event(&events[i], &first);
+			}
+		}
+		if (ferror(trace_spill)) {
+			ret = -1;
+		}
+	}
+
+	fprintf(trace_out, "\n]}\n");
+
+	mutex_unlock(&trace_mutex);
+
+	int error = errno;
+	fclose(trace_spill);
+	trace_spill = NULL;
+	if (fclose(trace_out) != 0 && ret == 0) {
+		error = errno;
+		ret = -1;
+	}
+	trace_out = NULL;
+
+	errno = error;
+	return ret;
+}
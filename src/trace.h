@@ -0,0 +1,117 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * Static tracepoints, and a buffered timeline trace (-D trace=FILE).
+ *
+ * Every probe fires the USDT probes bfs:NAME__start and bfs:NAME__done where
+ * <sys/sdt.h> is available, which are just nops until a tracer attaches.  With
+ * -D trace=FILE, spans are also appended to per-thread binary buffers, which
+ * are converted to Chrome trace JSON (for chrome://tracing or Perfetto) once
+ * the search is over, so the walk itself never formats any text.
+ */
+
+#ifndef BFS_TRACE_H
+#define BFS_TRACE_H
+
+#include "config.h"
+#include "perf.h"
+#include <stdint.h>
+
+#if BFS_USE_SYS_SDT_H
+#  include <sys/sdt.h>
+#  define BFS_USDT(name, arg) DTRACE_PROBE1(bfs, name, arg)
+#else
+#  define BFS_USDT(name, arg) ((void)(arg))
+#endif
+
+/**
+ * The traced spans.
+ */
+enum trace_probe {
+	/** bftw() submitting an opendir() to the ioq. */
+	TRACE_IOQ_OPENDIR,
+	/** bftw() waiting for ioq responses. */
+	TRACE_IOQ_POP,
+	/** bftw() reading a directory. */
+	TRACE_READDIR,
+	/** bftw() calling bfs_stat(). */
+	TRACE_STAT,
+	/** Evaluating the expression for a file. */
+	TRACE_EVAL,
+	/** Spawning a command for -exec. */
+	TRACE_SPAWN,
+	/** An ioq thread handling a request. */
+	TRACE_IOQ_HANDLE,
+	/** The number of probes. */
+	TRACE_PROBES,
+};
+
+/**
+ * Whether the buffered trace is enabled.  Only written by trace_open().
+ */
+extern bool trace_enabled;
+
+/**
+ * Start writing a trace.  Must be called before any other threads are started.
+ *
+ * @param path
+ *         The path to write the Chrome trace JSON to.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int trace_open(const char *path);
+
+/**
+ * Finish a trace, converting it to JSON.  Must be called after any threads that
+ * recorded events have finished.
+ *
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int trace_close(void);
+
+/**
+ * Record a span in the current thread's buffer.
+ *
+ * @param probe
+ *         The probe that fired.
+ * @param start
+ *         The start time, from trace_start().
+ * @param arg
+ *         The probe's argument.
+ */
+void trace_record(enum trace_probe probe, uint64_t start, uint64_t arg);
+
+/**
+ * Get the start time of a span, or 0 if the buffered trace is disabled.
+ */
+static inline uint64_t trace_start(void) {
+	return trace_enabled ? perf_now() : 0;
+}
+
+/**
+ * Define trace_NAME_start() and trace_NAME_stop() for a probe.
+ */
+#define BFS_TRACE_PROBE(name, probe) \
+	static inline uint64_t trace_##name##_start(uint64_t arg) { \
+		BFS_USDT(name##__start, arg); \
+		return trace_start(); \
+	} \
+	\
+	static inline void trace_##name##_stop(uint64_t start, uint64_t arg) { \
+		BFS_USDT(name##__done, arg); \
+		if (start) { \
+			trace_record(probe, start, arg); \
+		} \
+	}
+
+BFS_TRACE_PROBE(ioq_opendir, TRACE_IOQ_OPENDIR)
+BFS_TRACE_PROBE(ioq_pop, TRACE_IOQ_POP)
+BFS_TRACE_PROBE(readdir, TRACE_READDIR)
+BFS_TRACE_PROBE(stat, TRACE_STAT)
+BFS_TRACE_PROBE(eval, TRACE_EVAL)
+BFS_TRACE_PROBE(spawn, TRACE_SPAWN)
+BFS_TRACE_PROBE(ioq_handle, TRACE_IOQ_HANDLE)
+
+#endif // BFS_TRACE_H
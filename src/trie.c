@@ -168,6 +168,7 @@ void trie_init(struct trie *trie) {
 	LIST_INIT(trie);
 	VARENA_INIT(&trie->nodes, struct trie_node, children);
 	VARENA_INIT(&trie->leaves, struct trie_leaf, key);
+	trie->frozen = NULL;
 }
 
 /** Extract the nibble at a certain offset from a byte sequence. */
@@ -553,6 +554,8 @@ struct trie_leaf *trie_insert_str(struct trie *trie, const char *key) {
 
 TARGET_CLONES_POPCNT
 static struct trie_leaf *trie_insert_mem_impl(struct trie *trie, const void *key, size_t length) {
+	bfs_assert(!trie->frozen);
+
 	struct trie_leaf *rep = trie_representative(trie, key, length);
 	size_t mismatch = trie_mismatch(rep, key, length);
 	if (mismatch >= (length << 1)) {
@@ -655,6 +658,8 @@ static int trie_collapse_node(struct trie *trie, uintptr_t *parent, struct trie_
 
 TARGET_CLONES_POPCNT
 static void trie_remove_impl(struct trie *trie, struct trie_leaf *leaf) {
+	bfs_assert(!trie->frozen);
+
 	uintptr_t *child = &trie->root;
 	uintptr_t *parent = NULL;
 	unsigned int child_bit = 0, child_index = 0;
@@ -715,7 +720,116 @@ void trie_remove(struct trie *trie, struct trie_leaf *leaf) {
 	trie_remove_impl(trie, leaf);
 }
 
+/** The alignment of every node and leaf in a frozen trie. */
+#define FROZEN_ALIGN (alignof(struct trie_node) > alignof(struct trie_leaf) \
+	? alignof(struct trie_node) : alignof(struct trie_leaf))
+
+/** The size of a leaf in a frozen trie. */
+static size_t trie_frozen_leaf_size(const struct trie_leaf *leaf) {
+	return align_ceil(FROZEN_ALIGN, sizeof_flex(struct trie_leaf, key, leaf->length));
+}
+
+/** The size of a node in a frozen trie, which has no spare capacity. */
+static size_t trie_frozen_node_size(const struct trie_node *node) {
+	size_t count = count_ones(node->bitmap);
+	return align_ceil(FROZEN_ALIGN, sizeof_flex(struct trie_node, children, count));
+}
+
+/** Compute the size of a frozen subtrie. */
+TARGET_CLONES_POPCNT
+static size_t trie_frozen_size(uintptr_t ptr) {
+	if (trie_is_leaf(ptr)) {
+		return trie_frozen_leaf_size(trie_decode_leaf(ptr));
+	}
+
+	const struct trie_node *node = trie_decode_node(ptr);
+	size_t size = trie_frozen_node_size(node);
+	unsigned int count = count_ones(node->bitmap);
+	for (unsigned int i = 0; i < count; ++i) {
+		size += trie_frozen_size(node->children[i]);
+	}
+	return size;
+}
+
+/** Copy a leaf into a frozen trie, leaving a forwarding pointer in the old one. */
+static uintptr_t trie_freeze_leaf(struct trie_leaf *leaf, char **cursor) {
+	struct trie_leaf *copy = (struct trie_leaf *)*cursor;
+	memcpy(copy, leaf, offsetof(struct trie_leaf, key) + leaf->length);
+	*cursor += trie_frozen_leaf_size(leaf);
+
+	// The old leaf's prev pointer isn't needed any more, and its next
+	// pointer is still used to rebuild the list in insertion order
+	leaf->prev = copy;
+	return trie_encode_leaf(copy);
+}
+
+/**
+ * Copy a subtrie into a frozen trie.  The leaf children of each node are placed
+ * right after it, so the last step of a lookup usually hits the same cache line
+ * as the node that led to it.
+ */
+TARGET_CLONES_POPCNT
+static uintptr_t trie_freeze_node(uintptr_t ptr, char **cursor) {
+	if (trie_is_leaf(ptr)) {
+		return trie_freeze_leaf(trie_decode_leaf(ptr), cursor);
+	}
+
+	const struct trie_node *node = trie_decode_node(ptr);
+	struct trie_node *copy = (struct trie_node *)*cursor;
+	copy->bitmap = node->bitmap;
+	copy->offset = node->offset;
+	*cursor += trie_frozen_node_size(node);
+
+	unsigned int count = count_ones(node->bitmap);
+	for (unsigned int i = 0; i < count; ++i) {
+		uintptr_t child = node->children[i];
+		if (trie_is_leaf(child)) {
+			copy->children[i] = trie_freeze_leaf(trie_decode_leaf(child), cursor);
+		}
+	}
+
+	for (unsigned int i = 0; i < count; ++i) {
+		uintptr_t child = node->children[i];
+		if (!trie_is_leaf(child)) {
+			copy->children[i] = trie_freeze_node(child, cursor);
+		}
+	}
+
+	return trie_encode_node(copy);
+}
+
+int trie_freeze(struct trie *trie) {
+	if (trie->frozen || !trie->root) {
+		return 0;
+	}
+
+	size_t size = trie_frozen_size(trie->root);
+	char *block = alloc(FALSE_SHARING_SIZE, align_ceil(FALSE_SHARING_SIZE, size));
+	if (!block) {
+		return -1;
+	}
+
+	char *cursor = block;
+	trie->root = trie_freeze_node(trie->root, &cursor);
+	bfs_assert(cursor == block + size);
+
+	struct trie_leaf *head = trie->head;
+	LIST_INIT(trie);
+	for (struct trie_leaf *leaf = head; leaf; leaf = leaf->next) {
+		LIST_APPEND(trie, leaf->prev);
+	}
+
+	varena_destroy(&trie->leaves);
+	varena_destroy(&trie->nodes);
+	VARENA_INIT(&trie->nodes, struct trie_node, children);
+	VARENA_INIT(&trie->leaves, struct trie_leaf, key);
+
+	trie->frozen = block;
+	return 0;
+}
+
 void trie_destroy(struct trie *trie) {
+	free(trie->frozen);
 	varena_destroy(&trie->leaves);
 	varena_destroy(&trie->nodes);
 }
@@ -35,6 +35,8 @@ struct trie {
 	struct varena nodes;
 	/** Leaf allocator. */
 	struct varena leaves;
+	/** The contiguous block holding a frozen trie, if any. */
+	void *frozen;
 };
 
 /**
@@ -128,6 +130,21 @@ struct trie_leaf *trie_insert_mem(struct trie *trie, const void *key, size_t len
  */
 void trie_remove(struct trie *trie, struct trie_leaf *leaf);
 
+/**
+ * Compact a trie that is done being built.  Every node and leaf is copied into
+ * a single cache-aligned block, in depth-first order with each node's leaves
+ * right after it, so lookups touch fewer cache lines.
+ *
+ * Pointers to the old leaves are invalidated, though their values are kept.
+ * A frozen trie must not be modified, except for the leaves' values.
+ *
+ * @param trie
+ *         The trie to freeze.
+ * @return
+ *         0 on success, -1 on failure (in which case the trie is unchanged).
+ */
+int trie_freeze(struct trie *trie);
+
 /**
  * Destroy a trie and its contents.
  */
@@ -0,0 +1,251 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "watch.h"
+#include "alloc.h"
+#include "bfstd.h"
+#include "config.h"
+#include "dstring.h"
+#include "trie.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if BFS_CAN_WATCH
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+/** The events that make a file worth looking at again. */
+#define BFS_WATCH_MASK \
+	(IN_ATTRIB | IN_CLOSE_WRITE | IN_CREATE | IN_MODIFY | IN_MOVED_TO \
+	 | IN_DELETE_SELF | IN_MOVE_SELF | IN_EXCL_UNLINK | IN_ONLYDIR)
+
+/** The size of the event buffer, enough for many maximum-size events. */
+#define BFS_WATCH_BUFSIZE (64 * 1024)
+
+struct bfs_watch {
+	/** The inotify file descriptor. */
+	int fd;
+	/** Maps watch descriptors to directory paths. */
+	struct trie dirs;
+
+	/** The event currently being reported. */
+	struct bfs_watch_event event;
+	/** Storage for the event path. */
+	char *path;
+
+	/** The number of bytes in the event buffer. */
+	size_t len;
+	/** The offset of the next event in the buffer. */
+	size_t pos;
+	/** The event buffer. */
+	alignas(struct inotify_event) char buf[BFS_WATCH_BUFSIZE];
+};
+
+struct bfs_watch *bfs_watch_new(void) {
+	struct bfs_watch *watch = ALLOC(struct bfs_watch);
+	if (!watch) {
+		return NULL;
+	}
+
+	watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (watch->fd < 0) {
+		free(watch);
+		return NULL;
+	}
+
+	trie_init(&watch->dirs);
+	watch->path = NULL;
+	watch->len = 0;
+	watch->pos = 0;
+	return watch;
+}
+
+/** Look up the directory for a watch descriptor. */
+static struct trie_leaf *bfs_watch_find(const struct bfs_watch *watch, int wd) {
+	return trie_find_mem(&watch->dirs, &wd, sizeof(wd));
+}
+
+/** Forget a watch descriptor. */
+static void bfs_watch_forget(struct bfs_watch *watch, struct trie_leaf *leaf) {
+	free(leaf->value);
+	trie_remove(&watch->dirs, leaf);
+}
+
+int bfs_watch_add(struct bfs_watch *watch, const char *path) {
+	int wd = inotify_add_watch(watch->fd, path, BFS_WATCH_MASK);
+	if (wd < 0) {
+		return -1;
+	}
+
+	struct trie_leaf *leaf = bfs_watch_find(watch, wd);
+	if (leaf && strcmp(leaf->value, path) == 0) {
+		return 0;
+	}
+
+	char *copy = strdup(path);
+	if (!copy) {
+		goto fail;
+	}
+
+	if (!leaf) {
+		leaf = trie_insert_mem(&watch->dirs, &wd, sizeof(wd));
+		if (!leaf) {
+			free(copy);
+			goto fail;
+		}
+	}
+
+	free(leaf->value);
+	leaf->value = copy;
+	return 0;
+
+fail:
+	if (!leaf) {
+		inotify_rm_watch(watch->fd, wd);
+	}
+	return -1;
+}
+
+int bfs_watch_wait(struct bfs_watch *watch, int timeout) {
+	if (watch->pos < watch->len) {
+		return 1;
+	}
+
+	struct pollfd pfd = {
+		.fd = watch->fd,
+		.events = POLLIN,
+	};
+
+	int ret;
+	do {
+		ret = poll(&pfd, 1, timeout);
+	} while (ret < 0 && errno == EINTR);
+
+	return ret < 0 ? -1 : ret > 0;
+}
+
+/** Fill the event buffer. */
+static int bfs_watch_fill(struct bfs_watch *watch) {
+	ssize_t ret;
+	do {
+		ret = read(watch->fd, watch->buf, sizeof(watch->buf));
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			errno = 0;
+		}
+		return -1;
+	}
+
+	watch->len = ret;
+	watch->pos = 0;
+	return 0;
+}
+
+const struct bfs_watch_event *bfs_watch_next(struct bfs_watch *watch) {
+	struct bfs_watch_event *event = &watch->event;
+
+	while (true) {
+		if (watch->pos >= watch->len && bfs_watch_fill(watch) != 0) {
+			return NULL;
+		}
+
+		const struct inotify_event *ev = (const void *)(watch->buf + watch->pos);
+		watch->pos += sizeof(*ev) + ev->len;
+
+		if (ev->mask & IN_Q_OVERFLOW) {
+			event->path = NULL;
+			event->new_dir = false;
+			event->overflow = true;
+			return event;
+		}
+
+		struct trie_leaf *leaf = bfs_watch_find(watch, ev->wd);
+		if (!leaf) {
+			continue;
+		}
+
+		if (ev->mask & IN_IGNORED) {
+			// The directory was deleted, or its file system unmounted
+			bfs_watch_forget(watch, leaf);
+			continue;
+		} else if (ev->mask & IN_MOVE_SELF) {
+			// The path is stale now; if it moved somewhere we're
+			// watching, the new parent will see IN_MOVED_TO
+			inotify_rm_watch(watch->fd, ev->wd);
+			bfs_watch_forget(watch, leaf);
+			continue;
+		} else if (ev->mask & IN_DELETE_SELF) {
+			continue;
+		}
+
+		const char *dir = leaf->value;
+		if (dstrcpy(&watch->path, dir) != 0) {
+			return NULL;
+		}
+
+		// The name is NUL-padded, and empty for the directory itself
+		if (ev->len > 0 && ev->name[0]) {
+			size_t len = strlen(dir);
+			if (len == 0 || dir[len - 1] != '/') {
+				if (dstrapp(&watch->path, '/') != 0) {
+					return NULL;
+				}
+			}
+			if (dstrcat(&watch->path, ev->name) != 0) {
+				return NULL;
+			}
+		}
+
+		event->path = watch->path;
+		event->new_dir = (ev->mask & IN_ISDIR) && (ev->mask & (IN_CREATE | IN_MOVED_TO));
+		event->overflow = false;
+		return event;
+	}
+}
+
+void bfs_watch_free(struct bfs_watch *watch) {
+	if (!watch) {
+		return;
+	}
+
+	TRIE_FOR_EACH(&watch->dirs, leaf) {
+		free(leaf->value);
+	}
+	trie_destroy(&watch->dirs);
+
+	dstrfree(watch->path);
+	xclose(watch->fd);
+	free(watch);
+}
+
+#else // !BFS_CAN_WATCH
+
+struct bfs_watch *bfs_watch_new(void) {
+	errno = ENOTSUP;
+	return NULL;
+}
+
+int bfs_watch_add(struct bfs_watch *watch, const char *path) {
+	errno = ENOTSUP;
+	return -1;
+}
+
+int bfs_watch_wait(struct bfs_watch *watch, int timeout) {
+	errno = ENOTSUP;
+	return -1;
+}
+
+const struct bfs_watch_event *bfs_watch_next(struct bfs_watch *watch) {
+	errno = ENOTSUP;
+	return NULL;
+}
+
+void bfs_watch_free(struct bfs_watch *watch) {
+}
+
+#endif // !BFS_CAN_WATCH
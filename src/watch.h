@@ -0,0 +1,85 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+/**
+ * Change notifications for directory trees, for -watch.
+ *
+ * Each watched directory is registered individually, and events are reported
+ * as the path of the changed file, spelled the same way as the directory was
+ * when it was added.  Deletions aren't reported, since there is nothing left to
+ * evaluate.
+ */
+
+#ifndef BFS_WATCH_H
+#define BFS_WATCH_H
+
+#include "config.h"
+
+#define BFS_CAN_WATCH BFS_USE_SYS_INOTIFY_H
+
+/**
+ * A set of watched directories.
+ */
+struct bfs_watch;
+
+/**
+ * A change to a watched directory.
+ */
+struct bfs_watch_event {
+	/** The path to the changed file (valid until the next event is read). */
+	const char *path;
+	/** Whether the file is a directory that was created or moved in. */
+	bool new_dir;
+	/** Whether events were lost, so anything may have changed. */
+	bool overflow;
+};
+
+/**
+ * Create a new set of watched directories.
+ *
+ * @return
+ *         The new watch set, or NULL on failure.
+ */
+struct bfs_watch *bfs_watch_new(void);
+
+/**
+ * Start watching a directory.  Adding the same directory again is cheap, and
+ * updates the path that its events are reported under.
+ *
+ * @param watch
+ *         The watch set.
+ * @param path
+ *         The path to the directory.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_watch_add(struct bfs_watch *watch, const char *path);
+
+/**
+ * Wait for events to be available.
+ *
+ * @param watch
+ *         The watch set.
+ * @param timeout
+ *         The maximum time to wait in milliseconds, or -1 to wait forever.
+ * @return
+ *         1 if events are available, 0 on timeout, or -1 on failure.
+ */
+int bfs_watch_wait(struct bfs_watch *watch, int timeout);
+
+/**
+ * Read the next event, without blocking.
+ *
+ * @param watch
+ *         The watch set.
+ * @return
+ *         The next event, or NULL if there are none (errno == 0) or on failure.
+ */
+const struct bfs_watch_event *bfs_watch_next(struct bfs_watch *watch);
+
+/**
+ * Free a watch set.
+ */
+void bfs_watch_free(struct bfs_watch *watch);
+
+#endif // BFS_WATCH_H
@@ -4,16 +4,18 @@
 #include "xregex.h"
 #include "alloc.h"
 #include "config.h"
+#include "darray.h"
 #include "diag.h"
+#include "dstring.h"
 #include "thread.h"
 #include "sanity.h"
 #include <errno.h>
+#include <langinfo.h>
 #include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 
 #if BFS_USE_ONIGURUMA
-#  include <langinfo.h>
 #  include <oniguruma.h>
 #else
 #  include <regex.h>
@@ -28,7 +30,24 @@ struct bfs_regex {
 #else
 	regex_t impl;
 	int err;
+	/** The original pattern, for merging into sets. */
+	char *pattern;
 #endif
+	/** A substring that every match must contain, if known. */
+	char *literal;
+	/** A string that every anchored match must start with, if known. */
+	char *prefix;
+
+	/** The regex syntax. */
+	enum bfs_regex_type type;
+	/** The compilation flags. */
+	enum bfs_regcomp_flags flags;
+	/** Whether this regex can be merged into a set. */
+	bool mergeable;
+	/** The members of a set (darray), or NULL if this isn't a set. */
+	struct bfs_regex **members;
+	/** Whether a set has been compiled into impl by bfs_regfinish(). */
+	bool compiled;
 };
 
 #if BFS_USE_ONIGURUMA
@@ -114,12 +133,329 @@ static int bfs_onig_initialize(OnigEncoding *enc) {
 }
 #endif
 
+/** Check if ASCII bytes in patterns and paths always stand for themselves. */
+static bool regex_bytewise(void) {
+	// In UTF-8, bytes < 0x80 are never part of multi-byte characters, but
+	// in encodings like Shift JIS they can be
+	if (MB_CUR_MAX == 1) {
+		return true;
+	}
+
+	const char *charmap = nl_langinfo(CODESET);
+	return charmap && strcmp(charmap, "UTF-8") == 0;
+}
+
+/** Skip over a bracket expression, starting just after the '['. */
+static const char *regex_skip_bracket(const char *p) {
+	if (*p == '^') {
+		++p;
+	}
+	if (*p == ']') {
+		++p;
+	}
+
+	while (*p && *p != ']') {
+		if (p[0] == '[' && (p[1] == ':' || p[1] == '=' || p[1] == '.')) {
+			// [:class:], [=equiv=], [.coll.]
+			char delim = p[1];
+			p += 2;
+			while (*p && !(p[0] == delim && p[1] == ']')) {
+				++p;
+			}
+			if (*p) {
+				p += 2;
+			}
+#if BFS_USE_ONIGURUMA
+		} else if (p[0] == '\\' && p[1]) {
+			// Oniguruma allows escapes in brackets, unlike POSIX
+			p += 2;
+#endif
+		} else {
+			++p;
+		}
+	}
+
+	if (*p) {
+		++p;
+	}
+	return p;
+}
+
+/** Skip over an interval like {1,2}, starting just after the '{'. */
+static const char *regex_skip_interval(const char *p, bool ere) {
+	while (*p) {
+		if (ere && p[0] == '}') {
+			return p + 1;
+		} else if (!ere && p[0] == '\\' && p[1] == '}') {
+			return p + 2;
+		}
+		++p;
+	}
+	return p;
+}
+
+/**
+ * Find the longest literal string that every match of a POSIX regex must
+ * contain.  Only constructs that are definitely understood count; anything
+ * else just ends the current literal, and top-level alternation gives up.
+ *
+ * @param pattern
+ *         The regex to search.
+ * @param type
+ *         The regex syntax.
+ * @param[out] prefix
+ *         Will hold the literal that every anchored match must start with, if
+ *         any.
+ * @return
+ *         The literal, or NULL if none was found.
+ */
+static char *regex_literal(const char *pattern, enum bfs_regex_type type, char **prefix) {
+	*prefix = NULL;
+
+	bool ere;
+	switch (type) {
+	case BFS_REGEX_POSIX_BASIC:
+		ere = false;
+		break;
+	case BFS_REGEX_POSIX_EXTENDED:
+		ere = true;
+		break;
+	default:
+		return NULL;
+	}
+
+	size_t len = strlen(pattern);
+	char *best = malloc(len + 1);
+	char *run = malloc(len + 1);
+	if (!best || !run) {
+		goto fail;
+	}
+
+	size_t nbest = 0, nrun = 0;
+	// The nesting depth of groups, which we don't look inside
+	size_t depth = 0;
+	// Whether the last atom was appended to the run
+	bool appended = false;
+	// Whether the run is at the start of the pattern
+	bool leading = true;
+
+	const char *p = pattern;
+	while (*p) {
+		char c = *p++;
+		bool literal = false, quantifier = false;
+
+		if (c == '^' && p == pattern + 1) {
+			// Matches are anchored anyway
+			continue;
+		}
+
+		if (c == '\\') {
+			c = *p;
+			if (!c) {
+				break;
+			}
+			++p;
+
+			if (strchr(".[]*^$\\", c) || (ere && strchr("(){}+?|", c))) {
+				literal = true;
+			} else if (!ere && c == '(') {
+				++depth;
+			} else if (!ere && c == ')') {
+				depth -= depth > 0;
+			} else if (!ere && c == '{') {
+				p = regex_skip_interval(p, ere);
+				quantifier = true;
+			} else if (!ere && (c == '+' || c == '?')) {
+				quantifier = true;
+			} else if (!ere && c == '|') {
+				if (depth == 0) {
+					goto fail;
+				}
+			} else {
+#if BFS_USE_ONIGURUMA
+				// Oniguruma has escapes like \x41 that span
+				// several characters
+				goto fail;
+#endif
+			}
+		} else if (c == '[') {
+			p = regex_skip_bracket(p);
+		} else if (ere && c == '(') {
+#if BFS_USE_ONIGURUMA
+			if (*p == '?') {
+				// (?i) etc. can affect the rest of the pattern
+				goto fail;
+			}
+#endif
+			++depth;
+		} else if (ere && c == ')') {
+			depth -= depth > 0;
+		} else if (ere && c == '|') {
+			if (depth == 0) {
+				goto fail;
+			}
+		} else if (ere && c == '{') {
+			p = regex_skip_interval(p, ere);
+			quantifier = true;
+		} else if (c == '*' || (ere && (c == '+' || c == '?'))) {
+			quantifier = true;
+		} else if ((unsigned char)c < 0x80 && !strchr(".^$+?{}", c)) {
+			literal = true;
+		}
+
+		if (depth > 0) {
+			literal = false;
+			quantifier = false;
+		}
+
+		if (quantifier && appended) {
+			// The previous character is optional
+			--nrun;
+		}
+
+		if (literal) {
+			run[nrun++] = c;
+			appended = true;
+		} else {
+			if (leading) {
+				leading = false;
+				if (nrun > 0) {
+					*prefix = strndup(run, nrun);
+				}
+			}
+			if (nrun > nbest) {
+				memcpy(best, run, nrun);
+				nbest = nrun;
+			}
+			nrun = 0;
+			appended = false;
+		}
+	}
+
+	if (leading && nrun > 0) {
+		*prefix = strndup(run, nrun);
+	}
+	if (nrun > nbest) {
+		memcpy(best, run, nrun);
+		nbest = nrun;
+	}
+
+	free(run);
+	if (nbest == 0) {
+		free(best);
+		return NULL;
+	}
+	best[nbest] = '\0';
+	return best;
+
+fail:
+	free(*prefix);
+	*prefix = NULL;
+	free(run);
+	free(best);
+	return NULL;
+}
+
+#if !BFS_USE_ONIGURUMA
+
+/** Whether the POSIX BRE engine supports \\| and anchors inside groups. */
+static bool regex_bre_sets;
+
+/** pthread_once() callback. */
+static void regex_bre_once(void) {
+	// \| is a GNU extension to BREs, and ^/$ are only anchors at the ends of
+	// a \(group\) in some implementations
+	regex_t re;
+	if (regcomp(&re, "\\(^a$\\)\\|\\(b\\)", REG_NOSUB) != 0) {
+		sanitize_init(&re);
+		return;
+	}
+
+	regex_bre_sets = regexec(&re, "a", 0, NULL, 0) == 0
+		&& regexec(&re, "b", 0, NULL, 0) == 0
+		&& regexec(&re, "^a$", 0, NULL, 0) != 0;
+	regfree(&re);
+}
+
+/**
+ * Check if a POSIX regex can be combined with others by alternation, without
+ * changing what it matches.  Back-references would be renumbered, and
+ * unbalanced groups would escape their wrapper.
+ */
+static bool regex_mergeable(const char *pattern, enum bfs_regex_type type) {
+	bool ere;
+	switch (type) {
+	case BFS_REGEX_POSIX_BASIC:
+		ere = false;
+		break;
+	case BFS_REGEX_POSIX_EXTENDED:
+		ere = true;
+		break;
+	default:
+		return false;
+	}
+
+	if (!*pattern) {
+		return false;
+	}
+
+	if (!ere) {
+		static pthread_once_t once = PTHREAD_ONCE_INIT;
+		call_once(&once, regex_bre_once);
+		if (!regex_bre_sets) {
+			return false;
+		}
+	}
+
+	size_t depth = 0;
+	const char *p = pattern;
+	while (*p) {
+		char c = *p++;
+		bool open = false, close = false;
+
+		if (c == '\\') {
+			c = *p++;
+			if (!c || (c >= '0' && c <= '9')) {
+				return false;
+			}
+			open = !ere && c == '(';
+			close = !ere && c == ')';
+		} else if (c == '[') {
+			p = regex_skip_bracket(p);
+		} else {
+			open = ere && c == '(';
+			close = ere && c == ')';
+		}
+
+		if (open) {
+			++depth;
+		} else if (close) {
+			if (depth == 0) {
+				return false;
+			}
+			--depth;
+		}
+	}
+
+	return depth == 0;
+}
+
+#endif // !BFS_USE_ONIGURUMA
+
 int bfs_regcomp(struct bfs_regex **preg, const char *pattern, enum bfs_regex_type type, enum bfs_regcomp_flags flags) {
 	struct bfs_regex *regex = *preg = ALLOC(struct bfs_regex);
 	if (!regex) {
 		return -1;
 	}
 
+	regex->literal = NULL;
+	regex->prefix = NULL;
+	regex->type = type;
+	regex->flags = flags;
+	regex->mergeable = false;
+	regex->members = NULL;
+	regex->compiled = false;
+
 #if BFS_USE_ONIGURUMA
 	// onig_error_code_to_str() says
 	//
@@ -184,14 +520,26 @@ int bfs_regcomp(struct bfs_regex **preg, const char *pattern, enum bfs_regex_typ
 		cflags |= REG_ICASE;
 	}
 
+	regex->pattern = strdup(pattern);
+	if (!regex->pattern) {
+		goto fail;
+	}
+
 	regex->err = regcomp(&regex->impl, pattern, cflags);
 	if (regex->err != 0) {
 		// https://github.com/google/sanitizers/issues/1496
 		sanitize_init(&regex->impl);
 		return -1;
 	}
+
+	regex->mergeable = regex_mergeable(pattern, type);
 #endif
 
+	// Case-insensitive literals would need case-insensitive searching
+	if (!(flags & BFS_REGEX_ICASE) && regex_bytewise()) {
+		regex->literal = regex_literal(pattern, type, &regex->prefix);
+	}
+
 	return 0;
 
 fail:
@@ -200,7 +548,50 @@ fail:
 	return -1;
 }
 
+/** Match a regex set. */
+static int regset_exec(struct bfs_regex *set, const char *str, enum bfs_regexec_flags flags) {
+	bfs_assert(flags & BFS_REGEX_ANCHOR, "Regex sets only support anchored matching");
+
+#if !BFS_USE_ONIGURUMA
+	if (set->compiled) {
+		// Anchoring is built into the set, so no match offsets are needed
+		int ret = regexec(&set->impl, str, 0, NULL, 0);
+		if (ret == 0) {
+			return 1;
+		} else if (ret == REG_NOMATCH) {
+			return 0;
+		} else {
+			set->err = ret;
+			return -1;
+		}
+	}
+#endif
+
+	size_t count = darray_length(set->members);
+	for (size_t i = 0; i < count; ++i) {
+		struct bfs_regex *member = set->members[i];
+		int ret = bfs_regexec(member, str, flags);
+		if (ret < 0) {
+			set->err = member->err;
+		}
+		if (ret != 0) {
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
 int bfs_regexec(struct bfs_regex *regex, const char *str, enum bfs_regexec_flags flags) {
+	if (regex->members) {
+		return regset_exec(regex, str, flags);
+	}
+
+	// strstr() is much faster than the regex engines at ruling out a match
+	if (regex->literal && !strstr(str, regex->literal)) {
+		return 0;
+	}
+
 	size_t len = strlen(str);
 
 #if BFS_USE_ONIGURUMA
@@ -260,14 +651,150 @@ int bfs_regexec(struct bfs_regex *regex, const char *str, enum bfs_regexec_flags
 #endif
 }
 
+const char *bfs_regprefix(const struct bfs_regex *regex) {
+	return regex->prefix;
+}
+
+bool bfs_regmergeable(const struct bfs_regex *lhs, const struct bfs_regex *rhs) {
+	return lhs->mergeable && rhs->mergeable
+		&& lhs->type == rhs->type
+		&& lhs->flags == rhs->flags;
+}
+
+/** Add a regex, or the members of a set, to a set. */
+static int regset_add(struct bfs_regex *set, struct bfs_regex *regex) {
+	if (!regex->members) {
+		return DARRAY_PUSH(&set->members, &regex);
+	}
+
+	size_t count = darray_length(regex->members);
+	for (size_t i = 0; i < count; ++i) {
+		if (DARRAY_PUSH(&set->members, &regex->members[i]) != 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/** Free a regex set, but not its members. */
+static void regset_free(struct bfs_regex *set) {
+#if !BFS_USE_ONIGURUMA
+	if (set->compiled) {
+		regfree(&set->impl);
+	}
+#endif
+	darray_free(set->members);
+	free(set);
+}
+
+int bfs_regmerge(struct bfs_regex **preg, struct bfs_regex **lhs, struct bfs_regex **rhs) {
+	bfs_assert(bfs_regmergeable(*lhs, *rhs));
+
+	struct bfs_regex *set = *preg = ZALLOC(struct bfs_regex);
+	if (!set) {
+		return -1;
+	}
+
+	set->type = (*lhs)->type;
+	set->flags = (*lhs)->flags;
+	set->mergeable = true;
+
+	if (regset_add(set, *lhs) != 0 || regset_add(set, *rhs) != 0) {
+		regset_free(set);
+		*preg = NULL;
+		return -1;
+	}
+
+	// The members belong to the new set now
+	if ((*lhs)->members) {
+		regset_free(*lhs);
+	}
+	*lhs = NULL;
+	if ((*rhs)->members) {
+		regset_free(*rhs);
+	}
+	*rhs = NULL;
+
+	return 0;
+}
+
+int bfs_regfinish(struct bfs_regex *regex) {
+	if (!regex->members || regex->compiled) {
+		return 0;
+	}
+
+#if BFS_USE_ONIGURUMA
+	return 0;
+#else
+	bool ere = regex->type == BFS_REGEX_POSIX_EXTENDED;
+	const char *open = ere ? "(" : "\\(";
+	const char *close = ere ? ")" : "\\)";
+	const char *alt = ere ? "|" : "\\|";
+
+	// ^((p1)|(p2)|...)$ matches the same strings as anchored p1, p2, ...
+	char *pattern = dstrdup("^");
+	if (!pattern || dstrcat(&pattern, open) != 0) {
+		goto fail;
+	}
+
+	size_t count = darray_length(regex->members);
+	for (size_t i = 0; i < count; ++i) {
+		if (i > 0 && dstrcat(&pattern, alt) != 0) {
+			goto fail;
+		}
+		if (dstrcat(&pattern, open) != 0
+		    || dstrcat(&pattern, regex->members[i]->pattern) != 0
+		    || dstrcat(&pattern, close) != 0) {
+			goto fail;
+		}
+	}
+
+	if (dstrcat(&pattern, close) != 0 || dstrapp(&pattern, '$') != 0) {
+		goto fail;
+	}
+
+	int cflags = REG_NOSUB;
+	if (ere) {
+		cflags |= REG_EXTENDED;
+	}
+	if (regex->flags & BFS_REGEX_ICASE) {
+		cflags |= REG_ICASE;
+	}
+
+	// If the combined regex fails to compile (e.g. REG_ESPACE), the
+	// members are still matched one by one
+	if (regcomp(&regex->impl, pattern, cflags) == 0) {
+		regex->compiled = true;
+	} else {
+		sanitize_init(&regex->impl);
+	}
+
+	dstrfree(pattern);
+	return 0;
+
+fail:
+	dstrfree(pattern);
+	return -1;
+#endif
+}
+
 void bfs_regfree(struct bfs_regex *regex) {
-	if (regex) {
+	if (regex && regex->members) {
+		size_t count = darray_length(regex->members);
+		for (size_t i = 0; i < count; ++i) {
+			bfs_regfree(regex->members[i]);
+		}
+		regset_free(regex);
+	} else if (regex) {
 #if BFS_USE_ONIGURUMA
 		onig_free(regex->impl);
 		free(regex->pattern);
 #else
 		regfree(&regex->impl);
+		free(regex->pattern);
 #endif
+		free(regex->literal);
+		free(regex->prefix);
 		free(regex);
 	}
 }
@@ -277,17 +804,23 @@ char *bfs_regerror(const struct bfs_regex *regex) {
 		return strdup(strerror(ENOMEM));
 	}
 
+	int err = regex->err;
+	if (regex->members && !regex->compiled) {
+		// The error came from a member, and was copied to the set
+		regex = regex->members[0];
+	}
+
 #if BFS_USE_ONIGURUMA
 	unsigned char *str = malloc(ONIG_MAX_ERROR_MESSAGE_LEN);
 	if (str) {
-		onig_error_code_to_str(str, regex->err, &regex->einfo);
+		onig_error_code_to_str(str, err, &regex->einfo);
 	}
 	return (char *)str;
 #else
-	size_t len = regerror(regex->err, &regex->impl, NULL, 0);
+	size_t len = regerror(err, &regex->impl, NULL, 0);
 	char *str = malloc(len);
 	if (str) {
-		regerror(regex->err, &regex->impl, str, len);
+		regerror(err, &regex->impl, str, len);
 	}
 	return str;
 #endif
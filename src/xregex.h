@@ -4,6 +4,8 @@
 #ifndef BFS_XREGEX_H
 #define BFS_XREGEX_H
 
+#include "config.h"
+
 /**
  * A compiled regular expression.
  */
@@ -65,6 +67,50 @@ int bfs_regcomp(struct bfs_regex **preg, const char *pattern, enum bfs_regex_typ
  */
 int bfs_regexec(struct bfs_regex *regex, const char *str, enum bfs_regexec_flags flags);
 
+/**
+ * Get a literal prefix of every anchored match of a regex.
+ *
+ * @param regex
+ *         The compiled regex.
+ * @return
+ *         The prefix, or NULL if it isn't known.
+ */
+const char *bfs_regprefix(const struct bfs_regex *regex);
+
+/**
+ * Check if two regexes can be merged into a set by bfs_regmerge().
+ */
+bool bfs_regmergeable(const struct bfs_regex *lhs, const struct bfs_regex *rhs);
+
+/**
+ * Merge two regexes into a set, which matches a string if either of them does.
+ * Sets only support anchored matching (BFS_REGEX_ANCHOR).
+ *
+ * @param[out] preg
+ *         Will hold the set.
+ * @param lhs
+ *         The first regex or set, which will be consumed (set to NULL) on
+ *         success.
+ * @param rhs
+ *         The second regex or set, which will be consumed on success.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_regmerge(struct bfs_regex **preg, struct bfs_regex **lhs, struct bfs_regex **rhs);
+
+/**
+ * Compile a regex set into a single automaton, so every string is scanned once
+ * no matter how many regexes it holds.  Until then (or if the combined regex
+ * is too complex), the members are matched one by one.  Merging long chains
+ * pairwise and compiling once at the end avoids quadratic compilation time.
+ *
+ * @param regex
+ *         The regex.  Does nothing if it isn't a set.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int bfs_regfinish(struct bfs_regex *regex);
+
 /**
  * Free a compiled regex.
  */
@@ -8,6 +8,7 @@
 #include "list.h"
 #include <errno.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/resource.h>
@@ -19,6 +20,15 @@
 #  include <paths.h>
 #endif
 
+/**
+ * Whether to use vfork() rather than fork().  The child borrows our address
+ * space until it calls exec(), so we don't pay to copy the page tables of a
+ * large bfs process for every command.
+ */
+#ifndef BFS_USE_VFORK
+#  define BFS_USE_VFORK __linux__
+#endif
+
 /**
  * Types of spawn actions.
  */
@@ -134,23 +144,55 @@ int bfs_spawn_addsetrlimit(struct bfs_spawn *ctx, int resource, const struct rli
 	}
 }
 
-/** Actually exec() the new process. */
-static void bfs_spawn_exec(const char *exe, const struct bfs_spawn *ctx, char **argv, char **envp, int pipefd[2]) {
+/**
+ * Reset any signal handlers we installed, since they would otherwise run in the
+ * child (and, after vfork(), on our memory).  Then unblock the original mask.
+ */
+static int bfs_spawn_resetsigs(const sigset_t *mask) {
+	for (int sig = 1; sig < NSIG; ++sig) {
+		struct sigaction sa;
+		if (sigaction(sig, NULL, &sa) != 0) {
+			continue;
+		}
+
+		if (sa.sa_handler != SIG_DFL && sa.sa_handler != SIG_IGN) {
+			sa.sa_handler = SIG_DFL;
+			sa.sa_flags = 0;
+			if (sigaction(sig, &sa, NULL) != 0) {
+				return -1;
+			}
+		}
+	}
+
+	errno = pthread_sigmask(SIG_SETMASK, mask, NULL);
+	return errno ? -1 : 0;
+}
+
+/**
+ * Actually exec() the new process.  This runs in the child of a fork() or
+ * vfork(), so it must not modify any memory besides its own stack.
+ */
+static void bfs_spawn_exec(const char *exe, const struct bfs_spawn *ctx, char **argv, char **envp, const sigset_t *mask, const int pipefd[2]) {
+	int errfd = pipefd[1];
 	xclose(pipefd[0]);
 
+	if (bfs_spawn_resetsigs(mask) != 0) {
+		goto fail;
+	}
+
 	for (const struct bfs_spawn_action *action = ctx ? ctx->head : NULL; action; action = action->next) {
 		// Move the error-reporting pipe out of the way if necessary...
-		if (action->out_fd == pipefd[1]) {
-			int fd = dup_cloexec(pipefd[1]);
+		if (action->out_fd == errfd) {
+			int fd = dup_cloexec(errfd);
 			if (fd < 0) {
 				goto fail;
 			}
-			xclose(pipefd[1]);
-			pipefd[1] = fd;
+			xclose(errfd);
+			errfd = fd;
 		}
 
 		// ... and pretend the pipe doesn't exist
-		if (action->in_fd == pipefd[1]) {
+		if (action->in_fd == errfd) {
 			errno = EBADF;
 			goto fail;
 		}
@@ -187,9 +229,9 @@ fail:
 
 	// In case of a write error, the parent will still see that we exited
 	// unsuccessfully, but won't know why
-	(void) xwrite(pipefd[1], &error, sizeof(error));
+	(void) xwrite(errfd, &error, sizeof(error));
 
-	xclose(pipefd[1]);
+	xclose(errfd);
 	_Exit(127);
 }
 
@@ -215,22 +257,41 @@ pid_t bfs_spawn(const char *exe, const struct bfs_spawn *ctx, char **argv, char
 		return -1;
 	}
 
-	pid_t pid = fork();
-	if (pid < 0) {
+	// Block signals until the child has reset its handlers
+	sigset_t new_mask, old_mask;
+	sigfillset(&new_mask);
+	errno = pthread_sigmask(SIG_SETMASK, &new_mask, &old_mask);
+	if (errno != 0) {
 		close_quietly(pipefd[1]);
 		close_quietly(pipefd[0]);
 		free(resolved);
 		return -1;
-	} else if (pid == 0) {
+	}
+
+#if BFS_USE_VFORK
+	pid_t pid = vfork();
+#else
+	pid_t pid = fork();
+#endif
+	if (pid == 0) {
 		// Child
-		bfs_spawn_exec(exe, ctx, argv, envp, pipefd);
+		bfs_spawn_exec(exe, ctx, argv, envp, &old_mask, pipefd);
 	}
 
 	// Parent
+	int error = errno;
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+	if (pid < 0) {
+		close_quietly(pipefd[1]);
+		close_quietly(pipefd[0]);
+		free(resolved);
+		errno = error;
+		return -1;
+	}
+
 	xclose(pipefd[1]);
 	free(resolved);
 
-	int error;
 	ssize_t nbytes = xread(pipefd[0], &error, sizeof(error));
 	xclose(pipefd[0]);
 	if (nbytes == sizeof(error)) {
@@ -32,6 +32,41 @@ int xlocaltime(const time_t *timep, struct tm *result) {
 	}
 }
 
+void xtime_cache_init(struct xtime_cache *cache) {
+	for (size_t i = 0; i < countof(cache->entries); ++i) {
+		cache->entries[i].minute = -1;
+	}
+}
+
+int xlocaltime_cached(struct xtime_cache *cache, const time_t *timep, struct tm *result) {
+	time_t time = *timep;
+	if (time < 0) {
+		return xlocaltime(timep, result);
+	}
+
+	time_t minute = time / 60;
+	int sec = time % 60;
+	struct xtime_cache_entry *entry = &cache->entries[minute % XTIME_CACHE_SIZE];
+	if (entry->minute == minute) {
+		*result = entry->tm;
+		result->tm_sec = sec;
+		return 0;
+	}
+
+	if (xlocaltime(timep, result) != 0) {
+		return -1;
+	}
+
+	// Only cache minutes that line up with local minutes, which rules out
+	// odd historical UTC offsets and leap seconds
+	if (result->tm_sec == sec) {
+		entry->minute = minute;
+		entry->tm = *result;
+	}
+
+	return 0;
+}
+
 int xgmtime(const time_t *timep, struct tm *result) {
 	// Should be called before gmtime_r() according to POSIX.1-2004
 	xtzset();
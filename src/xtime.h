@@ -22,6 +22,41 @@
  */
 int xlocaltime(const time_t *timep, struct tm *result);
 
+/** The number of minutes remembered by an xtime_cache. */
+#define XTIME_CACHE_SIZE 16
+
+/**
+ * A cache of recent localtime() results.  Files tend to share a few minutes,
+ * and the seconds are easy to fill in.
+ */
+struct xtime_cache {
+	struct xtime_cache_entry {
+		/** The cached minute since the epoch, or -1 if empty. */
+		time_t minute;
+		/** The broken-down time for that minute. */
+		struct tm tm;
+	} entries[XTIME_CACHE_SIZE];
+};
+
+/**
+ * Initialize an xtime_cache.
+ */
+void xtime_cache_init(struct xtime_cache *cache);
+
+/**
+ * xlocaltime() with a cache.
+ *
+ * @param cache
+ *         The cache to use.
+ * @param[in] timep
+ *         The time_t to convert.
+ * @param[out] result
+ *         Buffer to hold the result.
+ * @return
+ *         0 on success, -1 on failure.
+ */
+int xlocaltime_cached(struct xtime_cache *cache, const time_t *timep, struct tm *result);
+
 /**
  * gmtime_r() wrapper that calls tzset() first.
  *
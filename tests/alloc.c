@@ -3,7 +3,9 @@
 
 #include "../src/alloc.h"
 #include "../src/diag.h"
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 int main(void) {
 	// Check sizeof_flex()
@@ -32,5 +34,57 @@ int main(void) {
 
 	varena_destroy(&varena);
 
+	// tvarena tests
+	struct tvarena tvarena;
+	bfs_verify(TVARENA_INIT(&tvarena, struct flexible, bar) == 0);
+
+	struct tvarena_cache cache;
+	tvarena_cache_init(&cache);
+
+	struct flexible *ptrs[256];
+	for (size_t i = 0; i < 256; ++i) {
+		ptrs[i] = tvarena_alloc(&tvarena, &cache, i);
+		bfs_verify(ptrs[i]);
+		ptrs[i]->foo[0] = i;
+	}
+	for (size_t i = 0; i < 256; ++i) {
+		bfs_verify(ptrs[i]->foo[0] == (int)i);
+		tvarena_free(&tvarena, &cache, ptrs[i], i);
+	}
+
+	tvarena_cache_destroy(&tvarena, &cache);
+	tvarena_destroy(&tvarena);
+
+	// scratch tests
+	struct scratch scratch;
+	scratch_init(&scratch);
+
+	for (int round = 0; round < 2; ++round) {
+		char *strs[256];
+		for (size_t i = 0; i < 256; ++i) {
+			void *ptr = scratch_alloc(&scratch, 3 * i);
+			bfs_verify(ptr);
+			bfs_verify((uintptr_t)ptr % alignof(max_align_t) == 0);
+			memset(ptr, 'x', 3 * i);
+
+			strs[i] = scratch_strndup(&scratch, "scratch", i);
+			bfs_verify(strs[i]);
+		}
+		for (size_t i = 0; i < 256; ++i) {
+			bfs_verify(strncmp(strs[i], "scratch", i) == 0);
+			bfs_verify(strlen(strs[i]) == (i < 7 ? i : 7));
+		}
+
+		// After a reset, everything fits in the one remaining block
+		scratch_reset(&scratch);
+		struct scratch_block *block = scratch.block;
+		bfs_verify(block);
+		bfs_verify(scratch_alloc(&scratch, 1000));
+		bfs_verify(scratch.block == block);
+		scratch_reset(&scratch);
+	}
+
+	scratch_destroy(&scratch);
+
 	return EXIT_SUCCESS;
 }
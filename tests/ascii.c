@@ -0,0 +1,85 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "../src/ascii.h"
+#include "../src/diag.h"
+#include <stdlib.h>
+#include <string.h>
+
+/** The obvious byte-at-a-time case folding. */
+static char fold(char c) {
+	if (c >= 'A' && c <= 'Z') {
+		c += 'a' - 'A';
+	}
+	return c;
+}
+
+/** Check every operation on one string. */
+static void check(const char *str, size_t len) {
+	char expected[256], actual[256];
+	bfs_verify(len <= sizeof(expected));
+
+	bool ascii = true;
+	for (size_t i = 0; i < len; ++i) {
+		expected[i] = fold(str[i]);
+		ascii &= (unsigned char)str[i] < 0x80;
+	}
+	bfs_verify(ascii_tolower(actual, str, len) == ascii);
+	bfs_verify(memcmp(actual, expected, len) == 0);
+
+	// In place
+	memcpy(actual, str, len);
+	bfs_verify(ascii_tolower(actual, actual, len) == ascii);
+	bfs_verify(memcmp(actual, expected, len) == 0);
+
+	bfs_verify(ascii_caseeq(str, expected, len));
+	bfs_verify(ascii_caseeq(expected, str, len));
+	for (size_t i = 0; i < len; ++i) {
+		memcpy(actual, str, len);
+		actual[i] ^= 0x01;
+		bool eq = fold(actual[i]) == fold(str[i]);
+		bfs_verify(ascii_caseeq(str, actual, len) == eq);
+	}
+
+	for (size_t i = 0; i < len; ++i) {
+		expected[i] = str[len - i - 1];
+	}
+	ascii_reverse(actual, str, len);
+	bfs_verify(memcmp(actual, expected, len) == 0);
+
+	memcpy(actual, str, len);
+	ascii_reverse(actual, actual, len);
+	bfs_verify(memcmp(actual, expected, len) == 0);
+}
+
+int main(void) {
+	// Every byte value, at every length and alignment around the block sizes
+	char str[256];
+	for (size_t i = 0; i < sizeof(str); ++i) {
+		str[i] = i;
+	}
+	for (size_t off = 0; off < 16; ++off) {
+		for (size_t len = 0; off + len <= sizeof(str); ++len) {
+			check(str + off, len);
+		}
+	}
+
+	// Letters and the bytes right next to them
+	const char *edges = "@AZ[`az{\x7F\x80\xC1\xDA\xE1\xFA";
+	char buf[64];
+	srand(0);
+	for (int i = 0; i < 10000; ++i) {
+		size_t len = rand() % sizeof(buf);
+		for (size_t j = 0; j < len; ++j) {
+			buf[j] = edges[rand() % strlen(edges)];
+		}
+		check(buf, len);
+	}
+
+	bfs_verify(ascii_caseeq("Makefile", "MAKEFILE", 8));
+	bfs_verify(!ascii_caseeq("Makefile", "MAKEFILF", 8));
+	bfs_verify(!ascii_caseeq("@", "`", 1));
+	bfs_verify(!ascii_caseeq("[", "{", 1));
+
+	return EXIT_SUCCESS;
+}
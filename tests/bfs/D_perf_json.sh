@@ -0,0 +1,3 @@
+stderr=$(invoke_bfs -S bfs -D perf=json basic -false 2>&1 >/dev/null)
+count=$(invoke_bfs basic -mindepth 1 | wc -l)
+[[ "$stderr" == *"\"dirent\":{\"count\":$((count))}"* ]]
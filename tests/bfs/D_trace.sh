@@ -0,0 +1,6 @@
+invoke_bfs basic -D trace="$OUT" -false
+
+# One eval span per file
+count=$(invoke_bfs basic | wc -l)
+[ "$(grep -c '"name":"eval"' "$OUT")" -eq "$count" ]
+grep -q '"traceEvents"' "$OUT"
@@ -0,0 +1 @@
+bfs_diff -O4 -depth basic -regex 'basic/k/.*'
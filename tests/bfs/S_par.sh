@@ -0,0 +1 @@
+bfs_diff -S par -j4 basic
@@ -0,0 +1 @@
+bfs_diff -L links -type f -name '*i*'
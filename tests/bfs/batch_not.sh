@@ -0,0 +1 @@
+bfs_diff basic ! \( -type d -o -name '[ab]*' \) -print
@@ -0,0 +1,7 @@
+clean_scratch
+"$XTOUCH" -p scratch/foo/bar scratch/foo/baz
+chmod 600 scratch/foo/bar
+chmod 744 scratch/foo/baz
+
+invoke_bfs scratch -type f -chmod g+w,o=u-x
+bfs_diff scratch -type f -printf '%m %p\n'
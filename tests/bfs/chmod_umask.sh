@@ -0,0 +1,9 @@
+clean_scratch
+"$XTOUCH" -p -M444 scratch/foo/bar scratch/foo/baz
+chmod 755 scratch/foo/baz
+
+# No user class means the umask bits are left alone, like chmod(1)
+umask 077
+invoke_bfs scratch -type f -chmod +w,=rX
+umask 022
+bfs_diff scratch -type f -printf '%m %p\n'
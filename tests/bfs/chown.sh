@@ -0,0 +1,6 @@
+clean_scratch
+"$XTOUCH" -p scratch/foo/bar scratch/foo/baz
+
+# Changing to the current owner is always allowed
+invoke_bfs scratch -chown "$(id -u):$(id -g)"
+bfs_diff scratch -user "$(id -u)" -group "$(id -g)"
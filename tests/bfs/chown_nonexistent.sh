@@ -0,0 +1 @@
+! invoke_bfs basic -chown not_a_user_name
@@ -0,0 +1,5 @@
+test "$UNAME" = "Linux" || skip
+
+# Pick a CPU we're allowed to run on
+cpu=$(sed -n 's/^Cpus_allowed_list:[[:space:]]*\([0-9]*\).*/\1/p' /proc/self/status)
+bfs_diff -cpus "$cpu" basic
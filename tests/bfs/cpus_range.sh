@@ -0,0 +1 @@
+! invoke_bfs -cpus 3-1 basic
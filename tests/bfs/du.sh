@@ -0,0 +1,2 @@
+# -du adds up the same totals as du
+diff <(invoke_bfs basic -type d -du | sort -k2) <(du -k basic | sort -k2)
@@ -0,0 +1,2 @@
+# -du implies -depth, so directories come after their contents
+invoke_bfs basic -du | tail -n1 | grep -q "	basic$"
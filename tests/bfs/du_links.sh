@@ -0,0 +1,6 @@
+# Hard links only count once towards -du
+clean_scratch
+mkdir -p scratch/foo scratch/bar
+printf '%4096s' >scratch/foo/file
+ln scratch/foo/file scratch/bar/file
+[ "$(invoke_bfs scratch -du | tail -n1)" = "$(du -ks scratch)" ]
@@ -0,0 +1,5 @@
+# -du still counts everything under -maxdepth, like du -d1
+clean_scratch
+mkdir -p scratch/foo/bar
+printf '%102400s' >scratch/foo/bar/file
+diff <(invoke_bfs scratch -maxdepth 1 -type d -du | sort -k2) <(du -k -d1 scratch | sort -k2)
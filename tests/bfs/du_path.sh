@@ -0,0 +1,5 @@
+# -O4 can't prune directories that -du still has to count
+clean_scratch
+mkdir -p scratch/foo/bar
+printf '%102400s' >scratch/foo/bar/file
+[ "$(invoke_bfs -O4 scratch -path scratch/foo -du)" = "$(du -ks scratch/foo)" ]
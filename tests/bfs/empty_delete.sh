@@ -0,0 +1,8 @@
+clean_scratch
+"$XTOUCH" -p scratch/foo/bar/baz/ scratch/foo/qux/ scratch/file scratch/dir/file
+echo data >scratch/dir/file
+
+# Each parent is only empty after its children are deleted
+invoke_bfs scratch -mindepth 1 -empty -delete
+
+bfs_diff scratch
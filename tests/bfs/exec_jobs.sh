@@ -0,0 +1,4 @@
+tree=$(invoke_bfs -D tree 2>&1 -quit)
+[[ "$tree" == *"-S dfs"* || "$tree" == *"-S par"* ]] && skip
+
+bfs_diff basic -exec-jobs 4 -execdir "$TESTS/sort-args.sh" {} +
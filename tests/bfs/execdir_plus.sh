@@ -1,4 +1,4 @@
 tree=$(invoke_bfs -D tree 2>&1 -quit)
-[[ "$tree" == *"-S dfs"* ]] && skip
+[[ "$tree" == *"-S dfs"* || "$tree" == *"-S par"* ]] && skip
 
 bfs_diff basic -execdir "$TESTS/sort-args.sh" {} +
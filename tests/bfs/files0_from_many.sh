@@ -0,0 +1,8 @@
+# More roots than are read from the input at once
+clean_scratch
+for ((i = 0; i < 1500; ++i)); do
+    printf 'basic/a\0basic/c\0'
+done >scratch/files0.in
+
+count=$(invoke_bfs -files0-from scratch/files0.in | wc -l)
+[ "$count" -eq 4500 ]
@@ -0,0 +1,10 @@
+# Every record is a 152-byte header and the path, padded to 8 bytes
+clean_scratch
+invoke_bfs basic -fprintb scratch/records || return 1
+
+expected=0
+while IFS= read -r path; do
+    ((expected += (152 + ${#path} + 1 + 7) / 8 * 8))
+done < <(invoke_bfs basic)
+
+[ "$(wc -c <scratch/records)" -eq "$expected" ]
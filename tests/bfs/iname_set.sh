@@ -0,0 +1 @@
+bfs_diff basic -iname 'F*' -o -iname '*AZ' -o -iname B -o -iname '[GH]'
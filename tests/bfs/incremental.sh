@@ -0,0 +1,9 @@
+clean_scratch
+"$XTOUCH" -p scratch/tree/{foo/bar,baz/qux}
+
+invoke_bfs scratch/tree -incremental scratch/snapshot >/dev/null || return 1
+
+# Change every directory, so nothing is skipped regardless of timing
+"$XTOUCH" scratch/tree/{new,foo/new,baz/new}
+
+bfs_diff scratch/tree -incremental scratch/snapshot
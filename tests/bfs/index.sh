@@ -0,0 +1,9 @@
+clean_scratch
+"$XTOUCH" -p scratch/tree/{foo/bar,baz/qux}
+
+invoke_bfs scratch/tree -index scratch/index >/dev/null || return 1
+
+"$XTOUCH" scratch/tree/foo/new
+rm scratch/tree/baz/qux
+
+bfs_diff scratch/tree -index scratch/index
@@ -0,0 +1,4 @@
+clean_scratch
+
+invoke_bfs basic -index scratch/index >/dev/null || return 1
+bfs_diff basic -index scratch/index
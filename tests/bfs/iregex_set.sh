@@ -0,0 +1 @@
+bfs_diff basic -iregex 'BASIC/[AB]' -o -iregex '.*/F.*' -o -regex '.*/E'
@@ -0,0 +1 @@
+bfs_diff -j64 basic -regex 'basic/[a-e].*'
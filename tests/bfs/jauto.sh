@@ -0,0 +1 @@
+bfs_diff -jauto basic
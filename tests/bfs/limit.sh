@@ -0,0 +1 @@
+[ "$(invoke_bfs basic -limit 3 | wc -l)" -eq 3 ]
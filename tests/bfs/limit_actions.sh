@@ -0,0 +1,2 @@
+# Each successful action counts, not each file
+[ "$(invoke_bfs basic -print -print -limit 3 | wc -l)" -eq 3 ]
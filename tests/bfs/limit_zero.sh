@@ -0,0 +1 @@
+! invoke_bfs basic -limit 0
@@ -0,0 +1 @@
+bfs_diff basic -name 'f*' -o -name '*r' -o -name a -o -name '[gh]'
@@ -0,0 +1 @@
+bfs_diff times -newer times/a -mtime +1000 -mtime -100000
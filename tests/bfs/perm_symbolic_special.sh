@@ -0,0 +1,8 @@
+clean_scratch
+"$XTOUCH" -p scratch/gx scratch/sx
+chmod 0010 scratch/gx
+chmod 4100 scratch/sx
+
+# Unlike chmod(1), X never applies to files, and = doesn't clear special bits
+# set by earlier clauses
+bfs_diff scratch -type f \( -perm -g+x,u+X -o -perm u+s,u=x \)
@@ -0,0 +1 @@
+bfs_diff basic -preload_users ! -nouser ! -nogroup
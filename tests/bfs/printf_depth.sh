@@ -0,0 +1 @@
+bfs_diff basic -printf '%p %d|%3d|%-3d|%03d|%+d\n'
@@ -0,0 +1,5 @@
+clean_scratch
+invoke_bfs basic -profile scratch/profile -type f -name '*a*' >/dev/null || return 1
+grep -q '^bfs-profile 1$' scratch/profile || return 1
+
+bfs_diff basic -O4 -profile scratch/profile -type f -name '*a*'
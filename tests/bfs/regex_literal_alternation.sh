@@ -0,0 +1 @@
+bfs_diff basic -regextype posix-extended -regex 'basic/a|.*/baz'
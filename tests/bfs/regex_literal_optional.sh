@@ -0,0 +1 @@
+bfs_diff basic -regex 'basic/.*fooo*'
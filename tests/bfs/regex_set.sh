@@ -0,0 +1 @@
+bfs_diff basic -regex 'basic/[ab]' -o -regex '.*/f.*' -o -regex '^basic/l/foo/bar$' -o -regex 'basic/\(k\|j\)/.*'
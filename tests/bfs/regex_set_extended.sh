@@ -0,0 +1 @@
+bfs_diff basic -regextype posix-extended -regex 'basic/(a|c)' -o -regex 'basic/e.+' -o -regex '.*/baz$' -o -regex '.*/(.)\1'
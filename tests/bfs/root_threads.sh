@@ -0,0 +1 @@
+bfs_diff basic links loops -root-threads 2
@@ -0,0 +1,8 @@
+# Roots from -files0-from are handed out to the threads as they're read
+clean_scratch
+for ((i = 0; i < 1500; ++i)); do
+    printf 'basic/a\0basic/c\0'
+done >scratch/files0.in
+
+count=$(invoke_bfs -files0-from scratch/files0.in -root-threads 4 | wc -l)
+[ "$count" -eq 4500 ]
@@ -0,0 +1,4 @@
+fstype=$(invoke_bfs basic -maxdepth 0 -printf '%F\n') || skip
+# The walkers share the mount table, so its file system types must be ready
+# before they start
+bfs_diff basic links loops -root-threads 2 -iolimit "$fstype=1"
@@ -0,0 +1,3 @@
+# -quit stops every root
+invoke_bfs basic links loops -root-threads 3 -print -quit >"$OUT"
+[ "$(wc -l <"$OUT")" -eq 1 ]
@@ -0,0 +1,9 @@
+# Check that -s sorts names by LC_COLLATE
+LOCALE=$(locale -a | grep -Ei '^(en_US|C)\.utf-?8$' | head -n1)
+test "$LOCALE" || skip
+
+clean_scratch
+"$XTOUCH" scratch/{B,a,_c,Z,z,10,9,é,e,f}
+
+LC_ALL="$LOCALE" invoke_bfs -s scratch -mindepth 1 >"$OUT"
+LC_ALL="$LOCALE" sort "$OUT" | diff -u - "$OUT"
@@ -0,0 +1,5 @@
+# Together, the shards should see every file exactly once
+for i in 1 2 3; do
+    invoke_bfs basic -shard "$i/3"
+done | sort >"$OUT"
+diff_output
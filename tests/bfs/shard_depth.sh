@@ -0,0 +1,4 @@
+for i in 1 2 3 4; do
+    invoke_bfs basic -shard "$i/4:2"
+done | sort >"$OUT"
+diff_output
@@ -0,0 +1 @@
+! invoke_bfs basic -shard 4/3
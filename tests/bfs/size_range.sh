@@ -0,0 +1,7 @@
+clean_scratch
+
+for size in 0 1 1023 1024 1025 2048 2049 3072; do
+    head -c $size /dev/zero >"scratch/$size"
+done
+
+bfs_diff scratch -type f -size +1k -size -3k
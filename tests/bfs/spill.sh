@@ -0,0 +1 @@
+bfs_diff basic -spill 1
@@ -0,0 +1 @@
+! invoke_bfs basic -spill 1X
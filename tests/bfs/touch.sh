@@ -0,0 +1,5 @@
+clean_scratch
+"$XTOUCH" -p -t "1991-12-14 00:00" scratch/foo/bar scratch/foo/baz
+
+invoke_bfs scratch/foo/bar -touch
+bfs_diff scratch -newermt "1991-12-15"
@@ -0,0 +1,8 @@
+invoke_bfs basic -quit -watch || skip
+
+clean_scratch
+"$XTOUCH" -p scratch/tree/foo/bar
+
+# Whether it shows up in the first pass or a later one, -quit stops there
+{ sleep 0.5; "$XTOUCH" -p scratch/tree/baz/qux; } &
+bfs_diff scratch/tree -watch -name qux -print -quit
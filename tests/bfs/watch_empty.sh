@@ -0,0 +1,9 @@
+invoke_bfs basic -quit -watch || skip
+
+clean_scratch
+mkdir -p scratch/tree/empty scratch/tree/full
+"$XTOUCH" scratch/tree/full/foo
+
+# Empty directories must still be watched, even though -empty matched them
+{ sleep 0.5; "$XTOUCH" scratch/tree/empty/bar; } &
+bfs_diff scratch/tree -watch -empty -name bar -print -quit
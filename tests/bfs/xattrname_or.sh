@@ -0,0 +1,11 @@
+invoke_bfs scratch -quit -xattr || skip
+make_xattrs || skip
+
+case "$UNAME" in
+    Darwin|FreeBSD)
+        bfs_diff scratch -xattrname bfs_test -o -xattrname bfs_test_2
+        ;;
+    *)
+        bfs_diff scratch -xattrname security.bfs_test -o -xattrname security.bfs_test_2
+        ;;
+esac
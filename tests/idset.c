@@ -0,0 +1,45 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "../src/idset.h"
+#include "../src/diag.h"
+#include <stdlib.h>
+
+int main(void) {
+	struct idset set;
+	idset_init(&set);
+
+	bfs_verify(!idset_contains(&set, 1, 1));
+	bfs_verify(!idset_contains(&set, 1, 0));
+
+	// Enough inodes to grow the tables a few times, on a few devices
+	const size_t count = 10000;
+	for (dev_t dev = 1; dev <= 3; ++dev) {
+		for (size_t i = 0; i < count; ++i) {
+			ino_t ino = i * dev;
+			bfs_verify(idset_insert(&set, dev, ino) == 1);
+			bfs_verify(idset_insert(&set, dev, ino) == 0);
+		}
+	}
+	bfs_verify(set.size == 3 * count);
+
+	for (dev_t dev = 1; dev <= 3; ++dev) {
+		for (size_t i = 0; i < count; ++i) {
+			bfs_verify(idset_contains(&set, dev, i * dev));
+		}
+		bfs_verify(!idset_contains(&set, dev, count * dev));
+	}
+
+	// Inode numbers are only unique within a device
+	bfs_verify(!idset_contains(&set, 2, 1));
+	bfs_verify(!idset_contains(&set, 4, 0));
+	bfs_verify(idset_insert(&set, 4, 0) == 1);
+	bfs_verify(idset_contains(&set, 4, 0));
+
+	// Large and unusual inode numbers
+	bfs_verify(idset_insert(&set, 1, (ino_t)-1) == 1);
+	bfs_verify(idset_contains(&set, 1, (ino_t)-1));
+
+	idset_destroy(&set);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,84 @@
+// Copyright © Tavian Barnes <tavianator@tavianator.com>
+// SPDX-License-Identifier: 0BSD
+
+#include "../src/mtab.h"
+#include "../src/bfstd.h"
+#include "../src/config.h"
+#include "../src/diag.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if __linux__
+
+/** A mountinfo table with unusual (but valid) lines. */
+static const char mountinfo[] =
+	// From man 5 proc
+	"36 35 98:0 /mnt1 /mnt/parent rw,noatime master:1 - ext3 /dev/root rw,errors=continue\n"
+	// No optional fields
+	"37 35 8:1 / /mnt/none rw - xfs /dev/sda1 rw\n"
+	// Several optional fields
+	"38 35 8:2 / /mnt/many rw shared:2 master:3 propagate_from:4 - btrfs /dev/sda2 rw\n"
+	// Escaped spaces, tabs, and backslashes
+	"39 35 8:3 / /mnt/a\\040b\\011c\\134d rw - fuse.foo\\040bar foo rw\n"
+	// Malformed lines are skipped
+	"garbage\n"
+	"40 35 8:4 / /mnt/nosep rw shared:5 tmpfs tmpfs rw\n"
+	"41 35 8:5\n";
+
+/** Check the file system type of a device. */
+static void check_type(const struct bfs_mtab *mtab, int major, int minor, const char *expected) {
+	const char *type = bfs_dev_fstype(mtab, xmakedev(major, minor));
+	bfs_verify(type, "bfs_dev_fstype(): %s", strerror(errno));
+	bfs_verify(strcmp(type, expected) == 0, "bfs_dev_fstype(%d:%d) == '%s' (!= '%s')", major, minor, type, expected);
+}
+
+/** Check that a name is (or isn't) a possible mount point. */
+static void check_mount(const struct bfs_mtab *mtab, const char *path, bool expected) {
+	bool ret = bfs_might_be_mount(mtab, path);
+	bfs_verify(ret == expected, "bfs_might_be_mount('%s') == %d (!= %d)", path, ret, expected);
+}
+
+static void check_mountinfo(void) {
+	FILE *file = fmemopen((char *)mountinfo, strlen(mountinfo), "r");
+	bfs_verify(file, "fmemopen(): %s", strerror(errno));
+
+	struct bfs_mtab *mtab = bfs_mtab_parse_mountinfo(file);
+	bfs_verify(mtab, "bfs_mtab_parse_mountinfo(): %s", strerror(errno));
+	fclose(file);
+
+	check_type(mtab, 98, 0, "ext3");
+	check_type(mtab, 8, 1, "xfs");
+	check_type(mtab, 8, 2, "btrfs");
+	check_type(mtab, 8, 3, "fuse.foo bar");
+	check_type(mtab, 8, 4, "unknown");
+	check_type(mtab, 8, 5, "unknown");
+
+	check_mount(mtab, "/some/parent", true);
+	check_mount(mtab, "none", true);
+	check_mount(mtab, "many", true);
+	check_mount(mtab, "a b\tc\\d", true);
+	check_mount(mtab, "a\\040b\\011c\\134d", false);
+	check_mount(mtab, "nosep", false);
+	check_mount(mtab, "mnt1", false);
+
+	// The first refresh switches to the live table
+	int ret = bfs_mtab_refresh(mtab);
+	if (ret >= 0 || errno != ENOENT) {
+		bfs_verify(ret == 1, "bfs_mtab_refresh() == %d: %s", ret, strerror(errno));
+		check_mount(mtab, "many", false);
+	}
+
+	bfs_mtab_free(mtab);
+}
+
+#endif // __linux__
+
+int main(void) {
+#if __linux__
+	check_mountinfo();
+#endif
+
+	return EXIT_SUCCESS;
+}
@@ -79,6 +79,41 @@ int main(void) {
 		bfs_verify(i == nkeys);
 	}
 
+	{
+		struct trie frozen;
+		trie_init(&frozen);
+		for (size_t i = 0; i < nkeys; ++i) {
+			struct trie_leaf *leaf = trie_insert_str(&frozen, keys[i]);
+			bfs_verify(leaf);
+			leaf->value = (void *)keys[i];
+		}
+		bfs_verify(trie_freeze(&frozen) == 0);
+
+		size_t i = 0;
+		TRIE_FOR_EACH(&frozen, leaf) {
+			bfs_verify(strcmp(leaf->key, keys[i]) == 0);
+			bfs_verify(leaf->value == keys[i]);
+			bfs_verify(leaf == trie_find_str(&frozen, keys[i]));
+			bfs_verify(!leaf->prev || leaf->prev->next == leaf);
+			bfs_verify(!leaf->next || leaf->next->prev == leaf);
+			++i;
+		}
+		bfs_verify(i == nkeys);
+
+		for (i = 0; i < nkeys; ++i) {
+			const struct trie_leaf *leaf = trie_find_postfix(&frozen, keys[i]);
+			bfs_verify(leaf);
+			bfs_verify(strncmp(leaf->key, keys[i], strlen(keys[i])) == 0);
+		}
+
+		const struct trie_leaf *leaf = trie_find_prefix(&frozen, "prefixes");
+		bfs_verify(leaf);
+		bfs_verify(strcmp(leaf->key, "prefix") == 0);
+		bfs_verify(!trie_find_str(&frozen, "prefixes"));
+
+		trie_destroy(&frozen);
+	}
+
 	for (size_t i = 0; i < nkeys; ++i) {
 		struct trie_leaf *leaf = trie_find_str(&trie, keys[i]);
 		bfs_verify(leaf);
@@ -128,6 +163,11 @@ int main(void) {
 	bfs_verify(!trie_find_mem(&trie, longstr, longsize));
 	bfs_verify(trie_insert_mem(&trie, longstr, longsize));
 
+	bfs_verify(trie_freeze(&trie) == 0);
+	bfs_verify(trie_find_mem(&trie, longstr, longsize));
+	memset(longstr, 0xAC, longsize);
+	bfs_verify(trie_find_mem(&trie, longstr, longsize));
+
 	free(longstr);
 	trie_destroy(&trie);
 	return EXIT_SUCCESS;
@@ -48,6 +48,31 @@ static void tm_print(FILE *file, const struct tm *tm) {
 		tm->tm_isdst ? (tm->tm_isdst < 0 ? " (DST?)" : " (DST)") : "");
 }
 
+/** Check xlocaltime_cached() against xlocaltime(). */
+static bool check_cached(void) {
+	struct xtime_cache cache;
+	xtime_cache_init(&cache);
+
+	// Every few minutes around a DST transition, twice to hit the cache
+	for (int pass = 0; pass < 2; ++pass)
+	for (time_t t = 1710054000 - 7200; t <= 1710054000 + 7200; t += 97) {
+		struct tm tma, tmb;
+		if (xlocaltime(&t, &tma) != 0 || xlocaltime_cached(&cache, &t, &tmb) != 0) {
+			perror("xlocaltime()");
+			return false;
+		}
+		if (!tm_equal(&tma, &tmb)) {
+			printf("xlocaltime():        ");
+			tm_print(stdout, &tma);
+			printf("xlocaltime_cached(): ");
+			tm_print(stdout, &tmb);
+			return false;
+		}
+	}
+
+	return true;
+}
+
 int main(void) {
 	if (setenv("TZ", "UTC0", true) != 0) {
 		perror("setenv()");
@@ -90,5 +115,16 @@ int main(void) {
 		}
 	}
 
+	// US Eastern time, which switched to DST at 1710054000
+	if (setenv("TZ", "EST5EDT,M3.2.0,M11.1.0", true) != 0) {
+		perror("setenv()");
+		return EXIT_FAILURE;
+	}
+	tzset();
+
+	if (!check_cached()) {
+		return EXIT_FAILURE;
+	}
+
 	return EXIT_SUCCESS;
 }